@@ -63,10 +63,6 @@ def envoy_proxy_dependencies():
         "com_github_redis_hiredis",
         build_file = "@envoy_proxy//bazel/external:hiredis.BUILD",
     )
-    _repository_impl(
-        "com_github_sewenew_redisplusplus",
-        build_file = "@envoy_proxy//bazel/external:redisplus.BUILD",
-    )
     _repository_impl(
         "com_github_pantor_inja",
         build_file = "@envoy_proxy//bazel/external:pantor_inja.BUILD",
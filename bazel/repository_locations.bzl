@@ -4,11 +4,6 @@ REPOSITORY_LOCATIONS = dict(
         strip_prefix = "hiredis-d5b4c69b7113213c1da3a0ccbfd1ee1b40443c7a",
         urls = ["https://github.com/redis/hiredis/archive/d5b4c69b7113213c1da3a0ccbfd1ee1b40443c7a.tar.gz"],
     ),
-    com_github_sewenew_redisplusplus = dict(
-        sha256 = "0644a5744765eb2fcb23b730f5643dd4c7391c9a093b731c3002fb5a6617ef40",
-        strip_prefix = "redis-plus-plus-d35267580568517f09bdf70cb582e5284c25401a",
-        urls = ["https://github.com/sewenew/redis-plus-plus/archive/d35267580568517f09bdf70cb582e5284c25401a.tar.gz"],
-    ),
     com_github_pantor_inja = dict(
         sha256 = "f4210493e7e3c62d3050ca6e5e9dd72823ec4125a469fa9b28519d7f32fc9731",
         strip_prefix = "inja-3.1.0",
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+/*
+ * Helpers of the compact binary form of cache entries. All integers are fixed width and in the
+ * native byte order because the data is only read back by the same kind of machine.
+ */
+class BinaryWriter {
+public:
+  BinaryWriter(std::string& output) : output_(output) {}
+
+  template <class T> void writeInt(T value) {
+    static_assert(std::is_integral_v<T>);
+    output_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // Length prefixed bytes.
+  void writeBytes(absl::string_view bytes) {
+    writeInt<uint32_t>(bytes.size());
+    writeRaw(bytes);
+  }
+
+  // Bytes without length. Used to write length prefixed bytes piece by piece.
+  void writeRaw(absl::string_view bytes) { output_.append(bytes.data(), bytes.size()); }
+
+private:
+  std::string& output_;
+};
+
+/*
+ * Reader of the data that is written by BinaryWriter. Every read checks the remaining length and
+ * returns false on truncated data.
+ */
+class BinaryReader {
+public:
+  BinaryReader(absl::string_view input) : input_(input) {}
+
+  template <class T> bool readInt(T& value) {
+    static_assert(std::is_integral_v<T>);
+    if (input_.size() < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, input_.data(), sizeof(T));
+    input_.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  // The result refers to the input and is only valid as long as the input.
+  bool readBytes(absl::string_view& bytes) {
+    uint32_t length = 0;
+    if (!readInt(length) || input_.size() < length) {
+      return false;
+    }
+    bytes = input_.substr(0, length);
+    input_.remove_prefix(length);
+    return true;
+  }
+
+  bool empty() const { return input_.empty(); }
+
+private:
+  absl::string_view input_;
+};
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
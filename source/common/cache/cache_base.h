@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,19 +25,35 @@ using CacheKeyType = std::string;
 
 class CacheEntry;
 using CacheEntryPtr = std::unique_ptr<CacheEntry>;
+using CacheEntryConstSharedPtr = std::shared_ptr<const CacheEntry>;
 
 /*
  * Abstract base class of cache entry. This class defined basic method that a cache entry must
  * implement such as serialize, deserialize, create copy and get cache entry memory size.
+ *
+ * An entry that is stored in a cache shared by multiple threads is sealed first. A sealed entry is
+ * immutable and createCopy() of it may be called concurrently. The copy should refer to the payload
+ * of the sealed entry rather than deep copy it.
  */
 class CacheEntry {
 public:
   virtual void loadFromString(std::string&& string_value) PURE;
-  virtual CacheEntryPtr createCopy() PURE;
-  virtual uint64_t cacheExpire() PURE;
+  virtual CacheEntryPtr createCopy() const PURE;
+  virtual void seal() PURE;
+  virtual uint64_t cacheExpire() const PURE;
   virtual void cacheExpire(uint64_t) PURE;
-  virtual uint64_t cacheLength() PURE;
-  virtual absl::optional<std::string> serializeAsString() PURE;
+  virtual uint64_t cacheLength() const PURE;
+  virtual absl::optional<std::string> serializeAsString() const PURE;
+
+  // Compact binary form of the entry that is used by persistent caches. By default it is the same
+  // as the string form.
+  virtual absl::optional<std::string> serializeAsBinary() const { return serializeAsString(); }
+  // Return false if the entry cannot be loaded from the data.
+  virtual bool loadFromBinary(absl::string_view data) {
+    loadFromString(std::string(data));
+    return true;
+  }
+
   virtual ~CacheEntry() = default;
 };
 
@@ -51,9 +68,21 @@ public:
   virtual CacheEntryPtr lookupCache(const CacheKeyType&) PURE;
   virtual void lookupCache(const CacheKeyType& key, AsyncCallback callback) PURE;
 
+  /*
+   * Try to complete the lookup in the same call stack. Return absl::nullopt if the lookup is
+   * pending and the asynchronous lookup should be used. Otherwise the entry or nullptr for a miss
+   * is returned and no callback is posted to the dispatcher.
+   */
+  virtual absl::optional<CacheEntryPtr> lookupCacheInline(const CacheKeyType&) {
+    return absl::nullopt;
+  }
+
   virtual void removeCache(const CacheKeyType& key) PURE;
   virtual void insertCache(const CacheKeyType& key, CacheEntryPtr&& value) PURE;
 
+  // Remove all entries. Caches that cannot be cleared ignore it.
+  virtual void clearCache() {}
+
   virtual ~CommonCacheBase() = default;
 };
 
@@ -62,6 +91,12 @@ using CommonCacheBaseSharedPtr = std::shared_ptr<CommonCacheBase>;
 
 using CacheEntryCreator = std::function<CacheEntryPtr()>;
 
+/*
+ * Called when a key of a remote cache is changed by others, so copies of the key in other caches
+ * must be dropped. The key is absl::nullopt if all keys may have been changed.
+ */
+using InvalidationCallback = std::function<void(absl::optional<absl::string_view> key)>;
+
 } // namespace Cache
 } // namespace Common
 } // namespace Proxy
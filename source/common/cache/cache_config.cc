@@ -1,6 +1,7 @@
 #include "source/common/cache/cache_config.h"
 
 #include "source/common/cache/local_cache_impl.h"
+#include "source/common/cache/mmap_cache_impl.h"
 #include "source/common/cache/redis_cache_impl.h"
 
 namespace Envoy {
@@ -10,12 +11,16 @@ namespace Cache {
 
 CommonCacheBasePtr CacheConfig::create(const ProtoCache& cache_config,
                                        Server::Configuration::FactoryContext& context,
-                                       CacheEntryCreator creator) {
+                                       CacheEntryCreator creator,
+                                       InvalidationCallback invalidation) {
   switch (cache_config.cache_type_case()) {
   case ProtoCache::CacheTypeCase::kRedis:
-    return std::make_unique<RedisCache>(cache_config.redis(), context, creator);
+    return std::make_unique<RedisCache>(cache_config.redis(), context, creator,
+                                        std::move(invalidation));
   case ProtoCache::CacheTypeCase::kLocal:
     return std::make_unique<LocalCache>(cache_config.local(), context);
+  case ProtoCache::CacheTypeCase::kMmap:
+    return std::make_unique<MmapCache>(cache_config.mmap(), context, creator);
   default:
     throw EnvoyException("Error cache type and should never run here");
   }
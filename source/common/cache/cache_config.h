@@ -17,8 +17,10 @@ using ProtoCache = proxy::common::cache_api::v3::Cache;
 
 class CacheConfig {
 public:
+  // The invalidation callback is only used by caches that track the keys changed by others.
   static CommonCacheBasePtr create(const ProtoCache& cache_config,
-                                   Server::Configuration::FactoryContext&, CacheEntryCreator);
+                                   Server::Configuration::FactoryContext&, CacheEntryCreator,
+                                   InvalidationCallback invalidation = nullptr);
 };
 
 } // namespace Cache
@@ -0,0 +1,102 @@
+#include "source/common/cache/frequency_sketch.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+namespace {
+
+constexpr uint64_t MinCapacity = 64;
+constexpr uint64_t MaxCapacity = 1ULL << 30;
+
+// Seeds that are used to derive the counter of every row from the key hash.
+constexpr uint64_t RowSeeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+
+uint64_t nextPowerOfTwo(uint64_t value) {
+  uint64_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+} // namespace
+
+FrequencySketch::FrequencySketch(uint64_t capacity) { ensureCapacity(capacity); }
+
+void FrequencySketch::ensureCapacity(uint64_t capacity) {
+  capacity = std::min(std::max(capacity, MinCapacity), MaxCapacity);
+  if (capacity <= capacity_) {
+    return;
+  }
+  capacity_ = capacity;
+  sample_size_ = 10 * capacity_;
+
+  // Every word holds 16 counters and one counter of every row is used for each key.
+  const uint64_t words = nextPowerOfTwo(capacity_);
+  if (table_.empty()) {
+    table_.assign(words, 0);
+  }
+  // The row index is the low bits of the mixed hash. When the table is doubled, the counters of a
+  // key are either at the same index or at the same index of the new half. So duplicating the
+  // table keeps all recorded frequencies.
+  while (table_.size() < words) {
+    table_.reserve(table_.size() * 2);
+    std::copy_n(table_.begin(), table_.size(), std::back_inserter(table_));
+  }
+  table_mask_ = table_.size() - 1;
+}
+
+void FrequencySketch::counterOf(uint64_t hash, uint32_t i, uint64_t& index,
+                                uint32_t& offset) const {
+  uint64_t h = (hash + RowSeeds[i]) * RowSeeds[i];
+  h ^= h >> 32;
+  index = h & table_mask_;
+  // Every row uses its own 4 counters of the 16 counters in the word.
+  offset = ((((h >> 32) & 3) << 2) + i) << 2;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+  bool added = false;
+  for (uint32_t i = 0; i < Depth; i++) {
+    uint64_t index;
+    uint32_t offset;
+    counterOf(hash, i, index, offset);
+    if (((table_[index] >> offset) & MaxCounter) != MaxCounter) {
+      table_[index] += 1ULL << offset;
+      added = true;
+    }
+  }
+  if (added && ++additions_ >= sample_size_) {
+    reset();
+  }
+}
+
+uint32_t FrequencySketch::frequency(uint64_t hash) const {
+  uint32_t result = MaxCounter;
+  for (uint32_t i = 0; i < Depth; i++) {
+    uint64_t index;
+    uint32_t offset;
+    counterOf(hash, i, index, offset);
+    result = std::min<uint32_t>(result, (table_[index] >> offset) & MaxCounter);
+  }
+  return result;
+}
+
+void FrequencySketch::reset() {
+  // Halve every counter. The mask clears the bit that shifts in from the neighbor counter.
+  for (auto& word : table_) {
+    word = (word >> 1) & 0x7777777777777777ULL;
+  }
+  additions_ /= 2;
+}
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+/*
+ * Count-min sketch with 4-bit counters that estimates the access frequency of keys. It is used by
+ * the TinyLFU admission policy. Every 64-bit word holds 16 counters and each key maps to one
+ * counter in each of 4 rows. When the number of increments reaches 10 times of the capacity, all
+ * counters are halved so that the sketch prefers recent accesses.
+ */
+class FrequencySketch {
+public:
+  FrequencySketch(uint64_t capacity);
+
+  // Resize the sketch if the capacity grows. Recorded frequencies are kept.
+  void ensureCapacity(uint64_t capacity);
+
+  void increment(uint64_t hash);
+  uint32_t frequency(uint64_t hash) const;
+
+  uint64_t capacity() const { return capacity_; }
+
+private:
+  static constexpr uint32_t MaxCounter = 15;
+  static constexpr uint32_t Depth = 4;
+
+  // Index of the counter of the row i in the table and the bit offset of the counter in the word.
+  void counterOf(uint64_t hash, uint32_t i, uint64_t& index, uint32_t& offset) const;
+  void reset();
+
+  uint64_t capacity_{0};
+  uint64_t table_mask_{0};
+  uint64_t sample_size_{0};
+  uint64_t additions_{0};
+  std::vector<uint64_t> table_;
+};
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,94 @@
+#include "source/common/cache/gzip_body_codec.h"
+
+#include "zlib.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+namespace {
+
+constexpr uint64_t ChunkSize = 16 * 1024;
+// 15 bits of window and 16 to write and read the gzip header instead of the zlib header.
+constexpr int GzipWindowBits = 15 + 16;
+constexpr int MemoryLevel = 8;
+
+} // namespace
+
+bool GzipBodyCodec::compress(const Envoy::Buffer::Instance& input,
+                             Envoy::Buffer::Instance& output) {
+  z_stream stream{};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GzipWindowBits, MemoryLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  unsigned char chunk[ChunkSize];
+  const auto slices = input.getRawSlices();
+  int result = Z_OK;
+  // The last round has no input and finishes the stream.
+  for (size_t i = 0; i <= slices.size() && result == Z_OK; i++) {
+    const bool finish = i == slices.size();
+    stream.next_in = finish ? nullptr : static_cast<Bytef*>(slices[i].mem_);
+    stream.avail_in = finish ? 0 : slices[i].len_;
+    do {
+      stream.next_out = chunk;
+      stream.avail_out = ChunkSize;
+      result = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+      if (result == Z_STREAM_ERROR) {
+        break;
+      }
+      output.add(chunk, ChunkSize - stream.avail_out);
+    } while (stream.avail_out == 0);
+    // No progress is possible when all input is consumed, which is not an error.
+    result = result == Z_BUF_ERROR ? Z_OK : result;
+  }
+
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+bool GzipBodyCodec::decompress(const Envoy::Buffer::Instance& input,
+                               Envoy::Buffer::Instance& output, uint64_t max_size) {
+  z_stream stream{};
+  if (inflateInit2(&stream, GzipWindowBits) != Z_OK) {
+    return false;
+  }
+
+  unsigned char chunk[ChunkSize];
+  uint64_t decompressed = 0;
+  int result = Z_OK;
+  for (const auto& slice : input.getRawSlices()) {
+    stream.next_in = static_cast<Bytef*>(slice.mem_);
+    stream.avail_in = slice.len_;
+    do {
+      stream.next_out = chunk;
+      stream.avail_out = ChunkSize;
+      result = inflate(&stream, Z_NO_FLUSH);
+      if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        inflateEnd(&stream);
+        return false;
+      }
+      const uint64_t size = ChunkSize - stream.avail_out;
+      decompressed += size;
+      if (decompressed > max_size) {
+        inflateEnd(&stream);
+        return false;
+      }
+      output.add(chunk, size);
+    } while (result != Z_STREAM_END && result != Z_BUF_ERROR &&
+             (stream.avail_in > 0 || stream.avail_out == 0));
+    if (result == Z_STREAM_END) {
+      break;
+    }
+  }
+
+  inflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "envoy/buffer/buffer.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+/*
+ * Gzip codec of cached bodies. Cached bodies are compressed once when they are inserted, so clients
+ * that accept gzip are served with the stored bytes and only the others need to decompress them.
+ */
+class GzipBodyCodec {
+public:
+  // Append the compressed input to the output. Returns false if zlib fails.
+  static bool compress(const Envoy::Buffer::Instance& input, Envoy::Buffer::Instance& output);
+
+  // Append the decompressed input to the output. Returns false if the input is not complete gzip
+  // data or is decompressed to more than max_size bytes.
+  static bool decompress(const Envoy::Buffer::Instance& input, Envoy::Buffer::Instance& output,
+                         uint64_t max_size);
+};
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
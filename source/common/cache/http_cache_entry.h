@@ -1,5 +1,6 @@
 #pragma once
 
+#include "source/common/cache/binary_codec.h"
 #include "source/common/cache/cache_base.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/http/proxy_base.h"
@@ -21,6 +22,47 @@ headersToJson(const Envoy::Http::HeaderEntry& e, rapidjson::Writer<rapidjson::St
   return Envoy::Http::HeaderMap::Iterate::Continue;
 }
 
+/*
+ * Buffer fragment that refers to bytes of a shared object, such as the body of a sealed cache
+ * message or the raw string that an entry is loaded from. The fragment holds a reference to the
+ * object to keep the slice valid until the fragment is drained.
+ */
+class SharedBodyFragment : public Envoy::Buffer::BufferFragment {
+public:
+  SharedBodyFragment(const Envoy::Buffer::RawSlice& slice, std::shared_ptr<const void> owner)
+      : slice_(slice), owner_(std::move(owner)) {}
+
+  // Buffer::BufferFragment
+  const void* data() const override { return slice_.mem_; }
+  size_t size() const override { return slice_.len_; }
+  void done() override { delete this; }
+
+private:
+  const Envoy::Buffer::RawSlice slice_;
+  const std::shared_ptr<const void> owner_;
+};
+
+// Size of the chunks of loaded bodies. Large bodies are kept as a chain of chunks instead of one
+// slice, so they can be streamed and released chunk by chunk.
+constexpr uint64_t BodyChunkSize = 64 * 1024;
+
+// Add the body to the buffer in chunks of BodyChunkSize. The chunks refer to the body if the owner
+// of the body is given, otherwise they are copies.
+static inline void addBodyChunks(Envoy::Buffer::Instance& buffer, absl::string_view body,
+                                 const std::shared_ptr<const void>& owner) {
+  while (!body.empty()) {
+    const absl::string_view chunk = body.substr(0, BodyChunkSize);
+    if (owner != nullptr) {
+      buffer.addBufferFragment(
+          *new SharedBodyFragment({const_cast<char*>(chunk.data()), chunk.size()}, owner));
+    } else {
+      // Every chunk fills a new slice, so the slices are never larger than a chunk.
+      buffer.add(chunk.data(), chunk.size());
+    }
+    body.remove_prefix(chunk.size());
+  }
+}
+
 template <class M, class M_IMPL, class H_IMPL> class HttpCacheEntryBase : public CacheEntry {
 public:
   HttpCacheEntryBase(std::unique_ptr<M>&& message, uint64_t cache_expire)
@@ -31,24 +73,29 @@ public:
     static_assert(std::is_same_v<H_IMPL, Envoy::Http::RequestHeaderMapImpl> ||
                   std::is_same_v<H_IMPL, Envoy::Http::ResponseHeaderMapImpl>);
 
-    if (cache_message_) {
-      cache_length_ += cache_message_->headers().byteSize();
-      cache_length_ += cache_message_->body().length();
-      // TODO(wbpcode): support trailter.
-    }
+    updateCacheLength();
   }
 
   // Default contructor. We can create empty cache entry and fill it by loadFromString.
   HttpCacheEntryBase() = default;
 
   // CacheEntry
+  // Both the JSON form and the binary form are accepted. They are told apart by the first byte,
+  // which is always '{' for the JSON form.
   void loadFromString(std::string&& raw_string) override {
     if (raw_string.empty()) {
       cache_message_ = nullptr;
       return;
     }
+    // The string is parsed in place and the body is adopted as fragments of it, so the body is
+    // never copied.
+    auto raw = std::make_shared<std::string>(std::move(raw_string));
+    if (static_cast<uint8_t>(raw->front()) == BinaryMagic) {
+      loadBinary(*raw, raw);
+      return;
+    }
     rapidjson::Document doc;
-    doc.Parse(raw_string.data(), raw_string.size());
+    doc.ParseInsitu(raw->data());
     if (doc.HasParseError()) {
       // Parse error.
       cache_message_ = nullptr;
@@ -60,40 +107,69 @@ public:
     if (doc.HasMember(headers.c_str())) {
       const rapidjson::Value& value = doc[headers.c_str()];
       for (auto it = value.MemberBegin(); it != value.MemberEnd(); it++) {
-        Envoy::Http::LowerCaseString header_name(it->name.GetString());
-        std::string header_value(it->value.GetString());
-        header_ptr->addCopy(header_name, header_value);
+        Envoy::Http::LowerCaseString header_name(
+            absl::string_view(it->name.GetString(), it->name.GetStringLength()));
+        header_ptr->addCopy(header_name, absl::string_view(it->value.GetString(),
+                                                           it->value.GetStringLength()));
       }
     }
 
-    if constexpr (std::is_same_v<H_IMPL, Envoy::Http::ResponseHeaderMapImpl>) {
-      if (header_ptr->empty() || !header_ptr->Status()) {
-        cache_message_ = nullptr;
-        return;
-      }
-    } else if (std::is_same_v<H_IMPL, Envoy::Http::RequestHeaderMapImpl>) {
-      if (header_ptr->empty() || !header_ptr->Host() || !header_ptr->Path() ||
-          !header_ptr->Method()) {
-        cache_message_ = nullptr;
-        return;
-      }
+    if (!validHeaders(*header_ptr)) {
+      cache_message_ = nullptr;
+      return;
     }
 
     cache_message_.reset(new M_IMPL(std::move(header_ptr)));
 
     if (doc.HasMember(rawbody.c_str())) {
       const rapidjson::Value& value = doc[rawbody.c_str()];
-      cache_message_->body().add(value.GetString(), value.GetStringLength());
+      addBodyChunks(cache_message_->body(),
+                    absl::string_view(value.GetString(), value.GetStringLength()), raw);
     }
 
-    cache_message_->headers().removeTransferEncoding();
+    normalizeFraming();
+    updateCacheLength();
+  }
 
-    auto content_length = cache_message_->body().length();
-    cache_message_->headers().setContentLength(content_length);
+  /*
+   * Binary form:
+   *   uint8 magic | uint8 version | uint32 header number | header key/value pairs | body |
+   *   uint32 trailer number | trailer key/value pairs
+   * Every key, value and body is prefixed with its uint32 length. The magic is never the first byte
+   * of the JSON string form.
+   */
+  absl::optional<std::string> serializeAsBinary() const override {
+    M* cache_message = message();
+    if (!cache_message) {
+      return absl::nullopt;
+    }
+    const auto& body = cache_message->body();
+    std::string result;
+    result.reserve(cache_message->headers().byteSize() + body.length() + 64);
+
+    BinaryWriter writer(result);
+    writer.writeInt(BinaryMagic);
+    writer.writeInt(BinaryVersion);
+    writer.writeInt<uint32_t>(cache_message->headers().size());
+    cache_message->headers().iterate([&writer](const Envoy::Http::HeaderEntry& e) {
+      writer.writeBytes(e.key().getStringView());
+      writer.writeBytes(e.value().getStringView());
+      return Envoy::Http::HeaderMap::Iterate::Continue;
+    });
+    writer.writeInt<uint32_t>(body.length());
+    for (const auto& slice : body.getRawSlices()) {
+      writer.writeRaw({static_cast<const char*>(slice.mem_), slice.len_});
+    }
+    // TODO(wbpcode): support trailer.
+    writer.writeInt<uint32_t>(0);
+    return result;
   }
 
-  absl::optional<std::string> serializeAsString() override {
-    if (!cache_message_) {
+  bool loadFromBinary(absl::string_view data) override { return loadBinary(data, nullptr); }
+
+  absl::optional<std::string> serializeAsString() const override {
+    M* cache_message = message();
+    if (!cache_message) {
       return absl::nullopt;
     }
     rapidjson::StringBuffer buffer;
@@ -101,35 +177,130 @@ public:
     result_writer.StartObject();
     result_writer.Key("headers");
     result_writer.StartObject();
-    cache_message_->headers().iterate([&result_writer](const Envoy::Http::HeaderEntry& e) {
+    cache_message->headers().iterate([&result_writer](const Envoy::Http::HeaderEntry& e) {
       return headersToJson(e, result_writer);
     });
 
     result_writer.EndObject();
     result_writer.Key("rawbody");
-    auto body_string = cache_message_->bodyAsString();
+    auto body_string = cache_message->bodyAsString();
     result_writer.String(body_string.data(), body_string.size());
     result_writer.EndObject();
     std::string result_string(buffer.GetString(), buffer.GetSize());
     return result_string;
   }
 
-  CacheEntryPtr createCopy() override {
+  CacheEntryPtr createCopy() const override {
+    if (sealed_message_) {
+      // Only headers are copied. The body of the copy refers to the body of the sealed message.
+      auto message = std::make_unique<M_IMPL>(
+          Envoy::Http::createHeaderMap<H_IMPL>(sealed_message_->headers()));
+      for (const auto& slice : sealed_message_->body().getRawSlices()) {
+        message->body().addBufferFragment(*new SharedBodyFragment(slice, sealed_message_));
+      }
+      return std::make_unique<HttpCacheEntryBase<M, M_IMPL, H_IMPL>>(std::move(message),
+                                                                     cache_expire_);
+    }
     return cache_message_ ? std::make_unique<HttpCacheEntryBase<M, M_IMPL, H_IMPL>>(
                                 Http::makeMessageCopy(cache_message_), 0)
                           : nullptr;
   }
 
-  uint64_t cacheExpire() override { return cache_expire_; }
+  void seal() override {
+    if (cache_message_) {
+      sealed_message_ = std::move(cache_message_);
+    }
+  }
+
+  uint64_t cacheExpire() const override { return cache_expire_; }
   void cacheExpire(uint64_t new_expire) override { cache_expire_ = new_expire; };
 
-  uint64_t cacheLength() override { return cache_length_; }
+  uint64_t cacheLength() const override { return cache_length_; }
 
+  // Message of the entry. Always empty for sealed entries and a copy of sealed entries should be
+  // used.
   std::unique_ptr<M>& cacheMessage() { return cache_message_; }
   void setCacheExpire(uint64_t expire) { cache_expire_ = expire; }
 
 private:
+  static constexpr uint8_t BinaryMagic = 0xCE;
+  static constexpr uint8_t BinaryVersion = 1;
+
+  M* message() const { return sealed_message_ ? sealed_message_.get() : cache_message_.get(); }
+
+  // Load the binary form. The body chunks refer to the data if the owner of the data is given,
+  // otherwise they are copied.
+  bool loadBinary(absl::string_view data, std::shared_ptr<const void> owner) {
+    cache_message_ = nullptr;
+    BinaryReader reader(data);
+
+    uint8_t magic = 0, version = 0;
+    uint32_t header_number = 0;
+    if (!reader.readInt(magic) || magic != BinaryMagic || !reader.readInt(version) ||
+        version != BinaryVersion || !reader.readInt(header_number)) {
+      return false;
+    }
+
+    auto header_ptr = H_IMPL::create();
+    for (uint32_t i = 0; i < header_number; i++) {
+      absl::string_view key, value;
+      if (!reader.readBytes(key) || !reader.readBytes(value)) {
+        return false;
+      }
+      header_ptr->addCopy(Envoy::Http::LowerCaseString(key), value);
+    }
+    absl::string_view body;
+    if (!validHeaders(*header_ptr) || !reader.readBytes(body)) {
+      return false;
+    }
+
+    // Trailers are skipped now.
+    uint32_t trailer_number = 0;
+    if (!reader.readInt(trailer_number)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < trailer_number; i++) {
+      absl::string_view key, value;
+      if (!reader.readBytes(key) || !reader.readBytes(value)) {
+        return false;
+      }
+    }
+
+    cache_message_ = std::make_unique<M_IMPL>(std::move(header_ptr));
+    addBodyChunks(cache_message_->body(), body, owner);
+    normalizeFraming();
+    updateCacheLength();
+    return true;
+  }
+
+  // The body of a loaded entry is always complete, so both forms replace the framing headers of the
+  // original message with the length of the body.
+  void normalizeFraming() {
+    cache_message_->headers().removeTransferEncoding();
+    cache_message_->headers().setContentLength(cache_message_->body().length());
+  }
+
+  static bool validHeaders(const H_IMPL& headers) {
+    if constexpr (std::is_same_v<H_IMPL, Envoy::Http::ResponseHeaderMapImpl>) {
+      return !headers.empty() && headers.Status();
+    } else {
+      return !headers.empty() && headers.Host() && headers.Path() && headers.Method();
+    }
+  }
+
+  void updateCacheLength() {
+    cache_length_ = 0;
+    if (cache_message_) {
+      cache_length_ += cache_message_->headers().byteSize();
+      cache_length_ += cache_message_->body().length();
+      // TODO(wbpcode): support trailter.
+    }
+  }
+
   std::unique_ptr<M> cache_message_{};
+  // Message of the sealed entry. It is shared with the body fragments of all copies and must never
+  // be modified.
+  std::shared_ptr<M> sealed_message_{};
   uint64_t cache_expire_{0};
   uint64_t cache_length_{0};
 };
@@ -1,8 +1,13 @@
 #include "source/common/cache/local_cache_impl.h"
 
+#include <algorithm>
+#include <new>
+
 #include "envoy/registry/registry.h"
 
+#include "source/common/common/hash.h"
 #include "source/common/common/proxy_utility.h"
+#include "source/common/protobuf/utility.h"
 
 namespace Envoy {
 namespace Proxy {
@@ -10,61 +15,279 @@ namespace Common {
 namespace Cache {
 
 constexpr uint64_t DEFAULT_MAX_CACHE_SIZE = 128 * 1024 * 1024; // 128 MB
+constexpr uint32_t DEFAULT_SHARD_NUMBER = 16;
+constexpr uint64_t DEFAULT_SWEEP_INTERVAL_MS = 1000;
+constexpr uint32_t DEFAULT_SWEEP_BATCH = 1024;
+// Max number of shards that are swept in one run of the sweeper.
+constexpr uint32_t SWEEP_SHARDS_PER_RUN = 4;
+// Number of generation slots. Keys in the same slot invalidate the worker caches of each other.
+constexpr size_t WORKER_CACHE_GENERATION_SLOTS = 4096;
+
+LruCacheImpl::LruItem* LruCacheImpl::LruItem::create(absl::string_view key,
+                                                      CacheEntryConstSharedPtr&& value) {
+  static_assert(sizeof(LruItem) % alignof(LruItem) == 0);
+  void* memory = ::operator new(sizeof(LruItem) + key.size());
+  char* key_data = static_cast<char*>(memory) + sizeof(LruItem);
+  std::copy(key.begin(), key.end(), key_data);
+  return new (memory) LruItem(absl::string_view(key_data, key.size()), std::move(value));
+}
+
+void LruCacheImpl::LruItem::destroy(LruItem* item) {
+  item->~LruItem();
+  ::operator delete(item);
+}
+
+LruCacheImpl::LruCacheImpl(uint64_t max_cache_length, bool tiny_lfu, RemovedCallback removed_cb)
+    : max_cache_length_(max_cache_length),
+      window_max_length_(tiny_lfu ? max_cache_length / 100 : 0),
+      sketch_(tiny_lfu ? std::make_unique<FrequencySketch>(0) : nullptr),
+      removed_cb_(std::move(removed_cb)) {}
+
+void LruCacheImpl::linkFront(LruList& list, LruItem& item) {
+  item.prev_ = nullptr;
+  item.next_ = list.head_;
+  if (list.head_ != nullptr) {
+    list.head_->prev_ = &item;
+  }
+  list.head_ = &item;
+  if (list.tail_ == nullptr) {
+    list.tail_ = &item;
+  }
+  list.length_ += item.value_->cacheLength();
+}
+
+void LruCacheImpl::unlink(LruList& list, LruItem& item) {
+  if (item.prev_ != nullptr) {
+    item.prev_->next_ = item.next_;
+  } else {
+    list.head_ = item.next_;
+  }
+  if (item.next_ != nullptr) {
+    item.next_->prev_ = item.prev_;
+  } else {
+    list.tail_ = item.prev_;
+  }
+  item.prev_ = nullptr;
+  item.next_ = nullptr;
+  list.length_ -= item.value_->cacheLength();
+}
 
-LruCacheImpl::LruCacheImpl(uint64_t max_cache_length) : max_cache_length_(max_cache_length) {}
+bool LruCacheImpl::insert(const CacheKeyType& key, CacheEntryPtr&& value) {
+  value->seal();
+  CacheEntryConstSharedPtr shared_value = std::move(value);
 
-void LruCacheImpl::insert(const CacheKeyType& key, CacheEntryPtr&& value) {
+  VictimList victims;
   Thread::LockGuard lock(mutex_);
-  // remove old data.
-  removeImpl(key);
-  // insert new data.
-  cache_length_ += value->cacheLength();
-  m_list_.push_front(key);
-  m_dict_[key] = {m_list_.begin(), std::move(value)};
 
-  // When memory usage exceeds the limit, the cache memory recall action is triggered. The last 10%
-  // of the LRU queue is currently reclaimed directly until the memory is reduced below the maximum
-  // memory space.
-  while (cache_length_ > max_cache_length_) {
-    drainNumber(std::max(m_dict_.size() / 10, 1UL));
+  // An entry that can never fit would flush the whole cache and then be evicted itself. Only drop
+  // the stale data of the same key.
+  if (shared_value->cacheLength() > max_cache_length_) {
+    return removeImpl(key, victims);
+  }
+
+  cache_length_ += shared_value->cacheLength();
+
+  auto iter = m_dict_.find(key);
+  const bool replaced = iter != m_dict_.end();
+  if (replaced) {
+    // Replace old data and reuse the item. The old data is freed after unlock too.
+    auto& item = *iter->second;
+    auto& list = listOf(item);
+    cache_length_ -= item.value_->cacheLength();
+    unlink(list, item);
+    std::swap(item.value_, shared_value);
+    item.expire_ = item.value_->cacheExpire();
+    heapUpdate(item);
+    linkFront(list, item);
+    if (removed_cb_ != nullptr) {
+      removed_cb_(item.key_);
+    }
+  } else {
+    // insert new data.
+    LruItemPtr item(LruItem::create(key, std::move(shared_value)));
+    if (sketch_ != nullptr) {
+      item->hash_ = HashUtil::xxHash64(key);
+      item->in_window_ = true;
+    }
+    linkFront(listOf(*item), *item);
+    heapPush(*item);
+    const absl::string_view item_key = item->key_;
+    m_dict_.emplace(item_key, std::move(item));
+  }
+
+  if (sketch_ != nullptr) {
+    sketch_->ensureCapacity(m_dict_.size());
+    evictWithAdmission(victims);
+  } else {
+    evictToFit(victims);
+  }
+  return replaced;
+}
+
+void LruCacheImpl::evictToFit(VictimList& victims) {
+  while (cache_length_ > max_cache_length_ && main_.tail_ != nullptr) {
+    removeImpl(main_.tail_->key_, victims);
+  }
+}
+
+void LruCacheImpl::evictWithAdmission(VictimList& victims) {
+  const uint64_t main_max_length = max_cache_length_ - window_max_length_;
+
+  while (window_.length_ > window_max_length_) {
+    LruItem* candidate = window_.tail_;
+    unlink(window_, *candidate);
+    candidate->in_window_ = false;
+    linkFront(main_, *candidate);
+
+    while (main_.length_ > main_max_length) {
+      LruItem* victim = main_.tail_;
+      if (victim != candidate &&
+          sketch_->frequency(candidate->hash_) > sketch_->frequency(victim->hash_)) {
+        removeImpl(victim->key_, victims);
+        continue;
+      }
+      // The candidate is rejected by the admission policy.
+      removeImpl(candidate->key_, victims);
+      break;
+    }
+  }
+
+  // Items in the main space may grow when they are replaced.
+  while (main_.length_ > main_max_length && main_.tail_ != nullptr) {
+    removeImpl(main_.tail_->key_, victims);
   }
 }
 
-CacheEntryPtr LruCacheImpl::lookup(const CacheKeyType& key) {
+CacheEntryConstSharedPtr LruCacheImpl::lookup(const CacheKeyType& key) {
+  VictimList victims;
   Thread::LockGuard lock(mutex_);
 
-  checkMemory();
+  // Both hits and misses are recorded, so the first insert after a miss has the frequency of 1.
+  if (sketch_ != nullptr) {
+    sketch_->increment(HashUtil::xxHash64(key));
+  }
 
   auto iter = m_dict_.find(key);
   if (iter == m_dict_.end()) {
     return nullptr;
   }
+  auto& item = *iter->second;
   // Cache entry is find but it is expired and just remove it.
-  if (Common::TimeUtil::createTimestamp() >= iter->second.second->cacheExpire()) {
-    removeImpl(key);
+  if (Common::TimeUtil::createTimestamp() >= item.expire_) {
+    removeImpl(key, victims);
     return nullptr;
   }
-  if (iter->second.first != m_list_.begin()) {
-    m_list_.erase(iter->second.first);
-    m_list_.push_front(key);
-    iter->second.first = m_list_.begin();
+  auto& list = listOf(item);
+  if (list.head_ != &item) {
+    unlink(list, item);
+    linkFront(list, item);
   }
-  return iter->second.second->createCopy();
+  return item.value_;
 }
 
 void LruCacheImpl::remove(const CacheKeyType& key) {
+  VictimList victims;
+  Thread::LockGuard lock(mutex_);
+  removeImpl(key, victims);
+}
+
+void LruCacheImpl::clear() {
+  VictimList victims;
   Thread::LockGuard lock(mutex_);
-  removeImpl(key);
+  victims.reserve(m_dict_.size());
+  for (auto& item : m_dict_) {
+    victims.push_back(std::move(item.second));
+  }
+  m_dict_.clear();
+  main_ = {};
+  window_ = {};
+  expire_heap_.clear();
+  cache_length_ = 0;
 }
 
-void LruCacheImpl::removeImpl(const CacheKeyType& key) {
+bool LruCacheImpl::removeImpl(absl::string_view key, VictimList& victims) {
   auto iter = m_dict_.find(key);
   if (iter == m_dict_.end()) {
-    return;
+    return false;
   }
-  cache_length_ -= iter->second.second->cacheLength();
-  m_list_.erase(iter->second.first);
+  cache_length_ -= iter->second->value_->cacheLength();
+  unlink(listOf(*iter->second), *iter->second);
+  heapRemove(*iter->second);
+  // The key of the index refers to the item, so the item must be moved out before the erase.
+  victims.push_back(std::move(iter->second));
   m_dict_.erase(iter);
+  if (removed_cb_ != nullptr) {
+    removed_cb_(victims.back()->key_);
+  }
+  return true;
+}
+
+LruCacheImpl::ReclaimResult LruCacheImpl::reclaimExpired(uint64_t now, uint64_t max_number) {
+  VictimList victims;
+  Thread::LockGuard lock(mutex_);
+  ReclaimResult result;
+  while (result.number_ < max_number && !expire_heap_.empty() && expire_heap_[0]->expire_ <= now) {
+    result.number_++;
+    result.length_ += expire_heap_[0]->value_->cacheLength();
+    removeImpl(expire_heap_[0]->key_, victims);
+  }
+  return result;
+}
+
+void LruCacheImpl::heapPush(LruItem& item) {
+  expire_heap_.push_back(&item);
+  item.heap_index_ = expire_heap_.size() - 1;
+  heapSiftUp(item.heap_index_);
+}
+
+void LruCacheImpl::heapRemove(LruItem& item) {
+  ASSERT(item.heap_index_ < expire_heap_.size() && expire_heap_[item.heap_index_] == &item);
+  const size_t index = item.heap_index_;
+  LruItem* last = expire_heap_.back();
+  expire_heap_.pop_back();
+  if (last == &item) {
+    return;
+  }
+  heapSet(index, last);
+  heapUpdate(*last);
+}
+
+void LruCacheImpl::heapUpdate(LruItem& item) {
+  heapSiftUp(item.heap_index_);
+  heapSiftDown(item.heap_index_);
+}
+
+void LruCacheImpl::heapSiftUp(size_t index) {
+  LruItem* item = expire_heap_[index];
+  while (index > 0) {
+    const size_t parent = (index - 1) / 2;
+    if (expire_heap_[parent]->expire_ <= item->expire_) {
+      break;
+    }
+    heapSet(index, expire_heap_[parent]);
+    index = parent;
+  }
+  heapSet(index, item);
+}
+
+void LruCacheImpl::heapSiftDown(size_t index) {
+  LruItem* item = expire_heap_[index];
+  const size_t size = expire_heap_.size();
+  while (true) {
+    size_t child = index * 2 + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size && expire_heap_[child + 1]->expire_ < expire_heap_[child]->expire_) {
+      child++;
+    }
+    if (item->expire_ <= expire_heap_[child]->expire_) {
+      break;
+    }
+    heapSet(index, expire_heap_[child]);
+    index = child;
+  }
+  heapSet(index, item);
 }
 
 uint64_t LruCacheImpl::cacheNumber() const {
@@ -77,37 +300,139 @@ uint64_t LruCacheImpl::cacheLength() const {
   return cache_length_;
 }
 
-uint64_t LruCacheImpl::drainNumber(uint64_t number) {
-  uint64_t true_number = 0;
-  for (size_t i = 0; i < number; i++) {
-    if (m_dict_.empty()) {
-      break;
-    }
-    CacheKeyType to_remove = *m_list_.rbegin();
-    removeImpl(to_remove);
-    true_number++;
+CacheEntryConstSharedPtr WorkerCache::lookup(absl::string_view key, uint64_t generation,
+                                              uint64_t now) {
+  auto iter = index_.find(key);
+  if (iter == index_.end()) {
+    return nullptr;
   }
-  return true_number;
+  auto item = iter->second;
+  if (item->generation_ != generation || now >= item->value_->cacheExpire()) {
+    erase(iter);
+    return nullptr;
+  }
+  items_.splice(items_.begin(), items_, item);
+  return item->value_;
+}
+
+void WorkerCache::insert(absl::string_view key, CacheEntryConstSharedPtr value,
+                         uint64_t generation) {
+  auto iter = index_.find(key);
+  if (iter != index_.end()) {
+    erase(iter);
+  }
+
+  if (index_.size() >= max_number_) {
+    // Reuse the least recently used item.
+    index_.erase(items_.back().key_);
+    items_.splice(items_.begin(), items_, std::prev(items_.end()));
+    items_.front().key_.assign(key.data(), key.size());
+    items_.front().value_ = std::move(value);
+    items_.front().generation_ = generation;
+  } else {
+    items_.push_front({std::string(key), std::move(value), generation});
+  }
+  index_.emplace(items_.front().key_, items_.begin());
+}
+
+void WorkerCache::erase(absl::flat_hash_map<absl::string_view, ItemList::iterator>::iterator iter) {
+  auto item = iter->second;
+  index_.erase(iter);
+  items_.erase(item);
 }
 
-LocalCache::LocalCache(const LocalConfig& config, Server::Configuration::FactoryContext& factory) {
+LocalCache::LocalCache(const LocalConfig& config, Server::Configuration::FactoryContext& factory)
+    : cache_list_number_(config.has_shard_number() ? config.shard_number().value()
+                                                   : DEFAULT_SHARD_NUMBER),
+      worker_cache_size_(config.has_worker_cache_size() ? config.worker_cache_size().value() : 0),
+      generations_(worker_cache_size_ > 0 ? WORKER_CACHE_GENERATION_SLOTS : 0),
+      shard_policy_(config.shard_policy()),
+      tiny_lfu_(config.admission_policy() == LocalConfig::TINY_LFU),
+      stats_({ALL_LOCAL_CACHE_STATS(POOL_COUNTER_PREFIX(factory.scope(), "local_cache."))}),
+      sweep_interval_(
+          PROTOBUF_GET_MS_OR_DEFAULT(config, expire_sweep_interval, DEFAULT_SWEEP_INTERVAL_MS)),
+      sweep_batch_(config.has_expire_sweep_batch() ? config.expire_sweep_batch().value()
+                                                   : DEFAULT_SWEEP_BATCH) {
   tls_slot_ = factory.threadLocal().allocateSlot();
-  tls_slot_->set(
-      [](Event::Dispatcher& dispatcher) { return std::make_unique<CacheThreadLocal>(dispatcher); });
+  tls_slot_->set([worker_cache_size = worker_cache_size_](Event::Dispatcher& dispatcher) {
+    return std::make_unique<CacheThreadLocal>(dispatcher, worker_cache_size);
+  });
 
   lru_caches_.reserve(cache_list_number_);
   uint64_t max_cache_size =
       config.has_max_cache_size() ? config.max_cache_size().value() : DEFAULT_MAX_CACHE_SIZE;
 
+  LruCacheImpl::RemovedCallback removed_cb;
+  if (worker_cache_size_ > 0) {
+    removed_cb = [this](absl::string_view key) {
+      generation(key).fetch_add(1, std::memory_order_acq_rel);
+    };
+  }
+
   uint64_t single_max_cache_size = max_cache_size / cache_list_number_;
   for (size_t i = 0; i < cache_list_number_; i++) {
-    lru_caches_.push_back(std::make_unique<LruCacheImpl>(single_max_cache_size));
+    lru_caches_.push_back(
+        std::make_unique<LruCacheImpl>(single_max_cache_size, tiny_lfu_, removed_cb));
+  }
+
+  if (sweep_interval_.count() > 0 && sweep_batch_ > 0) {
+    sweep_timer_ = factory.mainThreadDispatcher().createTimer([this]() { sweepExpired(); });
+    sweep_timer_->enableTimer(sweep_interval_);
   }
 }
 
-CacheEntryPtr LocalCache::lookupCache(const CacheKeyType& key) {
+void LocalCache::sweepExpired() {
+  const uint64_t now = Common::TimeUtil::createTimestamp();
+  // Only a few shards are swept in one run, so one run never takes the locks of all shards. The
+  // next run continues from the next shard, and every shard gets an equal part of the batch.
+  const uint32_t shard_number = std::min(cache_list_number_, SWEEP_SHARDS_PER_RUN);
+  const uint64_t shard_batch = std::max<uint64_t>(sweep_batch_ / shard_number, 1);
+
+  for (uint32_t i = 0; i < shard_number; i++) {
+    auto result = lru_caches_[next_sweep_shard_]->reclaimExpired(now, shard_batch);
+    next_sweep_shard_ = (next_sweep_shard_ + 1) % cache_list_number_;
+
+    stats_.expired_entries_reclaimed_.add(result.number_);
+    stats_.expired_bytes_reclaimed_.add(result.length_);
+  }
+
+  sweep_timer_->enableTimer(sweep_interval_);
+}
+
+LruCacheImpl& LocalCache::shard(const CacheKeyType& key) const {
   ASSERT(!key.empty());
-  return lru_caches_[static_cast<uint8_t>(key[0]) % cache_list_number_]->lookup(key);
+  if (shard_policy_ == LocalConfig::KEY_HASH) {
+    return *lru_caches_[HashUtil::xxHash64(key) % cache_list_number_];
+  }
+  return *lru_caches_[static_cast<uint8_t>(key[0]) % cache_list_number_];
+}
+
+std::atomic<uint64_t>& LocalCache::generation(absl::string_view key) {
+  return generations_[HashUtil::xxHash64(key) % generations_.size()];
+}
+
+CacheEntryPtr LocalCache::lookupCache(const CacheKeyType& key) {
+  if (worker_cache_size_ == 0) {
+    // The copy is created out of the shard lock and only refers to the payload of the shared entry.
+    auto shared_entry = shard(key).lookup(key);
+    return shared_entry ? shared_entry->createCopy() : nullptr;
+  }
+
+  auto& worker_cache = tls_slot_->getTyped<CacheThreadLocal>().worker_cache_;
+  // The generation must be loaded before the shard lookup. If the key is removed or replaced after
+  // the load, the entry is cached with an old generation and will never be returned.
+  const uint64_t current_generation = generation(key).load(std::memory_order_acquire);
+
+  auto shared_entry =
+      worker_cache.lookup(key, current_generation, Common::TimeUtil::createTimestamp());
+  if (shared_entry == nullptr) {
+    shared_entry = shard(key).lookup(key);
+    if (shared_entry == nullptr) {
+      return nullptr;
+    }
+    worker_cache.insert(key, shared_entry, current_generation);
+  }
+  return shared_entry->createCopy();
 }
 
 void LocalCache::lookupCache(const CacheKeyType& key, AsyncCallback callback) {
@@ -118,11 +443,18 @@ void LocalCache::lookupCache(const CacheKeyType& key, AsyncCallback callback) {
 }
 
 void LocalCache::insertCache(const CacheKeyType& key, CacheEntryPtr&& value) {
-  lru_caches_[static_cast<uint8_t>(key[0]) % cache_list_number_]->insert(key, std::move(value));
+  shard(key).insert(key, std::move(value));
 }
 
-void LocalCache::removeCache(const CacheKeyType& key) {
-  lru_caches_[static_cast<uint8_t>(key[0]) % cache_list_number_]->remove(key);
+void LocalCache::removeCache(const CacheKeyType& key) { shard(key).remove(key); }
+
+void LocalCache::clearCache() {
+  for (auto& lru_cache : lru_caches_) {
+    lru_cache->clear();
+  }
+  for (auto& current_generation : generations_) {
+    current_generation.fetch_add(1, std::memory_order_acq_rel);
+  }
 }
 
 } // namespace Cache
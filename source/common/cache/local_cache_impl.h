@@ -1,14 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <list>
+#include <memory>
+#include <vector>
 
+#include "envoy/event/timer.h"
 #include "envoy/server/factory_context.h"
+#include "envoy/stats/stats_macros.h"
 
 #include "source/common/cache/cache_base.h"
+#include "source/common/cache/frequency_sketch.h"
 #include "source/common/common/lock_guard.h"
 #include "source/common/common/logger.h"
 #include "source/common/common/thread.h"
 
+#include "absl/container/flat_hash_map.h"
 #include "api/proxy/common/cache_api/v3/cache_api.pb.h"
 
 namespace Envoy {
@@ -18,53 +27,177 @@ namespace Cache {
 
 using LocalConfig = proxy::common::cache_api::v3::LocalCacheImpl;
 
-using ListType = std::list<CacheKeyType>;
-using DictType = std::map<CacheKeyType, std::pair<ListType::iterator, CacheEntryPtr>>;
+// Shards are allocated separately and aligned to the cache line to avoid false sharing between the
+// mutexes of adjacent shards.
+constexpr size_t CacheLineSize = 64;
 
 /*
  * Specific implementation of lru cache . The cache must maintain its own data length and reclaim
- * memory space when it runs out of space. The current implementation does not support timer-based
- * memory recall. It will be implemented in the next version.
+ * memory space when it runs out of space. Only the bytes needed by the new item are evicted, and
+ * the evicted items are freed after the shard lock is released. Expired entries are reclaimed when
+ * they are looked up or by reclaimExpired(), which is called periodically by the owner of the
+ * cache.
+ *
+ * Every cache item is stored in a single allocation that contains the LRU links and the key bytes.
+ * The hash index is keyed by a view of the key stored in the item, so the key is never duplicated
+ * and a cache hit only relinks the item without any allocation. Items are also kept in a min-heap
+ * ordered by expire time, so expired items can be found without scanning the whole cache.
+ *
+ * If TinyLFU admission is enabled, the cache works as W-TinyLFU. New items are inserted into a
+ * small window LRU that takes 1% of the space. Items that overflow the window compete with the LRU
+ * victim of the main space and only the item with the higher estimated access frequency is kept.
+ * One-hit items from scans therefore cannot push the hot set out of the main space.
  */
-class LruCacheImpl {
+class alignas(CacheLineSize) LruCacheImpl {
 public:
-  LruCacheImpl(uint64_t max_cache_length);
+  // Called under the shard lock whenever the value of a key is removed or replaced, including
+  // evictions, rejections of the admission policy and reclaims of expired items.
+  using RemovedCallback = std::function<void(absl::string_view key)>;
+
+  LruCacheImpl(uint64_t max_cache_length, bool tiny_lfu = false,
+               RemovedCallback removed_cb = nullptr);
 
   uint64_t cacheNumber() const;
   uint64_t cacheLength() const;
 
-  void insert(const CacheKeyType& key, CacheEntryPtr&& value);
-  CacheEntryPtr lookup(const CacheKeyType& key);
+  // The value is sealed and then shared by all lookups of the same key. Return true if the value of
+  // an existing key is replaced.
+  bool insert(const CacheKeyType& key, CacheEntryPtr&& value);
+  CacheEntryConstSharedPtr lookup(const CacheKeyType& key);
   void remove(const CacheKeyType& key);
+  // Remove all items. The frequency sketch is kept.
+  void clear();
+
+  struct ReclaimResult {
+    uint64_t number_{0};
+    uint64_t length_{0};
+  };
+
+  // Reclaim at most max_number items that have expired before now.
+  ReclaimResult reclaimExpired(uint64_t now, uint64_t max_number);
 
 private:
-  void removeImpl(const CacheKeyType& key);
+  struct LruItem {
+    LruItem(absl::string_view key, CacheEntryConstSharedPtr&& value)
+        : key_(key), value_(std::move(value)), expire_(value_->cacheExpire()) {}
+
+    // Create an item and copy the key into the same allocation right after the item.
+    static LruItem* create(absl::string_view key, CacheEntryConstSharedPtr&& value);
+    static void destroy(LruItem* item);
+
+    const absl::string_view key_;
+    CacheEntryConstSharedPtr value_;
+
+    uint64_t expire_{0};
+    // Hash of the key. Only used by the frequency sketch.
+    uint64_t hash_{0};
+    bool in_window_{false};
+
+    LruItem* prev_{nullptr};
+    LruItem* next_{nullptr};
+
+    // Position of the item in the expire heap.
+    size_t heap_index_{0};
+  };
 
-  uint64_t drainNumber(uint64_t number);
+  struct LruItemDeleter {
+    void operator()(LruItem* item) const { LruItem::destroy(item); }
+  };
+  using LruItemPtr = std::unique_ptr<LruItem, LruItemDeleter>;
+
+  // Items removed under the shard lock are moved to a victim list. The list is declared before the
+  // lock guard, so the items and their payloads are freed only after the lock is released.
+  using VictimList = std::vector<LruItemPtr>;
+
+  // Return true if the key is found and removed.
+  bool removeImpl(absl::string_view key, VictimList& victims);
+
+  // Evict least recently used items until the cache fits in its space again.
+  void evictToFit(VictimList& victims);
+
+  // Intrusive LRU list. The head is the most recently used item.
+  struct LruList {
+    LruItem* head_{nullptr};
+    LruItem* tail_{nullptr};
+    uint64_t length_{0};
+  };
+
+  LruList& listOf(const LruItem& item) { return item.in_window_ ? window_ : main_; }
+  void linkFront(LruList& list, LruItem& item);
+  void unlink(LruList& list, LruItem& item);
 
-  void checkMemory() {
-    // If m_list_ size not equal to m_dict_ size, then there is some error. To avoid Crash, We just
-    // clear all cache now.
-    if (m_list_.size() != m_dict_.size()) {
-      ENVOY_LOG_TO_LOGGER(Envoy::Logger::Registry::getLog(Envoy::Logger::Id::client), error,
-                          "Local cache memory error, please check your code carefully");
+  // Move items that overflow the window into the main space and evict the items that lose the
+  // frequency competition.
+  void evictWithAdmission(VictimList& victims);
 
-      m_dict_.clear();
-      m_list_.clear();
-      cache_length_ = 0;
-    }
+  // Intrusive min-heap of items ordered by expire time.
+  void heapPush(LruItem& item);
+  void heapRemove(LruItem& item);
+  void heapUpdate(LruItem& item);
+  void heapSiftUp(size_t index);
+  void heapSiftDown(size_t index);
+  void heapSet(size_t index, LruItem* item) {
+    expire_heap_[index] = item;
+    item->heap_index_ = index;
   }
 
-  DictType m_dict_;
-  ListType m_list_;
+  absl::flat_hash_map<absl::string_view, LruItemPtr> m_dict_;
+  // All items are in the main list if TinyLFU admission is disabled.
+  LruList main_;
+  LruList window_;
+  std::vector<LruItem*> expire_heap_;
 
   const uint64_t max_cache_length_{0};
+  const uint64_t window_max_length_{0};
+  std::unique_ptr<FrequencySketch> sketch_;
+  const RemovedCallback removed_cb_;
   uint64_t cache_length_{0};
   mutable Thread::MutexBasicLockable mutex_;
 };
 
 using LruCacheImplPtr = std::unique_ptr<LruCacheImpl>;
 
+/*
+ * Small LRU cache that is owned by a single worker and is accessed without any lock. It only holds
+ * references to the sealed entries of the shared shards. Every item records the generation of its
+ * key when it is looked up from the shard, and the item is dropped when the generation changes.
+ */
+class WorkerCache {
+public:
+  WorkerCache(uint32_t max_number) : max_number_(max_number) {}
+
+  CacheEntryConstSharedPtr lookup(absl::string_view key, uint64_t generation, uint64_t now);
+  void insert(absl::string_view key, CacheEntryConstSharedPtr value, uint64_t generation);
+
+  size_t size() const { return index_.size(); }
+
+private:
+  struct Item {
+    std::string key_;
+    CacheEntryConstSharedPtr value_;
+    uint64_t generation_{0};
+  };
+  using ItemList = std::list<Item>;
+
+  void erase(absl::flat_hash_map<absl::string_view, ItemList::iterator>::iterator iter);
+
+  // The head is the most recently used item.
+  ItemList items_;
+  absl::flat_hash_map<absl::string_view, ItemList::iterator> index_;
+  const uint32_t max_number_{0};
+};
+
+#define ALL_LOCAL_CACHE_STATS(COUNTER)                                                             \
+  COUNTER(expired_entries_reclaimed)                                                               \
+  COUNTER(expired_bytes_reclaimed)
+
+/**
+ * Wrapper struct for local cache stats. @see stats_macros.h
+ */
+struct LocalCacheStats {
+  ALL_LOCAL_CACHE_STATS(GENERATE_COUNTER_STRUCT)
+};
+
 /*
  * Although Using TLS cache can solves the problem of multi-threaded data contention, there will be
  * new another risk. Requests are randomly assigned to different workers, and if we use TLS cache
@@ -73,6 +206,10 @@ using LruCacheImplPtr = std::unique_ptr<LruCacheImpl>;
  * performance degradation. Therefore, multiple LRU caches are designed here to store data in
  * different LRU according to their keys, which can share cache data and reduce the probability of
  * contention among multiple threads at the same time.
+ *
+ * An optional small worker cache can be put in front of the shards. It only keeps references to the
+ * hottest shared entries, so the extra memory is bounded and the hits of these entries need no
+ * lock.
  */
 class LocalCache : public CommonCacheBase {
 public:
@@ -80,23 +217,53 @@ public:
 
   void insertCache(const CacheKeyType& key, CacheEntryPtr&& value) override;
   void removeCache(const CacheKeyType& key) override;
+  void clearCache() override;
 
   CacheEntryPtr lookupCache(const CacheKeyType& key) override;
 
   void lookupCache(const CacheKeyType& key, AsyncCallback callback) override;
 
+  // Lookups never wait and are always completed inline.
+  absl::optional<CacheEntryPtr> lookupCacheInline(const CacheKeyType& key) override {
+    return lookupCache(key);
+  }
+
 private:
+  LruCacheImpl& shard(const CacheKeyType& key) const;
+
+  // Reclaim expired entries from a bounded number of shards in round robin order and re-arm the
+  // sweep timer.
+  void sweepExpired();
+
+  // Generation of all keys that share the same slot. It is bumped after a key is removed from or
+  // replaced in the shard for any reason, so worker caches never keep an evicted entry alive.
+  std::atomic<uint64_t>& generation(absl::string_view key);
+
   // We use TLS to ensure that the asynchronous callback function is executed on the correct worker.
+  // The worker cache is also stored in the TLS.
   struct CacheThreadLocal : public ThreadLocal::ThreadLocalObject {
-    CacheThreadLocal(Event::Dispatcher& dispather) : dispather_(dispather) {}
+    CacheThreadLocal(Event::Dispatcher& dispather, uint32_t worker_cache_size)
+        : dispather_(dispather), worker_cache_(worker_cache_size) {}
     Event::Dispatcher& dispather_;
+    WorkerCache worker_cache_;
   };
   ThreadLocal::SlotPtr tls_slot_;
 
-  // TODO(wbpcode): Make this configurable.
-  const uint8_t cache_list_number_{16};
+  const uint32_t cache_list_number_{16};
+  const uint32_t worker_cache_size_{0};
+  std::vector<std::atomic<uint64_t>> generations_;
+  const LocalConfig::ShardPolicy shard_policy_{LocalConfig::FIRST_CHAR};
+  const bool tiny_lfu_{false};
 
   std::vector<LruCacheImplPtr> lru_caches_;
+
+  LocalCacheStats stats_;
+
+  // Sweep timer runs on the main thread.
+  const std::chrono::milliseconds sweep_interval_;
+  const uint32_t sweep_batch_{0};
+  uint32_t next_sweep_shard_{0};
+  Event::TimerPtr sweep_timer_;
 };
 
 using LocalCacheSharedPtr = std::shared_ptr<LocalCache>;
@@ -0,0 +1,394 @@
+#include "source/common/cache/mmap_cache_impl.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/hash.h"
+#include "source/common/common/proxy_utility.h"
+#include "source/common/common/utility.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+namespace {
+
+constexpr uint64_t DEFAULT_MAX_CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB
+constexpr uint32_t DEFAULT_SLAB_SIZE = 1024 * 1024;             // 1 MB
+// Assume that the average size of entries is 4 KB and half of the index slots are used.
+constexpr uint64_t CACHE_SIZE_PER_BUCKET = 4 * 1024 * MmapLayout::BucketWays / 2;
+constexpr uint32_t MIN_BUCKET_NUMBER = 64;
+constexpr uint64_t PAGE_SIZE = 4096;
+constexpr std::chrono::milliseconds OWNER_RETRY_INTERVAL{1000};
+
+uint64_t alignTo(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t keyHash(absl::string_view key) {
+  const uint64_t hash = HashUtil::xxHash64(key);
+  // 0 is reserved for empty slots.
+  return hash == 0 ? 1 : hash;
+}
+
+uint64_t recordChecksum(absl::string_view key, absl::string_view value) {
+  return HashUtil::xxHash64(value, HashUtil::xxHash64(key));
+}
+
+uint64_t configSize(const MmapConfig& config) {
+  return config.has_max_cache_size() ? config.max_cache_size().value() : DEFAULT_MAX_CACHE_SIZE;
+}
+
+uint32_t configSlabSize(const MmapConfig& config) {
+  return config.has_slab_size() ? config.slab_size().value() : DEFAULT_SLAB_SIZE;
+}
+
+} // namespace
+
+MmapCache::MmapCache(const MmapConfig& config, Server::Configuration::FactoryContext& context,
+                     CacheEntryCreator creator)
+    : cache_entry_creator_(std::move(creator)), path_(config.path()),
+      slab_size_(alignTo(configSlabSize(config), 8)),
+      slab_number_(std::max<uint64_t>(configSize(config) / slab_size_, 2)),
+      bucket_number_(std::min<uint64_t>(
+          std::max<uint64_t>(configSize(config) / CACHE_SIZE_PER_BUCKET, MIN_BUCKET_NUMBER),
+          std::numeric_limits<uint32_t>::max())),
+      slab_info_offset_(PAGE_SIZE),
+      index_offset_(slab_info_offset_ +
+                    alignTo(sizeof(MmapLayout::SlabInfo) * slab_number_, PAGE_SIZE)),
+      slab_offset_(index_offset_ +
+                   alignTo(sizeof(MmapLayout::IndexBucket) * bucket_number_, PAGE_SIZE)),
+      file_size_(slab_offset_ + uint64_t(slab_size_) * slab_number_),
+      stats_({ALL_MMAP_CACHE_STATS(POOL_COUNTER_PREFIX(context.scope(), "mmap_cache."),
+                                   POOL_GAUGE_PREFIX(context.scope(), "mmap_cache."))}) {
+  ASSERT(cache_entry_creator_ != nullptr);
+
+  tls_slot_ = context.threadLocal().allocateSlot();
+  tls_slot_->set(
+      [](Event::Dispatcher& dispatcher) { return std::make_unique<CacheThreadLocal>(dispatcher); });
+
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw EnvoyException(
+        fmt::format("Cannot open mmap cache file {}: {}", path_, errorDetails(errno)));
+  }
+
+  tryToOwnFile();
+  if (writable()) {
+    return;
+  }
+
+  // Another process owns the file. Entries in the file can still be read before it exits.
+  {
+    Thread::LockGuard lock(mutex_);
+    mapFile();
+  }
+  owner_retry_timer_ = context.mainThreadDispatcher().createTimer([this]() {
+    tryToOwnFile();
+    if (!writable()) {
+      owner_retry_timer_->enableTimer(OWNER_RETRY_INTERVAL);
+    }
+  });
+  owner_retry_timer_->enableTimer(OWNER_RETRY_INTERVAL);
+}
+
+MmapCache::~MmapCache() {
+  if (base_ != nullptr) {
+    ::munmap(base_, file_size_);
+  }
+  // The file lock is released when the file is closed.
+  ::close(fd_);
+}
+
+void MmapCache::tryToOwnFile() {
+  if (::flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+    ENVOY_LOG(debug, "Mmap cache file {} is owned by another process", path_);
+    return;
+  }
+
+  Thread::LockGuard lock(mutex_);
+  writable_ = true;
+  if (base_ != nullptr && !validHeader()) {
+    initializeFile();
+  } else if (base_ == nullptr && !mapFile()) {
+    writable_ = false;
+    ::flock(fd_, LOCK_UN);
+    return;
+  }
+  stats_.writable_.set(1);
+  ENVOY_LOG(info, "Mmap cache file {} is owned by this process", path_);
+}
+
+bool MmapCache::mapFile() {
+  ASSERT(base_ == nullptr);
+
+  struct stat file_stat;
+  if (::fstat(fd_, &file_stat) != 0) {
+    ENVOY_LOG(error, "Cannot stat mmap cache file {}: {}", path_, errorDetails(errno));
+    return false;
+  }
+  // The file never shrinks, so other processes that map a larger file never access the pages after
+  // the end of the file.
+  if (static_cast<uint64_t>(file_stat.st_size) < file_size_) {
+    if (!writable_) {
+      return false;
+    }
+    if (::ftruncate(fd_, file_size_) != 0) {
+      ENVOY_LOG(error, "Cannot resize mmap cache file {}: {}", path_, errorDetails(errno));
+      return false;
+    }
+  }
+
+  void* base = ::mmap(nullptr, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (base == MAP_FAILED) {
+    ENVOY_LOG(error, "Cannot map mmap cache file {}: {}", path_, errorDetails(errno));
+    return false;
+  }
+  base_ = static_cast<char*>(base);
+
+  if (!validHeader()) {
+    if (!writable_) {
+      ::munmap(base_, file_size_);
+      base_ = nullptr;
+      return false;
+    }
+    initializeFile();
+  }
+  return true;
+}
+
+void MmapCache::initializeFile() {
+  ASSERT(writable_ && base_ != nullptr);
+  ENVOY_LOG(info, "Initialize mmap cache file {} with {} slabs of {} bytes", path_, slab_number_,
+            slab_size_);
+
+  auto& file_header = header();
+  // Invalidate the header first and the file is never used by other processes before the magic is
+  // written at the end.
+  file_header.magic_ = 0;
+  file_header.version_ = MmapLayout::Version;
+  file_header.slab_size_ = slab_size_;
+  file_header.slab_number_ = slab_number_;
+  file_header.bucket_number_ = bucket_number_;
+  file_header.write_slab_ = 0;
+  file_header.write_offset_ = 0;
+
+  for (uint32_t i = 0; i < slab_number_; i++) {
+    slabInfo(i).generation_ = 1;
+  }
+  std::memset(base_ + index_offset_, 0, sizeof(MmapLayout::IndexBucket) * bucket_number_);
+
+  file_header.magic_ = MmapLayout::Magic;
+}
+
+bool MmapCache::validHeader() const {
+  const auto& file_header = header();
+  return file_header.magic_ == MmapLayout::Magic && file_header.version_ == MmapLayout::Version &&
+         file_header.slab_size_ == slab_size_ && file_header.slab_number_ == slab_number_ &&
+         file_header.bucket_number_ == bucket_number_;
+}
+
+MmapLayout::SlabInfo& MmapCache::slabInfo(uint32_t index) const {
+  return reinterpret_cast<MmapLayout::SlabInfo*>(base_ + slab_info_offset_)[index];
+}
+
+MmapLayout::IndexBucket& MmapCache::bucket(uint64_t hash) const {
+  return reinterpret_cast<MmapLayout::IndexBucket*>(base_ + index_offset_)[hash % bucket_number_];
+}
+
+char* MmapCache::slab(uint32_t index) const {
+  return base_ + slab_offset_ + uint64_t(index) * slab_size_;
+}
+
+MmapLayout::IndexSlot* MmapCache::findSlot(uint64_t hash) const {
+  for (auto& slot : bucket(hash).slots_) {
+    if (slot.hash_ == hash) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+void MmapCache::insertCache(const CacheKeyType& key, CacheEntryPtr&& value) {
+  const uint64_t expire = value->cacheExpire();
+  if (expire <= Common::TimeUtil::createTimestamp()) {
+    return;
+  }
+  auto binary = value->serializeAsBinary();
+  if (!binary.has_value()) {
+    return;
+  }
+  const uint64_t record_size =
+      alignTo(sizeof(MmapLayout::RecordHeader) + key.size() + binary->size(), 8);
+  if (record_size > slab_size_) {
+    stats_.entries_too_large_.inc();
+    return;
+  }
+
+  const MmapLayout::RecordHeader record_header{MmapLayout::RecordMagic,
+                                               static_cast<uint32_t>(key.size()),
+                                               static_cast<uint32_t>(binary->size()),
+                                               0,
+                                               expire,
+                                               recordChecksum(key, *binary)};
+  const uint64_t hash = keyHash(key);
+
+  Thread::LockGuard lock(mutex_);
+  if (!writable_) {
+    return;
+  }
+
+  auto& file_header = header();
+  if (file_header.write_offset_ + record_size > slab_size_) {
+    // Recycle the next slab and drop all entries in it.
+    file_header.write_slab_ = (file_header.write_slab_ + 1) % slab_number_;
+    file_header.write_offset_ = 0;
+    auto& generation = slabInfo(file_header.write_slab_).generation_;
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELAXED);
+    // Lookups that copy records without the lock check the generation after the copy. The new
+    // generation must be visible before the records of the slab are overwritten.
+    std::atomic_thread_fence(std::memory_order_release);
+    stats_.slabs_recycled_.inc();
+  }
+
+  char* record = slab(file_header.write_slab_) + file_header.write_offset_;
+  std::memcpy(record, &record_header, sizeof(record_header));
+  record += sizeof(record_header);
+  std::memcpy(record, key.data(), key.size());
+  std::memcpy(record + key.size(), binary->data(), binary->size());
+
+  auto* slot = findSlot(hash);
+  if (slot == nullptr) {
+    // Use an empty or invalid slot first and then the slot that expires first.
+    auto& slots = bucket(hash).slots_;
+    slot = std::min_element(std::begin(slots), std::end(slots),
+                            [this](const MmapLayout::IndexSlot& a, const MmapLayout::IndexSlot& b) {
+                              auto rank = [this](const MmapLayout::IndexSlot& slot) {
+                                const bool valid =
+                                    slot.hash_ != 0 && slot.slab_ < slab_number_ &&
+                                    slot.generation_ == slabInfo(slot.slab_).generation_;
+                                return valid ? slot.expire_ : 0;
+                              };
+                              return rank(a) < rank(b);
+                            });
+  }
+  *slot = {hash,
+           expire,
+           file_header.write_slab_,
+           file_header.write_offset_,
+           slabInfo(file_header.write_slab_).generation_,
+           0};
+  file_header.write_offset_ += record_size;
+}
+
+void MmapCache::removeCache(const CacheKeyType& key) {
+  const uint64_t hash = keyHash(key);
+  Thread::LockGuard lock(mutex_);
+  if (!writable_) {
+    ENVOY_LOG(debug, "Mmap cache file {} is not owned and cannot remove key: {}", path_, key);
+    return;
+  }
+  if (auto* slot = findSlot(hash); slot != nullptr) {
+    slot->hash_ = 0;
+  }
+}
+
+void MmapCache::clearCache() {
+  Thread::LockGuard lock(mutex_);
+  if (!writable_) {
+    ENVOY_LOG(debug, "Mmap cache file {} is not owned and cannot be cleared", path_);
+    return;
+  }
+  // All index slots refer to old generations now. Records that are appended later to the current
+  // write slab use the new generation.
+  for (uint32_t i = 0; i < slab_number_; i++) {
+    auto& generation = slabInfo(i).generation_;
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELAXED);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+CacheEntryPtr MmapCache::lookupCache(const CacheKeyType& key) {
+  const uint64_t hash = keyHash(key);
+  const uint64_t now = Common::TimeUtil::createTimestamp();
+
+  // Only the index slot is read under the lock. The mapping never moves once it is created, so the
+  // record is copied after the lock is released. A record that is overwritten during the copy is
+  // detected by the generation of the slab and the checksum.
+  MmapLayout::IndexSlot slot;
+  {
+    Thread::LockGuard lock(mutex_);
+    // The file may be reinitialized by another process with a different layout.
+    if (base_ == nullptr || !validHeader()) {
+      return nullptr;
+    }
+    const auto* found = findSlot(hash);
+    if (found == nullptr || found->slab_ >= slab_number_ ||
+        found->generation_ != slabInfo(found->slab_).generation_ || found->expire_ <= now) {
+      return nullptr;
+    }
+    slot = *found;
+  }
+
+  MmapLayout::RecordHeader record_header;
+  if (uint64_t(slot.offset_) + sizeof(record_header) > slab_size_) {
+    stats_.corrupted_entries_.inc();
+    return nullptr;
+  }
+  const char* record = slab(slot.slab_) + slot.offset_;
+  std::memcpy(&record_header, record, sizeof(record_header));
+  if (record_header.magic_ != MmapLayout::RecordMagic ||
+      uint64_t(slot.offset_) + sizeof(record_header) + record_header.key_length_ +
+              record_header.value_length_ >
+          slab_size_) {
+    stats_.corrupted_entries_.inc();
+    return nullptr;
+  }
+  record += sizeof(record_header);
+  // Different keys with the same hash.
+  if (absl::string_view(record, record_header.key_length_) != key) {
+    return nullptr;
+  }
+  std::string value(record + record_header.key_length_, record_header.value_length_);
+
+  // The slab is recycled by this process while the record is copied.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (__atomic_load_n(&slabInfo(slot.slab_).generation_, __ATOMIC_RELAXED) != slot.generation_) {
+    return nullptr;
+  }
+  // The record may be rewritten by another process while it is copied.
+  if (recordChecksum(key, value) != record_header.checksum_) {
+    stats_.corrupted_entries_.inc();
+    return nullptr;
+  }
+  auto entry = cache_entry_creator_();
+  if (!entry->loadFromBinary(value)) {
+    stats_.corrupted_entries_.inc();
+    return nullptr;
+  }
+  entry->cacheExpire(record_header.expire_);
+  return entry;
+}
+
+void MmapCache::lookupCache(const CacheKeyType& key, AsyncCallback callback) {
+  auto result_wrapper = std::make_shared<CacheEntryPtr>(lookupCache(key));
+  auto& thread_lcoal = tls_slot_->getTyped<CacheThreadLocal>();
+  thread_lcoal.dispather_.post(
+      [result_wrapper, callback]() { callback("", std::move(*result_wrapper)); });
+}
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
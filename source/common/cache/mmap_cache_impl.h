@@ -0,0 +1,184 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "envoy/event/timer.h"
+#include "envoy/server/factory_context.h"
+#include "envoy/stats/stats_macros.h"
+
+#include "source/common/cache/cache_base.h"
+#include "source/common/common/lock_guard.h"
+#include "source/common/common/logger.h"
+#include "source/common/common/thread.h"
+
+#include "api/proxy/common/cache_api/v3/cache_api.pb.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+
+using MmapConfig = proxy::common::cache_api::v3::MmapCacheImpl;
+
+/*
+ * Layout of the cache file. All parts are aligned to the page size.
+ *
+ *   | FileHeader | SlabInfo * slab number | IndexBucket * bucket number | slab * slab number |
+ *
+ * Entries are appended to the current write slab as records. When the write slab is full, the next
+ * slab is recycled and all entries in it are dropped at once by bumping the generation of the slab.
+ * The index is a set associative hash table that maps the hash of the key to the record. When a
+ * bucket is full, the slot that expires first is replaced. Losing an index slot only causes a miss.
+ */
+namespace MmapLayout {
+
+constexpr uint64_t Magic = 0x31434d4d59584f52; // "ROXYMMC1"
+constexpr uint32_t Version = 1;
+constexpr uint32_t BucketWays = 8;
+constexpr uint32_t RecordMagic = 0x4d4d4352; // "RCMM"
+
+struct FileHeader {
+  uint64_t magic_;
+  uint32_t version_;
+  uint32_t slab_size_;
+  uint32_t slab_number_;
+  uint32_t bucket_number_;
+  // Write position. Only the process that owns the file lock can modify the file.
+  uint32_t write_slab_;
+  uint32_t write_offset_;
+};
+
+struct SlabInfo {
+  // Index slots that refer to an old generation of the slab are invalid.
+  uint32_t generation_;
+  uint32_t reserved_;
+};
+
+struct IndexSlot {
+  // Hash of the key. 0 means the slot is empty.
+  uint64_t hash_;
+  uint64_t expire_;
+  uint32_t slab_;
+  uint32_t offset_;
+  uint32_t generation_;
+  uint32_t reserved_;
+};
+
+struct IndexBucket {
+  IndexSlot slots_[BucketWays];
+};
+
+struct RecordHeader {
+  uint32_t magic_;
+  uint32_t key_length_;
+  uint32_t value_length_;
+  uint32_t reserved_;
+  uint64_t expire_;
+  // Checksum of the key and the value.
+  uint64_t checksum_;
+};
+
+} // namespace MmapLayout
+
+#define ALL_MMAP_CACHE_STATS(COUNTER, GAUGE)                                                       \
+  COUNTER(corrupted_entries)                                                                       \
+  COUNTER(slabs_recycled)                                                                          \
+  COUNTER(entries_too_large)                                                                       \
+  GAUGE(writable, NeverImport)
+
+/**
+ * Wrapper struct for mmap cache stats. @see stats_macros.h
+ */
+struct MmapCacheStats {
+  ALL_MMAP_CACHE_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT)
+};
+
+/*
+ * Persistent cache that stores entries in a memory mapped file in the compact binary form. The file
+ * is reopened by the next process after hot restart or deploy, and entries are looked up through
+ * the index in the file without loading the whole file.
+ *
+ * Only one process can modify the file. The owner is decided by an exclusive file lock. Other
+ * processes, for example the new process during hot restart, only read the file and retry to take
+ * the lock periodically. Every record has a checksum, so a record that is being rewritten by
+ * another process is detected and treated as a miss.
+ */
+class MmapCache : public CommonCacheBase, public Logger::Loggable<Logger::Id::client> {
+public:
+  MmapCache(const MmapConfig&, Server::Configuration::FactoryContext&, CacheEntryCreator);
+  ~MmapCache() override;
+
+  void insertCache(const CacheKeyType& key, CacheEntryPtr&& value) override;
+  void removeCache(const CacheKeyType& key) override;
+  // Drop all entries by bumping the generations of all slabs. Like removals, it is ignored if the
+  // file is owned by another process.
+  void clearCache() override;
+
+  CacheEntryPtr lookupCache(const CacheKeyType& key) override;
+  void lookupCache(const CacheKeyType& key, AsyncCallback callback) override;
+
+  // Lookups never wait and are always completed inline.
+  absl::optional<CacheEntryPtr> lookupCacheInline(const CacheKeyType& key) override {
+    return lookupCache(key);
+  }
+
+  bool writable() const {
+    Thread::LockGuard lock(mutex_);
+    return writable_;
+  }
+
+private:
+  // Try to take the file lock. The file is mapped and initialized if necessary when the lock is
+  // taken.
+  void tryToOwnFile();
+  // Map the file. The file is reinitialized if it is invalid and the file lock is held.
+  bool mapFile();
+  void initializeFile();
+  bool validHeader() const;
+
+  MmapLayout::FileHeader& header() const {
+    return *reinterpret_cast<MmapLayout::FileHeader*>(base_);
+  }
+  MmapLayout::SlabInfo& slabInfo(uint32_t index) const;
+  MmapLayout::IndexBucket& bucket(uint64_t hash) const;
+  char* slab(uint32_t index) const;
+
+  MmapLayout::IndexSlot* findSlot(uint64_t hash) const;
+
+  // We use TLS to ensure that the asynchronous callback function is executed on the correct worker.
+  struct CacheThreadLocal : public ThreadLocal::ThreadLocalObject {
+    CacheThreadLocal(Event::Dispatcher& dispather) : dispather_(dispather) {}
+    Event::Dispatcher& dispather_;
+  };
+  ThreadLocal::SlotPtr tls_slot_;
+
+  CacheEntryCreator cache_entry_creator_;
+
+  const std::string path_;
+  const uint32_t slab_size_{0};
+  const uint32_t slab_number_{0};
+  const uint32_t bucket_number_{0};
+
+  // Offsets of every part in the file.
+  const uint64_t slab_info_offset_{0};
+  const uint64_t index_offset_{0};
+  const uint64_t slab_offset_{0};
+  const uint64_t file_size_{0};
+
+  MmapCacheStats stats_;
+
+  // Mutex of the mapped data in this process.
+  mutable Thread::MutexBasicLockable mutex_;
+  int fd_{-1};
+  char* base_{nullptr};
+  bool writable_{false};
+
+  Event::TimerPtr owner_retry_timer_;
+};
+
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
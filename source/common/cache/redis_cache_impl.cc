@@ -12,29 +12,103 @@ namespace Common {
 namespace Cache {
 
 RedisCache::RedisCache(const RedisConfig& cache_config,
-                       Server::Configuration::FactoryContext& factory, CacheEntryCreator creator)
-    : cache_entry_creator_(std::move(creator)) {
+                       Server::Configuration::FactoryContext& factory, CacheEntryCreator creator,
+                       InvalidationCallback invalidation)
+    : cache_entry_creator_(std::move(creator)),
+      binary_format_(cache_config.format() == RedisConfig::BINARY),
+      load_ttl_(cache_config.load_ttl()),
+      stats_({ALL_REDIS_CACHE_STATS(POOL_COUNTER_PREFIX(factory.scope(), "redis_cache."))}) {
   ASSERT(cache_entry_creator_ != nullptr);
 
-  if (cache_config.redis_type_case() != RedisConfig::RedisTypeCase::kGeneral) {
-    throw EnvoyException("Unsupported redis mode and please check your config.");
+  if (cache_config.tracking() &&
+      cache_config.redis_type_case() != RedisConfig::RedisTypeCase::kGeneral) {
+    ENVOY_LOG(warn, "Redis client tracking is only supported in the general mode and is ignored");
+  }
+  if (invalidation != nullptr) {
+    invalidation = [stats = stats_, callback = std::move(invalidation)](
+                       absl::optional<absl::string_view> key) {
+      if (key.has_value()) {
+        stats.tracking_invalidated_keys_.inc();
+      } else {
+        stats.tracking_flushes_.inc();
+      }
+      callback(key);
+    };
   }
 
   tls_slot_ = factory.threadLocal().allocateSlot();
-  tls_slot_->set([cache_config](Event::Dispatcher& dispatcher) {
+  tls_slot_->set([cache_config, invalidation](Event::Dispatcher& dispatcher) {
     Event::DispatcherImpl* impl = dynamic_cast<Event::DispatcherImpl*>(&dispatcher);
     ASSERT(impl != nullptr);
 
-    RedisClient::Endpoint ep = {cache_config.general().host(),
-                                int(cache_config.general().port().value())};
-
-    auto client = std::make_unique<RedisClient>(
-        ep, cache_config.password(), &impl->base(),
-        cache_config.has_timeout() ? cache_config.timeout().value() : DEFAULT_REDIS_TIMEOUT);
-    return std::make_unique<CacheThreadLocal>(dispatcher, std::move(client));
+    return std::make_unique<CacheThreadLocal>(
+        dispatcher, createClient(cache_config, &impl->base(), invalidation));
   });
 }
 
+RedisCache::RedisClientPtr RedisCache::createClient(const RedisConfig& cache_config,
+                                                    event_base* base,
+                                                    const InvalidationCallback& invalidation) {
+  using Proxy::Common::Redis::AsyncClient;
+  using Proxy::Common::Redis::AsyncClientPool;
+  using Proxy::Common::Redis::ClusterAsyncClient;
+  using Proxy::Common::Redis::SentinelAsyncClient;
+
+  const uint64_t timeout =
+      cache_config.has_timeout() ? cache_config.timeout().value() : DEFAULT_REDIS_TIMEOUT;
+
+  Proxy::Common::Redis::PipelineOptions pipeline;
+  if (cache_config.has_pipeline()) {
+    pipeline.max_size_ = cache_config.pipeline().max_size().value();
+    pipeline.interval_ms_ = cache_config.pipeline().interval().value();
+  }
+
+  switch (cache_config.redis_type_case()) {
+  case RedisConfig::RedisTypeCase::kGeneral: {
+    AsyncClient::Endpoint ep = {cache_config.general().host(),
+                                int(cache_config.general().port().value())};
+    // The tracking needs a dedicated connection for invalidation messages, which is managed by
+    // the pool.
+    const bool tracking = cache_config.tracking() && invalidation != nullptr;
+    if (cache_config.poolsize().value() > 1 || tracking) {
+      auto pool = std::make_unique<AsyncClientPool>(ep, cache_config.password(), base, timeout,
+                                                    cache_config.poolsize().value(),
+                                                    cache_config.idletime().value(), pipeline);
+      if (tracking) {
+        pool->enableTracking(invalidation);
+      }
+      return pool;
+    }
+    auto client = std::make_unique<AsyncClient>(ep, cache_config.password(), base, timeout);
+    client->setPipeline(pipeline);
+    return client;
+  }
+  case RedisConfig::RedisTypeCase::kCluster: {
+    const auto& cluster = cache_config.cluster();
+    std::vector<AsyncClient::Endpoint> seeds;
+    for (const auto& node : cluster.nodes()) {
+      seeds.push_back({node.host(), int(node.port().value())});
+    }
+    return std::make_unique<ClusterAsyncClient>(
+        seeds, cache_config.password(), base, timeout,
+        cluster.has_refresh_interval() ? cluster.refresh_interval().value()
+                                       : DEFAULT_REDIS_CLUSTER_REFRESH_INTERVAL,
+        pipeline);
+  }
+  case RedisConfig::RedisTypeCase::kSentinel: {
+    const auto& sentinel = cache_config.sentinel();
+    std::vector<AsyncClient::Endpoint> sentinels;
+    for (const auto& node : sentinel.nodes()) {
+      sentinels.push_back({node.host(), int(node.port().value())});
+    }
+    return std::make_unique<SentinelAsyncClient>(sentinels, sentinel.master(), sentinel.password(),
+                                                 cache_config.password(), base, timeout, pipeline);
+  }
+  default:
+    throw EnvoyException("Unsupported redis mode and please check your config.");
+  }
+}
+
 void RedisCache::insertCache(const CacheKeyType& key, CacheEntryPtr&& value) {
   auto& thread_lcoal = tls_slot_->getTyped<CacheThreadLocal>();
   if (thread_lcoal.client_->clientStatus() != RedisClient::Status::WORKING) {
@@ -48,7 +122,7 @@ void RedisCache::insertCache(const CacheKeyType& key, CacheEntryPtr&& value) {
     if (ttl_count <= 0) {
       return;
     }
-    auto string_value = value->serializeAsString();
+    auto string_value = binary_format_ ? value->serializeAsBinary() : value->serializeAsString();
     if (!string_value.has_value()) {
       return;
     }
@@ -85,6 +159,11 @@ void RedisCache::lookupCache(const CacheKeyType& key, AsyncCallback callback) {
     return;
   }
 
+  if (load_ttl_) {
+    lookupWithTTL(key, std::move(callback));
+    return;
+  }
+
   auto& dispatcher = thread_lcoal.dispatcher_;
 
   try {
@@ -107,6 +186,72 @@ void RedisCache::lookupCache(const CacheKeyType& key, AsyncCallback callback) {
   }
 }
 
+void RedisCache::lookupWithTTL(const CacheKeyType& key, AsyncCallback callback) {
+  using Proxy::Common::Redis::AsyncClient;
+
+  struct LookupState {
+    absl::optional<std::string> value_;
+    int64_t ttl_ms_{-1};
+    // GET and PTTL. The result is completed when both replies are received.
+    uint32_t remaining_{2};
+    CacheEntryCreator creator_;
+    AsyncCallback callback_;
+  };
+
+  auto& thread_lcoal = tls_slot_->getTyped<CacheThreadLocal>();
+  auto& dispatcher = thread_lcoal.dispatcher_;
+  auto state = std::make_shared<LookupState>();
+  state->creator_ = cache_entry_creator_;
+  state->callback_ = std::move(callback);
+
+  auto complete = [state, &dispatcher]() {
+    if (--state->remaining_ > 0) {
+      return;
+    }
+    // -2 means the key has expired between the replies.
+    if (!state->value_.has_value() || state->ttl_ms_ == -2) {
+      dispatcher.post([state]() { state->callback_("", nullptr); });
+      return;
+    }
+    auto entry = state->creator_();
+    entry->loadFromString(std::move(state->value_.value()));
+    if (state->ttl_ms_ > 0) {
+      entry->cacheExpire(Common::TimeUtil::createTimestamp() + state->ttl_ms_);
+    }
+    auto entry_wrapper = std::make_shared<CacheEntryPtr>(std::move(entry));
+    dispatcher.post([state, en = std::move(entry_wrapper)]() {
+      state->callback_("", std::move(*en));
+    });
+  };
+
+  const bool sent = thread_lcoal.client_->command(
+      {"GET", key}, [state, complete](redisReply* reply, absl::optional<AsyncClient::Error> error) {
+        if (!error.has_value() && reply != nullptr && reply->type == REDIS_REPLY_STRING) {
+          state->value_ = AsyncClient::takeString(reply);
+        }
+        complete();
+      });
+  if (!sent) {
+    ENVOY_LOG(debug, "No available redis connection to get key: {}", key);
+    dispatcher.post([state]() { state->callback_("NO CONNECTION TO REDIS", nullptr); });
+    return;
+  }
+  // Both commands are sent to the same node since they have the same key, but maybe by different
+  // connections of the pool, so the key may expire after GET and before PTTL. The entry is still
+  // used without the expire time if PTTL fails.
+  const bool ttl_sent = thread_lcoal.client_->command(
+      {"PTTL", key},
+      [state, complete](redisReply* reply, absl::optional<AsyncClient::Error> error) {
+        if (!error.has_value() && reply != nullptr && reply->type == REDIS_REPLY_INTEGER) {
+          state->ttl_ms_ = reply->integer;
+        }
+        complete();
+      });
+  if (!ttl_sent) {
+    complete();
+  }
+}
+
 } // namespace Cache
 } // namespace Common
 } // namespace Proxy
@@ -4,6 +4,7 @@
 #include <cstdint>
 
 #include "envoy/server/filter_config.h"
+#include "envoy/stats/stats_macros.h"
 
 #include "source/common/cache/cache_base.h"
 #include "source/common/common/logger.h"
@@ -11,9 +12,11 @@
 #include "source/common/event/dispatcher_impl.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/redis/async_client.h"
+#include "source/common/redis/client_pool.h"
+#include "source/common/redis/cluster_client.h"
+#include "source/common/redis/sentinel_client.h"
 
 #include "api/proxy/common/cache_api/v3/cache_api.pb.h"
-#include "src/sw/redis++/redis++.h"
 
 namespace Envoy {
 namespace Proxy {
@@ -21,15 +24,29 @@ namespace Common {
 namespace Cache {
 
 namespace {
-constexpr uint64_t DEFAULT_REDIS_TIMEOUT = 5; // ms
+constexpr uint64_t DEFAULT_REDIS_TIMEOUT = 5;                     // ms
+constexpr uint64_t DEFAULT_REDIS_CLUSTER_REFRESH_INTERVAL = 30000; // ms
 } // namespace
 
 using RedisConfig = proxy::common::cache_api::v3::RedisCacheImpl;
 
+#define ALL_REDIS_CACHE_STATS(COUNTER)                                                             \
+  COUNTER(tracking_invalidated_keys)                                                               \
+  COUNTER(tracking_flushes)
+
+/**
+ * Wrapper struct for redis cache stats. @see stats_macros.h
+ */
+struct RedisCacheStats {
+  ALL_REDIS_CACHE_STATS(GENERATE_COUNTER_STRUCT)
+};
+
 class RedisCache : public CommonCacheBase, Logger::Loggable<Logger::Id::client> {
 public:
+  // Invalidation messages of the tracking are passed to the callback on the worker that reads the
+  // keys.
   RedisCache(const RedisConfig& config, Server::Configuration::FactoryContext& factory,
-             CacheEntryCreator creator);
+             CacheEntryCreator creator, InvalidationCallback invalidation = nullptr);
 
   void insertCache(const CacheKeyType& key, CacheEntryPtr&& value) override;
   void removeCache(const CacheKeyType& key) override;
@@ -38,10 +55,14 @@ public:
   void lookupCache(const CacheKeyType& key, AsyncCallback callback) override;
 
 private:
-  using RedisClient = Proxy::Common::Redis::AsyncClient;
+  using RedisClient = Proxy::Common::Redis::AsyncCommandClient;
   using RedisClientPtr = std::unique_ptr<RedisClient>;
 
-  void connectToRemote(RedisClient& client, const RedisConfig& config);
+  static RedisClientPtr createClient(const RedisConfig& config, event_base* base,
+                                     const InvalidationCallback& invalidation);
+
+  // Lookup the value and the remaining TTL of the key. The entry expires with the key.
+  void lookupWithTTL(const CacheKeyType& key, AsyncCallback callback);
 
   struct CacheThreadLocal : public ThreadLocal::ThreadLocalObject {
     CacheThreadLocal(Event::Dispatcher& dispatcher, RedisClientPtr&& client)
@@ -52,6 +73,11 @@ private:
   };
 
   CacheEntryCreator cache_entry_creator_;
+  // Values are written in the binary form. Both forms are accepted by lookups.
+  const bool binary_format_{false};
+  const bool load_ttl_{false};
+
+  RedisCacheStats stats_;
 
   ThreadLocal::SlotPtr tls_slot_;
 };
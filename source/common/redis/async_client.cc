@@ -1,12 +1,132 @@
 #include "source/common/redis/async_client.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 
 namespace Envoy {
 namespace Proxy {
 namespace Common {
 namespace Redis {
 
+namespace {
+
+// 响应对象。字符串保存在 buffer_ 中，reply_.str 指向它，因此字符串可以被移出而无需拷贝。reply_ 必须
+// 是第一个成员，hiredis 只能看到 reply_
+struct OwnedReply {
+  redisReply reply_;
+  std::string* buffer_;
+};
+static_assert(std::is_standard_layout_v<OwnedReply>);
+
+OwnedReply* ownedReply(void* reply) { return reinterpret_cast<OwnedReply*>(reply); }
+
+void* createReply(const redisReadTask* task) {
+  auto* owned = static_cast<OwnedReply*>(std::calloc(1, sizeof(OwnedReply)));
+  if (owned == nullptr) {
+    return nullptr;
+  }
+  owned->reply_.type = task->type;
+
+  // 与 hiredis 默认的实现相同，将子响应链接到父响应中
+  if (task->parent != nullptr) {
+    auto* parent = static_cast<redisReply*>(task->parent->obj);
+    parent->element[task->idx] = &owned->reply_;
+  }
+  return owned;
+}
+
+void freeReply(void* reply) {
+  OwnedReply* owned = ownedReply(reply);
+  if (owned == nullptr) {
+    return;
+  }
+  if (owned->reply_.element != nullptr) {
+    for (size_t i = 0; i < owned->reply_.elements; i++) {
+      freeReply(owned->reply_.element[i]);
+    }
+    std::free(owned->reply_.element);
+  }
+  delete owned->buffer_;
+  std::free(owned);
+}
+
+void setString(OwnedReply* owned, const char* str, size_t len) {
+  owned->buffer_ = new std::string(str, len);
+  owned->reply_.str = owned->buffer_->data();
+  owned->reply_.len = len;
+}
+
+void* createString(const redisReadTask* task, char* str, size_t len) {
+  OwnedReply* owned = ownedReply(createReply(task));
+  if (owned == nullptr) {
+    return nullptr;
+  }
+#ifdef REDIS_REPLY_VERB
+  // 格式为 "xxx:<string>"
+  if (task->type == REDIS_REPLY_VERB && len >= 4) {
+    memcpy(owned->reply_.vtype, str, 3);
+    owned->reply_.vtype[3] = '\0';
+    str += 4;
+    len -= 4;
+  }
+#endif
+  setString(owned, str, len);
+  return owned;
+}
+
+void* createArray(const redisReadTask* task, size_t elements) {
+  OwnedReply* owned = ownedReply(createReply(task));
+  if (owned == nullptr) {
+    return nullptr;
+  }
+  if (elements > 0) {
+    owned->reply_.element = static_cast<redisReply**>(std::calloc(elements, sizeof(redisReply*)));
+    if (owned->reply_.element == nullptr) {
+      if (task->parent != nullptr) {
+        static_cast<redisReply*>(task->parent->obj)->element[task->idx] = nullptr;
+      }
+      freeReply(owned);
+      return nullptr;
+    }
+  }
+  owned->reply_.elements = elements;
+  return owned;
+}
+
+void* createInteger(const redisReadTask* task, long long value) {
+  OwnedReply* owned = ownedReply(createReply(task));
+  if (owned != nullptr) {
+    owned->reply_.integer = value;
+  }
+  return owned;
+}
+
+void* createDouble(const redisReadTask* task, double value, char* str, size_t len) {
+  OwnedReply* owned = ownedReply(createReply(task));
+  if (owned != nullptr) {
+    owned->reply_.dval = value;
+    setString(owned, str, len);
+  }
+  return owned;
+}
+
+void* createNil(const redisReadTask* task) { return createReply(task); }
+
+void* createBool(const redisReadTask* task, int value) {
+  OwnedReply* owned = ownedReply(createReply(task));
+  if (owned != nullptr) {
+    owned->reply_.integer = value != 0;
+  }
+  return owned;
+}
+
+} // namespace
+
 AsyncClient::AsyncClient(const AsyncClient::Endpoint& endpoint, const std::string& password,
                          event_base* base, uint64_t timeout_ms, bool reconnect,
                          uint32_t max_reconnect)
@@ -43,6 +163,8 @@ void AsyncClient::connect() {
   }
 
   redis_async_context_->data = this;
+  // 响应直接由读取器解析到可以移出的字符串中
+  redis_async_context_->c.reader->fn = replyObjectFunctions();
 
   redisLibeventAttach(redis_async_context_, event_base_);
   if (redisAsyncSetConnectCallback(redis_async_context_, connectCb) != REDIS_OK) {
@@ -55,34 +177,234 @@ void AsyncClient::connect() {
     resetAsyncContext(INIT_ERROR);
     return;
   }
+  client_status_ = CONNECTING;
 }
 
 void AsyncClient::set(const std::string& key, const std::string& value, uint64_t expire_ms) {
-  if (client_status_ != WORKING || !redis_async_context_ || expire_ms == 0) {
+  if (expire_ms == 0) {
     return;
   }
-  redisAsyncCommand(redis_async_context_, nullptr, nullptr, "SET %s %b PX %lld", key.c_str(),
-                    value.c_str(), value.size(), expire_ms);
+  command({"SET", key, value, "PX", std::to_string(expire_ms)}, nullptr);
 }
 
 void AsyncClient::get(const std::string& key, CommandCallback callback) {
-  if (client_status_ != WORKING || !redis_async_context_) {
+  command({"GET", key}, stringReplyCallback(std::move(callback)));
+}
+
+void AsyncClient::del(const std::string& key) { command({"DEL", key}, nullptr); }
+
+bool AsyncClient::command(CommandArgs args, ReplyCallback callback) {
+  if (client_status_ != WORKING || !redis_async_context_ || args.empty()) {
+    return false;
+  }
+  std::string formatted = formatCommand(args);
+  if (!formattedCommand(formatted, &formatted, std::move(callback))) {
+    return false;
+  }
+  trackKey(args);
+  return true;
+}
+
+bool AsyncClient::formattedCommand(std::string&& formatted, ReplyCallback callback) {
+  return formattedCommand(formatted, &formatted, std::move(callback));
+}
+
+bool AsyncClient::formattedCommand(absl::string_view formatted, ReplyCallback callback) {
+  return formattedCommand(formatted, nullptr, std::move(callback));
+}
+
+bool AsyncClient::formattedCommand(absl::string_view formatted, std::string* owned,
+                                   ReplyCallback callback) {
+  if (client_status_ != WORKING || !redis_async_context_ || formatted.empty()) {
+    return false;
+  }
+
+  const bool reply = callback != nullptr;
+  unsigned long command_id = reply ? next_command_id_++ : 0;
+
+  if (pipeline_.max_size_ == 0) {
+    if (!sendCommand(formatted, command_id, reply)) {
+      return false;
+    }
+    if (reply) {
+      commands_map_[command_id] = std::move(callback);
+    }
+    return true;
+  }
+
+  if (reply) {
+    commands_map_[command_id] = std::move(callback);
+  }
+  pending_commands_.push_back(
+      {owned != nullptr ? std::move(*owned) : std::string(formatted), command_id, reply});
+
+  if (pending_commands_.size() >= pipeline_.max_size_) {
+    flush();
+  } else if (pending_commands_.size() == 1) {
+    if (flush_event_ == nullptr) {
+      flush_event_ = evtimer_new(event_base_, flushCb, this);
+    }
+    // 间隔为 0 时在下一次事件循环中发送
+    timeval interval;
+    setTimeval(interval, pipeline_.interval_ms_);
+    evtimer_add(flush_event_, &interval);
+  }
+  return true;
+}
+
+std::string AsyncClient::formatCommand(CommandArgs args) {
+  size_t size = 16;
+  for (const auto arg : args) {
+    size += arg.size() + 16;
+  }
+  std::string formatted;
+  formatted.reserve(size);
+  absl::StrAppend(&formatted, "*", args.size(), "\r\n");
+  for (const auto arg : args) {
+    absl::StrAppend(&formatted, "$", arg.size(), "\r\n", arg, "\r\n");
+  }
+  return formatted;
+}
+
+void AsyncClient::flush() {
+  if (flush_event_ != nullptr) {
+    evtimer_del(flush_event_);
+  }
+  if (pending_commands_.empty()) {
     return;
   }
 
-  unsigned long command_id = next_command_id_++;
-  commands_map_[command_id] = callback;
+  // hiredis 将命令追加到同一个输出缓冲区中，在连接可写时一次写入
+  auto pending_commands = std::move(pending_commands_);
+  pending_commands_.clear();
+  for (const auto& pending : pending_commands) {
+    if (sendCommand(pending.formatted_, pending.id_, pending.reply_) || !pending.reply_) {
+      continue;
+    }
+    auto callback = commands_map_.find(pending.id_);
+    if (callback != commands_map_.end()) {
+      ReplyCallback cb = std::move(callback->second);
+      commands_map_.erase(callback);
+      cb(nullptr, std::string("FAILED TO SEND COMMAND"));
+    }
+  }
+}
 
+bool AsyncClient::sendCommand(absl::string_view formatted, unsigned long command_id, bool reply) {
+  if (!redis_async_context_) {
+    return false;
+  }
   // NOLINTNEXTLINE
-  redisAsyncCommand(redis_async_context_, commandCb, (void*)command_id, "GET %s", key.c_str());
+  return redisAsyncFormattedCommand(redis_async_context_, reply ? commandCb : nullptr,
+                                    (void*)command_id, formatted.data(),
+                                    formatted.size()) == REDIS_OK;
+}
+
+void AsyncClient::setTracking(TrackingRedirect* redirect) {
+  tracking_redirect_ = redirect;
+  if (tracking_redirect_ == nullptr) {
+    return;
+  }
+  tracking_redirect_->addClient(this);
+  startTracking();
+}
+
+void AsyncClient::startTracking() {
+  if (tracking_redirect_ == nullptr || client_status_ != WORKING) {
+    return;
+  }
+  const auto redirect_id = tracking_redirect_->redirectId();
+  if (!redirect_id.has_value()) {
+    return;
+  }
+  ENVOY_LOG(debug, "Enable client tracking with redirect {}", redirect_id.value());
+  command({"CLIENT", "TRACKING", "ON", "REDIRECT", std::to_string(redirect_id.value()), "NOLOOP"},
+          [](redisReply*, absl::optional<Error> error) {
+            if (error.has_value()) {
+              ENVOY_LOG_TO_LOGGER(Envoy::Logger::Registry::getLog(Envoy::Logger::Id::redis), error,
+                                  "Cannot enable client tracking: {}", error.value());
+            }
+          });
 }
 
-void AsyncClient::del(const std::string& key) {
-  if (client_status_ != WORKING || !redis_async_context_) {
+void AsyncClient::trackKey(CommandArgs args) {
+  if (tracking_redirect_ == nullptr || args.size() < 2 || !absl::EqualsIgnoreCase(args[0], "GET") ||
+      tracked_keys_overflow_) {
+    return;
+  }
+  if (tracked_keys_.size() >= MAX_TRACKED_KEYS) {
+    tracked_keys_.clear();
+    tracked_keys_overflow_ = true;
     return;
   }
+  tracked_keys_.emplace(args[1]);
+}
+
+void AsyncClient::loseTracking() {
+  if (tracking_redirect_ == nullptr) {
+    return;
+  }
+  const auto keys = std::move(tracked_keys_);
+  const bool all = tracked_keys_overflow_;
+  untrackAllKeys();
+  if (!keys.empty() || all) {
+    tracking_redirect_->onTrackingLost(keys, all);
+  }
+}
 
-  redisAsyncCommand(redis_async_context_, nullptr, nullptr, "DEL %s", key.c_str());
+bool AsyncClient::subscribe(const std::string& channel, ReplyCallback callback) {
+  if (client_status_ != WORKING || !redis_async_context_ || callback == nullptr) {
+    return false;
+  }
+
+  unsigned long subscription_id = next_command_id_++;
+  // NOLINTNEXTLINE
+  if (redisAsyncCommand(redis_async_context_, commandCb, (void*)subscription_id, "SUBSCRIBE %b",
+                        channel.data(), channel.size()) != REDIS_OK) {
+    return false;
+  }
+  subscriptions_[subscription_id] = std::move(callback);
+  return true;
+}
+
+AsyncClient::ReplyCallback AsyncClient::stringReplyCallback(CommandCallback callback) {
+  return [callback = std::move(callback)](redisReply* reply, absl::optional<Error> error) {
+    if (error.has_value()) {
+      callback(absl::nullopt, std::move(error));
+    } else if (reply != nullptr && reply->type == REDIS_REPLY_STRING) {
+      callback(takeString(reply), absl::nullopt);
+    } else {
+      callback(absl::nullopt, absl::nullopt);
+    }
+  };
+}
+
+redisReplyObjectFunctions* AsyncClient::replyObjectFunctions() {
+  static redisReplyObjectFunctions functions = [] {
+    redisReplyObjectFunctions result{};
+    result.createString = createString;
+    result.createArray = createArray;
+    result.createInteger = createInteger;
+    result.createDouble = createDouble;
+    result.createNil = createNil;
+    result.createBool = createBool;
+    result.freeObject = freeReply;
+    return result;
+  }();
+  return &functions;
+}
+
+absl::optional<std::string> AsyncClient::takeString(redisReply* reply) {
+  OwnedReply* owned = ownedReply(reply);
+  if (owned == nullptr || owned->buffer_ == nullptr) {
+    return absl::nullopt;
+  }
+  std::string result = std::move(*owned->buffer_);
+  delete owned->buffer_;
+  owned->buffer_ = nullptr;
+  owned->reply_.str = nullptr;
+  owned->reply_.len = 0;
+  return result;
 }
 
 } // namespace Redis
@@ -1,13 +1,20 @@
+#pragma once
+
 #include <chrono>
 #include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "envoy/common/pure.h"
+
 #include "source/common/common/logger.h"
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "hiredis/adapters/libevent.h"
 #include "hiredis/async.h"
 #include "hiredis/hiredis.h"
@@ -25,7 +32,16 @@ void setTimeval(timeval& time, uint64_t value) {
 }
 
 } // namespace
-class AsyncClient : public Logger::Loggable<Logger::Id::redis> {
+
+// 命令批量发送配置。同一次事件循环或者 interval 之内的命令被合并为一次写入，max_size 为 0 时不启用
+struct PipelineOptions {
+  uint64_t max_size_{0};
+  uint64_t interval_ms_{0};
+};
+
+// 异步 Redis 客户端的公共接口。所有方法都必须在运行客户端 event base 的线程中调用，所有回调也在
+// 同一线程中执行
+class AsyncCommandClient {
 public:
   enum Status {
     // 未初始化或者连接断开后资源被清理
@@ -42,6 +58,53 @@ public:
     COMPLETED,
   };
 
+  using Reply = std::string;
+  using Error = std::string;
+
+  // 对外暴露的命令回调函数，目前为了简单起见，所有响应都为字符串
+  using CommandCallback =
+      std::function<void(absl::optional<Reply> reply, absl::optional<Error> error)>;
+
+  // 原始响应回调函数。响应只在回调执行期间有效，连接断开或者客户端析构时响应为空
+  using ReplyCallback = std::function<void(redisReply* reply, absl::optional<Error> error)>;
+
+  // 命令参数。参数只在调用期间被引用，除了格式化为 RESP 协议之外不会被拷贝
+  using CommandArgs = absl::Span<const absl::string_view>;
+
+  virtual ~AsyncCommandClient() = default;
+
+  virtual Status clientStatus() const PURE;
+
+  // 最简单的 Redis 命令封装
+  virtual void set(const std::string& key, const std::string& value, uint64_t expire_ms) PURE;
+  virtual void get(const std::string& key, CommandCallback callback) PURE;
+  virtual void del(const std::string& key) PURE;
+
+  // 发送任意命令。客户端不可用时返回 false 并且不会执行回调；回调为空时忽略响应
+  virtual bool command(CommandArgs args, ReplyCallback callback) PURE;
+};
+using AsyncCommandClientPtr = std::unique_ptr<AsyncCommandClient>;
+
+class AsyncClient;
+
+// 接收 tracking 客户端所读取 key 的失效消息的连接，即 "CLIENT TRACKING ON REDIRECT <id>" 的目标
+class TrackingRedirect {
+public:
+  virtual ~TrackingRedirect() = default;
+
+  // 连接的 client id，尚未订阅失效消息频道时为空
+  virtual absl::optional<long long> redirectId() const PURE;
+
+  virtual void addClient(AsyncClient* client) PURE;
+  virtual void removeClient(AsyncClient* client) PURE;
+
+  // tracking 客户端的连接断开，它读取过的 key 可能在没有失效消息的情况下被修改。all 为 true 表示
+  // key 过多而未被记录，所有 key 都可能受到影响
+  virtual void onTrackingLost(const absl::flat_hash_set<std::string>& keys, bool all) PURE;
+};
+
+class AsyncClient : public AsyncCommandClient, public Logger::Loggable<Logger::Id::redis> {
+public:
   struct Endpoint {
     std::string host_;
     int port_{0};
@@ -52,22 +115,13 @@ public:
     Exception(const std::string& message) : std::runtime_error(message) {}
   };
 
-  using Reply = std::string;
-  using Error = std::string;
-
-  // 对外暴露的命令回调函数，目前为了简单起见，所有响应都为字符串
-  using CommandCallback =
-      std::function<void(absl::optional<Reply> reply, absl::optional<Error> error)>;
-
   AsyncClient(const Endpoint& endpoint, const std::string& password, event_base* base,
               uint64_t timeout_ms = 20, bool reconnect = true, uint32_t max_reconnect = UINT32_MAX);
 
-  AsyncClient(const std::vector<Endpoint>&, const std::string&, const std::string&, event_base*,
-              uint64_t, bool, uint32_t) {
-    throw Exception("NOT IMPLEMENTED SENTINEL NOW.");
-  }
-
-  virtual ~AsyncClient() {
+  ~AsyncClient() override {
+    if (tracking_redirect_ != nullptr) {
+      tracking_redirect_->removeClient(this);
+    }
     resetAsyncContext(COMPLETED);
 
     if (reconnect_event_) {
@@ -75,6 +129,11 @@ public:
     }
     try_reconnecting_ = false;
     reconnect_event_ = nullptr;
+
+    if (flush_event_) {
+      event_free(flush_event_);
+    }
+    flush_event_ = nullptr;
   }
 
   AsyncClient() = delete;
@@ -86,12 +145,68 @@ public:
   // 默认为 30s
   void setReconnectInterval(uint64_t interval_ms) { setTimeval(reconnect_interval_, interval_ms); }
 
-  Status clientStatus() const { return client_status_; }
+  void setPipeline(const PipelineOptions& pipeline) { pipeline_ = pipeline; }
 
-  // 最简单的 Redis 命令封装
-  void set(const std::string& key, const std::string& value, uint64_t expire_ms);
-  void get(const std::string& key, CommandCallback callback);
-  void del(const std::string& key);
+  // 开启服务端辅助的客户端缓存。连接可用时发送 "CLIENT TRACKING ON REDIRECT <id> NOLOOP"，读取过的
+  // key 被其他连接修改时由 redirect 收到失效消息。redirect 为 nullptr 时仅解除关联
+  void setTracking(TrackingRedirect* redirect);
+
+  // 向 redirect 当前的连接开启 tracking。redirect 重新订阅之后需要再次调用
+  void startTracking();
+
+  // 开启 tracking 之后，记录通过该连接读取的 key，直到它们失效。超过 MAX_TRACKED_KEYS 个 key 之后
+  // 不再记录，连接断开时视为所有 key 都失效
+  static constexpr size_t MAX_TRACKED_KEYS = 16384;
+
+  // key 被修改后服务端不再跟踪它，直到它被再次读取
+  void untrackKey(absl::string_view key) { tracked_keys_.erase(key); }
+  void untrackAllKeys() {
+    tracked_keys_.clear();
+    tracked_keys_overflow_ = false;
+  }
+
+  // 连接断开或者即将被关闭，通过该连接读取的 key 不会再收到失效消息，交由 redirect 处理
+  void loseTracking();
+
+  Status clientStatus() const override { return client_status_; }
+
+  void set(const std::string& key, const std::string& value, uint64_t expire_ms) override;
+  void get(const std::string& key, CommandCallback callback) override;
+  void del(const std::string& key) override;
+
+  // 启用批量发送时命令会被暂存，响应按照发送顺序匹配
+  bool command(CommandArgs args, ReplyCallback callback) override;
+
+  // 发送已经格式化为 RESP 协议的命令。命令只会被拷贝到输出缓冲区中，或者在批量发送时被暂存
+  bool formattedCommand(std::string&& formatted, ReplyCallback callback);
+  bool formattedCommand(absl::string_view formatted, ReplyCallback callback);
+
+  // 将命令参数格式化为 RESP 协议
+  static std::string formatCommand(CommandArgs args);
+
+  // 立即发送所有暂存的命令
+  void flush();
+
+  // 订阅频道。每条消息都会执行回调，连接断开后订阅失效并以空响应执行回调
+  bool subscribe(const std::string& channel, ReplyCallback callback);
+
+  const Endpoint& endpoint() const { return working_endpoint_; }
+
+  // 等待响应的命令数量，不包括不关心响应的命令
+  size_t outstandingCommands() const { return commands_map_.size(); }
+
+  // 批量发送时暂存而尚未发送的命令数量，包括不关心响应的命令
+  size_t pendingCommands() const { return pending_commands_.size(); }
+
+  // 将原始响应转换为字符串响应：错误响应作为错误返回，空值或者非字符串响应作为空响应返回
+  static ReplyCallback stringReplyCallback(CommandCallback callback);
+
+  // 客户端使用的 hiredis 响应对象函数。字符串响应直接由读取器解析到 std::string 中，回调中可以通过
+  // takeString 取得而无需拷贝
+  static redisReplyObjectFunctions* replyObjectFunctions();
+
+  // 取得字符串响应的所有权，之后响应中的字符串为空。响应必须由 replyObjectFunctions 创建
+  static absl::optional<std::string> takeString(redisReply* reply);
 
 private:
   void connect();
@@ -107,7 +222,7 @@ private:
 
     redisReply* reply = (redisReply*)(void_reply); // NOLINT
     if (reply && strncmp(reply->str, "OK", 2) == 0) {
-      client->client_status_ = WORKING;
+      client->setWorking();
     } else {
       ENVOY_LOG_TO_LOGGER(Envoy::Logger::Registry::getLog(Envoy::Logger::Id::redis), error,
                           "Client failed to authenticated and check your password");
@@ -146,7 +261,7 @@ private:
       if (!client->password_.empty()) {
         client->authenticate();
       } else {
-        client->client_status_ = WORKING;
+        client->setWorking();
       }
     } else {
       // 连接失败
@@ -177,13 +292,48 @@ private:
     client->client_status_ = NOT_INIT;
     client->redis_async_context_->data = nullptr;
     client->redis_async_context_ = nullptr;
+    client->failPendingCommands();
+    client->clearSubscriptions();
+    client->loseTracking();
     client->waitingToReconnect();
   }
 
+  void setWorking() {
+    client_status_ = WORKING;
+    // 在任何其他命令之前开启 tracking，保证所有读取的 key 都被跟踪
+    startTracking();
+  }
+
   static void reconnectCb(evutil_socket_t, short, void* arg) {
     ((AsyncClient*)arg)->connect(); // NOLINT
   }
 
+  static void flushCb(evutil_socket_t, short, void* arg) {
+    ((AsyncClient*)arg)->flush(); // NOLINT
+  }
+
+  // owned 不为空时它与 formatted 为同一个命令，暂存命令时将其移入而不是拷贝
+  bool formattedCommand(absl::string_view formatted, std::string* owned, ReplyCallback callback);
+  bool sendCommand(absl::string_view formatted, unsigned long command_id, bool reply);
+  void trackKey(CommandArgs args);
+
+  // 连接断开时暂存的命令不会再发送，以空响应执行它们的回调
+  void failPendingCommands() {
+    auto pending_commands = std::move(pending_commands_);
+    pending_commands_.clear();
+    for (const auto& pending : pending_commands) {
+      if (!pending.reply_) {
+        continue;
+      }
+      auto callback = commands_map_.find(pending.id_);
+      if (callback != commands_map_.end()) {
+        ReplyCallback cb = std::move(callback->second);
+        commands_map_.erase(callback);
+        cb(nullptr, absl::nullopt);
+      }
+    }
+  }
+
   static void commandCb(redisAsyncContext* c, void* void_reply, void* void_id) {
     AsyncClient* client = (AsyncClient*)c->data; // NOLINT
 
@@ -197,22 +347,47 @@ private:
     unsigned long command_id = (unsigned long)void_id; // NOLINT
 
     auto command_callback = commands_map.find(command_id);
+    redisReply* reply = (redisReply*)(void_reply); // NOLINT
 
     if (command_callback == commands_map.end()) {
+      client->subscriptionCb(command_id, reply);
       return;
     }
 
-    redisReply* reply = (redisReply*)(void_reply); // NOLINT
+    // 回调执行期间可能发送新的命令，所以先从 map 中移除
+    ReplyCallback callback = std::move(command_callback->second);
+    commands_map.erase(command_callback);
 
-    if (reply != nullptr && reply->str != nullptr) {
-      command_callback->second(std::string(reply->str, reply->len), absl::nullopt);
-    } else if (c->errstr != nullptr) {
-      command_callback->second(absl::nullopt, std::string(c->errstr));
+    if (reply != nullptr && reply->type == REDIS_REPLY_ERROR) {
+      callback(reply, std::string(reply->str, reply->len));
+    } else if (reply == nullptr && c->err && c->errstr != nullptr) {
+      callback(nullptr, std::string(c->errstr));
     } else {
-      command_callback->second(absl::nullopt, absl::nullopt);
+      callback(reply, absl::nullopt);
+    }
+  }
+
+  void subscriptionCb(unsigned long subscription_id, redisReply* reply) {
+    auto subscription = subscriptions_.find(subscription_id);
+    if (subscription == subscriptions_.end()) {
+      return;
     }
+    if (reply != nullptr) {
+      subscription->second(reply, absl::nullopt);
+      return;
+    }
+    // 连接断开，订阅失效
+    ReplyCallback callback = std::move(subscription->second);
+    subscriptions_.erase(subscription);
+    callback(nullptr, absl::nullopt);
+  }
 
-    commands_map.erase(command_id);
+  void clearSubscriptions() {
+    auto subscriptions = std::move(subscriptions_);
+    subscriptions_.clear();
+    for (const auto& cb : subscriptions) {
+      cb.second(nullptr, absl::nullopt);
+    }
   }
 
   void resetAsyncContext(Status new_status) {
@@ -232,11 +407,14 @@ private:
       redisAsyncFree(to_free);
     }
 
-    // 清理所有回调函数
-    for (const auto& cb : commands_map_) {
-      cb.second(absl::nullopt, absl::nullopt);
-    }
+    // 清理所有回调函数。回调执行期间可能发送新的命令，所以先将 map 置换出来
+    pending_commands_.clear();
+    auto commands_map = std::move(commands_map_);
     commands_map_.clear();
+    for (const auto& cb : commands_map) {
+      cb.second(nullptr, absl::nullopt);
+    }
+    clearSubscriptions();
   }
 
   void waitingToReconnect() {
@@ -265,7 +443,21 @@ private:
 
   unsigned long next_command_id_{0};
 
-  std::unordered_map<unsigned long, CommandCallback> commands_map_;
+  std::unordered_map<unsigned long, ReplyCallback> commands_map_;
+  std::unordered_map<unsigned long, ReplyCallback> subscriptions_;
+
+  struct PendingCommand {
+    std::string formatted_;
+    unsigned long id_{0};
+    bool reply_{false};
+  };
+  PipelineOptions pipeline_;
+  std::vector<PendingCommand> pending_commands_;
+  // 对象所有权不属于当前客户端
+  TrackingRedirect* tracking_redirect_{nullptr};
+  absl::flat_hash_set<std::string> tracked_keys_;
+  bool tracked_keys_overflow_{false};
+  event* flush_event_{nullptr};
 
   Endpoint working_endpoint_;
   std::string password_;
@@ -3,71 +3,152 @@
 #include "envoy/common/exception.h"
 
 #include "source/common/common/utility.h"
+#include "source/common/event/dispatcher_impl.h"
+#include "source/common/redis/client_pool.h"
+#include "source/common/redis/cluster_client.h"
+#include "source/common/redis/sentinel_client.h"
 
 namespace Envoy {
 namespace Proxy {
 namespace Common {
 namespace Redis {
 
-RedisClient::RedisClient(const ClientOptions& options) : options_(options) {
-  try {
-    connectToGeneral();
-  } catch (const sw::redis::Error& e) {
-    throw EnvoyException(e.what());
+namespace {
+
+std::vector<AsyncClient::Endpoint> parseRedisNodes(const std::string& src) {
+  std::vector<AsyncClient::Endpoint> nodes;
+  for (const auto& node : StringUtil::splitToken(src, ",", false)) {
+    auto parts = StringUtil::splitToken(node, ":", false);
+    int port = 0;
+    if (parts.size() == 2 && absl::SimpleAtoi(parts[1], &port)) {
+      nodes.push_back({std::string(parts[0]), port});
+    }
   }
+  return nodes;
 }
 
-void RedisClient::parseRedisNodes(const std::string& src, NodeList& dst) {
-  if (!src.length()) {
-    return;
-  }
+} // namespace
 
-  auto nodes = StringUtil::splitToken(src, ",", false);
-  for (const auto& i : nodes) {
-    auto parts = StringUtil::splitToken(i, ":", false);
-    if (parts.size() == 2) {
-      int port;
-      bool success = absl::SimpleAtoi<int>(parts[1], &port);
-      if (success) {
-        dst.push_back({std::string(parts[0].data(), parts[0].length()), port});
-      }
+ReplyValue ReplyValue::fromReply(const redisReply& reply) {
+  ReplyValue value;
+  value.type_ = reply.type;
+  if (reply.str != nullptr) {
+    value.str_.assign(reply.str, reply.len);
+  }
+  value.integer_ = reply.integer;
+  if (reply.element != nullptr) {
+    value.elements_.reserve(reply.elements);
+    for (size_t i = 0; i < reply.elements; i++) {
+      value.elements_.push_back(fromReply(*reply.element[i]));
     }
   }
+  return value;
 }
 
-void RedisClient::connectToGeneral() {
-  sw::redis::ConnectionOptions opts;
-  sw::redis::ConnectionPoolOptions pool_options;
-
-  NodeList nodes;
+ReplyValue ReplyValue::error(std::string message) {
+  ReplyValue value;
+  value.type_ = REDIS_REPLY_ERROR;
+  value.str_ = std::move(message);
+  return value;
+}
 
-  parseRedisNodes(options_.hosts_, nodes);
+RedisClient::RedisClient(const ClientOptions& options, Event::Dispatcher& dispatcher)
+    : dispatcher_(dispatcher) {
+  auto* impl = dynamic_cast<Event::DispatcherImpl*>(&dispatcher_);
+  if (impl == nullptr) {
+    throw EnvoyException("redis client needs the event base of the dispatcher");
+  }
+  event_base* base = &impl->base();
 
-  if (!nodes.size()) {
+  const auto nodes = parseRedisNodes(options.hosts_);
+  if (nodes.empty()) {
     throw EnvoyException("no valid redis host");
   }
+  const uint64_t timeout = options.timeout_.count();
 
-  auto& node = nodes[0];
-
-  opts.host = node.first;
-  opts.port = node.second;
-  opts.password = options_.password_;
-  if (options_.connect_timeout_.count()) {
-    opts.connect_timeout = options_.connect_timeout_;
-  }
-  if (options_.socket_timeout_.count()) {
-    opts.connect_timeout = options_.socket_timeout_;
+  switch (options.redis_type_) {
+  case ClientOptions::RedisType::General:
+    master_ = std::make_unique<AsyncClientPool>(nodes[0], options.password_, base, timeout,
+                                                options.pool_size_, options.idle_time_.count(),
+                                                options.pipeline_);
+    for (size_t i = 1; i < nodes.size(); i++) {
+      auto replica = std::make_unique<AsyncClient>(nodes[i], options.password_, base, timeout);
+      replica->setPipeline(options.pipeline_);
+      replicas_.push_back(std::move(replica));
+    }
+    break;
+  case ClientOptions::RedisType::Cluster:
+    master_ = std::make_unique<ClusterAsyncClient>(nodes, options.password_, base, timeout,
+                                                   options.refresh_interval_.count(),
+                                                   options.pipeline_);
+    break;
+  case ClientOptions::RedisType::Sentinel:
+    if (options.master_name_.empty()) {
+      throw EnvoyException("redis sentinel master name is empty");
+    }
+    master_ = std::make_unique<SentinelAsyncClient>(nodes, options.master_name_,
+                                                    options.sentinel_password_, options.password_,
+                                                    base, timeout, options.pipeline_);
+    break;
   }
-  opts.keep_alive = options_.keep_alive_;
-  if (options_.pool_size_ > 0) {
-    pool_options.size = options_.pool_size_;
+}
+
+AsyncCommandClient& RedisClient::pick(ReadFrom read_from) {
+  if (read_from == ReadFrom::PreferReplica) {
+    for (size_t i = 0; i < replicas_.size(); i++) {
+      auto& replica = *replicas_[next_replica_++ % replicas_.size()];
+      if (replica.clientStatus() == AsyncCommandClient::WORKING) {
+        return replica;
+      }
+    }
   }
+  return *master_;
+}
 
-  client_ = std::make_unique<sw::redis::Redis>(opts, pool_options);
+bool RedisClient::command(AsyncCommandClient::CommandArgs args,
+                          AsyncCommandClient::ReplyCallback callback, ReadFrom read_from) {
+  return pick(read_from).command(args, std::move(callback));
 }
 
-void RedisClient::command(const std::vector<std::string>& args) {
-  client_->command(args.begin(), args.end());
+void RedisClient::batch(std::vector<std::vector<std::string>> commands, BatchCallback callback,
+                        ReadFrom read_from) {
+  struct BatchState {
+    std::vector<ReplyValue> replies_;
+    // One more than the outstanding commands until all commands are issued, so the callback is
+    // never called in the loop below.
+    size_t remaining_{0};
+    BatchCallback callback_;
+  };
+  auto state = std::make_shared<BatchState>();
+  state->replies_.resize(commands.size());
+  state->remaining_ = commands.size() + 1;
+  state->callback_ = std::move(callback);
+
+  for (size_t i = 0; i < commands.size(); i++) {
+    const std::vector<absl::string_view> args(commands[i].begin(), commands[i].end());
+    const bool sent = pick(read_from).command(
+        args,
+        [state, i](redisReply* reply, absl::optional<AsyncCommandClient::Error> error) {
+          if (error.has_value()) {
+            state->replies_[i] = ReplyValue::error(std::move(error.value()));
+          } else if (reply == nullptr) {
+            state->replies_[i] = ReplyValue::error("CONNECTION LOST");
+          } else {
+            state->replies_[i] = ReplyValue::fromReply(*reply);
+          }
+          if (--state->remaining_ == 0) {
+            state->callback_(std::move(state->replies_));
+          }
+        });
+    if (!sent) {
+      state->replies_[i] = ReplyValue::error("NO AVAILABLE REDIS CONNECTION");
+      state->remaining_--;
+    }
+  }
+
+  if (--state->remaining_ == 0) {
+    dispatcher_.post([state]() { state->callback_(std::move(state->replies_)); });
+  }
 }
 
 } // namespace Redis
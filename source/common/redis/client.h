@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
-#include "source/common/common/logger.h"
+#include "envoy/event/dispatcher.h"
 
-#include "src/sw/redis++/redis++.h"
+#include "source/common/common/logger.h"
+#include "source/common/redis/async_client.h"
 
 namespace Envoy {
 namespace Proxy {
@@ -16,41 +20,88 @@ class ClientOptions {
 public:
   enum class RedisType { Cluster, Sentinel, General };
 
+  // Comma separated "host:port" list. In the general mode the first node is the master and the
+  // others are read-only replicas. In the cluster mode all nodes are seeds. In the sentinel mode
+  // all nodes are sentinels.
   std::string hosts_;
   std::string password_;
   RedisType redis_type_{RedisType::General};
 
-  // Connection
-  std::chrono::milliseconds connect_timeout_{0};
-  std::chrono::milliseconds socket_timeout_{0};
-  size_t pool_size_;
-  bool keep_alive_{true};
+  // Sentinel
+  std::string master_name_;
+  std::string sentinel_password_;
 
-  // TODO: Sentinel
+  // Cluster
+  std::chrono::milliseconds refresh_interval_{30000};
 
-  // TODO: Cluster
+  // Connection. The timeout is used by both connecting and commands.
+  std::chrono::milliseconds timeout_{20};
+  // Connections to the master of the general mode.
+  size_t pool_size_{1};
+  std::chrono::milliseconds idle_time_{0};
+  PipelineOptions pipeline_;
 };
 
-class RedisClient : public Logger::Loggable<Logger::Id::client> {
+/**
+ * Owned copy of a reply, which is still valid after the reply callback returns.
+ */
+struct ReplyValue {
+  static ReplyValue fromReply(const redisReply& reply);
+  static ReplyValue error(std::string message);
+
+  bool isError() const { return type_ == REDIS_REPLY_ERROR; }
 
-  using RedisClientPtr = std::unique_ptr<sw::redis::Redis>;
-  using RedisClusterClientPtr = std::unique_ptr<sw::redis::RedisCluster>;
-  using NodeList = std::vector<std::pair<std::string, int>>;
+  int type_{REDIS_REPLY_NIL};
+  // Value of string, status, error and verbatim replies.
+  std::string str_;
+  long long integer_{0};
+  std::vector<ReplyValue> elements_;
+};
 
+/**
+ * Non-blocking Redis client that runs on the event loop of a dispatcher. It must only be used in
+ * the thread of the dispatcher and all callbacks are executed in the same thread.
+ *
+ * Read commands may be sent to the replicas of the general mode. Commands of a batch are issued
+ * in the same event loop iteration, so they are written at once if pipelining is enabled.
+ */
+class RedisClient : public Logger::Loggable<Logger::Id::redis> {
 public:
-  RedisClient(const ClientOptions& options);
+  enum class ReadFrom {
+    Master,
+    // A working replica is used in turn, or the master if no replica is working.
+    PreferReplica,
+  };
 
-  void command(const std::vector<std::string>& args);
+  // Replies of a batch in the order of the commands. Commands that cannot be sent or fail get an
+  // error reply.
+  using BatchCallback = std::function<void(std::vector<ReplyValue> replies)>;
 
-private:
-  void parseRedisNodes(const std::string& src, std::vector<std::pair<std::string, int>>& dst);
-  void connectToGeneral();
+  RedisClient(const ClientOptions& options, Event::Dispatcher& dispatcher);
+
+  AsyncCommandClient::Status clientStatus() const { return master_->clientStatus(); }
+
+  // Return false and the callback is never called if no connection is available.
+  bool command(AsyncCommandClient::CommandArgs args, AsyncCommandClient::ReplyCallback callback,
+               ReadFrom read_from = ReadFrom::Master);
+
+  // The callback is called exactly once. It is posted to the dispatcher if no command is sent.
+  void batch(std::vector<std::vector<std::string>> commands, BatchCallback callback,
+             ReadFrom read_from = ReadFrom::Master);
+
+  size_t replicaNumber() const { return replicas_.size(); }
 
 private:
-  ClientOptions options_;
-  RedisClientPtr client_{nullptr};
+  AsyncCommandClient& pick(ReadFrom read_from);
+
+  Event::Dispatcher& dispatcher_;
+  AsyncCommandClientPtr master_;
+  std::vector<AsyncCommandClientPtr> replicas_;
+  size_t next_replica_{0};
 };
 
+using RedisClientPtr = std::unique_ptr<RedisClient>;
+
 } // namespace Redis
 } // namespace Common
 } // namespace Proxy
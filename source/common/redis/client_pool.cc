@@ -0,0 +1,157 @@
+#include "source/common/redis/client_pool.h"
+
+#include <algorithm>
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+AsyncClientPool::AsyncClientPool(const AsyncClient::Endpoint& endpoint,
+                                 const std::string& password, event_base* base,
+                                 uint64_t timeout_ms, uint64_t pool_size, uint64_t idle_time_ms,
+                                 const PipelineOptions& pipeline)
+    : endpoint_(endpoint), password_(password), timeout_ms_(timeout_ms),
+      pool_size_(std::clamp<uint64_t>(pool_size, 1, MAX_POOL_SIZE)), idle_time_(idle_time_ms),
+      pipeline_(pipeline), event_base_(base) {
+  if (!event_base_) {
+    throw AsyncClient::Exception("EVENT BASE CAN NOT BE NULL AND PLEASE CHECK YOUR CODE");
+  }
+  clients_.reserve(pool_size_);
+  addClient();
+
+  if (idle_time_.count() > 0 && pool_size_ > 1) {
+    idle_event_ = event_new(event_base_, -1, EV_PERSIST, idleCb, this);
+    timeval interval;
+    setTimeval(interval, idle_time_.count());
+    evtimer_add(idle_event_, &interval);
+  }
+}
+
+AsyncClientPool::~AsyncClientPool() {
+  if (idle_event_) {
+    event_free(idle_event_);
+    idle_event_ = nullptr;
+  }
+}
+
+AsyncCommandClient::Status AsyncClientPool::clientStatus() const {
+  for (const auto& pooled : clients_) {
+    if (pooled.client_->clientStatus() == WORKING) {
+      return WORKING;
+    }
+  }
+  return clients_.front().client_->clientStatus();
+}
+
+void AsyncClientPool::set(const std::string& key, const std::string& value, uint64_t expire_ms) {
+  if (expire_ms == 0) {
+    return;
+  }
+  command({"SET", key, value, "PX", std::to_string(expire_ms)}, nullptr);
+}
+
+void AsyncClientPool::get(const std::string& key, CommandCallback callback) {
+  command({"GET", key}, AsyncClient::stringReplyCallback(std::move(callback)));
+}
+
+void AsyncClientPool::del(const std::string& key) { command({"DEL", key}, nullptr); }
+
+void AsyncClientPool::setReconnectInterval(uint64_t interval_ms) {
+  reconnect_interval_ms_ = interval_ms;
+  for (auto& pooled : clients_) {
+    pooled.client_->setReconnectInterval(interval_ms);
+  }
+}
+
+void AsyncClientPool::enableTracking(TrackingSubscriber::InvalidationCallback callback) {
+  if (tracking_ != nullptr) {
+    return;
+  }
+  tracking_ = std::make_unique<TrackingSubscriber>(endpoint_, password_, event_base_, timeout_ms_,
+                                                   std::move(callback));
+  for (auto& pooled : clients_) {
+    pooled.client_->setTracking(tracking_.get());
+  }
+}
+
+bool AsyncClientPool::command(CommandArgs args, ReplyCallback callback) {
+  AsyncClient* client = pick();
+  if (client == nullptr) {
+    return false;
+  }
+  return client->command(args, std::move(callback));
+}
+
+AsyncClient* AsyncClientPool::pick() {
+  const auto now = std::chrono::steady_clock::now();
+
+  PooledClient* picked = nullptr;
+  bool connecting = false;
+  for (size_t i = 0; i < clients_.size(); i++) {
+    auto& pooled = clients_[(next_ + i) % clients_.size()];
+    if (pooled.client_->clientStatus() != WORKING) {
+      connecting = connecting || pooled.client_->clientStatus() == CONNECTING ||
+                   pooled.client_->clientStatus() == CONNECTED;
+      continue;
+    }
+    if (picked == nullptr ||
+        pooled.client_->outstandingCommands() < picked->client_->outstandingCommands()) {
+      picked = &pooled;
+      if (pooled.client_->outstandingCommands() == 0) {
+        break;
+      }
+    }
+  }
+  next_++;
+
+  AsyncClient* client = nullptr;
+  if (picked != nullptr) {
+    picked->last_used_ = now;
+    client = picked->client_.get();
+  }
+
+  // All connections are busy. The new connection is used once it is established.
+  if ((client == nullptr || client->outstandingCommands() > 0) && !connecting &&
+      clients_.size() < pool_size_) {
+    addClient();
+  }
+  return client;
+}
+
+void AsyncClientPool::addClient() {
+  ENVOY_LOG(debug, "Create connection {} of the pool to redis server {}:{}", clients_.size() + 1,
+            endpoint_.host_, endpoint_.port_);
+  auto client = std::make_unique<AsyncClient>(endpoint_, password_, event_base_, timeout_ms_);
+  client->setPipeline(pipeline_);
+  if (reconnect_interval_ms_.has_value()) {
+    client->setReconnectInterval(reconnect_interval_ms_.value());
+  }
+  if (tracking_ != nullptr) {
+    client->setTracking(tracking_.get());
+  }
+  clients_.push_back({std::move(client), std::chrono::steady_clock::now()});
+}
+
+void AsyncClientPool::closeIdleClients() {
+  const auto now = std::chrono::steady_clock::now();
+  // The first connection is always kept. Connections with commands that are still held by the
+  // pipeline are kept as well, since the commands without replies would be lost silently.
+  for (size_t i = clients_.size(); i > 1; i--) {
+    auto& pooled = clients_[i - 1];
+    if (pooled.client_->outstandingCommands() > 0 || pooled.client_->pendingCommands() > 0 ||
+        now - pooled.last_used_ < idle_time_) {
+      continue;
+    }
+    ENVOY_LOG(debug, "Close idle connection of the pool to redis server {}:{}", endpoint_.host_,
+              endpoint_.port_);
+    // Keys read by the connection are no longer tracked once it is closed.
+    pooled.client_->loseTracking();
+    clients_.erase(clients_.begin() + (i - 1));
+  }
+}
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
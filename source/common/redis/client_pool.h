@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+#include "source/common/redis/async_client.h"
+#include "source/common/redis/tracking_subscriber.h"
+
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+/**
+ * Pool of asynchronous connections to one Redis server. A large reply only blocks the commands
+ * that are sent by the same connection, so every command is sent by the working connection with the
+ * fewest outstanding commands. A new connection is created when all connections are busy, up to
+ * the pool size, and connections that are idle for the idle time are closed.
+ */
+class AsyncClientPool : public AsyncCommandClient, public Logger::Loggable<Logger::Id::redis> {
+public:
+  // Upper bound of the pool size. Larger sizes are clamped to it.
+  static constexpr uint64_t MAX_POOL_SIZE = 1024;
+
+  AsyncClientPool(const AsyncClient::Endpoint& endpoint, const std::string& password,
+                  event_base* base, uint64_t timeout_ms, uint64_t pool_size, uint64_t idle_time_ms,
+                  const PipelineOptions& pipeline = {});
+  ~AsyncClientPool() override;
+
+  // Working if any connection is working.
+  Status clientStatus() const override;
+
+  void set(const std::string& key, const std::string& value, uint64_t expire_ms) override;
+  void get(const std::string& key, CommandCallback callback) override;
+  void del(const std::string& key) override;
+
+  bool command(CommandArgs args, ReplyCallback callback) override;
+
+  size_t size() const { return clients_.size(); }
+
+  // Reconnect interval of all connections, including the ones created later.
+  void setReconnectInterval(uint64_t interval_ms);
+
+  // Enable server assisted client side caching on all connections. Invalidation messages are
+  // received by a dedicated connection and passed to the callback.
+  void enableTracking(TrackingSubscriber::InvalidationCallback callback);
+
+private:
+  struct PooledClient {
+    std::unique_ptr<AsyncClient> client_;
+    std::chrono::steady_clock::time_point last_used_;
+  };
+
+  // Pick the working connection with the fewest outstanding commands. Returns nullptr if no
+  // connection is working.
+  AsyncClient* pick();
+  void addClient();
+  void closeIdleClients();
+
+  static void idleCb(evutil_socket_t, short, void* arg) {
+    static_cast<AsyncClientPool*>(arg)->closeIdleClients();
+  }
+
+  const AsyncClient::Endpoint endpoint_;
+  const std::string password_;
+  const uint64_t timeout_ms_{0};
+  const uint64_t pool_size_{1};
+  const std::chrono::milliseconds idle_time_;
+  const PipelineOptions pipeline_;
+  absl::optional<uint64_t> reconnect_interval_ms_;
+
+  // Not owned by the pool, so it is left alone on destruction.
+  event_base* event_base_{nullptr};
+  event* idle_event_{nullptr};
+
+  // Declared before the connections so that it outlives them.
+  TrackingSubscriberPtr tracking_;
+  std::vector<PooledClient> clients_;
+  // Start of the next scan. Connections with the same number of outstanding commands are used in
+  // turn.
+  size_t next_{0};
+};
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,317 @@
+#include "source/common/redis/cluster_client.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+namespace {
+
+constexpr uint32_t MaxRedirects = 5;
+// Interval of retrying to load the slot map when no node is available.
+constexpr uint64_t RefreshRetryIntervalMs = 100;
+
+bool parseEndpoint(absl::string_view address, AsyncClient::Endpoint& endpoint) {
+  const auto pos = address.rfind(':');
+  if (pos == absl::string_view::npos) {
+    return false;
+  }
+  if (!absl::SimpleAtoi(address.substr(pos + 1), &endpoint.port_)) {
+    return false;
+  }
+  endpoint.host_ = std::string(address.substr(0, pos));
+  return true;
+}
+
+} // namespace
+
+uint16_t ClusterUtil::crc16(absl::string_view data) {
+  uint16_t crc = 0;
+  for (const char c : data) {
+    crc ^= static_cast<uint16_t>(static_cast<uint8_t>(c)) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+uint16_t ClusterUtil::keySlot(absl::string_view key) {
+  const auto start = key.find('{');
+  if (start != absl::string_view::npos) {
+    const auto end = key.find('}', start + 1);
+    if (end != absl::string_view::npos && end != start + 1) {
+      key = key.substr(start + 1, end - start - 1);
+    }
+  }
+  return crc16(key) % ClusterSlotNumber;
+}
+
+absl::optional<ClusterUtil::Redirection> ClusterUtil::parseRedirection(absl::string_view error) {
+  std::vector<absl::string_view> parts = absl::StrSplit(error, ' ', absl::SkipEmpty());
+  if (parts.size() != 3 || (parts[0] != "MOVED" && parts[0] != "ASK")) {
+    return absl::nullopt;
+  }
+
+  Redirection redirection;
+  redirection.ask_ = parts[0] == "ASK";
+  uint32_t slot = 0;
+  if (!absl::SimpleAtoi(parts[1], &slot) || slot >= ClusterSlotNumber ||
+      !parseEndpoint(parts[2], redirection.endpoint_)) {
+    return absl::nullopt;
+  }
+  redirection.slot_ = slot;
+  return redirection;
+}
+
+bool ClusterUtil::parseClusterSlots(const redisReply* reply, const AsyncClient::Endpoint& replier,
+                                    std::vector<SlotRange>& ranges) {
+  if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY) {
+    return false;
+  }
+
+  for (size_t i = 0; i < reply->elements; i++) {
+    const redisReply* range = reply->element[i];
+    // [start, end, [host, port, id], replicas...]
+    if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 ||
+        range->element[0]->type != REDIS_REPLY_INTEGER ||
+        range->element[1]->type != REDIS_REPLY_INTEGER ||
+        range->element[2]->type != REDIS_REPLY_ARRAY || range->element[2]->elements < 2) {
+      return false;
+    }
+
+    const redisReply* master = range->element[2];
+    if (master->element[0]->type != REDIS_REPLY_STRING ||
+        master->element[1]->type != REDIS_REPLY_INTEGER) {
+      return false;
+    }
+
+    SlotRange slot_range;
+    const long long start = range->element[0]->integer;
+    const long long end = range->element[1]->integer;
+    if (start < 0 || end < start || end >= ClusterSlotNumber) {
+      return false;
+    }
+    slot_range.start_ = start;
+    slot_range.end_ = end;
+    slot_range.master_.host_ = std::string(master->element[0]->str, master->element[0]->len);
+    slot_range.master_.port_ = master->element[1]->integer;
+    if (slot_range.master_.host_.empty()) {
+      slot_range.master_.host_ = replier.host_;
+    }
+    ranges.push_back(std::move(slot_range));
+  }
+  return true;
+}
+
+ClusterAsyncClient::ClusterAsyncClient(const std::vector<AsyncClient::Endpoint>& seeds,
+                                       const std::string& password, event_base* base,
+                                       uint64_t timeout_ms, uint64_t refresh_interval_ms,
+                                       const PipelineOptions& pipeline)
+    : seeds_(seeds), password_(password), timeout_ms_(timeout_ms),
+      refresh_interval_ms_(refresh_interval_ms), pipeline_(pipeline), event_base_(base),
+      slots_(ClusterSlotNumber, nullptr) {
+  if (!event_base_) {
+    throw AsyncClient::Exception("EVENT BASE CAN NOT BE NULL AND PLEASE CHECK YOUR CODE");
+  }
+  if (seeds_.empty()) {
+    throw AsyncClient::Exception("NO SEED NODE OF REDIS CLUSTER");
+  }
+
+  for (const auto& seed : seeds_) {
+    node(seed);
+  }
+
+  refresh_event_ = evtimer_new(event_base_, refreshCb, this);
+  // Connections are not established yet.
+  scheduleRefresh(RefreshRetryIntervalMs);
+}
+
+ClusterAsyncClient::~ClusterAsyncClient() {
+  closing_ = true;
+  if (refresh_event_) {
+    event_free(refresh_event_);
+    refresh_event_ = nullptr;
+  }
+  // Pending commands are completed with empty replies while this object is still valid.
+  nodes_.clear();
+  retired_nodes_.clear();
+}
+
+void ClusterAsyncClient::set(const std::string& key, const std::string& value,
+                             uint64_t expire_ms) {
+  if (expire_ms == 0) {
+    return;
+  }
+  command({"SET", key, value, "PX", std::to_string(expire_ms)}, ClusterUtil::keySlot(key),
+          nullptr);
+}
+
+void ClusterAsyncClient::get(const std::string& key, CommandCallback callback) {
+  command({"GET", key}, ClusterUtil::keySlot(key),
+          AsyncClient::stringReplyCallback(std::move(callback)));
+}
+
+void ClusterAsyncClient::del(const std::string& key) {
+  command({"DEL", key}, ClusterUtil::keySlot(key), nullptr);
+}
+
+bool ClusterAsyncClient::command(CommandArgs args, ReplyCallback callback) {
+  if (!slots_ready_ || args.empty()) {
+    return false;
+  }
+  const uint16_t slot = ClusterUtil::keySlot(args.size() > 1 ? args[1] : absl::string_view());
+  if (slots_[slot] == nullptr || slots_[slot]->clientStatus() != WORKING) {
+    return false;
+  }
+  command(args, slot, std::move(callback));
+  return true;
+}
+
+void ClusterAsyncClient::command(CommandArgs args, uint16_t slot,
+                                 AsyncClient::ReplyCallback callback) {
+  auto command = std::make_shared<Command>();
+  command->name_ = std::string(args[0]);
+  command->formatted_ = AsyncClient::formatCommand(args);
+  command->callback_ = std::move(callback);
+  send(command, slots_[slot], false);
+}
+
+void ClusterAsyncClient::send(const CommandSharedPtr& command, AsyncClient* client, bool asking) {
+  if (client == nullptr || client->clientStatus() != WORKING) {
+    ENVOY_LOG(debug, "No available redis cluster node for command: {}", command->name_);
+    if (command->callback_ != nullptr) {
+      command->callback_(nullptr, std::string("NO AVAILABLE REDIS CLUSTER NODE"));
+    }
+    return;
+  }
+
+  if (asking) {
+    client->command({"ASKING"}, nullptr);
+  }
+
+  // The reply of a command without callback is still checked to follow redirections.
+  auto on_reply = [this, command](redisReply* reply, absl::optional<Error> error) {
+    if (!closing_ && error.has_value() && command->redirects_ < MaxRedirects) {
+      const auto redirection = ClusterUtil::parseRedirection(error.value());
+      if (redirection.has_value()) {
+        ENVOY_LOG(debug, "Redis cluster redirection: {}", error.value());
+        command->redirects_++;
+        AsyncClient& target = node(redirection->endpoint_);
+        if (!redirection->ask_) {
+          slots_[redirection->slot_] = &target;
+          scheduleRefresh(0);
+        }
+        send(command, &target, redirection->ask_);
+        return;
+      }
+    }
+    if (command->callback_ != nullptr) {
+      command->callback_(reply, std::move(error));
+    }
+  };
+  const bool sent =
+      client->formattedCommand(absl::string_view(command->formatted_), std::move(on_reply));
+
+  if (!sent && command->callback_ != nullptr) {
+    command->callback_(nullptr, std::string("FAILED TO SEND COMMAND TO REDIS CLUSTER NODE"));
+  }
+}
+
+AsyncClient& ClusterAsyncClient::node(const AsyncClient::Endpoint& endpoint) {
+  auto& client = nodes_[nodeName(endpoint)];
+  if (client == nullptr) {
+    ENVOY_LOG(debug, "Create connection to redis cluster node: {}", nodeName(endpoint));
+    client = std::make_unique<AsyncClient>(endpoint, password_, event_base_, timeout_ms_);
+    client->setPipeline(pipeline_);
+  }
+  return *client;
+}
+
+void ClusterAsyncClient::refreshSlots() {
+  retired_nodes_.clear();
+  if (refreshing_ || closing_) {
+    return;
+  }
+
+  // Ask any working node. The nodes of the current slot map and the seeds are all in the map.
+  for (const auto& item : nodes_) {
+    AsyncClient& client = *item.second;
+    if (client.clientStatus() != WORKING) {
+      continue;
+    }
+    const AsyncClient::Endpoint replier = client.endpoint();
+    refreshing_ = client.command(
+        {"CLUSTER", "SLOTS"}, [this, replier](redisReply* reply, absl::optional<Error> error) {
+          refreshing_ = false;
+          if (closing_) {
+            return;
+          }
+          if (error.has_value()) {
+            ENVOY_LOG(error, "Failed to load slots of redis cluster: {}", error.value());
+          }
+          onClusterSlots(error.has_value() ? nullptr : reply, replier);
+        });
+    if (refreshing_) {
+      return;
+    }
+  }
+
+  ENVOY_LOG(debug, "No working redis cluster node to load slots and retry later");
+  scheduleRefresh(RefreshRetryIntervalMs);
+}
+
+void ClusterAsyncClient::onClusterSlots(const redisReply* reply,
+                                        const AsyncClient::Endpoint& replier) {
+  std::vector<ClusterUtil::SlotRange> ranges;
+  if (!ClusterUtil::parseClusterSlots(reply, replier, ranges) || ranges.empty()) {
+    scheduleRefresh(RefreshRetryIntervalMs);
+    return;
+  }
+
+  std::vector<AsyncClient*> slots(ClusterSlotNumber, nullptr);
+  std::unordered_map<std::string, bool> masters;
+  for (const auto& range : ranges) {
+    AsyncClient* master = &node(range.master_);
+    masters[nodeName(range.master_)] = true;
+    for (uint32_t slot = range.start_; slot <= range.end_; slot++) {
+      slots[slot] = master;
+    }
+  }
+  slots_.swap(slots);
+  slots_ready_ = true;
+
+  // Close the connections to the nodes that are neither masters nor seeds.
+  for (const auto& seed : seeds_) {
+    masters[nodeName(seed)] = true;
+  }
+  for (auto it = nodes_.begin(); it != nodes_.end();) {
+    if (masters.find(it->first) == masters.end()) {
+      ENVOY_LOG(debug, "Redis cluster node {} is removed", it->first);
+      retired_nodes_.push_back(std::move(it->second));
+      nodes_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  ENVOY_LOG(debug, "Redis cluster slots are loaded with {} ranges", ranges.size());
+  scheduleRefresh(refresh_interval_ms_);
+}
+
+void ClusterAsyncClient::scheduleRefresh(uint64_t delay_ms) {
+  if (refresh_event_ == nullptr) {
+    return;
+  }
+  timeval interval;
+  setTimeval(interval, delay_ms);
+  evtimer_add(refresh_event_, &interval);
+}
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "source/common/common/logger.h"
+#include "source/common/redis/async_client.h"
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+constexpr uint32_t ClusterSlotNumber = 16384;
+
+class ClusterUtil {
+public:
+  // CRC16-CCITT (XMODEM) that is used by Redis Cluster to compute the slot of a key.
+  static uint16_t crc16(absl::string_view data);
+
+  // Slot of the key. Only the hash tag is hashed if the key contains a non-empty hash tag, for
+  // example "{user}.name" and "{user}.age" are in the same slot.
+  static uint16_t keySlot(absl::string_view key);
+
+  // Redirection of the "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>" error.
+  struct Redirection {
+    bool ask_{false};
+    uint16_t slot_{0};
+    AsyncClient::Endpoint endpoint_;
+  };
+  static absl::optional<Redirection> parseRedirection(absl::string_view error);
+
+  struct SlotRange {
+    uint16_t start_{0};
+    uint16_t end_{0};
+    AsyncClient::Endpoint master_;
+  };
+  // Parse the reply of CLUSTER SLOTS. A master with an empty host is the node that replies.
+  static bool parseClusterSlots(const redisReply* reply, const AsyncClient::Endpoint& replier,
+                                std::vector<SlotRange>& ranges);
+};
+
+/**
+ * Asynchronous Redis Cluster client. A connection is established to every master and commands are
+ * sent to the master that serves the slot of the key. The slot map is loaded by CLUSTER SLOTS and
+ * refreshed periodically or as soon as a MOVED redirection is received. The ASK redirection is
+ * followed only for the current command.
+ */
+class ClusterAsyncClient : public AsyncCommandClient, public Logger::Loggable<Logger::Id::redis> {
+public:
+  ClusterAsyncClient(const std::vector<AsyncClient::Endpoint>& seeds, const std::string& password,
+                     event_base* base, uint64_t timeout_ms, uint64_t refresh_interval_ms,
+                     const PipelineOptions& pipeline = {});
+  ~ClusterAsyncClient() override;
+
+  // Working after the slot map is loaded.
+  Status clientStatus() const override { return slots_ready_ ? WORKING : CONNECTING; }
+
+  void set(const std::string& key, const std::string& value, uint64_t expire_ms) override;
+  void get(const std::string& key, CommandCallback callback) override;
+  void del(const std::string& key) override;
+
+  // The command is sent to the master of the slot of args[1], so the key must be the first argument
+  // after the command name and all keys of the command must be in the same slot.
+  bool command(CommandArgs args, ReplyCallback callback) override;
+
+  // Number of nodes with an established or pending connection.
+  size_t nodeNumber() const { return nodes_.size(); }
+
+private:
+  // The command is formatted once and the same bytes are sent again on redirections.
+  struct Command {
+    std::string name_;
+    std::string formatted_;
+    AsyncClient::ReplyCallback callback_;
+    uint32_t redirects_{0};
+  };
+  using CommandSharedPtr = std::shared_ptr<Command>;
+
+  void command(CommandArgs args, uint16_t slot, AsyncClient::ReplyCallback callback);
+  void send(const CommandSharedPtr& command, AsyncClient* client, bool asking);
+
+  AsyncClient& node(const AsyncClient::Endpoint& endpoint);
+
+  void refreshSlots();
+  void onClusterSlots(const redisReply* reply, const AsyncClient::Endpoint& replier);
+  void scheduleRefresh(uint64_t delay_ms);
+
+  static void refreshCb(evutil_socket_t, short, void* arg) {
+    static_cast<ClusterAsyncClient*>(arg)->refreshSlots();
+  }
+
+  static std::string nodeName(const AsyncClient::Endpoint& endpoint) {
+    return endpoint.host_ + ":" + std::to_string(endpoint.port_);
+  }
+
+  const std::vector<AsyncClient::Endpoint> seeds_;
+  const std::string password_;
+  const uint64_t timeout_ms_{0};
+  const uint64_t refresh_interval_ms_{0};
+  const PipelineOptions pipeline_;
+
+  // Not owned by the client, so it is left alone on destruction.
+  event_base* event_base_{nullptr};
+  event* refresh_event_{nullptr};
+
+  std::unordered_map<std::string, std::unique_ptr<AsyncClient>> nodes_;
+  // Nodes that are removed from the slot map. They are freed in the next refresh because they may
+  // be removed in their own callback.
+  std::vector<std::unique_ptr<AsyncClient>> retired_nodes_;
+
+  std::vector<AsyncClient*> slots_;
+  bool slots_ready_{false};
+  bool refreshing_{false};
+  bool closing_{false};
+};
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
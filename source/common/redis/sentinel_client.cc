@@ -0,0 +1,236 @@
+#include "source/common/redis/sentinel_client.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+namespace {
+
+constexpr uint64_t CheckIntervalMs = 1000;
+// Query the master every 10 checks even if the master connection is working.
+constexpr uint32_t QueryMasterChecks = 10;
+// Switch to the next sentinel after the current one is not available for 3 checks.
+constexpr uint32_t MaxSentinelFailures = 3;
+
+constexpr absl::string_view SwitchMasterChannel = "+switch-master";
+
+} // namespace
+
+bool SentinelUtil::parseMasterAddress(const redisReply* reply, AsyncClient::Endpoint& master) {
+  if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+      reply->element[0]->type != REDIS_REPLY_STRING ||
+      reply->element[1]->type != REDIS_REPLY_STRING) {
+    return false;
+  }
+
+  int port = 0;
+  if (!absl::SimpleAtoi(absl::string_view(reply->element[1]->str, reply->element[1]->len),
+                        &port)) {
+    return false;
+  }
+  master.host_ = std::string(reply->element[0]->str, reply->element[0]->len);
+  master.port_ = port;
+  return !master.host_.empty();
+}
+
+bool SentinelUtil::parseSwitchMaster(const redisReply* reply, absl::string_view master_name,
+                                     AsyncClient::Endpoint& master) {
+  // ["message", "+switch-master", payload]
+  if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+      reply->element[0]->type != REDIS_REPLY_STRING ||
+      reply->element[2]->type != REDIS_REPLY_STRING ||
+      absl::string_view(reply->element[0]->str, reply->element[0]->len) != "message") {
+    return false;
+  }
+
+  std::vector<absl::string_view> parts =
+      absl::StrSplit(absl::string_view(reply->element[2]->str, reply->element[2]->len), ' ',
+                     absl::SkipEmpty());
+  int port = 0;
+  if (parts.size() != 5 || parts[0] != master_name || !absl::SimpleAtoi(parts[4], &port)) {
+    return false;
+  }
+  master.host_ = std::string(parts[3]);
+  master.port_ = port;
+  return true;
+}
+
+SentinelAsyncClient::SentinelAsyncClient(const std::vector<AsyncClient::Endpoint>& sentinels,
+                                         const std::string& master_name,
+                                         const std::string& sentinel_password,
+                                         const std::string& password, event_base* base,
+                                         uint64_t timeout_ms, const PipelineOptions& pipeline)
+    : sentinels_(sentinels), master_name_(master_name), sentinel_password_(sentinel_password),
+      password_(password), timeout_ms_(timeout_ms), pipeline_(pipeline), event_base_(base) {
+  if (!event_base_) {
+    throw AsyncClient::Exception("EVENT BASE CAN NOT BE NULL AND PLEASE CHECK YOUR CODE");
+  }
+  if (sentinels_.empty() || master_name_.empty()) {
+    throw AsyncClient::Exception("NO SENTINEL NODE OR MASTER NAME");
+  }
+
+  connectToSentinel();
+
+  check_event_ = evtimer_new(event_base_, checkCb, this);
+  scheduleCheck();
+}
+
+SentinelAsyncClient::~SentinelAsyncClient() {
+  closing_ = true;
+  if (check_event_) {
+    event_free(check_event_);
+    check_event_ = nullptr;
+  }
+  // Pending commands are completed with empty replies while this object is still valid.
+  master_.reset();
+  retired_clients_.clear();
+  subscriber_.reset();
+  sentinel_.reset();
+}
+
+void SentinelAsyncClient::set(const std::string& key, const std::string& value,
+                              uint64_t expire_ms) {
+  if (master_ != nullptr) {
+    master_->set(key, value, expire_ms);
+  }
+}
+
+void SentinelAsyncClient::get(const std::string& key, CommandCallback callback) {
+  if (master_ != nullptr) {
+    master_->get(key, std::move(callback));
+  }
+}
+
+void SentinelAsyncClient::del(const std::string& key) {
+  if (master_ != nullptr) {
+    master_->del(key);
+  }
+}
+
+bool SentinelAsyncClient::command(CommandArgs args, ReplyCallback callback) {
+  if (master_ == nullptr) {
+    return false;
+  }
+  return master_->command(args, std::move(callback));
+}
+
+std::unique_ptr<AsyncClient>
+SentinelAsyncClient::createClient(const AsyncClient::Endpoint& endpoint,
+                                  const std::string& password) {
+  auto client = std::make_unique<AsyncClient>(endpoint, password, event_base_, timeout_ms_);
+  // The dead node is replaced in a few checks and there is no need to wait for the default 30s.
+  client->setReconnectInterval(CheckIntervalMs);
+  return client;
+}
+
+void SentinelAsyncClient::connectToSentinel() {
+  const auto& endpoint = sentinels_[sentinel_index_];
+  ENVOY_LOG(debug, "Connect to redis sentinel {}:{}", endpoint.host_, endpoint.port_);
+
+  // Pending callbacks of the old connections are executed here.
+  subscriber_.reset();
+  sentinel_.reset();
+  querying_ = false;
+  subscribed_ = false;
+
+  sentinel_ = createClient(endpoint, sentinel_password_);
+  subscriber_ = createClient(endpoint, sentinel_password_);
+}
+
+void SentinelAsyncClient::check() {
+  retired_clients_.clear();
+
+  if (sentinel_->clientStatus() != WORKING) {
+    if (++sentinel_failures_ >= MaxSentinelFailures) {
+      ENVOY_LOG(info, "Redis sentinel {}:{} is not available and try the next one",
+                sentinels_[sentinel_index_].host_, sentinels_[sentinel_index_].port_);
+      sentinel_failures_ = 0;
+      sentinel_index_ = (sentinel_index_ + 1) % sentinels_.size();
+      connectToSentinel();
+    }
+    scheduleCheck();
+    return;
+  }
+
+  sentinel_failures_ = 0;
+  if (!subscribed_) {
+    subscribe();
+  }
+  if (master_ == nullptr || master_->clientStatus() != WORKING ||
+      ++checks_ % QueryMasterChecks == 0) {
+    queryMaster();
+  }
+  scheduleCheck();
+}
+
+void SentinelAsyncClient::queryMaster() {
+  if (querying_) {
+    return;
+  }
+  querying_ = sentinel_->command(
+      {"SENTINEL", "get-master-addr-by-name", master_name_},
+      [this](redisReply* reply, absl::optional<Error> error) {
+        querying_ = false;
+        if (closing_ || reply == nullptr) {
+          return;
+        }
+        AsyncClient::Endpoint master;
+        if (error.has_value() || !SentinelUtil::parseMasterAddress(reply, master)) {
+          ENVOY_LOG(error, "Failed to get address of redis master {} from sentinel: {}",
+                    master_name_, error.value_or("unknown master"));
+          return;
+        }
+        switchMaster(master);
+      });
+}
+
+void SentinelAsyncClient::subscribe() {
+  subscribed_ = subscriber_->subscribe(
+      std::string(SwitchMasterChannel), [this](redisReply* reply, absl::optional<Error>) {
+        if (closing_) {
+          return;
+        }
+        if (reply == nullptr) {
+          // The subscription is lost with the connection.
+          subscribed_ = false;
+          return;
+        }
+        AsyncClient::Endpoint master;
+        if (SentinelUtil::parseSwitchMaster(reply, master_name_, master)) {
+          switchMaster(master);
+        }
+      });
+}
+
+void SentinelAsyncClient::switchMaster(const AsyncClient::Endpoint& master) {
+  if (master_ != nullptr && master_->endpoint().host_ == master.host_ &&
+      master_->endpoint().port_ == master.port_) {
+    return;
+  }
+
+  ENVOY_LOG(info, "Redis master {} is switched to {}:{}", master_name_, master.host_,
+            master.port_);
+  if (master_ != nullptr) {
+    retired_clients_.push_back(std::move(master_));
+  }
+  master_ = createClient(master, password_);
+  master_->setPipeline(pipeline_);
+}
+
+void SentinelAsyncClient::scheduleCheck() {
+  if (check_event_ == nullptr) {
+    return;
+  }
+  timeval interval;
+  setTimeval(interval, CheckIntervalMs);
+  evtimer_add(check_event_, &interval);
+}
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
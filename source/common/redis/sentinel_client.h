@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+#include "source/common/redis/async_client.h"
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+class SentinelUtil {
+public:
+  // Parse the reply of "SENTINEL get-master-addr-by-name <master>".
+  static bool parseMasterAddress(const redisReply* reply, AsyncClient::Endpoint& master);
+
+  // Parse the "+switch-master" message. The payload of the message is "<master> <old host>
+  // <old port> <new host> <new port>". Messages of other masters are ignored.
+  static bool parseSwitchMaster(const redisReply* reply, absl::string_view master_name,
+                                AsyncClient::Endpoint& master);
+};
+
+/**
+ * Asynchronous Redis client that discovers the master by Redis Sentinel. The address of the master
+ * is queried from a sentinel and the client subscribes to "+switch-master" of the same sentinel, so
+ * the connection is moved to the new master as soon as a failover is done. The master is also
+ * queried periodically and whenever the master connection is not working, in case the message is
+ * missed. Another sentinel is tried when the current sentinel is not available.
+ */
+class SentinelAsyncClient : public AsyncCommandClient, public Logger::Loggable<Logger::Id::redis> {
+public:
+  SentinelAsyncClient(const std::vector<AsyncClient::Endpoint>& sentinels,
+                      const std::string& master_name, const std::string& sentinel_password,
+                      const std::string& password, event_base* base, uint64_t timeout_ms,
+                      const PipelineOptions& pipeline = {});
+  ~SentinelAsyncClient() override;
+
+  Status clientStatus() const override {
+    return master_ != nullptr ? master_->clientStatus() : CONNECTING;
+  }
+
+  void set(const std::string& key, const std::string& value, uint64_t expire_ms) override;
+  void get(const std::string& key, CommandCallback callback) override;
+  void del(const std::string& key) override;
+
+  // Sent to the current master.
+  bool command(CommandArgs args, ReplyCallback callback) override;
+
+  absl::optional<AsyncClient::Endpoint> masterEndpoint() const {
+    if (master_ == nullptr) {
+      return absl::nullopt;
+    }
+    return master_->endpoint();
+  }
+
+private:
+  void connectToSentinel();
+  void check();
+  void queryMaster();
+  void subscribe();
+  void switchMaster(const AsyncClient::Endpoint& master);
+  void scheduleCheck();
+
+  static void checkCb(evutil_socket_t, short, void* arg) {
+    static_cast<SentinelAsyncClient*>(arg)->check();
+  }
+
+  std::unique_ptr<AsyncClient> createClient(const AsyncClient::Endpoint& endpoint,
+                                            const std::string& password);
+
+  const std::vector<AsyncClient::Endpoint> sentinels_;
+  const std::string master_name_;
+  const std::string sentinel_password_;
+  const std::string password_;
+  const uint64_t timeout_ms_{0};
+  // Only used by the master connection.
+  const PipelineOptions pipeline_;
+
+  // Not owned by the client, so it is left alone on destruction.
+  event_base* event_base_{nullptr};
+  event* check_event_{nullptr};
+
+  size_t sentinel_index_{0};
+  uint32_t sentinel_failures_{0};
+  uint32_t checks_{0};
+
+  // Connection to the current sentinel for queries.
+  std::unique_ptr<AsyncClient> sentinel_;
+  // Connection to the current sentinel that subscribes to "+switch-master".
+  std::unique_ptr<AsyncClient> subscriber_;
+  std::unique_ptr<AsyncClient> master_;
+  // Old master connections. They are freed in the next check because the switch may happen in
+  // their callbacks.
+  std::vector<std::unique_ptr<AsyncClient>> retired_clients_;
+
+  bool querying_{false};
+  bool subscribed_{false};
+  bool closing_{false};
+};
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
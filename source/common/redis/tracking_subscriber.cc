@@ -0,0 +1,194 @@
+#include "source/common/redis/tracking_subscriber.h"
+
+#include <algorithm>
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+namespace {
+
+// Interval of retrying to subscribe when the connection is not working.
+constexpr uint64_t RetryIntervalMs = 100;
+
+constexpr absl::string_view InvalidateChannel = "__redis__:invalidate";
+
+absl::string_view replyString(const redisReply* reply) {
+  return absl::string_view(reply->str, reply->len);
+}
+
+} // namespace
+
+bool TrackingUtil::parseInvalidation(const redisReply* reply,
+                                     std::vector<absl::string_view>& keys, bool& all) {
+  // ["message", "__redis__:invalidate", payload]
+  if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+      reply->element[0]->type != REDIS_REPLY_STRING ||
+      replyString(reply->element[0]) != "message") {
+    return false;
+  }
+
+  const redisReply* payload = reply->element[2];
+  if (payload->type == REDIS_REPLY_NIL) {
+    all = true;
+    return true;
+  }
+  if (payload->type != REDIS_REPLY_ARRAY) {
+    return false;
+  }
+  for (size_t i = 0; i < payload->elements; i++) {
+    if (payload->element[i]->type != REDIS_REPLY_STRING) {
+      return false;
+    }
+    keys.push_back(replyString(payload->element[i]));
+  }
+  all = false;
+  return true;
+}
+
+TrackingSubscriber::TrackingSubscriber(const AsyncClient::Endpoint& endpoint,
+                                       const std::string& password, event_base* base,
+                                       uint64_t timeout_ms, InvalidationCallback callback)
+    : callback_(std::move(callback)), event_base_(base) {
+  if (!event_base_) {
+    throw AsyncClient::Exception("EVENT BASE CAN NOT BE NULL AND PLEASE CHECK YOUR CODE");
+  }
+  subscriber_ = std::make_unique<AsyncClient>(endpoint, password, event_base_, timeout_ms);
+  subscriber_->setReconnectInterval(1000);
+
+  check_event_ = evtimer_new(event_base_, checkCb, this);
+  scheduleCheck();
+}
+
+TrackingSubscriber::~TrackingSubscriber() {
+  closing_ = true;
+  if (check_event_) {
+    event_free(check_event_);
+    check_event_ = nullptr;
+  }
+  for (AsyncClient* client : clients_) {
+    client->setTracking(nullptr);
+  }
+  subscriber_.reset();
+}
+
+void TrackingSubscriber::addClient(AsyncClient* client) { clients_.push_back(client); }
+
+void TrackingSubscriber::removeClient(AsyncClient* client) {
+  clients_.erase(std::remove(clients_.begin(), clients_.end(), client), clients_.end());
+}
+
+void TrackingSubscriber::onTrackingLost(const absl::flat_hash_set<std::string>& keys, bool all) {
+  if (closing_) {
+    return;
+  }
+  if (all) {
+    invalidateAll();
+    return;
+  }
+  ENVOY_LOG(debug, "Tracking of {} keys is lost with the connection", keys.size());
+  for (const auto& key : keys) {
+    invalidate(key);
+  }
+}
+
+void TrackingSubscriber::invalidate(absl::string_view key) {
+  for (AsyncClient* client : clients_) {
+    client->untrackKey(key);
+  }
+  callback_(key);
+}
+
+void TrackingSubscriber::invalidateAll() {
+  for (AsyncClient* client : clients_) {
+    client->untrackAllKeys();
+  }
+  callback_(absl::nullopt);
+}
+
+void TrackingSubscriber::check() {
+  if (closing_ || redirect_id_.has_value()) {
+    return;
+  }
+  if (!subscribing_ && subscriber_->clientStatus() == AsyncClient::WORKING) {
+    subscribe();
+  }
+  scheduleCheck();
+}
+
+void TrackingSubscriber::subscribe() {
+  auto on_client_id = [this](redisReply* reply, absl::optional<AsyncClient::Error> error) {
+    if (closing_) {
+      return;
+    }
+    if (error.has_value() || reply == nullptr || reply->type != REDIS_REPLY_INTEGER) {
+      ENVOY_LOG(error, "Cannot get the client id of the tracking redirect connection");
+      subscribing_ = false;
+      return;
+    }
+    const long long client_id = reply->integer;
+    subscribing_ = subscriber_->subscribe(
+        std::string(InvalidateChannel),
+        [this, client_id](redisReply* message, absl::optional<AsyncClient::Error>) {
+          if (closing_) {
+            return;
+          }
+          if (message == nullptr) {
+            // The subscription is lost with the connection.
+            ENVOY_LOG(debug, "Tracking redirect connection is lost");
+            redirect_id_.reset();
+            subscribing_ = false;
+            invalidateAll();
+            scheduleCheck();
+            return;
+          }
+          onMessage(client_id, message);
+        });
+  };
+  subscribing_ = subscriber_->command({"CLIENT", "ID"}, std::move(on_client_id));
+}
+
+void TrackingSubscriber::onMessage(long long client_id, const redisReply* reply) {
+  // ["subscribe", "__redis__:invalidate", count]
+  if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 3 &&
+      reply->element[0]->type == REDIS_REPLY_STRING &&
+      replyString(reply->element[0]) == "subscribe") {
+    ENVOY_LOG(debug, "Tracking redirect connection {} subscribes to invalidation", client_id);
+    redirect_id_ = client_id;
+    subscribing_ = false;
+    // Keys that are read before are not tracked by this connection.
+    invalidateAll();
+    for (AsyncClient* client : clients_) {
+      client->startTracking();
+    }
+    return;
+  }
+
+  std::vector<absl::string_view> keys;
+  bool all = false;
+  if (!TrackingUtil::parseInvalidation(reply, keys, all)) {
+    return;
+  }
+  if (all) {
+    invalidateAll();
+    return;
+  }
+  for (const absl::string_view key : keys) {
+    invalidate(key);
+  }
+}
+
+void TrackingSubscriber::scheduleCheck() {
+  if (check_event_ == nullptr) {
+    return;
+  }
+  timeval interval;
+  setTimeval(interval, RetryIntervalMs);
+  evtimer_add(check_event_, &interval);
+}
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
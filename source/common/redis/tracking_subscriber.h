@@ -0,0 +1,83 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/common/logger.h"
+#include "source/common/redis/async_client.h"
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+class TrackingUtil {
+public:
+  // Parse the message of "__redis__:invalidate". The payload is an array of keys, or nil if the
+  // database is flushed and all keys are invalidated. Other messages are ignored.
+  static bool parseInvalidation(const redisReply* reply, std::vector<absl::string_view>& keys,
+                                bool& all);
+};
+
+/**
+ * Receiver of the invalidation messages of server assisted client side caching. It subscribes to
+ * "__redis__:invalidate" by a dedicated connection, and the tracking clients redirect their
+ * invalidation messages to it. Keys are only invalidated once after every read, so the callback
+ * must drop the local copies of the keys.
+ *
+ * Keys that are read while the tracking is not enabled are never invalidated, so all keys are
+ * invalidated whenever the redirect connection subscribes again. When the connection of a tracking
+ * client is lost, only the keys read by it are invalidated, unless it read too many keys to record.
+ */
+class TrackingSubscriber : public TrackingRedirect, public Logger::Loggable<Logger::Id::redis> {
+public:
+  // The key is nullopt if all keys are invalidated.
+  using InvalidationCallback = std::function<void(absl::optional<absl::string_view> key)>;
+
+  TrackingSubscriber(const AsyncClient::Endpoint& endpoint, const std::string& password,
+                     event_base* base, uint64_t timeout_ms, InvalidationCallback callback);
+  ~TrackingSubscriber() override;
+
+  // TrackingRedirect
+  absl::optional<long long> redirectId() const override { return redirect_id_; }
+  void addClient(AsyncClient* client) override;
+  void removeClient(AsyncClient* client) override;
+  void onTrackingLost(const absl::flat_hash_set<std::string>& keys, bool all) override;
+
+private:
+  void check();
+  void subscribe();
+  void onMessage(long long client_id, const redisReply* reply);
+  void invalidate(absl::string_view key);
+  void invalidateAll();
+  void scheduleCheck();
+
+  static void checkCb(evutil_socket_t, short, void* arg) {
+    static_cast<TrackingSubscriber*>(arg)->check();
+  }
+
+  const InvalidationCallback callback_;
+
+  // Not owned by the subscriber, so it is left alone on destruction.
+  event_base* event_base_{nullptr};
+  event* check_event_{nullptr};
+
+  std::unique_ptr<AsyncClient> subscriber_;
+  std::vector<AsyncClient*> clients_;
+
+  absl::optional<long long> redirect_id_;
+  bool subscribing_{false};
+  bool closing_{false};
+};
+
+using TrackingSubscriberPtr = std::unique_ptr<TrackingSubscriber>;
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -1,6 +1,7 @@
 #include "source/common/sender/cache_request_sender.h"
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <string>
@@ -14,9 +15,16 @@
 #include "source/common/http/headers.h"
 #include "source/common/http/proxy_base.h"
 #include "source/common/http/utility.h"
+#include "source/common/protobuf/utility.h"
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "openssl/md5.h"
 
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
 namespace Envoy {
 namespace Proxy {
 namespace Common {
@@ -26,6 +34,11 @@ namespace {
 
 constexpr absl::string_view RedisCacheName = "RedisCache";
 constexpr absl::string_view LocalCacheName = "LocalCache";
+constexpr absl::string_view MmapCacheName = "MmapCache";
+
+constexpr uint64_t DEFAULT_HEDGE_DELAY_MS = 5;
+constexpr uint32_t DEFAULT_PROMOTION_PER_SECOND = 100;
+constexpr uint64_t DEFAULT_PROMOTION_MIN_REMAINING_TTL_MS = 1000;
 
 constexpr absl::string_view OldRedisCacheName = "RedisHttpCache";
 constexpr absl::string_view OldLocalCacheName = "LocalHttpCache";
@@ -37,63 +50,198 @@ bool isLocalCache(const std::string& name) {
   return name == LocalCacheName || name == OldLocalCacheName;
 }
 
+class Md5KeyHasher {
+public:
+  Md5KeyHasher() { MD5_Init(&context_); }
+
+  void update(absl::string_view data) { MD5_Update(&context_, data.data(), data.size()); }
+
+  std::string hexDigest(absl::string_view tail) {
+    update(tail);
+    uint8_t result[MD5_DIGEST_LENGTH];
+    MD5_Final(result, &context_);
+    return Hex::encode(result, MD5_DIGEST_LENGTH);
+  }
+
+private:
+  MD5_CTX context_;
+};
+
+class Xxh3KeyHasher {
+public:
+  void update(absl::string_view data) {
+    if (!streaming_) {
+      XXH3_INITSTATE(&state_);
+      XXH3_128bits_reset(&state_);
+      streaming_ = true;
+    }
+    XXH3_128bits_update(&state_, data.data(), data.size());
+  }
+
+  std::string hexDigest(absl::string_view tail) {
+    XXH128_hash_t hash;
+    if (streaming_) {
+      update(tail);
+      hash = XXH3_128bits_digest(&state_);
+    } else {
+      // The streaming and one-shot hashes are the same.
+      hash = XXH3_128bits(tail.data(), tail.size());
+    }
+    XXH128_canonical_t result;
+    XXH128_canonicalFromHash(&result, hash);
+    return Hex::encode(result.digest, sizeof(result.digest));
+  }
+
+private:
+  // Only keys that are longer than the buffer of KeyFeeder use the streaming state, which is kept
+  // on the stack.
+  bool streaming_{false};
+  XXH3_state_t state_;
+};
+
+// Feed the parts of the key to the hasher through a buffer on the stack, so short keys are hashed
+// at once and long keys are hashed in a few large updates. Parts are lowercased when they are
+// copied if the case is ignored.
+template <class Hasher> class KeyFeeder {
+public:
+  KeyFeeder(bool ignore_case, bool separate) : ignore_case_(ignore_case), separate_(separate) {}
+
+  void add(absl::string_view part) {
+    while (!part.empty()) {
+      if (size_ == sizeof(buffer_)) {
+        flush();
+      }
+      const size_t size = std::min(part.size(), sizeof(buffer_) - size_);
+      if (ignore_case_) {
+        for (size_t i = 0; i < size; i++) {
+          buffer_[size_ + i] = absl::ascii_tolower(part[i]);
+        }
+      } else {
+        memcpy(buffer_ + size_, part.data(), size);
+      }
+      size_ += size;
+      part.remove_prefix(size);
+    }
+    // NUL never appears in the request line or headers.
+    if (separate_) {
+      if (size_ == sizeof(buffer_)) {
+        flush();
+      }
+      buffer_[size_++] = '\0';
+    }
+  }
+
+  std::string hexDigest() { return hasher_.hexDigest({buffer_, size_}); }
+
+private:
+  void flush() {
+    hasher_.update({buffer_, size_});
+    size_ = 0;
+  }
+
+  Hasher hasher_;
+  const bool ignore_case_{false};
+  const bool separate_{false};
+  char buffer_[256];
+  size_t size_{0};
+};
+
+// Patterns without special characters only match themselves.
+bool isLiteral(absl::string_view pattern) {
+  return pattern.find_first_of("\\^$.|?*+()[]{}") == absl::string_view::npos;
+}
+
+// Value of the first parameter with the name, the same as Http::Utility::parseQueryString but
+// without building the map.
+absl::optional<absl::string_view> queryParameter(absl::string_view query, absl::string_view name) {
+  while (!query.empty()) {
+    const size_t end = std::min(query.find('&'), query.size());
+    const absl::string_view param = query.substr(0, end);
+    const size_t equal = param.find('=');
+    if (param.substr(0, equal) == name) {
+      return equal == absl::string_view::npos ? absl::string_view() : param.substr(equal + 1);
+    }
+    query.remove_prefix(std::min(end + 1, query.size()));
+  }
+  return absl::nullopt;
+}
+
 } // namespace
 
-Cache::CacheKeyType HttpCacheUtil::cacheKey(const KeyMakerConfig& config,
-                                            Envoy::Http::RequestHeaderMap& headers,
-                                            const std::string& prefix) {
+HttpCacheKeyBuilder::HttpCacheKeyBuilder(const KeyMakerConfig& config, const std::string& prefix)
+    : prefix_(prefix), exclude_path_(config.exclude_path()), exclude_host_(config.exclude_host()),
+      ignore_case_(config.ignore_case()), hash_(config.hash()),
+      query_params_(config.query_params().begin(), config.query_params().end()) {
+  for (const auto& header : config.headers_keys()) {
+    header_keys_.emplace_back(header);
+  }
+}
+
+Cache::CacheKeyType HttpCacheKeyBuilder::build(const Envoy::Http::RequestHeaderMap& headers) const {
   ASSERT(headers.Method());
   ASSERT(headers.Path());
   ASSERT(headers.Host());
 
-  std::string raw(prefix);
-  raw.reserve(128);
+  return hash_ == KeyMakerConfig::XXH3_128 ? build<Xxh3KeyHasher>(headers)
+                                           : build<Md5KeyHasher>(headers);
+}
+
+template <class Hasher>
+Cache::CacheKeyType
+HttpCacheKeyBuilder::build(const Envoy::Http::RequestHeaderMap& headers) const {
+  // The input of MD5 is the same as the raw key of previous versions.
+  const bool legacy = hash_ == KeyMakerConfig::MD5;
+  KeyFeeder<Hasher> feeder(ignore_case_, !legacy);
 
-  // TODO(wbpcode): use raw += headers.Method()->value().getStringView().data();
-  if (!config.exclude_path()) {
-    raw += std::string(headers.Method()->value().getStringView());
+  feeder.add(prefix_);
+  if (!legacy || !exclude_path_) {
+    feeder.add(headers.getMethodValue());
   }
-  if (!config.exclude_host()) {
-    raw += std::string(headers.Host()->value().getStringView());
+  if (!exclude_host_) {
+    feeder.add(headers.getHostValue());
   }
 
   // path and query string
-  const auto path = headers.Path()->value().getStringView();
-  if (!config.exclude_path()) {
-    raw += std::string(Envoy::Http::PathUtil::removeQueryAndFragment(path));
+  const auto path = headers.getPathValue();
+  if (!exclude_path_) {
+    feeder.add(Envoy::Http::PathUtil::removeQueryAndFragment(path));
   }
-  auto query_params = Envoy::Http::Utility::parseQueryString(path);
-
-  for (auto& query : config.query_params()) {
-    if (query_params.find(query) != query_params.end()) {
-      raw = raw + query + query_params[query];
+  const size_t query_start = path.find('?');
+  const absl::string_view query =
+      query_start == absl::string_view::npos ? absl::string_view() : path.substr(query_start + 1);
+  for (const auto& name : query_params_) {
+    const auto value = queryParameter(query, name);
+    if (value.has_value()) {
+      feeder.add(name);
+      feeder.add(value.value());
     }
   }
   // headers
-  for (auto& header : config.headers_keys()) {
-    auto result = headers.get(Envoy::Http::LowerCaseString(header));
+  for (const auto& key : header_keys_) {
+    const auto result = headers.get(key);
     if (result.empty()) {
       continue;
     }
-    raw.append(std::string(result[0]->key().getStringView()));
-    raw.append(std::string(result[0]->value().getStringView()));
-  }
-
-  if (config.ignore_case()) {
-    std::transform(raw.begin(), raw.end(), raw.begin(), ::tolower);
+    feeder.add(result[0]->key().getStringView());
+    feeder.add(result[0]->value().getStringView());
   }
 
-  ENVOY_LOG_TO_LOGGER(Envoy::Logger::Registry::getLog(Envoy::Logger::Id::client), trace,
-                      "Request Cache key string: {}", raw);
+  return feeder.hexDigest();
+}
 
-  uint8_t md5_result[MD5_DIGEST_LENGTH];
-  MD5(reinterpret_cast<uint8_t*>(raw.data()), raw.size(), md5_result);
-  return Hex::encode(md5_result, MD5_DIGEST_LENGTH);
+Cache::CacheKeyType HttpCacheUtil::cacheKey(const KeyMakerConfig& config,
+                                            Envoy::Http::RequestHeaderMap& headers,
+                                            const std::string& prefix) {
+  return HttpCacheKeyBuilder(config, prefix).build(headers);
 }
 
 CacheGetterSetterConfig::CacheGetterSetterConfig(const ProtoCaches& caches,
                                                  Server::Configuration::FactoryContext& context,
-                                                 bool request_cache) {
+                                                 bool request_cache,
+                                                 const LookupPolicy& lookup_policy)
+    : lookup_mode_(lookup_policy.mode()),
+      hedge_delay_(PROTOBUF_GET_MS_OR_DEFAULT(lookup_policy, hedge_delay, DEFAULT_HEDGE_DELAY_MS)),
+      time_source_(context.timeSource()) {
   std::set<absl::string_view> used_names;
   for (const auto& it : caches) {
     // get cache name
@@ -105,6 +253,9 @@ CacheGetterSetterConfig::CacheGetterSetterConfig(const ProtoCaches& caches,
     case Cache::ProtoCache::CacheTypeCase::kLocal:
       name = LocalCacheName;
       break;
+    case Cache::ProtoCache::CacheTypeCase::kMmap:
+      name = MmapCacheName;
+      break;
     default:
       throw EnvoyException("Error cache type and should never run here");
     }
@@ -113,6 +264,25 @@ CacheGetterSetterConfig::CacheGetterSetterConfig(const ProtoCaches& caches,
       continue;
     }
     used_names.insert(name);
+    // Keys changed in a remote cache are dropped from the caches before it. The callback runs on
+    // workers and the caches may be released before the callback is unregistered.
+    std::vector<std::weak_ptr<Cache::CommonCacheBase>> previous_caches;
+    for (const auto& used : used_caches_) {
+      previous_caches.push_back(used.second);
+    }
+    auto invalidation = [previous_caches](absl::optional<absl::string_view> key) {
+      for (const auto& weak_cache : previous_caches) {
+        auto cache = weak_cache.lock();
+        if (cache == nullptr) {
+          continue;
+        }
+        if (key.has_value()) {
+          cache->removeCache(std::string(key.value()));
+        } else {
+          cache->clearCache();
+        }
+      }
+    };
     // create cache
     auto cache = Cache::CacheConfig::create(
         it, context,
@@ -121,19 +291,114 @@ CacheGetterSetterConfig::CacheGetterSetterConfig(const ProtoCaches& caches,
         }}
                       : Cache::CacheEntryCreator{[]() -> Cache::CacheEntryPtr {
                           return std::make_unique<Cache::HttpCacheEntry>();
-                        }});
+                        }},
+        previous_caches.empty() ? nullptr : Cache::InvalidationCallback{std::move(invalidation)});
     if (!cache) {
       ENVOY_LOG(error, "Error get cache implemention for cache: {}", name);
       continue;
     }
     used_caches_.push_back({std::string(name), std::move(cache)});
   }
+  initLookup(context, lookup_policy);
+}
+
+CacheGetterSetterConfig::CacheGetterSetterConfig(CacheList caches,
+                                                 Server::Configuration::FactoryContext& context,
+                                                 const LookupPolicy& lookup_policy)
+    : used_caches_(std::move(caches)), lookup_mode_(lookup_policy.mode()),
+      hedge_delay_(PROTOBUF_GET_MS_OR_DEFAULT(lookup_policy, hedge_delay, DEFAULT_HEDGE_DELAY_MS)),
+      time_source_(context.timeSource()) {
+  initLookup(context, lookup_policy);
+}
+
+void CacheGetterSetterConfig::initLookup(Server::Configuration::FactoryContext& context,
+                                         const LookupPolicy& lookup_policy) {
+  tier_stats_.reserve(used_caches_.size());
+  for (const auto& cache : used_caches_) {
+    const std::string prefix = absl::StrCat("cache_lookup.", cache.first, ".");
+    tier_stats_.push_back({ALL_CACHE_TIER_STATS(POOL_COUNTER_PREFIX(context.scope(), prefix),
+                                                POOL_HISTOGRAM_PREFIX(context.scope(), prefix))});
+  }
+
+  // Promotions are limited on every worker, so the limit does not need any lock.
+  if (lookup_policy.has_promotion() && used_caches_.size() > 1) {
+    const auto& promotion = lookup_policy.promotion();
+    const uint32_t per_second =
+        PROTOBUF_GET_WRAPPED_OR_DEFAULT(promotion, max_per_second, DEFAULT_PROMOTION_PER_SECOND);
+    min_remaining_ttl_ = std::chrono::milliseconds(PROTOBUF_GET_MS_OR_DEFAULT(
+        promotion, min_remaining_ttl, DEFAULT_PROMOTION_MIN_REMAINING_TTL_MS));
+    promotion_bucket_ = std::make_unique<Common::TheadLocalTokenBucket>(
+        context.getServerFactoryContext(),
+        PROTOBUF_GET_WRAPPED_OR_DEFAULT(promotion, burst, per_second), per_second);
+  }
+
+  // Timers of the hedged lookups and the promotions are created by the dispatcher of the worker.
+  if (lookup_mode_ == LookupPolicy::HEDGED || promotionEnabled()) {
+    tls_slot_ = context.threadLocal().allocateSlot();
+    tls_slot_->set([](Event::Dispatcher& dispatcher) {
+      return std::make_shared<ThreadLocalDispatcher>(dispatcher);
+    });
+  }
+}
+
+CacheTTLRules::CacheTTLRules(const ProtoTTL& config) : default_ttl_(config.default_()) {
+  // Patterns of the map are unordered and they are sorted to make the result stable.
+  const std::map<std::string, uint64_t> customs(config.customs().begin(), config.customs().end());
+
+  re2::RE2::Options options;
+  options.set_log_errors(false);
+  auto regexes = std::make_unique<re2::RE2::Set>(options, re2::RE2::ANCHOR_BOTH);
+  for (const auto& custom : customs) {
+    const absl::string_view pattern = custom.first;
+    if (isLiteral(pattern)) {
+      exacts_.emplace(pattern, custom.second);
+      continue;
+    }
+    if (absl::EndsWith(pattern, ".*") && isLiteral(pattern.substr(0, pattern.size() - 2))) {
+      prefixes_.emplace_back(pattern.substr(0, pattern.size() - 2), custom.second);
+      continue;
+    }
+    std::string error;
+    if (regexes->Add(re2::StringPiece(pattern.data(), pattern.size()), &error) < 0) {
+      throw EnvoyException(absl::StrCat("Invalid custom TTL pattern '", pattern, "': ", error));
+    }
+    regex_ttls_.push_back(custom.second);
+  }
+  std::stable_sort(prefixes_.begin(), prefixes_.end(), [](const auto& a, const auto& b) {
+    return a.first.size() > b.first.size();
+  });
+  if (!regex_ttls_.empty()) {
+    if (!regexes->Compile()) {
+      throw EnvoyException("Failed to compile custom TTL patterns");
+    }
+    regexes_ = std::move(regexes);
+  }
+}
+
+uint64_t CacheTTLRules::ttl(absl::string_view value) const {
+  if (auto exact = exacts_.find(value); exact != exacts_.end()) {
+    return exact->second;
+  }
+  for (const auto& prefix : prefixes_) {
+    if (absl::StartsWith(value, prefix.first)) {
+      return prefix.second;
+    }
+  }
+  if (regexes_ != nullptr) {
+    std::vector<int> matched;
+    if (regexes_->Match(re2::StringPiece(value.data(), value.size()), &matched)) {
+      return regex_ttls_[*std::min_element(matched.begin(), matched.end())];
+    }
+  }
+  return default_ttl_;
 }
 
 SpecificCacheConfig::SpecificCacheConfig(const KeyMakerConfig& key_maker,
                                          const std::map<std::string, ProtoTTL>& proto_ttls,
-                                         const std::string& prefix)
-    : cache_key_prefix_(prefix), key_maker_config_(key_maker) {
+                                         const std::string& prefix, uint64_t max_entry_size,
+                                         uint64_t stale_grace)
+    : cache_key_prefix_(prefix), key_builder_(key_maker, prefix), max_entry_size_(max_entry_size),
+      stale_grace_(stale_grace) {
 
   for (const auto& proto_ttl : proto_ttls) {
     std::string cache_name;
@@ -145,79 +410,203 @@ SpecificCacheConfig::SpecificCacheConfig(const KeyMakerConfig& key_maker,
     } else {
       cache_name = proto_ttl.first;
     }
-    cache_ttls_.insert({cache_name, std::pair<uint64_t, CustomsTTL>()});
-    auto& ttl = cache_ttls_[cache_name];
-    ttl.first = proto_ttl.second.default_();
-    for (auto& v : proto_ttl.second.customs()) {
-      ttl.second.push_back({std::regex(v.first), v.second});
-    }
+    cache_ttls_.insert_or_assign(cache_name, CacheTTLRules(proto_ttl.second));
   }
 }
 
-uint64_t SpecificCacheConfig::cacheTTL(std::string name, std::string code) const {
+uint64_t SpecificCacheConfig::cacheTTL(absl::string_view name, absl::string_view code) const {
   auto cache_ttl = cache_ttls_.find(name);
   if (cache_ttl == cache_ttls_.end()) {
     return 0;
   }
-  for (const auto& i : cache_ttl->second.second) {
-    if (std::regex_match(code, i.first)) {
-      return i.second; // custom
-    }
-  }
-  return cache_ttl->second.first; // default
+  return cache_ttl->second.ttl(code);
 }
 
 CacheGetterSetter::CacheGetterSetter(CacheGetterSetterConfig* config,
                                      const SpecificCacheConfig* route_config)
-    : used_caches_(config->usedCaches()), route_config_(route_config) {}
+    : config_(*config), used_caches_(config->usedCaches()), route_config_(route_config) {}
 
 CacheLookupStatus CacheGetterSetter::lookupCache(CacheLookupCallback* callback) {
   if (used_caches_.empty() || callback == nullptr || !has_cache_key_) {
     return CacheLookupStatus::FAILED;
   }
   callback_ = callback;
+  tiers_.resize(used_caches_.size());
 
-  auto keep_self_live = shared_from_this();
-  lookupCacheOnce(std::move(keep_self_live));
+  resolveLookup(shared_from_this());
 
   return CacheLookupStatus::ONCALL;
 }
 
-void CacheGetterSetter::lookupCacheOnce(CacheGetterSetterSharedPtr keep_self_live) {
-  if (lookup_cache_over_ || lookup_cache_stop_ || !callback_) {
+void CacheGetterSetter::resolveLookup(const CacheGetterSetterSharedPtr& keep_self_live) {
+  // Caches that complete the lookup inline are tried in the same call stack. The loop only stops
+  // when the lookup is over or the first unresolved cache is pending.
+  while (true) {
+    if (!lookupActive()) {
+      return;
+    }
+    while (first_unresolved_ < tiers_.size() &&
+           tiers_[first_unresolved_].state_ == TierState::Miss) {
+      first_unresolved_++;
+    }
+    if (first_unresolved_ >= tiers_.size()) {
+      lookup_cache_stop_ = true;
+      hedge_timer_.reset();
+      callback_->onFailure();
+      callback_ = nullptr;
+      return;
+    }
+
+    const auto state = tiers_[first_unresolved_].state_;
+    if (state == TierState::Hit) {
+      onCacheHit(first_unresolved_);
+      return;
+    }
+    if (state == TierState::Pending) {
+      break;
+    }
+    // All caches before it miss.
+    ASSERT(first_unresolved_ == next_tier_);
+    lookupNextTier(keep_self_live);
+  }
+
+  switch (config_.lookupMode()) {
+  case LookupPolicy::PARALLEL:
+    while (next_tier_ < tiers_.size() && !later_hit_) {
+      lookupNextTier(keep_self_live);
+    }
+    break;
+  case LookupPolicy::HEDGED:
+    if (next_tier_ < tiers_.size() && !later_hit_ &&
+        (hedge_timer_ == nullptr || !hedge_timer_->enabled())) {
+      if (hedge_timer_ == nullptr) {
+        hedge_timer_ = config_.dispatcher().createTimer([this]() { onHedgeTimeout(); });
+      }
+      hedge_timer_->enableTimer(config_.hedgeDelay());
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void CacheGetterSetter::lookupNextTier(const CacheGetterSetterSharedPtr& keep_self_live) {
+  const size_t index = next_tier_++;
+  auto& tier = tiers_[index];
+  tier.state_ = TierState::Pending;
+  tier.start_ = config_.timeSource().monotonicTime();
+  config_.tierStats(index).lookup_.inc();
+
+  auto inline_result = used_caches_[index].second->lookupCacheInline(cache_key_);
+  if (inline_result.has_value()) {
+    onTierResult(index, std::move(inline_result.value()));
+    return;
+  }
+
+  auto cache_lookup_callback = [self = keep_self_live, this,
+                                index](std::string, Cache::CacheEntryPtr&& entry) {
+    // The request may be aborted externally while waiting for the callback function to be called,
+    // and then the result is only counted.
+    onTierResult(index, std::move(entry));
+    resolveLookup(self);
+  };
+  used_caches_[index].second->lookupCache(cache_key_, cache_lookup_callback);
+}
+
+void CacheGetterSetter::onTierResult(size_t index, Cache::CacheEntryPtr&& entry) {
+  auto& stats = config_.tierStats(index);
+  auto& tier = tiers_[index];
+  stats.lookup_latency_.recordValue(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        config_.timeSource().monotonicTime() - tier.start_)
+                                        .count());
+  if (entry == nullptr) {
+    stats.miss_.inc();
+    tier.state_ = TierState::Miss;
     return;
   }
-  if (current_cache_ >= used_caches_.size()) {
-    lookup_cache_stop_ = true;
-    callback_->onFailure();
-    callback_ = nullptr;
+  stats.hit_.inc();
+  if (!lookupActive()) {
+    stats.discarded_.inc();
+    tier.state_ = TierState::Miss;
     return;
   }
+  tier.state_ = TierState::Hit;
+  tier.entry_ = std::move(entry);
+  later_hit_ = later_hit_ || index > first_unresolved_;
+}
 
-  auto cache_lookup_callback = [self = std::move(keep_self_live),
-                                this](std::string, Cache::CacheEntryPtr&& entry) {
-    // The request may be aborted externally while waiting for the callback function to be called.
-    if (lookup_cache_over_ || lookup_cache_stop_ || !callback_) {
-      return;
-    }
-    if (entry == nullptr) {
-      // Try to lookup cache entry in the next cache.
-      current_cache_++;
-      lookupCacheOnce(std::move(self));
-      return;
+void CacheGetterSetter::onHedgeTimeout() {
+  if (!lookupActive() || next_tier_ >= tiers_.size() || later_hit_) {
+    return;
+  }
+  ENVOY_LOG(trace, "Hedge lookup of {} in cache: {}", cache_key_, used_caches_[next_tier_].first);
+  auto keep_self_live = shared_from_this();
+  lookupNextTier(keep_self_live);
+  resolveLookup(keep_self_live);
+}
+
+void CacheGetterSetter::onCacheHit(size_t index) {
+  hit_in_cache_ = index;
+  lookup_cache_over_ = true;
+  hedge_timer_.reset();
+
+  // Hits of the later caches are dropped. Pending lookups are discarded when they complete.
+  for (size_t i = index + 1; i < tiers_.size(); i++) {
+    if (tiers_[i].state_ == TierState::Hit) {
+      config_.tierStats(i).discarded_.inc();
+      tiers_[i].entry_.reset();
     }
-    // Hit in the current cache.
-    hit_in_cache_ = current_cache_;
-    lookup_cache_over_ = true;
+  }
+  auto entry = std::move(tiers_[index].entry_);
+  if (index > 0 && config_.promotionEnabled()) {
+    entry = promoteEntry(index, std::move(entry));
+  }
 
-    callback_->onSuccess(std::move(entry));
-    callback_ = nullptr;
-  };
+  callback_->onSuccess(std::move(entry));
+  callback_ = nullptr;
+}
 
-  used_caches_[current_cache_].second->lookupCache(cache_key_, cache_lookup_callback);
+Cache::CacheEntryPtr CacheGetterSetter::promoteEntry(size_t index, Cache::CacheEntryPtr&& entry) {
+  auto& stats = config_.tierStats(index);
+
+  // The expire time is kept, so the promoted entries never outlive the entry of this cache.
+  const uint64_t expire = entry->cacheExpire();
+  const uint64_t now = Proxy::Common::Common::TimeUtil::createTimestamp();
+  if (expire == 0 || expire < now + config_.minRemainingTTL().count()) {
+    stats.promotion_skipped_.inc();
+    return std::move(entry);
+  }
+  if (!config_.acquirePromotion()) {
+    stats.promotion_throttled_.inc();
+    return std::move(entry);
+  }
+  stats.promoted_.inc();
+  ENVOY_LOG(trace, "Promote entry: {} from cache: {}", cache_key_, used_caches_[index].first);
+
+  // The response and all promoted entries share the body of the sealed entry.
+  entry->seal();
+  auto response = entry->createCopy();
+  Cache::CacheEntryConstSharedPtr sealed = std::move(entry);
+
+  std::vector<std::weak_ptr<Cache::CommonCacheBase>> caches;
+  for (size_t i = 0; i < index; i++) {
+    caches.push_back(used_caches_[i].second);
+  }
+  config_.dispatcher().post([caches = std::move(caches), sealed, key = cache_key_, expire]() {
+    for (const auto& weak_cache : caches) {
+      auto cache = weak_cache.lock();
+      auto entry_copy = sealed->createCopy();
+      if (cache == nullptr || entry_copy == nullptr) {
+        continue;
+      }
+      entry_copy->cacheExpire(expire);
+      cache->insertCache(key, std::move(entry_copy));
+    }
+  });
+  return response;
 }
 
-void CacheGetterSetter::insertCache(Cache::CacheEntryPtr&& entry, std::string key_for_ttl) {
+bool CacheGetterSetter::insertCache(Cache::CacheEntryPtr&& entry, std::string key_for_ttl) {
   ASSERT(has_cache_key_);
   ASSERT(hit_in_cache_ < int32_t(used_caches_.size()));
 
@@ -225,6 +614,9 @@ void CacheGetterSetter::insertCache(Cache::CacheEntryPtr&& entry, std::string ke
 
   uint64_t current_timpestamp = Proxy::Common::Common::TimeUtil::createTimestamp();
 
+  // All caches share the body of the sealed entry and only the headers are copied.
+  entry->seal();
+  bool inserted = false;
   for (int32_t i = 0; i < insert_number; i++) {
     // Except for the last insertion, a copy of the cache entry must be created.
     auto entry_copy = i == insert_number - 1 ? std::move(entry) : entry->createCopy();
@@ -235,10 +627,13 @@ void CacheGetterSetter::insertCache(Cache::CacheEntryPtr&& entry, std::string ke
       continue;
     }
 
-    entry_copy->cacheExpire(current_timpestamp + lifetime);
+    // Entries are kept for the stale grace period after their TTL.
+    entry_copy->cacheExpire(current_timpestamp + lifetime + route_config_->staleGrace());
     ENVOY_LOG(trace, "Insert entry: {} to cache: {}", cache_key_, used_caches_[i].first);
     used_caches_[i].second->insertCache(cache_key_, std::move(entry_copy));
+    inserted = true;
   }
+  return inserted;
 }
 
 void CacheGetterSetter::removeCache() {
@@ -280,6 +675,7 @@ void CacheRequestSender::onSuccess(Cache::CacheEntryPtr&& entry) {
 
   ENVOY_LOG(debug, "'{}/{}' hit in {}", cache_key_, request_stream_id_,
             used_caches_[hit_in_cache_].first);
+  hit_cache_expire_ = http_result->cacheExpire();
   origin_callback_->onSuccess(*this, std::move(http_result->cacheMessage()));
   callback_ = nullptr;
 }
@@ -291,22 +687,47 @@ void CacheRequestSender::onFailure() {
   origin_callback_ = nullptr;
 }
 
-void CacheRequestSender::insertResponse(const Cache::CacheKeyType& cache_key,
+bool CacheRequestSender::acceptResponse(const Cache::CacheKeyType& cache_key,
+                                        const Envoy::Http::ResponseMessage& message) {
+  setCacheKey(cache_key);
+
+  const uint64_t message_size = message.headers().byteSize() + message.body().length();
+  if (route_config_ == nullptr || message_size > route_config_->maxEntrySize()) {
+    ENVOY_LOG(debug, "Skip caching '{}/{}' of {} bytes.", cache_key_, request_stream_id_,
+              message_size);
+    return false;
+  }
+  return true;
+}
+
+bool CacheRequestSender::insertResponse(const Cache::CacheKeyType& cache_key,
                                         Envoy::Http::ResponseMessagePtr&& message) {
   ASSERT(message != nullptr);
+  if (!acceptResponse(cache_key, *message)) {
+    return false;
+  }
 
-  setCacheKey(cache_key);
+  const std::string status(message->headers().getStatusValue());
+  return insertCache(std::make_unique<Cache::HttpCacheEntry>(std::move(message), 0), status);
+}
 
-  static constexpr size_t MAX_CACHE_ENTRY_SIZE = 512 * 1024; // 512 KB
-  size_t message_size = message->headers().byteSize() + message->body().length();
-  if (message_size > MAX_CACHE_ENTRY_SIZE) {
-    return;
+Cache::CacheEntryConstSharedPtr
+CacheRequestSender::insertSharedResponse(const Cache::CacheKeyType& cache_key,
+                                         Envoy::Http::ResponseMessagePtr&& message) {
+  ASSERT(message != nullptr);
+  if (!acceptResponse(cache_key, *message)) {
+    return nullptr;
   }
 
-  auto status = message->headers().getStatusValue();
+  const std::string status(message->headers().getStatusValue());
 
-  auto entry = std::make_unique<Cache::HttpCacheEntry>(std::move(message), 0);
-  insertCache(std::move(entry), std::string(status));
+  // The caches get copies and the sealed entry is kept for the caller.
+  auto entry = std::make_shared<Cache::HttpCacheEntry>(std::move(message), 0);
+  entry->seal();
+  if (!insertCache(entry->createCopy(), status)) {
+    return nullptr;
+  }
+  return entry;
 }
 
 void CacheRequestSender::removeResponse(const Cache::CacheKeyType& cache_key) {
@@ -1,16 +1,24 @@
 #pragma once
 
-#include <regex>
+#include <chrono>
 
+#include "envoy/common/time.h"
+#include "envoy/event/timer.h"
 #include "envoy/registry/registry.h"
 #include "envoy/server/factory_context.h"
+#include "envoy/stats/stats_macros.h"
+#include "envoy/thread_local/thread_local.h"
 
 #include "source/common/cache/cache_base.h"
 #include "source/common/common/empty_string.h"
+#include "source/common/common/token_bucket.h"
 #include "source/common/http/message_impl.h"
 #include "source/common/http/path_utility.h"
 #include "source/common/sender/request_sender.h"
 
+#include "absl/container/flat_hash_map.h"
+#include "re2/set.h"
+
 namespace Envoy {
 namespace Proxy {
 namespace Common {
@@ -18,6 +26,8 @@ namespace Sender {
 
 using KeyMakerConfig = proxy::common::cache_api::v3::HttpCacheKeyMaker;
 using ProtoTTL = proxy::common::cache_api::v3::CacheTTL;
+using LookupPolicy = proxy::common::cache_api::v3::LookupPolicy;
+using PromotionPolicy = proxy::common::cache_api::v3::PromotionPolicy;
 
 using ProtoCaches = google::protobuf::RepeatedPtrField<Cache::ProtoCache>;
 
@@ -41,6 +51,29 @@ enum class CacheLookupStatus {
   ONCALL,
 };
 
+/**
+ * Builder of the cache keys of requests. The selected parts of the request are fed into an
+ * incremental hash one by one, so the raw key is never built and only the final key is allocated.
+ */
+class HttpCacheKeyBuilder {
+public:
+  HttpCacheKeyBuilder(const KeyMakerConfig& config, const std::string& prefix);
+
+  Cache::CacheKeyType build(const Envoy::Http::RequestHeaderMap& headers) const;
+
+private:
+  template <class Hasher>
+  Cache::CacheKeyType build(const Envoy::Http::RequestHeaderMap& headers) const;
+
+  const std::string prefix_;
+  const bool exclude_path_{false};
+  const bool exclude_host_{false};
+  const bool ignore_case_{false};
+  const KeyMakerConfig::Hash hash_{KeyMakerConfig::MD5};
+  std::vector<std::string> query_params_;
+  std::vector<Envoy::Http::LowerCaseString> header_keys_;
+};
+
 class HttpCacheUtil {
 public:
   static Cache::CacheKeyType cacheKey(const KeyMakerConfig& config,
@@ -48,37 +81,124 @@ public:
                                       const std::string& prefix);
 };
 
+#define ALL_CACHE_TIER_STATS(COUNTER, HISTOGRAM)                                                  \
+  COUNTER(lookup)                                                                                  \
+  COUNTER(hit)                                                                                     \
+  COUNTER(miss)                                                                                    \
+  COUNTER(discarded)                                                                               \
+  COUNTER(promoted)                                                                                \
+  COUNTER(promotion_skipped)                                                                       \
+  COUNTER(promotion_throttled)                                                                     \
+  HISTOGRAM(lookup_latency, Milliseconds)
+
+/**
+ * Wrapper struct for the lookup stats of one cache. Results that arrive after the lookup is over
+ * are also counted as discarded. Promotions are counted by the cache that is hit. @see
+ * stats_macros.h
+ */
+struct CacheTierStats {
+  ALL_CACHE_TIER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_HISTOGRAM_STRUCT)
+};
+
 class CacheGetterSetterConfig : public Logger::Loggable<Logger::Id::client> {
 public:
-  using CacheList = std::vector<std::pair<std::string, Cache::CommonCacheBasePtr>>;
+  // Caches are shared with the invalidation callbacks of the caches after them.
+  using CacheList = std::vector<std::pair<std::string, Cache::CommonCacheBaseSharedPtr>>;
 
   CacheGetterSetterConfig(const ProtoCaches&, Server::Configuration::FactoryContext&,
-                          bool request_cache = false);
+                          bool request_cache = false,
+                          const LookupPolicy& lookup_policy = LookupPolicy());
+  // Use the caches as they are.
+  CacheGetterSetterConfig(CacheList caches, Server::Configuration::FactoryContext&,
+                          const LookupPolicy& lookup_policy = LookupPolicy());
 
   CacheList& usedCaches() { return used_caches_; }
 
+  LookupPolicy::Mode lookupMode() const { return lookup_mode_; }
+  std::chrono::milliseconds hedgeDelay() const { return hedge_delay_; }
+  CacheTierStats& tierStats(size_t index) { return tier_stats_[index]; }
+  TimeSource& timeSource() { return time_source_; }
+
+  bool promotionEnabled() const { return promotion_bucket_ != nullptr; }
+  std::chrono::milliseconds minRemainingTTL() const { return min_remaining_ttl_; }
+  // Take a promotion token of the current worker. Return false if the rate limit is reached.
+  bool acquirePromotion() { return promotion_bucket_->consume(1, false) == 1; }
+
+  // Dispatcher of the current worker. Only available in the HEDGED mode or if the promotion is
+  // enabled.
+  Event::Dispatcher& dispatcher() {
+    return tls_slot_->getTyped<ThreadLocalDispatcher>().dispatcher_;
+  }
+
 private:
+  void initLookup(Server::Configuration::FactoryContext& context,
+                  const LookupPolicy& lookup_policy);
+
+  struct ThreadLocalDispatcher : public ThreadLocal::ThreadLocalObject {
+    ThreadLocalDispatcher(Event::Dispatcher& dispatcher) : dispatcher_(dispatcher) {}
+    Event::Dispatcher& dispatcher_;
+  };
+
   CacheList used_caches_;
+
+  const LookupPolicy::Mode lookup_mode_{LookupPolicy::SEQUENTIAL};
+  const std::chrono::milliseconds hedge_delay_;
+  std::vector<CacheTierStats> tier_stats_;
+  TimeSource& time_source_;
+  std::chrono::milliseconds min_remaining_ttl_{0};
+  std::unique_ptr<Common::TheadLocalTokenBucket> promotion_bucket_;
+  ThreadLocal::SlotPtr tls_slot_;
+};
+
+/**
+ * TTL rules of a cache. Patterns of the custom TTLs are fully matched. Patterns without special
+ * characters and literal prefixes followed by ".*" are matched without any regex, and the others
+ * are compiled into one RE2::Set. If multiple patterns match, exact patterns win over prefixes,
+ * longer prefixes over shorter ones, and prefixes over regexes. Regexes are ordered by pattern.
+ */
+class CacheTTLRules {
+public:
+  explicit CacheTTLRules(const ProtoTTL& config);
+
+  uint64_t ttl(absl::string_view value) const;
+
+private:
+  uint64_t default_ttl_{0};
+  absl::flat_hash_map<std::string, uint64_t> exacts_;
+  // Longest prefix first.
+  std::vector<std::pair<std::string, uint64_t>> prefixes_;
+  std::unique_ptr<re2::RE2::Set> regexes_;
+  std::vector<uint64_t> regex_ttls_;
 };
 
 class SpecificCacheConfig : public Logger::Loggable<Logger::Id::config> {
 public:
+  static constexpr uint64_t DefaultMaxEntrySize = 512 * 1024;
+
   SpecificCacheConfig(const KeyMakerConfig&, const std::map<std::string, ProtoTTL>&,
-                      const std::string& prefix = "v1");
+                      const std::string& prefix = "v1",
+                      uint64_t max_entry_size = DefaultMaxEntrySize, uint64_t stale_grace = 0);
 
-  uint64_t cacheTTL(std::string name, std::string code) const;
+  // TTL of the cache for the status code. Zero if the cache has no TTL.
+  uint64_t cacheTTL(absl::string_view name, absl::string_view code) const;
+
+  // Responses whose headers and body are larger than the size are never cached.
+  uint64_t maxEntrySize() const { return max_entry_size_; }
+
+  // Entries are kept in the caches for the milliseconds after their TTL to be served stale.
+  uint64_t staleGrace() const { return stale_grace_; }
 
   Cache::CacheKeyType cacheKey(Envoy::Http::RequestHeaderMap& headers) const {
-    return HttpCacheUtil::cacheKey(key_maker_config_, headers, cache_key_prefix_);
+    return key_builder_.build(headers);
   }
 
 private:
-  using CustomsTTL = std::vector<std::pair<std::regex, uint64_t>>;
-
-  std::map<std::string, std::pair<uint64_t, CustomsTTL>> cache_ttls_{};
+  absl::flat_hash_map<std::string, CacheTTLRules> cache_ttls_{};
 
   const std::string cache_key_prefix_{};
-  const KeyMakerConfig key_maker_config_{};
+  const HttpCacheKeyBuilder key_builder_;
+  const uint64_t max_entry_size_{DefaultMaxEntrySize};
+  const uint64_t stale_grace_{0};
 };
 
 using SpecificCacheConfigPtr = std::unique_ptr<SpecificCacheConfig>;
@@ -109,18 +229,44 @@ public:
   void cancelLookup() override {
     lookup_cache_stop_ = true;
     callback_ = nullptr;
+    hedge_timer_.reset();
   }
 
+  // If the lookup can be completed inline, the callback is called before this method returns.
   CacheLookupStatus lookupCache(CacheLookupCallback*);
-  void insertCache(Cache::CacheEntryPtr&& entry, std::string key_for_ttl);
+  // Returns false if the entry is inserted into no cache.
+  bool insertCache(Cache::CacheEntryPtr&& entry, std::string key_for_ttl);
   void removeCache();
 
   const std::string& reqeustHitInCache() const {
     return hit_in_cache_ == -1 ? EMPTY_STRING : used_caches_[hit_in_cache_].first;
   }
 
+  // Forget the hit, e.g. a stale hit that is sent to upstream, so the response is inserted into all
+  // caches instead of only the caches before the hit one.
+  void treatAsMiss() { hit_in_cache_ = -1; }
+
 protected:
-  void lookupCacheOnce(CacheGetterSetterSharedPtr keep_self_live);
+  enum class TierState { Idle, Pending, Miss, Hit };
+
+  struct TierLookup {
+    TierState state_{TierState::Idle};
+    Cache::CacheEntryPtr entry_;
+    MonotonicTime start_;
+  };
+
+  // Decide the result by the tiers in the configured order and start the lookups that the policy
+  // allows. Tiers are always started in order.
+  void resolveLookup(const CacheGetterSetterSharedPtr& keep_self_live);
+  // Start the lookup of the next idle tier. Lookups that complete inline are recorded directly.
+  void lookupNextTier(const CacheGetterSetterSharedPtr& keep_self_live);
+  void onTierResult(size_t index, Cache::CacheEntryPtr&& entry);
+  void onHedgeTimeout();
+  void onCacheHit(size_t index);
+  // Insert the hit of the cache into the caches before it in the next event loop iteration. The
+  // returned entry is passed to the callback.
+  Cache::CacheEntryPtr promoteEntry(size_t index, Cache::CacheEntryPtr&& entry);
+  bool lookupActive() const { return !lookup_cache_over_ && !lookup_cache_stop_ && callback_; }
 
   bool has_cache_key_{false};
   Cache::CacheKeyType cache_key_;
@@ -129,9 +275,17 @@ protected:
   bool lookup_cache_stop_{false};
   int32_t hit_in_cache_{-1};
 
-  uint32_t current_cache_{0};
+  std::vector<TierLookup> tiers_;
+  // Next tier to start.
+  uint32_t next_tier_{0};
+  // First tier that has not missed.
+  uint32_t first_unresolved_{0};
+  // Some started tier after the first unresolved one has hit, so no more tiers are needed.
+  bool later_hit_{false};
+  Event::TimerPtr hedge_timer_;
 
   CacheLookupCallback* callback_{nullptr};
+  CacheGetterSetterConfig& config_;
   CacheGetterSetterConfig::CacheList& used_caches_;
   const SpecificCacheConfig* route_config_{};
 };
@@ -148,13 +302,24 @@ public:
   SendRequestStatus sendRequest(Envoy::Http::RequestMessagePtr&&,
                                 Envoy::Http::AsyncClient::Callbacks*) override;
 
-  void insertResponse(const Cache::CacheKeyType& key_for_no_request,
+  // The response is moved into the caches. Returns false if it is inserted into no cache.
+  bool insertResponse(const Cache::CacheKeyType& key_for_no_request,
                       Envoy::Http::ResponseMessagePtr&&);
 
+  // Returns the sealed entry of the response, which may be shared with other threads, or nullptr if
+  // the response is inserted into no cache. It costs one more copy of the headers than
+  // insertResponse.
+  Cache::CacheEntryConstSharedPtr
+  insertSharedResponse(const Cache::CacheKeyType& key_for_no_request,
+                       Envoy::Http::ResponseMessagePtr&&);
+
   void removeResponse(const Cache::CacheKeyType& key_for_no_request);
 
   void setStreamId(uint64_t stream_id) { request_stream_id_ = std::to_string(stream_id); }
 
+  // Expire time of the hit entry, including the stale grace period. Zero if it is unknown.
+  uint64_t hitCacheExpire() const { return hit_cache_expire_; }
+
   // CacheLookupCallback
   void onSuccess(Cache::CacheEntryPtr&& entry) override;
   void onFailure() override;
@@ -162,8 +327,13 @@ public:
   void cancel() override { cancelLookup(); }
 
 private:
+  // Set the cache key and check whether the response is small enough to be cached.
+  bool acceptResponse(const Cache::CacheKeyType& cache_key,
+                      const Envoy::Http::ResponseMessage& message);
+
   // For debugging.
   std::string request_stream_id_{"-"};
+  uint64_t hit_cache_expire_{0};
   Envoy::Http::AsyncClient::Callbacks* origin_callback_{nullptr};
 };
 
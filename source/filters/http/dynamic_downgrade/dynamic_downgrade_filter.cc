@@ -48,7 +48,7 @@ DynamicDowngradeCommonConfig::DynamicDowngradeCommonConfig(
 
   if (!config.used_caches().empty()) {
     used_caches_ = std::make_shared<Proxy::Common::Sender::CacheGetterSetterConfig>(
-        config.used_caches(), context_);
+        config.used_caches(), context_, false, config.lookup_policy());
   }
   if (config.has_used_remote()) {
     const uint32_t timeout_ms =
@@ -285,6 +285,11 @@ HttpDynamicDowngradeFilter::encodeHeaders(Http::ResponseHeaderMap& headers, bool
     is_sending_request_ = true;
     return headers_only_resp_ ? Http::FilterHeadersStatus::StopIteration
                               : Http::FilterHeadersStatus::StopAllIterationAndBuffer;
+  } else if (local_response_ != nullptr) {
+    // 降级响应在本地缓存中直接命中，无需暂停插件链。
+    ENVOY_LOG(debug, "Downgrade response is hit in local cache");
+    applyDowngradeResponse(std::move(local_response_));
+    return Http::FilterHeadersStatus::Continue;
   } else {
     ENVOY_LOG(debug, "Failed to send downgrade request to remote");
     downgrade_suspend_ = true;
@@ -327,13 +332,21 @@ Http::FilterDataStatus HttpDynamicDowngradeFilter::encodeData(Buffer::Instance&
 void HttpDynamicDowngradeFilter::onSuccess(const Http::AsyncClient::Request&,
                                            Http::ResponseMessagePtr&& response) {
   if (!is_sending_request_) {
-    // 在创建异步请求的过程中直接完成请求并调用 onSuccess，即异步请求未发出。此时不做任何操作
-    // 直接返回。
+    // 在创建异步请求的过程中直接完成请求并调用 onSuccess，即异步请求未发出。如果是本地缓存命中，
+    // 则保存响应并在 encodeHeaders 中直接使用，否则不做任何操作直接返回。
     local_request_over_ = true;
+    if (router_config_->downgradeWithCache()) {
+      local_response_ = std::move(response);
+    }
     return;
   }
 
   is_sending_request_ = false;
+  applyDowngradeResponse(std::move(response));
+  encoder_callbacks_->continueEncoding();
+}
+
+void HttpDynamicDowngradeFilter::applyDowngradeResponse(Http::ResponseMessagePtr&& response) {
   auto& header = response->headers();
   ENVOY_LOG(trace, "Remote response headers:\n{}", header);
 
@@ -347,8 +360,6 @@ void HttpDynamicDowngradeFilter::onSuccess(const Http::AsyncClient::Request&,
 
   downgrade_complete_ ? encoder_callbacks_->addEncodedData(response->body(), false)
                       : buffered_rpx_body_.move(response->body());
-
-  encoder_callbacks_->continueEncoding();
 }
 
 void HttpDynamicDowngradeFilter::onFailure(const Http::AsyncClient::Request&,
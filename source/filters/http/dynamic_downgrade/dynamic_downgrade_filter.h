@@ -114,6 +114,9 @@ public:
   }
 
 private:
+  // 使用降级响应替换原始响应头，并保存或者添加降级响应体。
+  void applyDowngradeResponse(Http::ResponseMessagePtr&& response);
+
   Http::RequestHeaderMap* rqx_headers_{nullptr};
   Http::ResponseHeaderMap* rpx_headers_{nullptr};
 
@@ -135,6 +138,8 @@ private:
 
   bool is_sending_request_{false}; // 降级请求正在进行当中
   bool local_request_over_{false}; // 降级请求在本地直接完成
+  // 降级请求在本地缓存中直接命中时的响应
+  Http::ResponseMessagePtr local_response_{nullptr};
 
   Proxy::Common::Sender::RequestSenderSharedPtr request_sender_{};
 
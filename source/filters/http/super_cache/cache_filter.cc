@@ -6,16 +6,28 @@
 
 #include "envoy/registry/registry.h"
 #include "envoy/server/admin.h"
+#include "envoy/upstream/cluster_manager.h"
 
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/cache/gzip_body_codec.h"
+#include "source/common/cache/http_cache_entry.h"
 #include "source/common/common/hex.h"
+#include "source/common/common/macros.h"
 #include "source/common/common/proxy_utility.h"
+#include "source/common/http/codes.h"
 #include "source/common/http/header_utility.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/proxy_header.h"
 #include "source/common/http/utility.h"
 #include "source/common/json/json_loader.h"
+#include "source/common/protobuf/utility.h"
 
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "openssl/md5.h"
 
@@ -42,6 +54,186 @@ bool isCacheableResponse(Http::ResponseHeaderMap& headers) {
   return true;
 }
 
+constexpr uint32_t DefaultCompressionMinSize = 1024;
+constexpr uint64_t DefaultCoalescingTimeoutMs = 3000;
+// Timeouts of refreshes of stale entries. Routes without a timeout use the coalescing timeout or
+// the default, and longer timeouts are capped since the refresh blocks other refreshes of the key.
+constexpr uint64_t DefaultStaleRefreshTimeoutMs = 3000;
+constexpr uint64_t MaxStaleRefreshTimeoutMs = 30000;
+// Limit of decompressed bodies. Cached bodies are much smaller and larger ones must be broken.
+constexpr uint64_t MaxDecompressedSize = 16 * 1024 * 1024;
+
+// Whether gzip is accepted by the Accept-Encoding header. An explicit gzip coding takes precedence
+// over "*" wherever they appear. Codings with q=0 or an invalid q-value are not accepted.
+bool acceptsGzip(const Http::RequestHeaderMap& headers) {
+  absl::optional<bool> gzip;
+  absl::optional<bool> any;
+  const auto accept_encoding = headers.get(Http::CustomHeaders::get().AcceptEncoding);
+  for (size_t i = 0; i < accept_encoding.size(); i++) {
+    for (absl::string_view coding :
+         absl::StrSplit(accept_encoding[i]->value().getStringView(), ',')) {
+      std::vector<absl::string_view> params = absl::StrSplit(coding, ';');
+      const absl::string_view name = absl::StripAsciiWhitespace(params[0]);
+      const bool is_gzip =
+          absl::EqualsIgnoreCase(name, Http::CustomHeaders::get().ContentEncodingValues.Gzip);
+      if (!is_gzip && name != "*") {
+        continue;
+      }
+      double quality = 1;
+      for (size_t j = 1; j < params.size(); j++) {
+        const absl::string_view param = absl::StripAsciiWhitespace(params[j]);
+        if (absl::StartsWithIgnoreCase(param, "q=") &&
+            !absl::SimpleAtod(param.substr(2), &quality)) {
+          quality = 0;
+        }
+      }
+      if (is_gzip) {
+        gzip = quality > 0;
+      } else {
+        any = quality > 0;
+      }
+    }
+  }
+  return gzip.value_or(any.value_or(false));
+}
+
+bool isGzipEncoded(const Http::ResponseHeaderMap& headers) {
+  const auto content_encoding = headers.get(Http::CustomHeaders::get().ContentEncoding);
+  if (content_encoding.empty()) {
+    return false;
+  }
+  return absl::EqualsIgnoreCase(
+      absl::StripAsciiWhitespace(content_encoding[0]->value().getStringView()),
+      Http::CustomHeaders::get().ContentEncodingValues.Gzip);
+}
+
+// Internal header of the entries whose bodies are compressed by the filter. It is stored with the
+// entries, so they are decompressed for clients without gzip whatever the current route config
+// is, and it is never sent to clients.
+const Http::LowerCaseString& compressedByCacheHeader() {
+  CONSTRUCT_ON_FIRST_USE(Http::LowerCaseString, "x-super-cache-compressed");
+}
+
+// Compress the body and update the headers as the compressor filter does. The response is kept as
+// it is if the body cannot be compressed smaller.
+void compressResponse(Http::ResponseMessage& response) {
+  Buffer::OwnedImpl compressed;
+  if (!Proxy::Common::Cache::GzipBodyCodec::compress(response.body(), compressed) ||
+      compressed.length() >= response.body().length()) {
+    return;
+  }
+  response.body().drain(response.body().length());
+  response.body().move(compressed);
+
+  auto& headers = response.headers();
+  headers.setCopy(Http::CustomHeaders::get().ContentEncoding,
+                  Http::CustomHeaders::get().ContentEncodingValues.Gzip);
+  headers.setContentLength(response.body().length());
+  headers.setCopy(compressedByCacheHeader(),
+                  Http::CustomHeaders::get().ContentEncodingValues.Gzip);
+
+  // The compressed body is a different representation and a strong ETag is weakened.
+  const auto etag = headers.get(Http::CustomHeaders::get().Etag);
+  if (!etag.empty() && !absl::StartsWith(etag[0]->value().getStringView(), "W/")) {
+    headers.setCopy(Http::CustomHeaders::get().Etag,
+                    absl::StrCat("W/", etag[0]->value().getStringView()));
+  }
+
+  const auto vary = headers.get(Http::CustomHeaders::get().Vary);
+  if (vary.empty()) {
+    headers.setCopy(Http::CustomHeaders::get().Vary,
+                    Http::CustomHeaders::get().VaryValues.AcceptEncoding);
+  } else if (!StringUtil::caseFindToken(vary[0]->value().getStringView(), ",",
+                                        Http::CustomHeaders::get().VaryValues.AcceptEncoding)) {
+    headers.setCopy(Http::CustomHeaders::get().Vary,
+                    absl::StrCat(vary[0]->value().getStringView(), ", ",
+                                 Http::CustomHeaders::get().VaryValues.AcceptEncoding));
+  }
+}
+
+// Compress the response before it is cached if compression is enabled by the route.
+void compressResponseToCache(const RouteCacheConfig& route_config,
+                             Http::ResponseMessage& response) {
+  // The header of upstream never marks the body as compressed by the filter.
+  response.headers().remove(compressedByCacheHeader());
+  const auto& min_size = route_config.compressionMinSize();
+  if (min_size.has_value() && response.body().length() >= min_size.value() &&
+      response.headers().get(Http::CustomHeaders::get().ContentEncoding).empty()) {
+    compressResponse(response);
+  }
+}
+
+/**
+ * Background request that refreshes a stale entry. It is the leader of the cache key until the
+ * response is inserted, so only one refresh of a key is sent at a time and misses of the key wait
+ * for it. It deletes itself once the request is done. The caches and the coalescer may be destroyed
+ * with the listener before the request is done, so they are never kept alive by the refresher.
+ */
+class StaleRefresher : public Http::AsyncClient::Callbacks,
+                       public Logger::Loggable<Logger::Id::filter> {
+public:
+  StaleRefresher(Router::RouteConstSharedPtr route, const RouteCacheConfig& route_config,
+                 const Proxy::Common::Sender::CacheGetterSetterConfigSharedPtr& used_caches,
+                 RequestCoalescer::LeaderPtr&& leader, const std::string& cache_key)
+      : route_(std::move(route)), route_config_(route_config), used_caches_(used_caches),
+        leader_(std::move(leader)), cache_key_(cache_key) {}
+
+  // The refresher may be deleted before this method returns.
+  void send(Http::AsyncClient& client, Http::RequestMessagePtr&& request,
+            std::chrono::milliseconds timeout) {
+    client.send(std::move(request), *this, Http::AsyncClient::RequestOptions().setTimeout(timeout));
+  }
+
+  // Http::AsyncClient::Callbacks
+  void onSuccess(const Http::AsyncClient::Request&, Http::ResponseMessagePtr&& response) override {
+    auto used_caches = used_caches_.lock();
+    if (used_caches == nullptr) {
+      ENVOY_LOG(debug, "Caches of stale entry {} are destroyed", cache_key_);
+      leader_->finish(nullptr);
+      delete this;
+      return;
+    }
+
+    auto& headers = response->headers();
+    // Errors of upstream never replace the stale entry.
+    if (!Http::CodeUtility::is5xx(Http::Utility::getResponseStatus(headers)) &&
+        isCacheableResponse(headers) &&
+        route_config_.checkEnable(headers, RouteCacheConfig::Type::RP)) {
+      headers.removeEnvoyUpstreamServiceTime();
+      compressResponseToCache(route_config_, *response);
+      auto sender = std::make_shared<Proxy::Common::Sender::CacheRequestSender>(
+          used_caches.get(), route_config_.cacheConfig().get());
+      if (leader_->hasWaiters()) {
+        leader_->finish(sender->insertSharedResponse(cache_key_, std::move(response)));
+      } else {
+        sender->insertResponse(cache_key_, std::move(response));
+        leader_->finish(nullptr);
+      }
+    } else {
+      ENVOY_LOG(debug, "Stale entry {} is not refreshed by the response", cache_key_);
+      leader_->finish(nullptr);
+    }
+    delete this;
+  }
+
+  void onFailure(const Http::AsyncClient::Request&, Http::AsyncClient::FailureReason) override {
+    ENVOY_LOG(debug, "Failed to refresh stale entry {}", cache_key_);
+    leader_->finish(nullptr);
+    delete this;
+  }
+
+  void onBeforeFinalizeUpstreamSpan(Tracing::Span&, const Http::ResponseHeaderMap*) override {}
+
+private:
+  // Keeps the route config alive.
+  const Router::RouteConstSharedPtr route_;
+  const RouteCacheConfig& route_config_;
+  const std::weak_ptr<Proxy::Common::Sender::CacheGetterSetterConfig> used_caches_;
+  // Does nothing once the coalescer is destroyed.
+  RequestCoalescer::LeaderPtr leader_;
+  const std::string cache_key_;
+};
+
 std::set<std::string> readCacheKeys(std::string& json_body) {
   std::vector<std::string> cache_keys{30};
   try {
@@ -63,8 +255,9 @@ std::set<std::string> readCacheKeys(std::string& json_body) {
 
 } // namespace
 
-HttpCacheFilter::HttpCacheFilter(CommonCacheConfig* config, TimeSource&, const std::string& name)
-    : config_(config), filter_name_(name) {}
+HttpCacheFilter::HttpCacheFilter(CommonCacheConfig* config, TimeSource& time_source,
+                                 const std::string& name)
+    : config_(config), time_source_(time_source), filter_name_(name) {}
 
 // no cache or no config: no additional headers be added
 // config disable cache: x-cache-status: BYPASS
@@ -93,6 +286,8 @@ Http::FilterHeadersStatus HttpCacheFilter::decodeHeaders(Http::RequestHeaderMap&
   }
 
   enable_caches_ = true;
+  accept_gzip_ = acceptsGzip(headers);
+  request_headers_ = &headers;
 
   request_sender_ = std::make_shared<Proxy::Common::Sender::CacheRequestSender>(
       config_->usedCaches().get(), route_config_->cacheConfig().get());
@@ -101,38 +296,62 @@ Http::FilterHeadersStatus HttpCacheFilter::decodeHeaders(Http::RequestHeaderMap&
 
   auto cache_request = std::make_unique<Proxy::Common::Http::WeakHeaderOnlyMessage>(headers);
 
-  if (request_sender_->sendRequest(std::move(cache_request), this) ==
-      Proxy::Common::Sender::SendRequestStatus::ONCALL) {
+  // Lookups of local caches are completed inline and onSuccess/onFailure may be called before
+  // sendRequest returns.
+  in_decode_headers_ = true;
+  const auto status = request_sender_->sendRequest(std::move(cache_request), this);
+  in_decode_headers_ = false;
+
+  if (status == Proxy::Common::Sender::SendRequestStatus::ONCALL && !lookup_over_inline_) {
     return end_stream ? Http::FilterHeadersStatus::StopIteration
                       : Http::FilterHeadersStatus::StopAllIterationAndWatermark;
   }
+  if (hit_in_caches_) {
+    // The response from cache has been sent.
+    return Http::FilterHeadersStatus::StopIteration;
+  }
 
-  cache_suspend_ = true;
+  cache_suspend_ = status != Proxy::Common::Sender::SendRequestStatus::ONCALL;
   return Http::FilterHeadersStatus::Continue;
 }
 
 Http::FilterHeadersStatus HttpCacheFilter::encodeHeaders(Http::ResponseHeaderMap& headers,
                                                          bool end_stream) {
+  if (stale_response_ != nullptr) {
+    if (Http::CodeUtility::is5xx(Http::Utility::getResponseStatus(headers))) {
+      return encodeStaleResponse(headers, end_stream);
+    }
+    stale_response_ = nullptr;
+  }
+
   if (!enable_caches_ || !isCacheableResponse(headers) ||
       !route_config_->checkEnable(headers, RouteCacheConfig::Type::RP)) {
     // 当前由于路由配置对于当前请求无需缓存或者响应不符合基本缓存需求
     ENVOY_LOG(debug, "Cache filter cannot cache current response");
     enable_caches_ = false;
+    finishLeading(nullptr);
     return Http::FilterHeadersStatus::Continue;
   }
 
   ASSERT(request_sender_.get());
 
-  // Try to cache response when request is miss in cache or low level fill is enable.
-  if (route_config_->lowlevelFill() || !hit_in_caches_) {
+  // Try to cache response when request is miss in cache or low level fill is enable. Responses that
+  // are known to be too large are never buffered.
+  uint64_t content_length = 0;
+  const bool too_large =
+      absl::SimpleAtoi(headers.getContentLengthValue(), &content_length) &&
+      headers.byteSize() + content_length > route_config_->maxEntrySize();
+  if ((route_config_->lowlevelFill() || !hit_in_caches_) && !too_large) {
     auto headers_copy = Http::ResponseHeaderMapImpl::create();
     Http::HeaderMapImpl::copyFrom(*headers_copy, headers);
     headers_copy->removeEnvoyUpstreamServiceTime();
 
     response_to_cache_ = std::make_unique<Http::ResponseMessageImpl>(std::move(headers_copy));
     if (end_stream) {
-      request_sender_->insertResponse("", std::move(response_to_cache_));
+      insertResponse();
     }
+  } else {
+    finishLeading(nullptr);
   }
 
   headers.addCopy(Http::LowerCaseString("x-cache-key"), request_sender_->cacheKey());
@@ -146,28 +365,192 @@ Http::FilterHeadersStatus HttpCacheFilter::encodeHeaders(Http::ResponseHeaderMap
 }
 
 Http::FilterDataStatus HttpCacheFilter::encodeData(Buffer::Instance& data, bool end_stream) {
+  if (encoding_stale_response_) {
+    // Abandon the body of upstream.
+    data.drain(data.length());
+    if (end_stream) {
+      encoding_stale_response_ = false;
+      encoder_callbacks_->addEncodedData(stale_response_->body(), false);
+      return Http::FilterDataStatus::Continue;
+    }
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  }
+
   if (!enable_caches_ || !response_to_cache_) {
     return Http::FilterDataStatus::Continue;
   }
 
+  const uint64_t buffered_size =
+      response_to_cache_->headers().byteSize() + response_to_cache_->body().length();
+  if (buffered_size + data.length() > route_config_->maxEntrySize()) {
+    ENVOY_LOG(debug, "Response of {} is too large to be cached", request_sender_->cacheKey());
+    response_to_cache_ = nullptr;
+    finishLeading(nullptr);
+    return Http::FilterDataStatus::Continue;
+  }
+
   response_to_cache_->body().add(data);
   if (end_stream) {
     ASSERT(request_sender_.get());
-    request_sender_->insertResponse("", std::move(response_to_cache_));
+    insertResponse();
   }
   return Http::FilterDataStatus::Continue;
 }
 
-void HttpCacheFilter::onSuccess(const Http::AsyncClient::Request&,
+Http::FilterTrailersStatus HttpCacheFilter::encodeTrailers(Http::ResponseTrailerMap&) {
+  if (encoding_stale_response_) {
+    encoding_stale_response_ = false;
+    encoder_callbacks_->addEncodedData(stale_response_->body(), false);
+  }
+  return Http::FilterTrailersStatus::Continue;
+}
+
+Http::FilterHeadersStatus HttpCacheFilter::encodeStaleResponse(Http::ResponseHeaderMap& headers,
+                                                               bool end_stream) {
+  if (!decodeCachedResponse(*stale_response_)) {
+    ENVOY_LOG(error, "Cannot decompress the cached response of {}", request_sender_->cacheKey());
+    stale_response_ = nullptr;
+    return Http::FilterHeadersStatus::Continue;
+  }
+
+  ENVOY_LOG(debug, "Serve stale response of {} for {} of upstream", request_sender_->cacheKey(),
+            headers.getStatusValue());
+  config_->stats_.stale_if_error_.inc();
+  // The waiters go to upstream by themselves and are served their own stale responses if upstream
+  // still fails.
+  finishLeading(nullptr);
+  enable_caches_ = false;
+
+  Proxy::Common::Http::HeaderUtility::replaceHeaders(headers, stale_response_->headers());
+  headers.addCopy(Http::LowerCaseString("x-cache-key"), request_sender_->cacheKey());
+  headers.addCopy(Http::LowerCaseString("x-cache-status"), "STALE");
+
+  // The body of upstream is replaced in encodeData unless the response is headers only.
+  if (end_stream) {
+    encoder_callbacks_->addEncodedData(stale_response_->body(), false);
+    return Http::FilterHeadersStatus::Continue;
+  }
+  encoding_stale_response_ = true;
+  return Http::FilterHeadersStatus::StopIteration;
+}
+
+void HttpCacheFilter::insertResponse() {
+  compressResponseToCache(*route_config_, *response_to_cache_);
+  // The sealed entry is only kept for the waiters. Requests that join after the check go to
+  // upstream by themselves.
+  if (coalescing_leader_ != nullptr && coalescing_leader_->hasWaiters()) {
+    finishLeading(request_sender_->insertSharedResponse("", std::move(response_to_cache_)));
+    return;
+  }
+  request_sender_->insertResponse("", std::move(response_to_cache_));
+  finishLeading(nullptr);
+}
+
+bool HttpCacheFilter::decodeCachedResponse(Http::ResponseMessage& response) {
+  // Only bodies that are compressed by the filter are decompressed, and encodings of upstream are
+  // kept as they are.
+  const bool compressed_by_cache = response.headers().remove(compressedByCacheHeader()) > 0;
+  if (accept_gzip_ || !compressed_by_cache || !isGzipEncoded(response.headers())) {
+    return true;
+  }
+
+  Buffer::OwnedImpl decompressed;
+  if (!Proxy::Common::Cache::GzipBodyCodec::decompress(response.body(), decompressed,
+                                                       MaxDecompressedSize)) {
+    return false;
+  }
+  response.body().drain(response.body().length());
+  response.body().move(decompressed);
+  response.headers().remove(Http::CustomHeaders::get().ContentEncoding);
+  response.headers().setContentLength(response.body().length());
+  return true;
+}
+
+void HttpCacheFilter::onSuccess(const Http::AsyncClient::Request& request,
                                 Http::ResponseMessagePtr&& response) {
+  // Entries are kept for the grace period after their TTL and they are stale in the period.
+  const uint64_t grace = route_config_->cacheConfig()->staleGrace();
+  const uint64_t expire = request_sender_->hitCacheExpire();
+  const uint64_t now = Proxy::Common::Common::TimeUtil::createTimestamp();
+  bool stale = false;
+  if (grace > 0 && expire > 0 && now + grace >= expire) {
+    const uint64_t stale_for = now + grace - expire;
+    if (stale_for >= static_cast<uint64_t>(route_config_->staleWhileRevalidate().count())) {
+      // Served only if upstream fails, and the request goes to upstream as a miss. The response of
+      // upstream replaces the stale entry in all caches.
+      stale_response_ = std::move(response);
+      request_sender_->treatAsMiss();
+      onFailure(request, Http::AsyncClient::FailureReason::Reset);
+      return;
+    }
+    stale = true;
+    refreshStaleEntry();
+  }
+
+  if (!encodeCachedResponse(std::move(response), request_sender_->reqeustHitInCache(), stale)) {
+    onFailure(request, Http::AsyncClient::FailureReason::Reset);
+  }
+}
+
+void HttpCacheFilter::refreshStaleEntry() {
+  Router::RouteConstSharedPtr route = decoder_callbacks_->route();
+  const auto* route_entry = route ? route->routeEntry() : nullptr;
+  if (route_entry == nullptr) {
+    return;
+  }
+  auto* cluster = config_->clusterManager().getThreadLocalCluster(route_entry->clusterName());
+  if (cluster == nullptr) {
+    ENVOY_LOG(debug, "No cluster {} to refresh stale entry", route_entry->clusterName());
+    return;
+  }
+
+  auto leader = config_->coalescer()->tryLead(request_sender_->cacheKey());
+  if (leader == nullptr) {
+    // The key is being fetched by another request.
+    return;
+  }
+  config_->stats_.stale_refresh_.inc();
+
+  auto request = std::make_unique<Http::RequestMessageImpl>(
+      Http::createHeaderMap<Http::RequestHeaderMapImpl>(*request_headers_));
+  // The async client does not route the request, so the headers and the path are rewritten by the
+  // route as the router does for the request itself.
+  route_entry->finalizeRequestHeaders(request->headers(), decoder_callbacks_->streamInfo(), true);
+  // The full response is required to refresh the entry.
+  request->headers().remove(Http::CustomHeaders::get().IfNoneMatch);
+  request->headers().remove(Http::CustomHeaders::get().IfModifiedSince);
+
+  std::chrono::milliseconds timeout = route_entry->timeout();
+  if (timeout.count() == 0) {
+    timeout = route_config_->coalescingTimeout().value_or(
+        std::chrono::milliseconds(DefaultStaleRefreshTimeoutMs));
+  }
+  timeout = std::min(timeout, std::chrono::milliseconds(MaxStaleRefreshTimeoutMs));
+
+  auto* refresher = new StaleRefresher(route, *route_config_, config_->usedCaches(),
+                                       std::move(leader), request_sender_->cacheKey());
+  refresher->send(cluster->httpAsyncClient(), std::move(request), timeout);
+}
+
+bool HttpCacheFilter::encodeCachedResponse(Http::ResponseMessagePtr&& response,
+                                           absl::string_view hit_in, bool stale) {
+  if (!decodeCachedResponse(*response)) {
+    ENVOY_LOG(error, "Cannot decompress the cached response of {}", request_sender_->cacheKey());
+    return false;
+  }
+
+  lookup_over_inline_ = in_decode_headers_;
   hit_in_caches_ = true;
-  config_->stats_.hit_.inc();
+  if (stale) {
+    config_->stats_.stale_hit_.inc();
+  } else {
+    config_->stats_.hit_.inc();
+  }
 
   auto response_headers = Http::createHeaderMap<Http::ResponseHeaderMapImpl>(response->headers());
 
-  response_headers->addCopy(Http::LowerCaseString("x-cache-status"), "HIT");
-  response_headers->addCopy(Http::LowerCaseString("x-cache-hit"),
-                            request_sender_->reqeustHitInCache());
+  response_headers->addCopy(Http::LowerCaseString("x-cache-status"), stale ? "STALE" : "HIT");
+  response_headers->addCopy(Http::LowerCaseString("x-cache-hit"), hit_in);
 
   const bool end_stream = response->body().length() == 0;
   ENVOY_LOG(debug, "Encode headers from cache:\n {}", response->headers());
@@ -175,15 +558,152 @@ void HttpCacheFilter::onSuccess(const Http::AsyncClient::Request&,
 
   decoder_callbacks_->encodeHeaders(std::move(response_headers), end_stream, "CACHE_HIT");
   if (end_stream) {
-    return;
+    return true;
   }
 
   ENVOY_LOG(debug, "Encode data from cache, length: {}", response->body().length());
-  decoder_callbacks_->encodeData(response->body(), true);
+  cached_body_.move(response->body());
+  encodeCachedBody();
+  return true;
+}
+
+bool HttpCacheFilter::waitForLeader() {
+  const auto& timeout = route_config_->coalescingTimeout();
+  if (!timeout.has_value()) {
+    return false;
+  }
+  const MonotonicTime now = time_source_.monotonicTime();
+  if (!coalescing_deadline_.has_value()) {
+    coalescing_deadline_ = now + timeout.value();
+  } else if (now >= coalescing_deadline_.value()) {
+    ENVOY_LOG(debug, "No time left to wait for the leader of {}", request_sender_->cacheKey());
+    config_->stats_.coalesced_timeout_.inc();
+    return false;
+  }
+
+  auto joined = config_->coalescer()->join(
+      request_sender_->cacheKey(), decoder_callbacks_->dispatcher(),
+      [this](RequestCoalescer::Result result, const RequestCoalescer::EntrySharedPtr& entry) {
+        onLeaderDone(result, entry);
+      });
+  if (joined.leader_ != nullptr) {
+    coalescing_leader_ = std::move(joined.leader_);
+    return false;
+  }
+
+  ENVOY_LOG(debug, "Wait for the leader of {}", request_sender_->cacheKey());
+  coalescing_waiter_ = std::move(joined.waiter_);
+  if (coalescing_timer_ == nullptr) {
+    coalescing_timer_ = decoder_callbacks_->dispatcher().createTimer([this]() { onWaitTimeout(); });
+  }
+  coalescing_timer_->enableTimer(std::chrono::ceil<std::chrono::milliseconds>(
+      coalescing_deadline_.value() - now));
+  return true;
+}
+
+void HttpCacheFilter::onLeaderDone(RequestCoalescer::Result result,
+                                   const RequestCoalescer::EntrySharedPtr& entry) {
+  coalescing_waiter_.reset();
+  coalescing_timer_->disableTimer();
+
+  switch (result) {
+  case RequestCoalescer::Result::Inserted: {
+    // The sealed entry is shared by all waiters and every waiter serves its own copy.
+    auto copy = entry->createCopy();
+    auto* http_entry = dynamic_cast<Proxy::Common::Cache::HttpCacheEntry*>(copy.get());
+    if (http_entry != nullptr && http_entry->cacheMessage() != nullptr &&
+        encodeCachedResponse(std::move(http_entry->cacheMessage()), "coalesced", false)) {
+      config_->stats_.coalesced_hit_.inc();
+      return;
+    }
+    config_->stats_.coalesced_miss_.inc();
+    break;
+  }
+  case RequestCoalescer::Result::NotInserted:
+    config_->stats_.coalesced_miss_.inc();
+    break;
+  case RequestCoalescer::Result::Cancelled:
+    // The stream of the leader is reset and one of the waiters becomes the new leader.
+    config_->stats_.coalesced_cancelled_.inc();
+    if (waitForLeader()) {
+      return;
+    }
+    break;
+  }
+  decoder_callbacks_->continueDecoding();
+}
+
+void HttpCacheFilter::onWaitTimeout() {
+  ENVOY_LOG(debug, "Timeout of waiting for the leader of {}", request_sender_->cacheKey());
+  config_->stats_.coalesced_timeout_.inc();
+  coalescing_waiter_.reset();
+  decoder_callbacks_->continueDecoding();
+}
+
+void HttpCacheFilter::finishLeading(RequestCoalescer::EntrySharedPtr entry) {
+  if (coalescing_leader_ != nullptr) {
+    coalescing_leader_->finish(std::move(entry));
+    coalescing_leader_.reset();
+  }
+}
+
+void HttpCacheFilter::encodeCachedBody() {
+  if (!watermark_callbacks_added_ &&
+      cached_body_.length() > Proxy::Common::Cache::BodyChunkSize) {
+    // Called at once for every high watermark that is outstanding.
+    watermark_callbacks_added_ = true;
+    decoder_callbacks_->addDownstreamWatermarkCallbacks(*this);
+  }
+
+  // The stream may be destroyed while a chunk is encoded and the rest of the body is drained then.
+  while (cached_body_.length() > 0 && high_watermark_count_ == 0) {
+    Buffer::OwnedImpl chunk;
+    chunk.move(cached_body_,
+               std::min<uint64_t>(cached_body_.length(), Proxy::Common::Cache::BodyChunkSize));
+    decoder_callbacks_->encodeData(chunk, cached_body_.length() == 0);
+  }
+
+  if (cached_body_.length() == 0) {
+    stopEncodingCachedBody();
+  }
+}
+
+void HttpCacheFilter::stopEncodingCachedBody() {
+  cached_body_.drain(cached_body_.length());
+  if (watermark_callbacks_added_) {
+    watermark_callbacks_added_ = false;
+    decoder_callbacks_->removeDownstreamWatermarkCallbacks(*this);
+  }
+}
+
+void HttpCacheFilter::onAboveWriteBufferHighWatermark() { high_watermark_count_++; }
+
+void HttpCacheFilter::onBelowWriteBufferLowWatermark() {
+  ASSERT(high_watermark_count_ > 0);
+  if (--high_watermark_count_ > 0 || cached_body_.length() == 0) {
+    return;
+  }
+  // The callback is called while the downstream connection is writing, so the rest of the body is
+  // encoded in the next iteration of the event loop.
+  std::weak_ptr<bool> alive = alive_;
+  decoder_callbacks_->dispatcher().post([this, alive]() {
+    if (!alive.expired()) {
+      encodeCachedBody();
+    }
+  });
 }
 
 void HttpCacheFilter::onFailure(const Http::AsyncClient::Request&,
                                 Http::AsyncClient::FailureReason) {
+  // The filter chain is stopped until the leader of the cache key is done.
+  if (waitForLeader()) {
+    return;
+  }
+  if (in_decode_headers_) {
+    // Missed in all caches inline and decodeHeaders will continue the filter chain.
+    lookup_over_inline_ = true;
+    return;
+  }
   decoder_callbacks_->continueDecoding();
 }
 
@@ -191,6 +711,12 @@ void HttpCacheFilter::onDestroy() {
   if (request_sender_) {
     request_sender_->cancel();
   }
+  stopEncodingCachedBody();
+  alive_.reset();
+  // Waiters of the cache key are woken up if the response is not inserted yet.
+  coalescing_leader_.reset();
+  coalescing_waiter_.reset();
+  coalescing_timer_.reset();
 }
 
 std::map<std::string, std::string> CommonCacheConfig::ADMIN_HANDLER_UUID_MAP = {};
@@ -202,7 +728,7 @@ CommonCacheConfig::CommonCacheConfig(const ProtoConfig& config,
   // create or get cache
   if (!config.used_caches().empty()) {
     used_caches_ = std::make_shared<Proxy::Common::Sender::CacheGetterSetterConfig>(
-        config.used_caches(), context_);
+        config.used_caches(), context_, false, config.lookup_policy());
   }
 
   // 无api prefix提供或者无缓存情况下不扩展Admin api
@@ -246,6 +772,12 @@ CommonCacheConfig::CommonCacheConfig(const ProtoConfig& config,
   context_.admin().addHandler(final_apis_prefix_, "remove item in all cache.", func, true, true);
 }
 
+CommonCacheConfig::CommonCacheConfig(
+    Proxy::Common::Sender::CacheGetterSetterConfigSharedPtr used_caches,
+    Server::Configuration::FactoryContext& context, const std::string& stats_prefix)
+    : used_caches_(std::move(used_caches)), context_(context),
+      stats_(generateStats(stats_prefix, context_.scope())) {}
+
 CommonCacheConfig::~CommonCacheConfig() {
   if (final_apis_prefix_.empty()) {
     return;
@@ -272,10 +804,32 @@ RouteCacheConfig::RouteCacheConfig(const RouteProtoConfig& config) {
 
   low_level_fill_ = config.low_level_fill();
 
+  if (config.has_compression()) {
+    compression_min_size_ = config.compression().has_min_size()
+                                ? config.compression().min_size().value()
+                                : DefaultCompressionMinSize;
+  }
+
+  if (config.has_stale()) {
+    stale_while_revalidate_ = std::chrono::milliseconds(
+        PROTOBUF_GET_MS_OR_DEFAULT(config.stale(), stale_while_revalidate, 0));
+    stale_if_error_ =
+        std::chrono::milliseconds(PROTOBUF_GET_MS_OR_DEFAULT(config.stale(), stale_if_error, 0));
+  }
+
+  if (config.has_coalescing()) {
+    coalescing_timeout_ = std::chrono::milliseconds(PROTOBUF_GET_MS_OR_DEFAULT(
+        config.coalescing(), timeout, DefaultCoalescingTimeoutMs));
+  }
+
   std::map<std::string, Proxy::Common::Sender::ProtoTTL> ttl_config(config.cache_ttls().begin(),
                                                                     config.cache_ttls().end());
-  cache_config_ =
-      std::make_shared<Proxy::Common::Sender::SpecificCacheConfig>(config.key_maker(), ttl_config);
+  using Proxy::Common::Sender::SpecificCacheConfig;
+  cache_config_ = std::make_shared<SpecificCacheConfig>(
+      config.key_maker(), ttl_config, "v1",
+      PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_entry_size,
+                                      SpecificCacheConfig::DefaultMaxEntrySize),
+      std::max(stale_while_revalidate_, stale_if_error_).count());
 }
 
 bool RouteCacheConfig::checkEnable(const Http::HeaderMap& headers, Type type) const {
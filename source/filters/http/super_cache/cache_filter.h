@@ -1,16 +1,20 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <regex>
 #include <string>
 #include <vector>
 
+#include "envoy/event/timer.h"
 #include "envoy/server/filter_config.h"
 
+#include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/logger.h"
 #include "source/common/http/header_utility.h"
 #include "source/common/sender/cache_request_sender.h"
+#include "source/filters/http/super_cache/request_coalescer.h"
 #include "source/extensions/filters/http/common/pass_through_filter.h"
 
 #include "api/proxy/filters/http/super_cache/v2/super_cache.pb.h"
@@ -25,7 +29,14 @@ using RouteProtoConfig = proxy::filters::http::super_cache::v2::CacheConfig;
 
 #define ALL_SUPER_CACHE_FILTER_STATS(COUNTER)                                                      \
   COUNTER(hit)                                                                                     \
-  COUNTER(miss)
+  COUNTER(miss)                                                                                    \
+  COUNTER(coalesced_hit)                                                                           \
+  COUNTER(coalesced_miss)                                                                          \
+  COUNTER(coalesced_cancelled)                                                                     \
+  COUNTER(coalesced_timeout)                                                                       \
+  COUNTER(stale_hit)                                                                               \
+  COUNTER(stale_if_error)                                                                          \
+  COUNTER(stale_refresh)
 
 /**
  * Wrapper struct for Super cache filter stats. @see stats_macros.h
@@ -38,10 +49,18 @@ class CommonCacheConfig : public Logger::Loggable<Logger::Id::filter> {
 public:
   CommonCacheConfig(const ProtoConfig& config, Server::Configuration::FactoryContext& context,
                     const std::string& stats_prefix);
+  // Use the caches as they are and extend no admin API.
+  CommonCacheConfig(Proxy::Common::Sender::CacheGetterSetterConfigSharedPtr used_caches,
+                    Server::Configuration::FactoryContext& context,
+                    const std::string& stats_prefix);
   virtual ~CommonCacheConfig();
 
   Proxy::Common::Sender::CacheGetterSetterConfigSharedPtr& usedCaches();
 
+  const RequestCoalescerSharedPtr& coalescer() const { return coalescer_; }
+
+  Upstream::ClusterManager& clusterManager() { return context_.clusterManager(); }
+
 private:
   static std::map<std::string, std::string> ADMIN_HANDLER_UUID_MAP;
   std::string admin_handler_uuid_;
@@ -49,6 +68,8 @@ private:
 
   Proxy::Common::Sender::CacheGetterSetterConfigSharedPtr used_caches_;
   Server::Configuration::FactoryContext& context_;
+  // Shared by the filters of all workers.
+  RequestCoalescerSharedPtr coalescer_{std::make_shared<RequestCoalescer>()};
 
   SuperCacheFilterStats generateStats(const std::string& prefix, Stats::Scope& scope) {
     const std::string final_prefix = prefix + "super_cache.";
@@ -74,6 +95,22 @@ public:
 
   bool lowlevelFill() const { return low_level_fill_; }
 
+  // Bodies of at least the size are compressed with gzip before they are cached. Compression is
+  // disabled if it is unset.
+  const absl::optional<uint32_t>& compressionMinSize() const { return compression_min_size_; }
+
+  uint64_t maxEntrySize() const { return cache_config_->maxEntrySize(); }
+
+  // Timeout of waiting for the leader of a miss. Misses are not coalesced if it is unset.
+  const absl::optional<std::chrono::milliseconds>& coalescingTimeout() const {
+    return coalescing_timeout_;
+  }
+
+  // Periods after the TTL of entries, in which stale entries are served at once or only if upstream
+  // fails. Zero if they are disabled.
+  std::chrono::milliseconds staleWhileRevalidate() const { return stale_while_revalidate_; }
+  std::chrono::milliseconds staleIfError() const { return stale_if_error_; }
+
 private:
   // construct all regex object at init to avoid repeated construct
   // at request
@@ -83,11 +120,19 @@ private:
   Proxy::Common::Sender::SpecificCacheConfigSharedPtr cache_config_{nullptr};
 
   bool low_level_fill_;
+
+  absl::optional<uint32_t> compression_min_size_;
+
+  absl::optional<std::chrono::milliseconds> coalescing_timeout_;
+
+  std::chrono::milliseconds stale_while_revalidate_{0};
+  std::chrono::milliseconds stale_if_error_{0};
 };
 
 class HttpCacheFilter : public Http::PassThroughFilter,
                         public Logger::Loggable<Logger::Id::filter>,
-                        public Http::AsyncClient::Callbacks {
+                        public Http::AsyncClient::Callbacks,
+                        public Http::DownstreamWatermarkCallbacks {
 public:
   HttpCacheFilter(CommonCacheConfig* config, TimeSource& time_source, const std::string& name);
 
@@ -98,6 +143,8 @@ public:
 
   Http::FilterDataStatus encodeData(Buffer::Instance& buffer, bool end_stream) override;
 
+  Http::FilterTrailersStatus encodeTrailers(Http::ResponseTrailerMap& trailers) override;
+
   Http::FilterHeadersStatus encodeHeaders(Http::ResponseHeaderMap& headers,
                                           bool end_stream) override;
 
@@ -110,15 +157,73 @@ public:
 
   void onBeforeFinalizeUpstreamSpan(Tracing::Span&, const Http::ResponseHeaderMap*) override {}
 
+  // Http::DownstreamWatermarkCallbacks
+  void onAboveWriteBufferHighWatermark() override;
+  void onBelowWriteBufferLowWatermark() override;
+
 private:
+  // Encode the cached response to the downstream. Returns false if the body cannot be decompressed.
+  bool encodeCachedResponse(Http::ResponseMessagePtr&& response, absl::string_view hit_in,
+                            bool stale);
+
+  // Send one background request to refresh the stale entry unless the key is being fetched.
+  void refreshStaleEntry();
+  // Replace the 5xx response of upstream with the stale response.
+  Http::FilterHeadersStatus encodeStaleResponse(Http::ResponseHeaderMap& headers, bool end_stream);
+
+  // Wait for the leader of the cache key if another request is fetching it. Otherwise this request
+  // becomes the leader and false is returned.
+  bool waitForLeader();
+  void onLeaderDone(RequestCoalescer::Result result, const RequestCoalescer::EntrySharedPtr& entry);
+  void onWaitTimeout();
+  // Wake up the waiters of the cache key if this request is the leader.
+  void finishLeading(RequestCoalescer::EntrySharedPtr entry);
+
+  // Encode the cached body chunk by chunk until it is done or the downstream is above the high
+  // watermark. The rest is encoded when the downstream drains below the low watermark.
+  void encodeCachedBody();
+  void stopEncodingCachedBody();
+
+  // Insert response_to_cache_ into the caches. The body is compressed first if it is enabled.
+  void insertResponse();
+  // Decompress the body of the cached response if it is compressed by the filter and the client
+  // does not accept gzip. Returns false if the body cannot be decompressed.
+  bool decodeCachedResponse(Http::ResponseMessage& response);
+
   Http::ResponseMessagePtr response_to_cache_{nullptr};
 
+  Http::RequestHeaderMap* request_headers_{nullptr};
+  // Stale response that is served if upstream fails.
+  Http::ResponseMessagePtr stale_response_{nullptr};
+  // The body of upstream is replaced with the body of the stale response.
+  bool encoding_stale_response_{false};
+
+  bool accept_gzip_{false};
+
   bool cache_suspend_{false}; // 缓存搜索因错误而中止
   bool enable_caches_{false};
 
   bool hit_in_caches_{false};
 
+  bool in_decode_headers_{false};  // 缓存查询在 decodeHeaders 中进行
+  bool lookup_over_inline_{false}; // 缓存查询在 decodeHeaders 中直接完成
+
+  // Body of the hit that is not encoded yet.
+  Buffer::OwnedImpl cached_body_;
+  bool watermark_callbacks_added_{false};
+  // High watermark events are nested, and the body is encoded only if none is outstanding.
+  uint32_t high_watermark_count_{0};
+  // Guards the resumption that is posted to the dispatcher against the destroyed filter.
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+
+  RequestCoalescer::LeaderPtr coalescing_leader_;
+  RequestCoalescer::WaiterHandle coalescing_waiter_;
+  Event::TimerPtr coalescing_timer_;
+  // Set by the first wait. Waits after the leader is cancelled end at the same time.
+  absl::optional<MonotonicTime> coalescing_deadline_;
+
   CommonCacheConfig* config_{nullptr};
+  TimeSource& time_source_;
   const std::string filter_name_;
 
   const RouteCacheConfig* route_config_{nullptr};
@@ -0,0 +1,101 @@
+#include "source/filters/http/super_cache/request_coalescer.h"
+
+#include <algorithm>
+
+namespace Envoy {
+namespace Proxy {
+namespace HttpFilters {
+namespace SuperCache {
+
+RequestCoalescer::Leader::~Leader() {
+  if (finished_) {
+    return;
+  }
+  if (auto flights = flights_.lock()) {
+    complete(*flights, key_, Result::Cancelled, nullptr);
+  }
+}
+
+void RequestCoalescer::Leader::finish(EntrySharedPtr entry) {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  const Result result = entry != nullptr ? Result::Inserted : Result::NotInserted;
+  if (auto flights = flights_.lock()) {
+    complete(*flights, key_, result, std::move(entry));
+  }
+}
+
+bool RequestCoalescer::Leader::hasWaiters() const {
+  auto flights = flights_.lock();
+  if (flights == nullptr) {
+    return false;
+  }
+  Thread::LockGuard lock(flights->mutex_);
+  auto iter = flights->map_.find(key_);
+  if (iter == flights->map_.end()) {
+    return false;
+  }
+  return std::any_of(iter->second.begin(), iter->second.end(),
+                     [](const Waiter& waiter) { return !waiter.callback_.expired(); });
+}
+
+RequestCoalescer::Joined RequestCoalescer::join(const std::string& key,
+                                                Event::Dispatcher& dispatcher, Callback callback) {
+  Joined joined;
+  Thread::LockGuard lock(flights_->mutex_);
+  auto result = flights_->map_.try_emplace(key);
+  if (result.second) {
+    joined.leader_.reset(new Leader(flights_, key));
+    return joined;
+  }
+  joined.waiter_ = std::make_shared<Callback>(std::move(callback));
+  result.first->second.push_back({&dispatcher, joined.waiter_});
+  return joined;
+}
+
+RequestCoalescer::LeaderPtr RequestCoalescer::tryLead(const std::string& key) {
+  Thread::LockGuard lock(flights_->mutex_);
+  if (!flights_->map_.try_emplace(key).second) {
+    return nullptr;
+  }
+  return LeaderPtr(new Leader(flights_, key));
+}
+
+size_t RequestCoalescer::flights() const {
+  Thread::LockGuard lock(flights_->mutex_);
+  return flights_->map_.size();
+}
+
+void RequestCoalescer::complete(Flights& flights, const std::string& key, Result result,
+                                EntrySharedPtr entry) {
+  std::vector<Waiter> waiters;
+  {
+    Thread::LockGuard lock(flights.mutex_);
+    auto iter = flights.map_.find(key);
+    if (iter == flights.map_.end()) {
+      return;
+    }
+    waiters = std::move(iter->second);
+    flights.map_.erase(iter);
+  }
+
+  ENVOY_LOG(debug, "Flight of {} is completed with {} waiters", key, waiters.size());
+  for (auto& waiter : waiters) {
+    if (waiter.callback_.expired()) {
+      continue;
+    }
+    // Waiters are woken up in their own threads, where the handles are released.
+    waiter.dispatcher_->post([callback = std::move(waiter.callback_), result, entry]() {
+      if (auto locked = callback.lock()) {
+        (*locked)(result, entry);
+      }
+    });
+  }
+}
+
+} // namespace SuperCache
+} // namespace HttpFilters
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/event/dispatcher.h"
+
+#include "source/common/cache/cache_base.h"
+#include "source/common/common/lock_guard.h"
+#include "source/common/common/logger.h"
+#include "source/common/common/thread.h"
+
+#include "absl/container/flat_hash_map.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace HttpFilters {
+namespace SuperCache {
+
+/**
+ * Registry of in-flight cache misses that is shared by all workers. The first miss of a key becomes
+ * the leader and fetches the response from upstream. Later misses of the key wait until the leader
+ * is finished and are served from the entry that the leader inserts into the caches, so only one
+ * request of a key is sent to upstream at a time.
+ */
+class RequestCoalescer : public Logger::Loggable<Logger::Id::filter> {
+  struct Flights;
+
+public:
+  enum class Result {
+    // The response of the leader is inserted and the sealed entry is given.
+    Inserted,
+    // The response of the leader is not cacheable.
+    NotInserted,
+    // The stream of the leader is destroyed before the response is inserted.
+    Cancelled,
+  };
+
+  using EntrySharedPtr = Proxy::Common::Cache::CacheEntryConstSharedPtr;
+  using Callback = std::function<void(Result, const EntrySharedPtr&)>;
+
+  class Leader {
+  public:
+    ~Leader();
+
+    // Wake up all waiters of the key. The entry is nullptr if the response is not inserted. The
+    // waiters are cancelled if the leader is released before it is finished. Leaders may outlive
+    // the coalescer and do nothing then.
+    void finish(EntrySharedPtr entry);
+
+    // Whether any request waits for the leader now. Requests may still join before it is finished.
+    bool hasWaiters() const;
+
+  private:
+    friend class RequestCoalescer;
+    Leader(const std::shared_ptr<Flights>& flights, const std::string& key)
+        : flights_(flights), key_(key) {}
+
+    const std::weak_ptr<Flights> flights_;
+    const std::string key_;
+    bool finished_{false};
+  };
+  using LeaderPtr = std::unique_ptr<Leader>;
+
+  // The waiter stops waiting once the handle is released.
+  using WaiterHandle = std::shared_ptr<Callback>;
+
+  struct Joined {
+    // Set if the caller is the leader of the key.
+    LeaderPtr leader_;
+    // Set if the caller waits for the leader of the key.
+    WaiterHandle waiter_;
+  };
+
+  // Join the flight of the key. The callback of a waiter is called at most once in the thread of
+  // the dispatcher, and never after the waiter handle is released.
+  Joined join(const std::string& key, Event::Dispatcher& dispatcher, Callback callback);
+
+  // Become the leader of the key if no request is fetching it. Otherwise nullptr is returned and
+  // nothing is left in the flight of the key.
+  LeaderPtr tryLead(const std::string& key);
+
+  // Number of keys that have a leader.
+  size_t flights() const;
+
+private:
+  struct Waiter {
+    Event::Dispatcher* dispatcher_;
+    std::weak_ptr<Callback> callback_;
+  };
+
+  struct Flights {
+    Thread::MutexBasicLockable mutex_;
+    absl::flat_hash_map<std::string, std::vector<Waiter>> map_ ABSL_GUARDED_BY(mutex_);
+  };
+
+  static void complete(Flights& flights, const std::string& key, Result result,
+                       EntrySharedPtr entry);
+
+  // Only referenced weakly by the leaders.
+  const std::shared_ptr<Flights> flights_{std::make_shared<Flights>()};
+};
+
+using RequestCoalescerSharedPtr = std::shared_ptr<RequestCoalescer>;
+
+} // namespace SuperCache
+} // namespace HttpFilters
+} // namespace Proxy
+} // namespace Envoy
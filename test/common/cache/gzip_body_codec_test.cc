@@ -0,0 +1,87 @@
+#include <random>
+#include <string>
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/cache/gzip_body_codec.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+std::string jsonBody(size_t size) {
+  std::string body;
+  for (size_t i = 0; body.size() < size; i++) {
+    absl::StrAppend(&body, "{\"id\":", i, ",\"name\":\"item name\",\"tags\":[\"a\",\"b\"]},");
+  }
+  return body;
+}
+
+TEST(GzipBodyCodecTest, RoundTrip) {
+  const std::string body = jsonBody(256 * 1024);
+  // The body is split into slices of the input buffer.
+  Envoy::Buffer::OwnedImpl input;
+  for (size_t i = 0; i < body.size(); i += 10000) {
+    input.add(absl::string_view(body).substr(i, 10000));
+  }
+
+  Envoy::Buffer::OwnedImpl compressed;
+  ASSERT_TRUE(GzipBodyCodec::compress(input, compressed));
+  EXPECT_LT(compressed.length() * 10, body.size());
+  // Gzip magic.
+  EXPECT_EQ("\x1f\x8b", compressed.toString().substr(0, 2));
+
+  Envoy::Buffer::OwnedImpl decompressed;
+  ASSERT_TRUE(GzipBodyCodec::decompress(compressed, decompressed, body.size()));
+  EXPECT_EQ(body, decompressed.toString());
+}
+
+TEST(GzipBodyCodecTest, IncompressibleAndEmptyBody) {
+  std::string body(64 * 1024, 0);
+  std::mt19937 random(0);
+  for (auto& c : body) {
+    c = static_cast<char>(random());
+  }
+
+  Envoy::Buffer::OwnedImpl compressed;
+  ASSERT_TRUE(GzipBodyCodec::compress(Envoy::Buffer::OwnedImpl(body), compressed));
+  Envoy::Buffer::OwnedImpl decompressed;
+  ASSERT_TRUE(GzipBodyCodec::decompress(compressed, decompressed, body.size()));
+  EXPECT_EQ(body, decompressed.toString());
+
+  Envoy::Buffer::OwnedImpl empty_compressed;
+  ASSERT_TRUE(GzipBodyCodec::compress(Envoy::Buffer::OwnedImpl(), empty_compressed));
+  Envoy::Buffer::OwnedImpl empty;
+  ASSERT_TRUE(GzipBodyCodec::decompress(empty_compressed, empty, 0));
+  EXPECT_EQ(0, empty.length());
+}
+
+TEST(GzipBodyCodecTest, InvalidData) {
+  const std::string body = jsonBody(64 * 1024);
+  Envoy::Buffer::OwnedImpl compressed;
+  ASSERT_TRUE(GzipBodyCodec::compress(Envoy::Buffer::OwnedImpl(body), compressed));
+
+  // The size limit is exceeded.
+  Envoy::Buffer::OwnedImpl limited;
+  EXPECT_FALSE(GzipBodyCodec::decompress(compressed, limited, body.size() - 1));
+
+  // Truncated data.
+  const std::string data = compressed.toString();
+  Envoy::Buffer::OwnedImpl truncated;
+  EXPECT_FALSE(GzipBodyCodec::decompress(
+      Envoy::Buffer::OwnedImpl(data.substr(0, data.size() / 2)), truncated, body.size()));
+
+  // Not gzip data.
+  Envoy::Buffer::OwnedImpl output;
+  EXPECT_FALSE(GzipBodyCodec::decompress(Envoy::Buffer::OwnedImpl(body), output, body.size()));
+}
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,117 @@
+#include <memory>
+#include <random>
+#include <string>
+
+#include "source/common/cache/http_cache_entry.h"
+
+#include "test/benchmark/main.h"
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+enum class BodyKind { Html, Json, Binary };
+
+// Bodies that look like cached responses. Binary bodies stand for images, protobuf and compressed
+// responses, where most bytes are escaped by the JSON form.
+std::string benchmarkBody(BodyKind kind, size_t size) {
+  std::string body;
+  body.reserve(size + 128);
+  std::mt19937 random(size);
+  switch (kind) {
+  case BodyKind::Html:
+    while (body.size() < size) {
+      absl::StrAppend(&body, "<div class=\"item\"><a href=\"/item/", random() % 100000,
+                      "\">Item title</a><p>Some text of the item.</p></div>\n");
+    }
+    break;
+  case BodyKind::Json:
+    while (body.size() < size) {
+      absl::StrAppend(&body, "{\"id\":", random() % 100000,
+                      ",\"name\":\"item name\",\"tags\":[\"a\",\"b\"],\"price\":12.5},");
+    }
+    break;
+  case BodyKind::Binary:
+    while (body.size() < size) {
+      body.push_back(static_cast<char>(random()));
+    }
+    break;
+  }
+  body.resize(size);
+  return body;
+}
+
+HttpCacheEntryPtr benchmarkEntry(BodyKind kind, size_t size) {
+  auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+  headers->setStatus(200);
+  headers->setContentType(kind == BodyKind::Html   ? "text/html; charset=utf-8"
+                          : kind == BodyKind::Json ? "application/json"
+                                                   : "image/jpeg");
+  headers->addCopy(Envoy::Http::LowerCaseString("cache-control"), "max-age=300");
+  headers->addCopy(Envoy::Http::LowerCaseString("etag"), "\"5d8c72a5edda8d6a\"");
+  auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+  message->body().add(benchmarkBody(kind, size));
+  auto entry = std::make_unique<HttpCacheEntry>(std::move(message), 0);
+  entry->seal();
+  return entry;
+}
+
+absl::optional<std::string> serialize(const HttpCacheEntry& entry, bool binary) {
+  return binary ? entry.serializeAsBinary() : entry.serializeAsString();
+}
+
+// Args: body kind, body size, binary form.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_HttpCacheEntrySerialize(::benchmark::State& state) {
+  const auto entry = benchmarkEntry(static_cast<BodyKind>(state.range(0)), state.range(1));
+  const bool binary = state.range(2);
+
+  size_t encoded = 0;
+  for (auto _ : state) { // NOLINT
+    auto value = serialize(*entry, binary);
+    encoded = value->size();
+    benchmark::DoNotOptimize(value);
+  }
+  state.counters["encoded_ratio"] = static_cast<double>(encoded) / entry->cacheLength();
+  state.SetBytesProcessed(state.iterations() * entry->cacheLength());
+}
+
+// Args: body kind, body size, binary form. Every iteration loads a fresh copy of the value as a
+// remote cache does with a reply.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_HttpCacheEntryLoad(::benchmark::State& state) {
+  const auto entry = benchmarkEntry(static_cast<BodyKind>(state.range(0)), state.range(1));
+  const std::string value = serialize(*entry, state.range(2)).value();
+
+  for (auto _ : state) { // NOLINT
+    std::string reply = value;
+    HttpCacheEntry loaded;
+    loaded.loadFromString(std::move(reply));
+    benchmark::DoNotOptimize(loaded.cacheMessage());
+  }
+  state.SetBytesProcessed(state.iterations() * entry->cacheLength());
+}
+
+void codecArgs(benchmark::internal::Benchmark* b) {
+  for (int64_t kind : {0, 1, 2}) {
+    for (int64_t size : {1024, 64 * 1024}) {
+      for (int64_t binary : {0, 1}) {
+        b->Args({kind, size, binary});
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_HttpCacheEntrySerialize)->Apply(codecArgs);
+BENCHMARK(BM_HttpCacheEntryLoad)->Apply(codecArgs);
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
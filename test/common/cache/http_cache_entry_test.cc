@@ -0,0 +1,238 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "source/common/cache/http_cache_entry.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+HttpCacheEntryPtr createEntry(absl::string_view body) {
+  auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+  headers->setStatus(200);
+  headers->setContentType("text/plain");
+  headers->setContentLength(body.size());
+  auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+  message->body().add(body);
+  return std::make_unique<HttpCacheEntry>(std::move(message), 0);
+}
+
+std::vector<std::pair<std::string, std::string>> headerList(const Envoy::Http::HeaderMap& headers) {
+  std::vector<std::pair<std::string, std::string>> result;
+  headers.iterate([&result](const Envoy::Http::HeaderEntry& e) {
+    result.emplace_back(e.key().getStringView(), e.value().getStringView());
+    return Envoy::Http::HeaderMap::Iterate::Continue;
+  });
+  return result;
+}
+
+TEST(HttpCacheEntryTest, CopyOfUnsealedEntry) {
+  auto entry = createEntry("hello world");
+  auto copy = entry->createCopy();
+  auto* http_copy = dynamic_cast<HttpCacheEntry*>(copy.get());
+  ASSERT_NE(nullptr, http_copy);
+
+  EXPECT_EQ("hello world", http_copy->cacheMessage()->bodyAsString());
+  EXPECT_NE(entry->cacheMessage()->body().frontSlice().mem_,
+            http_copy->cacheMessage()->body().frontSlice().mem_);
+}
+
+TEST(HttpCacheEntryTest, CopyOfSealedEntrySharesBody) {
+  auto entry = createEntry("hello world");
+  const uint64_t length = entry->cacheLength();
+  entry->seal();
+
+  EXPECT_EQ(nullptr, entry->cacheMessage());
+  EXPECT_EQ(length, entry->cacheLength());
+
+  auto copy1 = entry->createCopy();
+  auto copy2 = entry->createCopy();
+  auto& message1 = dynamic_cast<HttpCacheEntry*>(copy1.get())->cacheMessage();
+  auto& message2 = dynamic_cast<HttpCacheEntry*>(copy2.get())->cacheMessage();
+
+  EXPECT_EQ("200", message1->headers().getStatusValue());
+  EXPECT_EQ("hello world", message1->bodyAsString());
+  EXPECT_EQ("hello world", message2->bodyAsString());
+  EXPECT_EQ(length, copy1->cacheLength());
+
+  // Both copies refer to the same bytes and nothing is copied.
+  EXPECT_EQ(message1->body().frontSlice().mem_, message2->body().frontSlice().mem_);
+
+  // Headers of copies are independent.
+  message1->headers().setStatus(404);
+  EXPECT_EQ("200", message2->headers().getStatusValue());
+
+  // The bytes stay valid after the sealed entry is released.
+  entry.reset();
+  copy1.reset();
+  EXPECT_EQ("hello world", message2->bodyAsString());
+}
+
+TEST(HttpCacheEntryTest, SerializeSealedEntry) {
+  auto entry = createEntry("hello world");
+  entry->seal();
+
+  auto serialized = entry->serializeAsString();
+  ASSERT_TRUE(serialized.has_value());
+
+  HttpCacheEntry loaded;
+  loaded.loadFromString(std::move(serialized.value()));
+  ASSERT_NE(nullptr, loaded.cacheMessage());
+  EXPECT_EQ("hello world", loaded.cacheMessage()->bodyAsString());
+}
+
+TEST(HttpCacheEntryTest, LoadFromStringAdoptsBody) {
+  const std::string body(4096, 'x');
+  auto serialized = createEntry(body)->serializeAsString();
+  ASSERT_TRUE(serialized.has_value());
+  const char* begin = serialized->data();
+  const char* end = begin + serialized->size();
+
+  HttpCacheEntry loaded;
+  loaded.loadFromString(std::move(serialized.value()));
+  ASSERT_NE(nullptr, loaded.cacheMessage());
+  EXPECT_EQ(body, loaded.cacheMessage()->bodyAsString());
+  EXPECT_EQ("text/plain", loaded.cacheMessage()->headers().getContentTypeValue());
+
+  // The body refers to the loaded string instead of a copy of it.
+  const auto* mem = static_cast<const char*>(loaded.cacheMessage()->body().frontSlice().mem_);
+  EXPECT_TRUE(mem >= begin && mem < end);
+
+  // The string stays valid after the entry is sealed and released.
+  loaded.seal();
+  auto copy = loaded.createCopy();
+  loaded.loadFromString("");
+  EXPECT_EQ(body, dynamic_cast<HttpCacheEntry*>(copy.get())->cacheMessage()->bodyAsString());
+}
+
+TEST(HttpCacheEntryTest, LoadFromStringWithEscapedBody) {
+  const std::string body("\0\x01\"quoted\"\n\\", 12);
+  auto serialized = createEntry(body)->serializeAsString();
+  ASSERT_TRUE(serialized.has_value());
+
+  HttpCacheEntry loaded;
+  loaded.loadFromString(std::move(serialized.value()));
+  ASSERT_NE(nullptr, loaded.cacheMessage());
+  EXPECT_EQ(body, loaded.cacheMessage()->bodyAsString());
+  EXPECT_EQ("12", loaded.cacheMessage()->headers().getContentLengthValue());
+}
+
+TEST(HttpCacheEntryTest, BinaryRoundTrip) {
+  // Binary body that would be escaped by the JSON form.
+  const std::string body("\0\x01\xff\"binary\"\n", 12);
+  auto entry = createEntry(body);
+  entry->seal();
+
+  auto serialized = entry->serializeAsBinary();
+  ASSERT_TRUE(serialized.has_value());
+  EXPECT_LT(serialized->size(), entry->serializeAsString()->size());
+
+  HttpCacheEntry loaded;
+  ASSERT_TRUE(loaded.loadFromBinary(serialized.value()));
+  ASSERT_NE(nullptr, loaded.cacheMessage());
+  EXPECT_EQ("200", loaded.cacheMessage()->headers().getStatusValue());
+  EXPECT_EQ("text/plain", loaded.cacheMessage()->headers().getContentTypeValue());
+  EXPECT_EQ(body, loaded.cacheMessage()->bodyAsString());
+  EXPECT_EQ(entry->cacheLength(), loaded.cacheLength());
+
+  // Truncated data is rejected.
+  HttpCacheEntry truncated;
+  EXPECT_FALSE(truncated.loadFromBinary(absl::string_view(*serialized).substr(0, 20)));
+  EXPECT_EQ(nullptr, truncated.cacheMessage());
+}
+
+TEST(HttpCacheEntryTest, LoadFromStringDetectsBinary) {
+  const std::string body("\0\x01\xff\"binary\"\n", 12);
+  auto entry = createEntry(body);
+  auto serialized = entry->serializeAsBinary();
+  ASSERT_TRUE(serialized.has_value());
+  const char* begin = serialized->data();
+  const char* end = begin + serialized->size();
+
+  HttpCacheEntry loaded;
+  loaded.loadFromString(std::move(serialized.value()));
+  ASSERT_NE(nullptr, loaded.cacheMessage());
+  EXPECT_EQ("text/plain", loaded.cacheMessage()->headers().getContentTypeValue());
+  EXPECT_EQ(body, loaded.cacheMessage()->bodyAsString());
+  EXPECT_EQ(entry->cacheLength(), loaded.cacheLength());
+
+  // The body refers to the loaded string instead of a copy of it.
+  const auto* mem = static_cast<const char*>(loaded.cacheMessage()->body().frontSlice().mem_);
+  EXPECT_TRUE(mem >= begin && mem < end);
+
+  // The JSON form is still accepted.
+  HttpCacheEntry json;
+  json.loadFromString(std::move(entry->serializeAsString().value()));
+  ASSERT_NE(nullptr, json.cacheMessage());
+  EXPECT_EQ(body, json.cacheMessage()->bodyAsString());
+}
+
+TEST(HttpCacheEntryTest, BothFormsNormalizeFramingHeaders) {
+  auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+  headers->setStatus(200);
+  headers->setTransferEncoding("chunked");
+  headers->setContentType("text/plain");
+  auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+  message->body().add("hello world");
+  HttpCacheEntry entry(std::move(message), 0);
+
+  HttpCacheEntry json;
+  json.loadFromString(std::move(entry.serializeAsString().value()));
+  HttpCacheEntry binary;
+  ASSERT_TRUE(binary.loadFromBinary(entry.serializeAsBinary().value()));
+  ASSERT_NE(nullptr, json.cacheMessage());
+  ASSERT_NE(nullptr, binary.cacheMessage());
+
+  for (auto* loaded : {&json, &binary}) {
+    EXPECT_EQ(nullptr, loaded->cacheMessage()->headers().TransferEncoding());
+    EXPECT_EQ("11", loaded->cacheMessage()->headers().getContentLengthValue());
+  }
+  EXPECT_EQ(headerList(json.cacheMessage()->headers()),
+            headerList(binary.cacheMessage()->headers()));
+  EXPECT_EQ(json.cacheLength(), binary.cacheLength());
+}
+
+TEST(HttpCacheEntryTest, LargeBodyIsLoadedInChunks) {
+  std::string body(3 * BodyChunkSize + 100, 'x');
+  body.back() = 'y';
+  auto entry = createEntry(body);
+  auto binary = entry->serializeAsBinary();
+  ASSERT_TRUE(binary.has_value());
+
+  const auto expectChunks = [&body](HttpCacheEntry& loaded) {
+    auto& message = loaded.cacheMessage();
+    ASSERT_NE(nullptr, message);
+    EXPECT_EQ(body, message->bodyAsString());
+    const auto slices = message->body().getRawSlices();
+    ASSERT_EQ(4, slices.size());
+    for (const auto& slice : slices) {
+      EXPECT_LE(slice.len_, BodyChunkSize);
+    }
+    EXPECT_EQ(100, slices.back().len_);
+  };
+
+  // Chunks are copied from the data.
+  HttpCacheEntry copied;
+  ASSERT_TRUE(copied.loadFromBinary(binary.value()));
+  expectChunks(copied);
+
+  // Chunks refer to the loaded string.
+  HttpCacheEntry adopted;
+  adopted.loadFromString(std::move(binary.value()));
+  expectChunks(adopted);
+
+  HttpCacheEntry json;
+  json.loadFromString(std::move(entry->serializeAsString().value()));
+  expectChunks(json);
+}
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,324 @@
+#include "source/common/cache/frequency_sketch.h"
+#include "source/common/cache/local_cache_impl.h"
+#include "source/common/common/proxy_utility.h"
+
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/server/factory_context.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+class TestCacheEntry : public CacheEntry {
+public:
+  TestCacheEntry(uint64_t length, uint64_t expire) : length_(length), expire_(expire) {}
+
+  void loadFromString(std::string&&) override {}
+  CacheEntryPtr createCopy() const override {
+    return std::make_unique<TestCacheEntry>(length_, expire_);
+  }
+  void seal() override {}
+  uint64_t cacheExpire() const override { return expire_; }
+  void cacheExpire(uint64_t expire) override { expire_ = expire; }
+  uint64_t cacheLength() const override { return length_; }
+  absl::optional<std::string> serializeAsString() const override { return absl::nullopt; }
+
+private:
+  const uint64_t length_{0};
+  uint64_t expire_{0};
+};
+
+uint64_t farExpire() { return Common::TimeUtil::createTimestamp() + 3600 * 1000; }
+
+CacheEntryPtr entry(uint64_t length, uint64_t expire = farExpire()) {
+  return std::make_unique<TestCacheEntry>(length, expire);
+}
+
+TEST(LruCacheImplTest, InsertLookupAndRemove) {
+  LruCacheImpl cache(1000);
+
+  cache.insert("a", entry(100));
+  cache.insert("b", entry(200));
+  EXPECT_EQ(2, cache.cacheNumber());
+  EXPECT_EQ(300, cache.cacheLength());
+  EXPECT_NE(nullptr, cache.lookup("a"));
+  EXPECT_EQ(nullptr, cache.lookup("c"));
+
+  // Replace the old entry.
+  cache.insert("a", entry(50));
+  EXPECT_EQ(2, cache.cacheNumber());
+  EXPECT_EQ(250, cache.cacheLength());
+
+  cache.remove("a");
+  EXPECT_EQ(nullptr, cache.lookup("a"));
+  EXPECT_EQ(1, cache.cacheNumber());
+  EXPECT_EQ(200, cache.cacheLength());
+}
+
+TEST(LruCacheImplTest, EvictLeastRecentlyUsed) {
+  LruCacheImpl cache(1000);
+  for (size_t i = 0; i < 10; i++) {
+    cache.insert(absl::StrCat("key-", i), entry(100));
+  }
+  // Touch the oldest one and it will not be evicted.
+  EXPECT_NE(nullptr, cache.lookup("key-0"));
+
+  cache.insert("key-10", entry(100));
+  EXPECT_LE(cache.cacheLength(), 1000);
+  EXPECT_NE(nullptr, cache.lookup("key-0"));
+  EXPECT_NE(nullptr, cache.lookup("key-10"));
+  EXPECT_EQ(nullptr, cache.lookup("key-1"));
+}
+
+TEST(LruCacheImplTest, EvictOnlyEnoughSpace) {
+  LruCacheImpl cache(1000);
+  for (size_t i = 0; i < 10; i++) {
+    cache.insert(absl::StrCat("key-", i), entry(100));
+  }
+
+  // Only the 3 oldest entries are evicted to make room for the large entry.
+  cache.insert("large", entry(250));
+  EXPECT_EQ(8, cache.cacheNumber());
+  EXPECT_EQ(950, cache.cacheLength());
+  EXPECT_EQ(nullptr, cache.lookup("key-2"));
+  EXPECT_NE(nullptr, cache.lookup("key-3"));
+
+  // An entry larger than the whole cache is not inserted and only removes the stale data.
+  cache.insert("key-3", entry(1001));
+  EXPECT_EQ(nullptr, cache.lookup("key-3"));
+  EXPECT_EQ(7, cache.cacheNumber());
+  EXPECT_EQ(850, cache.cacheLength());
+}
+
+TEST(LruCacheImplTest, Clear) {
+  LruCacheImpl cache(1000, true);
+  for (size_t i = 0; i < 5; i++) {
+    cache.insert(absl::StrCat("key-", i), entry(100));
+  }
+  cache.clear();
+  EXPECT_EQ(0, cache.cacheNumber());
+  EXPECT_EQ(0, cache.cacheLength());
+  EXPECT_EQ(nullptr, cache.lookup("key-0"));
+
+  // The cache is still usable after it is cleared.
+  cache.insert("key-0", entry(100));
+  EXPECT_NE(nullptr, cache.lookup("key-0"));
+  EXPECT_EQ(100, cache.cacheLength());
+}
+
+TEST(LruCacheImplTest, ExpiredEntry) {
+  LruCacheImpl cache(1000);
+  cache.insert("a", entry(100, 0));
+  EXPECT_EQ(nullptr, cache.lookup("a"));
+  EXPECT_EQ(0, cache.cacheNumber());
+  EXPECT_EQ(0, cache.cacheLength());
+}
+
+TEST(LruCacheImplTest, ReclaimExpired) {
+  LruCacheImpl cache(10000);
+  for (uint64_t i = 0; i < 10; i++) {
+    // Insert in reverse order of expire time.
+    cache.insert(absl::StrCat("key-", i), entry(100, 1000 - i));
+  }
+  cache.insert("live", entry(100, 5000));
+
+  auto result = cache.reclaimExpired(995, 3);
+  EXPECT_EQ(3, result.number_);
+  EXPECT_EQ(300, result.length_);
+  EXPECT_EQ(8, cache.cacheNumber());
+
+  // Update the expire time of a reclaimable entry.
+  cache.insert("key-0", entry(100, 4000));
+
+  result = cache.reclaimExpired(1000, 100);
+  EXPECT_EQ(6, result.number_);
+  EXPECT_EQ(2, cache.cacheNumber());
+
+  result = cache.reclaimExpired(4000, 100);
+  EXPECT_EQ(1, result.number_);
+  EXPECT_EQ(1, cache.cacheNumber());
+  EXPECT_EQ(100, cache.cacheLength());
+}
+
+TEST(LruCacheImplTest, RemovedCallback) {
+  std::vector<std::string> removed;
+  LruCacheImpl cache(1000, false, [&removed](absl::string_view key) {
+    removed.emplace_back(key);
+  });
+
+  cache.insert("a", entry(600));
+  cache.insert("a", entry(600));
+  cache.insert("b", entry(600));
+  cache.insert("c", entry(100, 1));
+  cache.reclaimExpired(Common::TimeUtil::createTimestamp(), 10);
+  cache.remove("b");
+  // Replaced, evicted, reclaimed and removed.
+  EXPECT_EQ(std::vector<std::string>({"a", "a", "c", "b"}), removed);
+}
+
+// Access 99 hot keys 3 times and then scan 100 keys that are accessed only once. Return the number
+// of hot keys that are still in the cache.
+size_t hotKeysAfterScan(bool tiny_lfu) {
+  // 100 entries in total and 1 entry in the window.
+  LruCacheImpl cache(100 * 100, tiny_lfu);
+  for (size_t i = 0; i < 99; i++) {
+    const std::string key = absl::StrCat("hot-", i);
+    for (size_t j = 0; j < 3; j++) {
+      cache.lookup(key);
+    }
+    cache.insert(key, entry(100));
+  }
+
+  for (size_t i = 0; i < 100; i++) {
+    const std::string key = absl::StrCat("scan-", i);
+    EXPECT_EQ(nullptr, cache.lookup(key));
+    cache.insert(key, entry(100));
+    EXPECT_LE(cache.cacheLength(), 100 * 100);
+  }
+
+  size_t hits = 0;
+  for (size_t i = 0; i < 99; i++) {
+    hits += cache.lookup(absl::StrCat("hot-", i)) != nullptr;
+  }
+  return hits;
+}
+
+TEST(LruCacheImplTest, TinyLfuKeepsFrequentEntries) {
+  EXPECT_EQ(0, hotKeysAfterScan(false));
+  // The sketch is approximate, so a few hot keys may lose to colliding scan keys.
+  EXPECT_GE(hotKeysAfterScan(true), 95);
+}
+
+TEST(WorkerCacheTest, GenerationAndExpire) {
+  WorkerCache cache(2);
+  const uint64_t now = Common::TimeUtil::createTimestamp();
+  CacheEntryConstSharedPtr value = entry(100);
+
+  cache.insert("a", value, 1);
+  EXPECT_EQ(value, cache.lookup("a", 1, now));
+  // The key is removed or replaced in the shared cache.
+  EXPECT_EQ(nullptr, cache.lookup("a", 2, now));
+  EXPECT_EQ(0, cache.size());
+
+  cache.insert("a", value, 2);
+  EXPECT_EQ(nullptr, cache.lookup("a", 2, value->cacheExpire()));
+  EXPECT_EQ(0, cache.size());
+}
+
+TEST(WorkerCacheTest, EvictLeastRecentlyUsed) {
+  WorkerCache cache(2);
+  const uint64_t now = Common::TimeUtil::createTimestamp();
+
+  cache.insert("a", entry(100), 0);
+  cache.insert("b", entry(100), 0);
+  EXPECT_NE(nullptr, cache.lookup("a", 0, now));
+  cache.insert("c", entry(100), 0);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_NE(nullptr, cache.lookup("a", 0, now));
+  EXPECT_EQ(nullptr, cache.lookup("b", 0, now));
+  EXPECT_NE(nullptr, cache.lookup("c", 0, now));
+}
+
+TEST(LocalCacheTest, WorkerCacheInvalidation) {
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  LocalConfig config;
+  config.mutable_worker_cache_size()->set_value(16);
+  LocalCache cache(config, context);
+
+  cache.insertCache("a", entry(100));
+  EXPECT_EQ(100, cache.lookupCache("a")->cacheLength());
+  // Served by the worker cache.
+  EXPECT_EQ(100, cache.lookupCache("a")->cacheLength());
+
+  cache.insertCache("a", entry(50));
+  EXPECT_EQ(50, cache.lookupCache("a")->cacheLength());
+
+  cache.removeCache("a");
+  EXPECT_EQ(nullptr, cache.lookupCache("a"));
+
+  cache.insertCache("b", entry(100));
+  EXPECT_EQ(100, cache.lookupCache("b")->cacheLength());
+  cache.clearCache();
+  EXPECT_EQ(nullptr, cache.lookupCache("b"));
+}
+
+TEST(LocalCacheTest, WorkerCacheDropsEvictedEntries) {
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  LocalConfig config;
+  config.mutable_worker_cache_size()->set_value(16);
+  config.mutable_shard_number()->set_value(1);
+  config.mutable_max_cache_size()->set_value(1000);
+  LocalCache cache(config, context);
+
+  cache.insertCache("a", entry(600));
+  EXPECT_NE(nullptr, cache.lookupCache("a"));
+  // The entry of the key is evicted from the shard, and the worker cache must not serve it.
+  cache.insertCache("b", entry(600));
+  EXPECT_EQ(nullptr, cache.lookupCache("a"));
+  EXPECT_NE(nullptr, cache.lookupCache("b"));
+}
+
+TEST(LocalCacheTest, SweepExpiredInRoundRobin) {
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  auto* timer = new testing::NiceMock<Event::MockTimer>(&context.dispatcher_);
+  LocalConfig config;
+  config.mutable_shard_number()->set_value(8);
+  LocalCache cache(config, context);
+
+  // Keys with different first chars are stored in different shards.
+  for (char c = 'a'; c < 'a' + 8; c++) {
+    cache.insertCache(std::string(1, c), entry(100, 1));
+    cache.insertCache(absl::StrCat(std::string(1, c), "-live"), entry(100));
+  }
+  auto reclaimed = [&context](const std::string& name) {
+    return context.scope().counterFromString("local_cache.expired_" + name + "_reclaimed").value();
+  };
+
+  // Every run sweeps only 4 of the 8 shards and re-arms the timer.
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(1000), testing::_)).Times(3);
+  timer->invokeCallback();
+  EXPECT_EQ(4, reclaimed("entries"));
+  EXPECT_EQ(400, reclaimed("bytes"));
+  timer->invokeCallback();
+  EXPECT_EQ(8, reclaimed("entries"));
+  timer->invokeCallback();
+  EXPECT_EQ(8, reclaimed("entries"));
+
+  for (char c = 'a'; c < 'a' + 8; c++) {
+    EXPECT_NE(nullptr, cache.lookupCache(absl::StrCat(std::string(1, c), "-live")));
+  }
+}
+
+TEST(FrequencySketchTest, EstimateAndAging) {
+  FrequencySketch sketch(512);
+  for (size_t i = 0; i < 10; i++) {
+    sketch.increment(1);
+  }
+  sketch.increment(2);
+  EXPECT_EQ(10, sketch.frequency(1));
+  EXPECT_EQ(1, sketch.frequency(2));
+  EXPECT_EQ(0, sketch.frequency(3));
+
+  // Counters are saturated at 15.
+  for (size_t i = 0; i < 10; i++) {
+    sketch.increment(1);
+  }
+  EXPECT_EQ(15, sketch.frequency(1));
+
+  // Counters are halved after enough increments.
+  for (uint64_t i = 0; i < 10 * sketch.capacity(); i++) {
+    sketch.increment(1000 + i);
+  }
+  EXPECT_LT(sketch.frequency(1), 15);
+}
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
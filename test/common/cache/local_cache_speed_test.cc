@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "source/common/cache/local_cache_impl.h"
+#include "source/common/common/hash.h"
+#include "source/common/common/hex.h"
+#include "source/common/common/proxy_utility.h"
+
+#include "test/benchmark/main.h"
+#include "test/mocks/server/factory_context.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+constexpr uint64_t BenchmarkEntryLength = 1024;
+
+class BenchmarkCacheEntry : public CacheEntry {
+public:
+  BenchmarkCacheEntry(uint64_t expire, uint64_t length = BenchmarkEntryLength)
+      : expire_(expire), length_(length) {}
+
+  void loadFromString(std::string&&) override {}
+  CacheEntryPtr createCopy() const override {
+    return std::make_unique<BenchmarkCacheEntry>(expire_, length_);
+  }
+  void seal() override {}
+  uint64_t cacheExpire() const override { return expire_; }
+  void cacheExpire(uint64_t expire) override { expire_ = expire; }
+  uint64_t cacheLength() const override { return length_; }
+  absl::optional<std::string> serializeAsString() const override { return absl::nullopt; }
+
+private:
+  uint64_t expire_{0};
+  const uint64_t length_{0};
+};
+
+// Keys look like the MD5 hex keys that HttpCacheUtil::cacheKey generates.
+const std::vector<std::string>& benchmarkKeys() {
+  static const std::vector<std::string>* keys = [] {
+    auto* keys = new std::vector<std::string>();
+    const size_t key_number = benchmark::skipExpensiveBenchmarks() ? 1024 : 64 * 1024;
+    keys->reserve(key_number);
+    for (size_t i = 0; i < key_number; i++) {
+      const std::string seed = std::to_string(i);
+      keys->push_back(Hex::uint64ToHex(HashUtil::xxHash64(seed)) +
+                      Hex::uint64ToHex(HashUtil::xxHash64(seed, 1)));
+    }
+    return keys;
+  }();
+  return *keys;
+}
+
+// The cache instances are shared by all benchmark threads and created at most once for every
+// combination of shard policy and shard number.
+LocalCache& benchmarkCache(int64_t policy, int64_t shard_number) {
+  static Thread::MutexBasicLockable mutex;
+  static auto* context = new testing::NiceMock<Server::Configuration::MockFactoryContext>();
+  static auto* caches = new absl::flat_hash_map<std::pair<int64_t, int64_t>, LocalCache*>();
+
+  Thread::LockGuard lock(mutex);
+  auto& cache = (*caches)[{policy, shard_number}];
+  if (cache == nullptr) {
+    LocalConfig config;
+    config.set_shard_policy(static_cast<LocalConfig::ShardPolicy>(policy));
+    config.mutable_shard_number()->set_value(shard_number);
+    // Large enough to hold all keys and then every lookup is a hit.
+    config.mutable_max_cache_size()->set_value(4 * BenchmarkEntryLength * shard_number *
+                                               benchmarkKeys().size());
+    cache = new LocalCache(config, *context);
+
+    const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+    for (const auto& key : benchmarkKeys()) {
+      cache->insertCache(key, std::make_unique<BenchmarkCacheEntry>(expire));
+    }
+  }
+  return *cache;
+}
+
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LocalCacheLookup(::benchmark::State& state) {
+  auto& cache = benchmarkCache(state.range(0), state.range(1));
+  const auto& keys = benchmarkKeys();
+  size_t index = HashUtil::xxHash64(std::to_string(reinterpret_cast<uintptr_t>(&state)));
+
+  for (auto _ : state) { // NOLINT
+    ::benchmark::DoNotOptimize(cache.lookupCache(keys[index++ % keys.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LocalCacheMixed(::benchmark::State& state) {
+  auto& cache = benchmarkCache(state.range(0), state.range(1));
+  const auto& keys = benchmarkKeys();
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+  size_t index = HashUtil::xxHash64(std::to_string(reinterpret_cast<uintptr_t>(&state)));
+
+  // 90% lookups and 10% inserts.
+  for (auto _ : state) { // NOLINT
+    const auto& key = keys[index++ % keys.size()];
+    if (index % 10 == 0) {
+      cache.insertCache(key, std::make_unique<BenchmarkCacheEntry>(expire));
+    } else {
+      ::benchmark::DoNotOptimize(cache.lookupCache(key));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Fill a single LRU shard with 1M entries and then lookup with the given hit ratio in percent.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LruCacheHitMiss(::benchmark::State& state) {
+  const size_t entry_number = benchmark::skipExpensiveBenchmarks() ? 1024 : 1024 * 1024;
+  const int64_t hit_ratio = state.range(0);
+
+  std::vector<std::string> keys;
+  keys.reserve(entry_number * 2);
+  for (size_t i = 0; i < entry_number * 2; i++) {
+    const std::string seed = std::to_string(i);
+    keys.push_back(Hex::uint64ToHex(HashUtil::xxHash64(seed)) +
+                   Hex::uint64ToHex(HashUtil::xxHash64(seed, 1)));
+  }
+
+  LruCacheImpl cache(BenchmarkEntryLength * entry_number * 2);
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+  // Only the first half of keys is inserted and the second half of keys is always missed.
+  for (size_t i = 0; i < entry_number; i++) {
+    cache.insert(keys[i], std::make_unique<BenchmarkCacheEntry>(expire));
+  }
+
+  size_t index = 0;
+  for (auto _ : state) { // NOLINT
+    index++;
+    const size_t offset = static_cast<int64_t>(index % 100) < hit_ratio ? 0 : entry_number;
+    ::benchmark::DoNotOptimize(cache.lookup(keys[offset + (index * 7919) % entry_number]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LruCacheHitMiss)->Arg(100)->Arg(90)->Arg(50)->Arg(0)->Unit(::benchmark::kNanosecond);
+
+// Trace with a Zipf distributed hot set that is interleaved with scans of keys which are accessed
+// only once. This is what crawler traffic looks like to the cache.
+const std::vector<std::string>& scanPollutedTrace() {
+  static const std::vector<std::string>* trace = [] {
+    const size_t key_number = benchmark::skipExpensiveBenchmarks() ? 1000 : 100000;
+    const size_t trace_length = key_number * 10;
+
+    std::vector<double> cdf(key_number);
+    double sum = 0;
+    for (size_t i = 0; i < key_number; i++) {
+      sum += 1.0 / std::pow(i + 1, 0.9);
+      cdf[i] = sum;
+    }
+
+    auto* trace = new std::vector<std::string>();
+    trace->reserve(trace_length);
+    std::mt19937_64 random(trace_length);
+    std::uniform_real_distribution<double> distribution(0, sum);
+    size_t scan_key = 0;
+    for (size_t i = 0; i < trace_length; i++) {
+      if (i % 3 == 0) {
+        trace->push_back(absl::StrCat("scan-", scan_key++));
+        continue;
+      }
+      const size_t rank =
+          std::lower_bound(cdf.begin(), cdf.end(), distribution(random)) - cdf.begin();
+      trace->push_back(absl::StrCat("hot-", rank));
+    }
+    return trace;
+  }();
+  return *trace;
+}
+
+// Replay the trace and insert on every miss. The hit ratio is reported as a counter and the time
+// per item is the latency of a lookup plus the insert on miss.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LruCacheTraceReplay(::benchmark::State& state) {
+  const auto& trace = scanPollutedTrace();
+  // Space for 1% of the distinct keys of the hot set.
+  LruCacheImpl cache(BenchmarkEntryLength * trace.size() / 1000,
+                     state.range(0) == LocalConfig::TINY_LFU);
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+
+  size_t index = 0;
+  uint64_t hits = 0;
+  for (auto _ : state) { // NOLINT
+    const auto& key = trace[index++ % trace.size()];
+    if (cache.lookup(key) != nullptr) {
+      hits++;
+    } else {
+      cache.insert(key, std::make_unique<BenchmarkCacheEntry>(expire));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_ratio"] = static_cast<double>(hits) / std::max<size_t>(index, 1);
+}
+BENCHMARK(BM_LruCacheTraceReplay)
+    ->Arg(LocalConfig::ADMIT_ALL)
+    ->Arg(LocalConfig::TINY_LFU)
+    ->Iterations(1000000);
+
+// Lookup hits through the asynchronous interface, which posts the result to the dispatcher, or the
+// inline interface. The time spent in the event loop of a real dispatcher is not included.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LocalCacheAsyncOrInlineLookup(::benchmark::State& state) {
+  auto& cache = benchmarkCache(LocalConfig::KEY_HASH, 16);
+  const auto& keys = benchmarkKeys();
+  const bool inline_lookup = state.range(0) != 0;
+
+  size_t index = 0;
+  size_t hits = 0;
+  for (auto _ : state) { // NOLINT
+    const auto& key = keys[index++ % keys.size()];
+    if (inline_lookup) {
+      hits += cache.lookupCacheInline(key).value() != nullptr;
+    } else {
+      cache.lookupCache(key, [&hits](std::string, CacheEntryPtr&& entry) {
+        hits += entry != nullptr;
+      });
+    }
+  }
+  ::benchmark::DoNotOptimize(hits);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LocalCacheAsyncOrInlineLookup)->Arg(0)->Arg(1);
+
+// Lookup a full cache while another thread keeps inserting entries and every 8th entry is 256 times
+// larger than the others. Every large insert has to evict many entries from its shard. The lookup
+// latency percentiles are reported as counters.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LocalCacheLookupLatencyUnderInsertPressure(::benchmark::State& state) {
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  const auto& keys = benchmarkKeys();
+  LocalConfig config;
+  config.set_shard_policy(LocalConfig::KEY_HASH);
+  config.mutable_shard_number()->set_value(16);
+  config.mutable_max_cache_size()->set_value(BenchmarkEntryLength * keys.size());
+  LocalCache cache(config, context);
+
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+  for (const auto& key : keys) {
+    cache.insertCache(key, std::make_unique<BenchmarkCacheEntry>(expire));
+  }
+
+  std::atomic<bool> stopped{false};
+  std::thread inserter([&]() {
+    size_t index = 0;
+    while (!stopped.load(std::memory_order_relaxed)) {
+      const uint64_t length = index % 8 == 0 ? BenchmarkEntryLength * 256 : BenchmarkEntryLength;
+      cache.insertCache(keys[(index * 7919) % keys.size()],
+                        std::make_unique<BenchmarkCacheEntry>(expire, length));
+      index++;
+    }
+  });
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(1024 * 1024);
+  size_t index = 0;
+  for (auto _ : state) { // NOLINT
+    const auto& key = keys[index++ % keys.size()];
+    const auto start = std::chrono::steady_clock::now();
+    ::benchmark::DoNotOptimize(cache.lookupCache(key));
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+  }
+  stopped = true;
+  inserter.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  if (!latencies.empty()) {
+    state.counters["p50_ns"] = latencies[latencies.size() / 2];
+    state.counters["p99_ns"] = latencies[latencies.size() * 99 / 100];
+    state.counters["p999_ns"] = latencies[latencies.size() * 999 / 1000];
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LocalCacheLookupLatencyUnderInsertPressure)->UseRealTime();
+
+// Lookup a hot set of 256 keys with the given worker cache size.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_LocalCacheHotLookup(::benchmark::State& state) {
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  const auto& keys = benchmarkKeys();
+  const size_t hot_number = std::min<size_t>(256, keys.size());
+  LocalConfig config;
+  config.set_shard_policy(LocalConfig::KEY_HASH);
+  config.mutable_worker_cache_size()->set_value(state.range(0));
+  LocalCache cache(config, context);
+
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 3600 * 1000;
+  for (size_t i = 0; i < hot_number; i++) {
+    cache.insertCache(keys[i], std::make_unique<BenchmarkCacheEntry>(expire));
+  }
+
+  size_t index = 0;
+  for (auto _ : state) { // NOLINT
+    ::benchmark::DoNotOptimize(cache.lookupCache(keys[index++ % hot_number]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LocalCacheHotLookup)->Arg(0)->Arg(512);
+
+// Args: {shard policy, shard number}. {FIRST_CHAR, 16} is the legacy layout.
+#define LOCAL_CACHE_BENCHMARK_ARGS                                                                 \
+  Args({LocalConfig::FIRST_CHAR, 16})                                                              \
+      ->Args({LocalConfig::KEY_HASH, 16})                                                          \
+      ->Args({LocalConfig::KEY_HASH, 64})                                                          \
+      ->Args({LocalConfig::KEY_HASH, 256})                                                         \
+      ->ThreadRange(1, 64)                                                                         \
+      ->UseRealTime()
+
+BENCHMARK(BM_LocalCacheLookup)->LOCAL_CACHE_BENCHMARK_ARGS;
+BENCHMARK(BM_LocalCacheMixed)->LOCAL_CACHE_BENCHMARK_ARGS;
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,199 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "source/common/cache/mmap_cache_impl.h"
+#include "source/common/common/proxy_utility.h"
+
+#include "test/mocks/server/factory_context.h"
+#include "test/test_common/environment.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Cache {
+namespace {
+
+class TestCacheEntry : public CacheEntry {
+public:
+  TestCacheEntry() = default;
+  TestCacheEntry(std::string payload, uint64_t expire)
+      : payload_(std::move(payload)), expire_(expire) {}
+
+  void loadFromString(std::string&& value) override { payload_ = std::move(value); }
+  CacheEntryPtr createCopy() const override {
+    return std::make_unique<TestCacheEntry>(payload_, expire_);
+  }
+  void seal() override {}
+  uint64_t cacheExpire() const override { return expire_; }
+  void cacheExpire(uint64_t expire) override { expire_ = expire; }
+  uint64_t cacheLength() const override { return payload_.size(); }
+  absl::optional<std::string> serializeAsString() const override { return payload_; }
+
+  const std::string& payload() const { return payload_; }
+
+private:
+  std::string payload_;
+  uint64_t expire_{0};
+};
+
+uint64_t farExpire() { return Common::TimeUtil::createTimestamp() + 3600 * 1000; }
+
+CacheEntryPtr entry(std::string payload) {
+  return std::make_unique<TestCacheEntry>(std::move(payload), farExpire());
+}
+
+std::string payloadOf(const CacheEntryPtr& entry) {
+  return entry == nullptr ? "" : dynamic_cast<TestCacheEntry*>(entry.get())->payload();
+}
+
+class MmapCacheTest : public testing::Test {
+protected:
+  MmapCacheTest() : path_(TestEnvironment::temporaryPath("mmap_cache_test")) {
+    ::unlink(path_.c_str());
+    config_.set_path(path_);
+    config_.mutable_max_cache_size()->set_value(4 * 4096);
+    config_.mutable_slab_size()->set_value(4096);
+  }
+  ~MmapCacheTest() override { ::unlink(path_.c_str()); }
+
+  std::unique_ptr<MmapCache> createCache() {
+    return std::make_unique<MmapCache>(config_, context_,
+                                       []() { return std::make_unique<TestCacheEntry>(); });
+  }
+
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context_;
+  const std::string path_;
+  MmapConfig config_;
+};
+
+TEST_F(MmapCacheTest, InsertLookupAndRemove) {
+  auto cache = createCache();
+  EXPECT_TRUE(cache->writable());
+
+  cache->insertCache("a", entry("value-a"));
+  cache->insertCache("b", entry("value-b"));
+  EXPECT_EQ("value-a", payloadOf(cache->lookupCache("a")));
+  EXPECT_EQ("value-b", payloadOf(cache->lookupCache("b")));
+  EXPECT_EQ(nullptr, cache->lookupCache("c"));
+
+  cache->insertCache("a", entry("new-value-a"));
+  EXPECT_EQ("new-value-a", payloadOf(cache->lookupCache("a")));
+
+  cache->removeCache("a");
+  EXPECT_EQ(nullptr, cache->lookupCache("a"));
+
+  // Expired entries are not cached.
+  cache->insertCache("d", std::make_unique<TestCacheEntry>("value-d", 1));
+  EXPECT_EQ(nullptr, cache->lookupCache("d"));
+}
+
+TEST_F(MmapCacheTest, ReopenFile) {
+  auto cache = createCache();
+  auto expected = entry("value-a");
+  const uint64_t expire = expected->cacheExpire();
+  cache->insertCache("a", std::move(expected));
+  cache.reset();
+
+  cache = createCache();
+  auto result = cache->lookupCache("a");
+  EXPECT_EQ("value-a", payloadOf(result));
+  EXPECT_EQ(expire, result->cacheExpire());
+
+  // The file is reinitialized if the layout is changed.
+  cache.reset();
+  config_.mutable_max_cache_size()->set_value(8 * 4096);
+  cache = createCache();
+  EXPECT_EQ(nullptr, cache->lookupCache("a"));
+}
+
+TEST_F(MmapCacheTest, RecycleOldestSlab) {
+  auto cache = createCache();
+  const std::string payload(1000, 'x');
+  // 3 entries in every slab and the first slab is recycled by the 13th entry.
+  for (size_t i = 0; i < 13; i++) {
+    cache->insertCache(absl::StrCat("key-", i), entry(payload));
+  }
+  EXPECT_EQ(nullptr, cache->lookupCache("key-0"));
+  EXPECT_EQ(nullptr, cache->lookupCache("key-2"));
+  EXPECT_EQ(payload, payloadOf(cache->lookupCache("key-3")));
+  EXPECT_EQ(payload, payloadOf(cache->lookupCache("key-12")));
+
+  // Entries larger than a slab are not cached.
+  cache->insertCache("large", entry(std::string(4096, 'x')));
+  EXPECT_EQ(nullptr, cache->lookupCache("large"));
+}
+
+TEST_F(MmapCacheTest, OnlyOwnerCanModifyFile) {
+  auto owner = createCache();
+  owner->insertCache("a", entry("value-a"));
+
+  auto reader = createCache();
+  EXPECT_FALSE(reader->writable());
+  EXPECT_EQ("value-a", payloadOf(reader->lookupCache("a")));
+
+  reader->insertCache("b", entry("value-b"));
+  reader->removeCache("a");
+  EXPECT_EQ(nullptr, owner->lookupCache("b"));
+  EXPECT_EQ("value-a", payloadOf(owner->lookupCache("a")));
+
+  // Entries written by the owner are visible to the reader.
+  owner->insertCache("c", entry("value-c"));
+  EXPECT_EQ("value-c", payloadOf(reader->lookupCache("c")));
+}
+
+TEST_F(MmapCacheTest, ClearCache) {
+  auto owner = createCache();
+  owner->insertCache("a", entry("value-a"));
+  owner->insertCache("b", entry("value-b"));
+
+  // Only the owner can clear the file.
+  auto reader = createCache();
+  reader->clearCache();
+  EXPECT_EQ("value-a", payloadOf(owner->lookupCache("a")));
+
+  owner->clearCache();
+  EXPECT_EQ(nullptr, owner->lookupCache("a"));
+  EXPECT_EQ(nullptr, reader->lookupCache("b"));
+
+  // New entries are appended to the same slab and are still cached.
+  owner->insertCache("c", entry("value-c"));
+  EXPECT_EQ("value-c", payloadOf(owner->lookupCache("c")));
+  EXPECT_EQ(nullptr, owner->lookupCache("b"));
+
+  // Cleared entries are not loaded again after reopen.
+  reader.reset();
+  owner.reset();
+  owner = createCache();
+  EXPECT_EQ(nullptr, owner->lookupCache("a"));
+  EXPECT_EQ("value-c", payloadOf(owner->lookupCache("c")));
+}
+
+TEST_F(MmapCacheTest, CorruptedRecord) {
+  auto cache = createCache();
+  cache->insertCache("a", entry("value-a"));
+  cache.reset();
+
+  // Flip the last byte of the first record in the first slab.
+  const int fd = ::open(path_.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  const off_t file_size = ::lseek(fd, 0, SEEK_END);
+  const off_t record_end = file_size - 4 * 4096 + sizeof(MmapLayout::RecordHeader) + 1 + 7 - 1;
+  char byte = 0;
+  ASSERT_EQ(1, ::pread(fd, &byte, 1, record_end));
+  EXPECT_EQ('a', byte);
+  byte = 'b';
+  ASSERT_EQ(1, ::pwrite(fd, &byte, 1, record_end));
+  ::close(fd);
+
+  cache = createCache();
+  EXPECT_EQ(nullptr, cache->lookupCache("a"));
+}
+
+} // namespace
+} // namespace Cache
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "source/common/redis/async_client.h"
+
+#include "test/benchmark/main.h"
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+// Number of write syscalls of this process.
+uint64_t writeSyscalls() {
+  std::ifstream io("/proc/self/io");
+  std::string line;
+  while (std::getline(io, line)) {
+    uint64_t value = 0;
+    if (absl::StartsWith(line, "syscw: ") && absl::SimpleAtoi(line.substr(7), &value)) {
+      return value;
+    }
+  }
+  return 0;
+}
+
+// Run against a local redis-server, for example REDIS_SERVER=127.0.0.1:6379. Every iteration sends
+// a burst of GET commands of cached keys in one event loop iteration and waits for all replies.
+// Args: burst size, pipeline max_size (0 disables pipelining).
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_AsyncClientGetBurst(::benchmark::State& state) {
+  const char* server = std::getenv("REDIS_SERVER");
+  if (server == nullptr) {
+    state.SkipWithError("REDIS_SERVER is not set");
+    return;
+  }
+  std::vector<absl::string_view> address = absl::StrSplit(server, ':');
+  AsyncClient::Endpoint endpoint{std::string(address[0]), 6379};
+  if (address.size() != 2 || !absl::SimpleAtoi(address[1], &endpoint.port_)) {
+    state.SkipWithError("REDIS_SERVER must be <host>:<port>");
+    return;
+  }
+
+  const size_t burst = state.range(0);
+  event_base* base = event_base_new();
+  {
+    AsyncClient client(endpoint, "", base, 1000);
+    client.setPipeline({static_cast<uint64_t>(state.range(1)), 0});
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (client.clientStatus() != AsyncClient::WORKING &&
+           std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    if (client.clientStatus() != AsyncClient::WORKING) {
+      state.SkipWithError("Cannot connect to REDIS_SERVER");
+    }
+
+    const std::string value(1024, 'v');
+    for (size_t i = 0; i < burst; i++) {
+      client.set(absl::StrCat("async-client-speed-test-", i), value, 60000);
+    }
+
+    size_t replies = 0;
+    size_t hits = 0;
+    const uint64_t writes = writeSyscalls();
+    for (auto _ : state) { // NOLINT
+      if (client.clientStatus() != AsyncClient::WORKING) {
+        break;
+      }
+      replies = 0;
+      for (size_t i = 0; i < burst; i++) {
+        client.get(absl::StrCat("async-client-speed-test-", i),
+                   [&replies, &hits](absl::optional<AsyncClient::Reply> reply,
+                                     absl::optional<AsyncClient::Error>) {
+                     replies++;
+                     hits += reply.has_value();
+                   });
+      }
+      while (replies < burst) {
+        event_base_loop(base, EVLOOP_ONCE);
+      }
+    }
+
+    const double operations = state.iterations() * burst;
+    state.counters["write_syscalls_per_op"] =
+        operations > 0 ? (writeSyscalls() - writes) / operations : 0;
+    state.counters["hit_ratio"] = operations > 0 ? hits / operations : 0;
+    state.SetItemsProcessed(operations);
+  }
+  event_base_free(base);
+}
+BENCHMARK(BM_AsyncClientGetBurst)
+    ->Args({1, 0})
+    ->Args({16, 0})
+    ->Args({16, 16})
+    ->Args({128, 0})
+    ->Args({128, 32})
+    ->Args({128, 128})
+    ->UseRealTime();
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,200 @@
+#include <string>
+#include <vector>
+
+#include "source/common/redis/async_client.h"
+
+#include "test/common/redis/fake_server.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+// Parse a reply with the reply object functions of the client.
+class ReplyReader {
+public:
+  ReplyReader() : reader_(redisReaderCreate()) {
+    reader_->fn = AsyncClient::replyObjectFunctions();
+  }
+  ~ReplyReader() {
+    if (reply_ != nullptr) {
+      reader_->fn->freeObject(reply_);
+    }
+    redisReaderFree(reader_);
+  }
+
+  redisReply* read(const std::string& data) {
+    EXPECT_EQ(REDIS_OK, redisReaderFeed(reader_, data.data(), data.size()));
+    EXPECT_EQ(REDIS_OK, redisReaderGetReply(reader_, &reply_));
+    return static_cast<redisReply*>(reply_);
+  }
+
+private:
+  redisReader* reader_{nullptr};
+  void* reply_{nullptr};
+};
+
+TEST(AsyncClientTest, TakeStringOfBulkString) {
+  const std::string value(4096, 'v');
+  ReplyReader reader;
+  redisReply* reply = reader.read(absl::StrCat("$", value.size(), "\r\n", value, "\r\n"));
+  ASSERT_NE(nullptr, reply);
+  ASSERT_EQ(REDIS_REPLY_STRING, reply->type);
+  ASSERT_EQ(value, std::string(reply->str, reply->len));
+
+  // The string is moved out of the reply and nothing is copied.
+  const char* str = reply->str;
+  auto taken = AsyncClient::takeString(reply);
+  ASSERT_TRUE(taken.has_value());
+  EXPECT_EQ(value, taken.value());
+  EXPECT_EQ(str, taken->data());
+  EXPECT_EQ(nullptr, reply->str);
+  EXPECT_EQ(0u, reply->len);
+  EXPECT_FALSE(AsyncClient::takeString(reply).has_value());
+}
+
+TEST(AsyncClientTest, NestedReplies) {
+  ReplyReader reader;
+  redisReply* reply = reader.read("*4\r\n:1\r\n$-1\r\n+OK\r\n*2\r\n$3\r\nfoo\r\n-ERR bar\r\n");
+  ASSERT_NE(nullptr, reply);
+  ASSERT_EQ(REDIS_REPLY_ARRAY, reply->type);
+  ASSERT_EQ(4u, reply->elements);
+
+  EXPECT_EQ(REDIS_REPLY_INTEGER, reply->element[0]->type);
+  EXPECT_EQ(1, reply->element[0]->integer);
+  EXPECT_EQ(REDIS_REPLY_NIL, reply->element[1]->type);
+  EXPECT_FALSE(AsyncClient::takeString(reply->element[1]).has_value());
+  EXPECT_EQ(REDIS_REPLY_STATUS, reply->element[2]->type);
+  EXPECT_EQ("OK", std::string(reply->element[2]->str, reply->element[2]->len));
+
+  const redisReply* nested = reply->element[3];
+  ASSERT_EQ(REDIS_REPLY_ARRAY, nested->type);
+  ASSERT_EQ(2u, nested->elements);
+  EXPECT_EQ("foo", AsyncClient::takeString(nested->element[0]).value());
+  EXPECT_EQ(REDIS_REPLY_ERROR, nested->element[1]->type);
+  EXPECT_EQ("ERR bar", std::string(nested->element[1]->str, nested->element[1]->len));
+}
+
+TEST(AsyncClientTest, StringReplyCallback) {
+  // Long enough to be stored out of the string, so the pointer survives the move.
+  const std::string value(64, 'v');
+  ReplyReader reader;
+  redisReply* reply = reader.read(absl::StrCat("$", value.size(), "\r\n", value, "\r\n"));
+  const char* str = reply->str;
+
+  absl::optional<AsyncClient::Reply> result;
+  AsyncClient::stringReplyCallback(
+      [&result](absl::optional<AsyncClient::Reply> value, absl::optional<AsyncClient::Error>) {
+        result = std::move(value);
+      })(reply, absl::nullopt);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(value, result.value());
+  EXPECT_EQ(str, result->data());
+}
+
+TEST(AsyncClientTest, FormatCommand) {
+  const std::string value("a\r\nb");
+  EXPECT_EQ("*4\r\n$3\r\nSET\r\n$3\r\nkey\r\n$4\r\na\r\nb\r\n$0\r\n\r\n",
+            AsyncClient::formatCommand({"SET", "key", value, ""}));
+}
+
+class AsyncClientPipelineTest : public testing::Test {
+public:
+  AsyncClientPipelineTest()
+      : base_(event_base_new()),
+        server_(base_, [](FakeServer::Connection&, const FakeServer::Command& command) {
+          return FakeServer::bulk(absl::StrCat(command[0], ":", command[1]));
+        }) {
+    client_ = std::make_unique<AsyncClient>(AsyncClient::Endpoint{"127.0.0.1", server_.port()},
+                                            "", base_);
+    EXPECT_TRUE(FakeServer::runUntil(
+        base_, [this] { return client_->clientStatus() == AsyncClient::WORKING; }));
+  }
+
+  ~AsyncClientPipelineTest() override {
+    client_.reset();
+    event_base_free(base_);
+  }
+
+  void get(const std::string& key) {
+    client_->get(key, [this](absl::optional<AsyncClient::Reply> reply,
+                             absl::optional<AsyncClient::Error>) {
+      replies_.push_back(reply.value_or("<null>"));
+    });
+  }
+
+  // The connection of the client in the server.
+  FakeServer::Connection& connection() { return *server_.connections().back(); }
+
+  event_base* base_;
+  FakeServer server_;
+  std::unique_ptr<AsyncClient> client_;
+  std::vector<std::string> replies_;
+};
+
+TEST_F(AsyncClientPipelineTest, FlushWhenPipelineIsFull) {
+  client_->setPipeline({3, 60000});
+
+  get("a");
+  client_->set("b", "value", 1000);
+  FakeServer::runFor(base_, std::chrono::milliseconds(20));
+  // Nothing is sent before the pipeline is full.
+  EXPECT_TRUE(server_.commands().empty());
+
+  get("c");
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_.size() == 2; }));
+  // All commands are sent in one write and the replies are matched in order, including the reply
+  // of the command that ignores it.
+  EXPECT_EQ(std::vector<size_t>({3}), connection().commands_per_read_);
+  EXPECT_EQ(std::vector<std::string>({"GET:a", "GET:c"}), replies_);
+  EXPECT_EQ(std::vector<std::string>({"SET", "b", "value", "PX", "1000"}), server_.commands()[1]);
+  EXPECT_EQ(0, client_->outstandingCommands());
+}
+
+TEST_F(AsyncClientPipelineTest, FlushAfterInterval) {
+  client_->setPipeline({100, 30});
+
+  get("a");
+  get("b");
+  FakeServer::runFor(base_, std::chrono::milliseconds(5));
+  EXPECT_TRUE(server_.commands().empty());
+
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_.size() == 2; }));
+  EXPECT_EQ(std::vector<size_t>({2}), connection().commands_per_read_);
+  EXPECT_EQ(std::vector<std::string>({"GET:a", "GET:b"}), replies_);
+
+  // The timer is armed again by the next command.
+  get("c");
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_.size() == 3; }));
+  EXPECT_EQ("GET:c", replies_[2]);
+}
+
+TEST_F(AsyncClientPipelineTest, ExplicitFlush) {
+  client_->setPipeline({100, 60000});
+
+  get("a");
+  client_->flush();
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_.size() == 1; }));
+  EXPECT_EQ("GET:a", replies_[0]);
+}
+
+TEST_F(AsyncClientPipelineTest, PendingCommandsFailOnDisconnect) {
+  client_->setPipeline({100, 60000});
+
+  get("a");
+  server_.close(connection());
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_.size() == 1; }));
+  EXPECT_EQ("<null>", replies_[0]);
+  EXPECT_EQ(AsyncClient::CONNECTING, client_->clientStatus());
+  EXPECT_TRUE(server_.commands().empty());
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
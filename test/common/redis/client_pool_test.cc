@@ -0,0 +1,220 @@
+#include <chrono>
+#include <cstdlib>
+
+#include "source/common/redis/client_pool.h"
+
+#include "test/common/redis/fake_server.h"
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+// Run against a local redis-server, for example REDIS_SERVER=127.0.0.1:6379. The test is skipped
+// if the variable is not set.
+TEST(AsyncClientPoolTest, LocalServer) {
+  const char* server = std::getenv("REDIS_SERVER");
+  if (server == nullptr) {
+    GTEST_SKIP() << "REDIS_SERVER is not set";
+  }
+  std::vector<absl::string_view> address = absl::StrSplit(server, ':');
+  ASSERT_EQ(2, address.size());
+  AsyncClient::Endpoint endpoint{std::string(address[0]), 0};
+  ASSERT_TRUE(absl::SimpleAtoi(address[1], &endpoint.port_));
+
+  event_base* base = event_base_new();
+  // Run the event loop until the condition is true or 5 seconds are passed.
+  auto run_until = [base](const std::function<bool()>& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    return condition();
+  };
+
+  size_t replies = 0;
+  size_t hits = 0;
+  {
+    AsyncClientPool pool(endpoint, "", base, 1000, 4, 200);
+    EXPECT_EQ(1, pool.size());
+    ASSERT_TRUE(run_until([&pool] { return pool.clientStatus() == AsyncCommandClient::WORKING; }));
+
+    const std::string value(512 * 1024, 'v');
+    pool.set("client-pool-test", value, 10000);
+
+    // Connections are added while the first one is busy and all of them are used once they are
+    // established.
+    constexpr size_t Rounds = 20;
+    constexpr size_t Burst = 8;
+    for (size_t round = 0; round < Rounds; round++) {
+      for (size_t i = 0; i < Burst; i++) {
+        pool.get("client-pool-test", [&](absl::optional<AsyncCommandClient::Reply> reply,
+                                         absl::optional<AsyncCommandClient::Error>) {
+          replies++;
+          hits += reply.has_value() && reply->size() == value.size();
+        });
+      }
+      ASSERT_TRUE(run_until([&replies, round] { return replies == (round + 1) * Burst; }));
+    }
+    EXPECT_EQ(Rounds * Burst, hits);
+    EXPECT_EQ(4, pool.size());
+
+    // Idle connections are closed and the first one is kept.
+    EXPECT_TRUE(run_until([&pool] { return pool.size() == 1; }));
+    EXPECT_EQ(AsyncCommandClient::WORKING, pool.clientStatus());
+  }
+  event_base_free(base);
+}
+
+// Replies are only sent to the commands of keys that do not start with "slow".
+class AsyncClientPoolFakeServerTest : public testing::Test {
+public:
+  AsyncClientPoolFakeServerTest()
+      : base_(event_base_new()),
+        server_(base_, [this](FakeServer::Connection& connection, const FakeServer::Command& cmd) {
+          received_.push_back({&connection, cmd.size() > 1 ? cmd[1] : ""});
+          return absl::StartsWith(received_.back().second, "slow") ? "" : FakeServer::ok();
+        }) {}
+
+  ~AsyncClientPoolFakeServerTest() override {
+    pool_.reset();
+    event_base_free(base_);
+  }
+
+  void createPool(uint64_t pool_size, uint64_t idle_time_ms, const PipelineOptions& pipeline = {}) {
+    pool_ = std::make_unique<AsyncClientPool>(AsyncClient::Endpoint{"127.0.0.1", server_.port()},
+                                              "", base_, 1000, pool_size, idle_time_ms, pipeline);
+    ASSERT_TRUE(FakeServer::runUntil(
+        base_, [this] { return pool_->clientStatus() == AsyncCommandClient::WORKING; }));
+  }
+
+  void get(const std::string& key) {
+    EXPECT_TRUE(pool_->command({"GET", key}, [this](redisReply*, absl::optional<std::string>) {
+      replies_++;
+    }));
+  }
+
+  // Index of the server connection of the command of the key.
+  int connectionOf(const std::string& key) {
+    for (const auto& received : received_) {
+      if (received.second != key) {
+        continue;
+      }
+      for (size_t i = 0; i < server_.connections().size(); i++) {
+        if (server_.connections()[i].get() == received.first) {
+          return i;
+        }
+      }
+    }
+    return -1;
+  }
+
+  bool receivedAll(size_t number) {
+    return FakeServer::runUntil(base_, [this, number] { return received_.size() == number; });
+  }
+
+  event_base* base_;
+  FakeServer server_;
+  std::unique_ptr<AsyncClientPool> pool_;
+  std::vector<std::pair<FakeServer::Connection*, std::string>> received_;
+  size_t replies_{0};
+};
+
+TEST_F(AsyncClientPoolFakeServerTest, PickLeastBusyConnection) {
+  createPool(3, 0);
+  EXPECT_EQ(1, pool_->size());
+
+  // The only connection is busy, so a new one is created but not used until it is established.
+  get("slow-1");
+  get("slow-2");
+  EXPECT_EQ(2, pool_->size());
+  ASSERT_TRUE(receivedAll(2));
+  EXPECT_EQ(0, connectionOf("slow-1"));
+  EXPECT_EQ(0, connectionOf("slow-2"));
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return server_.connections().size() == 2; }));
+  FakeServer::runFor(base_, std::chrono::milliseconds(20));
+
+  // The idle connection is picked while the first one waits for replies, and no more connections
+  // are created since it is not busy.
+  get("a");
+  ASSERT_TRUE(receivedAll(3));
+  EXPECT_EQ(1, connectionOf("a"));
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_ == 1; }));
+  EXPECT_EQ(2, pool_->size());
+
+  // Both connections are busy and the pool grows to the pool size and no further.
+  get("slow-3");
+  get("slow-4");
+  EXPECT_EQ(3, pool_->size());
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return server_.connections().size() == 3; }));
+  FakeServer::runFor(base_, std::chrono::milliseconds(20));
+  get("b");
+  get("slow-5");
+  get("slow-6");
+  EXPECT_EQ(3, pool_->size());
+  ASSERT_TRUE(receivedAll(8));
+  EXPECT_EQ(2, connectionOf("b"));
+}
+
+TEST_F(AsyncClientPoolFakeServerTest, CloseIdleConnections) {
+  createPool(2, 30);
+  get("slow-1");
+  get("a");
+  ASSERT_EQ(2, pool_->size());
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return server_.connections().size() == 2; }));
+  FakeServer::runFor(base_, std::chrono::milliseconds(10));
+  get("b");
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_ == 2; }));
+  EXPECT_EQ(1, connectionOf("b"));
+
+  // The idle connection is closed. The first one is kept even if it is busy.
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return pool_->size() == 1; }));
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return server_.connections()[1]->closed_; }));
+  EXPECT_FALSE(server_.connections()[0]->closed_);
+}
+
+TEST_F(AsyncClientPoolFakeServerTest, KeepConnectionsWithPendingCommands) {
+  createPool(2, 30, {100, 60000});
+  get("slow-1");
+  get("a");
+  ASSERT_EQ(2, pool_->size());
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return server_.connections().size() == 2; }));
+  FakeServer::runFor(base_, std::chrono::milliseconds(10));
+
+  // The command without reply is held by the pipeline of the second connection, which is not
+  // closed while the command is pending.
+  pool_->del("b");
+  FakeServer::runFor(base_, std::chrono::milliseconds(100));
+  EXPECT_EQ(2, pool_->size());
+}
+
+TEST_F(AsyncClientPoolFakeServerTest, Reconnect) {
+  createPool(1, 0);
+  pool_->setReconnectInterval(10);
+
+  server_.close(*server_.connections()[0]);
+  ASSERT_TRUE(FakeServer::runUntil(
+      base_, [this] { return pool_->clientStatus() != AsyncCommandClient::WORKING; }));
+  // No command is accepted until the connection is established again.
+  EXPECT_FALSE(pool_->command({"GET", "a"}, nullptr));
+
+  ASSERT_TRUE(FakeServer::runUntil(
+      base_, [this] { return pool_->clientStatus() == AsyncCommandClient::WORKING; }));
+  EXPECT_EQ(2, server_.connections().size());
+  get("a");
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return replies_ == 1; }));
+  EXPECT_EQ(1, connectionOf("a"));
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
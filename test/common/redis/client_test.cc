@@ -0,0 +1,126 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+
+#include "source/common/redis/client.h"
+
+#include "test/common/redis/reply_builder.h"
+#include "test/test_common/utility.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+TEST(ReplyValueTest, FromReply) {
+  ReplyBuilder r;
+  const ReplyValue value = ReplyValue::fromReply(
+      *r.array({r.string("value"), r.integer(42), r.nil(), r.array({r.string("nested")})}));
+  EXPECT_EQ(REDIS_REPLY_ARRAY, value.type_);
+  ASSERT_EQ(4, value.elements_.size());
+  EXPECT_EQ("value", value.elements_[0].str_);
+  EXPECT_EQ(42, value.elements_[1].integer_);
+  EXPECT_EQ(REDIS_REPLY_NIL, value.elements_[2].type_);
+  ASSERT_EQ(1, value.elements_[3].elements_.size());
+  EXPECT_EQ("nested", value.elements_[3].elements_[0].str_);
+
+  const ReplyValue error = ReplyValue::error("ERR");
+  EXPECT_TRUE(error.isError());
+  EXPECT_EQ("ERR", error.str_);
+}
+
+TEST(RedisClientTest, InvalidHosts) {
+  Api::ApiPtr api = Api::createApiForTest();
+  Event::DispatcherPtr dispatcher = api->allocateDispatcher("test_thread");
+
+  ClientOptions options;
+  options.hosts_ = "localhost";
+  EXPECT_THROW(RedisClient(options, *dispatcher), EnvoyException);
+
+  options.hosts_ = "localhost:6379";
+  options.redis_type_ = ClientOptions::RedisType::Sentinel;
+  EXPECT_THROW(RedisClient(options, *dispatcher), EnvoyException);
+}
+
+TEST(RedisClientTest, BatchWithoutConnection) {
+  Api::ApiPtr api = Api::createApiForTest();
+  Event::DispatcherPtr dispatcher = api->allocateDispatcher("test_thread");
+
+  ClientOptions options;
+  // Nothing listens on the port.
+  options.hosts_ = "127.0.0.1:1";
+  RedisClient client(options, *dispatcher);
+
+  bool done = false;
+  client.batch({{"GET", "a"}, {"GET", "b"}}, [&done](std::vector<ReplyValue> replies) {
+    done = true;
+    ASSERT_EQ(2, replies.size());
+    EXPECT_TRUE(replies[0].isError());
+    EXPECT_TRUE(replies[1].isError());
+  });
+  // The callback is never called inline.
+  EXPECT_FALSE(done);
+  dispatcher->run(Event::Dispatcher::RunType::NonBlock);
+  EXPECT_TRUE(done);
+}
+
+// Run against a local redis-server, for example REDIS_SERVER=127.0.0.1:6379. The same server is
+// used as a replica. The test is skipped if the variable is not set.
+TEST(RedisClientTest, LocalServer) {
+  const char* server = std::getenv("REDIS_SERVER");
+  if (server == nullptr) {
+    GTEST_SKIP() << "REDIS_SERVER is not set";
+  }
+
+  Api::ApiPtr api = Api::createApiForTest();
+  Event::DispatcherPtr dispatcher = api->allocateDispatcher("test_thread");
+  auto run_until = [&dispatcher](const std::function<bool()>& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      dispatcher->run(Event::Dispatcher::RunType::NonBlock);
+    }
+    return condition();
+  };
+
+  ClientOptions options;
+  options.hosts_ = absl::StrCat(server, ",", server);
+  options.timeout_ = std::chrono::milliseconds(100);
+  options.pipeline_.max_size_ = 16;
+  RedisClient client(options, *dispatcher);
+  EXPECT_EQ(1, client.replicaNumber());
+  ASSERT_TRUE(
+      run_until([&client] { return client.clientStatus() == AsyncCommandClient::WORKING; }));
+
+  std::vector<ReplyValue> result;
+  client.batch({{"SET", "redis-client-test", "1"},
+                {"INCR", "redis-client-test"},
+                {"NOT-A-COMMAND"}},
+               [&result](std::vector<ReplyValue> replies) { result = std::move(replies); });
+  ASSERT_TRUE(run_until([&result] { return !result.empty(); }));
+  EXPECT_EQ("OK", result[0].str_);
+  EXPECT_EQ(2, result[1].integer_);
+  EXPECT_TRUE(result[2].isError());
+
+  std::string value;
+  // The replica may still be connecting and the master is used then.
+  ASSERT_TRUE(client.command(
+      {"GET", "redis-client-test"},
+      [&value](redisReply* reply, absl::optional<AsyncCommandClient::Error>) {
+        if (reply != nullptr && reply->type == REDIS_REPLY_STRING) {
+          value.assign(reply->str, reply->len);
+        }
+      },
+      RedisClient::ReadFrom::PreferReplica));
+  ASSERT_TRUE(run_until([&value] { return !value.empty(); }));
+  EXPECT_EQ("2", value);
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
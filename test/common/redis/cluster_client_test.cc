@@ -0,0 +1,161 @@
+#include <chrono>
+#include <cstdlib>
+
+#include "source/common/redis/cluster_client.h"
+
+#include "test/common/redis/reply_builder.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+TEST(ClusterUtilTest, KeySlot) {
+  EXPECT_EQ(0x31C3, ClusterUtil::crc16("123456789"));
+  EXPECT_EQ(12182, ClusterUtil::keySlot("foo"));
+  EXPECT_EQ(5061, ClusterUtil::keySlot("bar"));
+
+  // Only the hash tag is hashed.
+  EXPECT_EQ(ClusterUtil::keySlot("user1000"), ClusterUtil::keySlot("{user1000}.following"));
+  EXPECT_EQ(ClusterUtil::keySlot("{user1000}.followers"),
+            ClusterUtil::keySlot("{user1000}.following"));
+  EXPECT_EQ(ClusterUtil::keySlot("bar"), ClusterUtil::keySlot("foo{bar}{zap}"));
+  EXPECT_EQ(ClusterUtil::keySlot("{bar"), ClusterUtil::keySlot("foo{{bar}}zap"));
+  // An empty hash tag is ignored.
+  EXPECT_EQ(ClusterUtil::crc16("foo{}{bar}") % ClusterSlotNumber,
+            ClusterUtil::keySlot("foo{}{bar}"));
+}
+
+TEST(ClusterUtilTest, ParseRedirection) {
+  auto moved = ClusterUtil::parseRedirection("MOVED 3999 127.0.0.1:6381");
+  ASSERT_TRUE(moved.has_value());
+  EXPECT_FALSE(moved->ask_);
+  EXPECT_EQ(3999, moved->slot_);
+  EXPECT_EQ("127.0.0.1", moved->endpoint_.host_);
+  EXPECT_EQ(6381, moved->endpoint_.port_);
+
+  auto ask = ClusterUtil::parseRedirection("ASK 1 ::1:7000");
+  ASSERT_TRUE(ask.has_value());
+  EXPECT_TRUE(ask->ask_);
+  EXPECT_EQ("::1", ask->endpoint_.host_);
+  EXPECT_EQ(7000, ask->endpoint_.port_);
+
+  EXPECT_FALSE(ClusterUtil::parseRedirection("ERR unknown command").has_value());
+  EXPECT_FALSE(ClusterUtil::parseRedirection("MOVED 16384 127.0.0.1:6381").has_value());
+  EXPECT_FALSE(ClusterUtil::parseRedirection("MOVED 1 127.0.0.1").has_value());
+}
+
+TEST(ClusterUtilTest, ParseClusterSlots) {
+  ReplyBuilder r;
+  const AsyncClient::Endpoint replier{"10.0.0.1", 7000};
+
+  redisReply* reply = r.array({
+      r.array({r.integer(0), r.integer(8191),
+                r.array({r.string("10.0.0.2"), r.integer(7001), r.string("id-1")}),
+                r.array({r.string("10.0.0.3"), r.integer(7002), r.string("id-2")})}),
+      r.array({r.integer(8192), r.integer(16383),
+                r.array({r.string(""), r.integer(7000), r.string("id-3")})}),
+  });
+
+  std::vector<ClusterUtil::SlotRange> ranges;
+  ASSERT_TRUE(ClusterUtil::parseClusterSlots(reply, replier, ranges));
+  ASSERT_EQ(2, ranges.size());
+  EXPECT_EQ(0, ranges[0].start_);
+  EXPECT_EQ(8191, ranges[0].end_);
+  EXPECT_EQ("10.0.0.2", ranges[0].master_.host_);
+  EXPECT_EQ(7001, ranges[0].master_.port_);
+  EXPECT_EQ(16383, ranges[1].end_);
+  // The empty host is the node that replies.
+  EXPECT_EQ("10.0.0.1", ranges[1].master_.host_);
+
+  ranges.clear();
+  EXPECT_FALSE(ClusterUtil::parseClusterSlots(
+      r.array({r.array({r.integer(0), r.integer(16384),
+                        r.array({r.string("10.0.0.2"), r.integer(7001)})})}),
+      replier, ranges));
+  EXPECT_FALSE(ClusterUtil::parseClusterSlots(r.string("OK"), replier, ranges));
+  EXPECT_FALSE(ClusterUtil::parseClusterSlots(nullptr, replier, ranges));
+}
+
+// Run against a local cluster that is started by `redis-server --cluster-enabled yes` processes
+// and `redis-cli --cluster create`, for example:
+//
+//   REDIS_CLUSTER_NODES=127.0.0.1:7000,127.0.0.1:7001,127.0.0.1:7002
+//
+// The test is skipped if the variable is not set.
+TEST(ClusterAsyncClientTest, LocalCluster) {
+  const char* nodes = std::getenv("REDIS_CLUSTER_NODES");
+  if (nodes == nullptr) {
+    GTEST_SKIP() << "REDIS_CLUSTER_NODES is not set";
+  }
+
+  std::vector<AsyncClient::Endpoint> seeds;
+  for (absl::string_view node : absl::StrSplit(nodes, ',', absl::SkipEmpty())) {
+    const auto pos = node.rfind(':');
+    ASSERT_NE(absl::string_view::npos, pos);
+    AsyncClient::Endpoint endpoint{std::string(node.substr(0, pos)), 0};
+    ASSERT_TRUE(absl::SimpleAtoi(node.substr(pos + 1), &endpoint.port_));
+    seeds.push_back(endpoint);
+  }
+
+  event_base* base = event_base_new();
+  // Run the event loop until the condition is true or 5 seconds are passed.
+  auto run_until = [base](const std::function<bool()>& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    return condition();
+  };
+
+  constexpr size_t KeyNumber = 100;
+  std::vector<bool> hit(KeyNumber, false);
+  size_t hits = 0;
+  size_t pending = 0;
+
+  {
+    const char* password = std::getenv("REDIS_CLUSTER_PASSWORD");
+    ClusterAsyncClient client(seeds, password != nullptr ? password : "", base, 100, 30000);
+    ASSERT_TRUE(
+        run_until([&client] { return client.clientStatus() == AsyncCommandClient::WORKING; }));
+
+    // Keys are spread across all masters. Commands fail until the connections to all masters are
+    // established, so write and read the missing keys again until all of them are hit.
+    ASSERT_TRUE(run_until([&] {
+      if (pending == 0) {
+        for (size_t i = 0; i < KeyNumber; i++) {
+          if (hit[i]) {
+            continue;
+          }
+          const std::string key = absl::StrCat("cluster-client-test-", i);
+          // Keys expire soon and are not removed after the test.
+          client.set(key, absl::StrCat("value-", i), 10000);
+          pending++;
+          client.get(key, [&, i](absl::optional<AsyncCommandClient::Reply> reply,
+                                 absl::optional<AsyncCommandClient::Error>) {
+            pending--;
+            if (!hit[i] && reply.has_value() && reply.value() == absl::StrCat("value-", i)) {
+              hit[i] = true;
+              hits++;
+            }
+          });
+        }
+      }
+      return hits == KeyNumber;
+    }));
+    EXPECT_GE(client.nodeNumber(), 3);
+  }
+  event_base_free(base);
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "event2/event.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+/**
+ * Scripted Redis server for the tests of the clients. It listens on a local port and runs in the
+ * event base of the clients, so the tests need no redis-server. Every command is passed to the
+ * handler and the returned bytes are written back as the reply. An empty string means no reply.
+ */
+class FakeServer {
+public:
+  struct Connection {
+    FakeServer* server_{nullptr};
+    int fd_{-1};
+    event* event_{nullptr};
+    std::string buffer_;
+    bool closed_{false};
+    // Number of commands in every read of the connection.
+    std::vector<size_t> commands_per_read_;
+  };
+
+  using Command = std::vector<std::string>;
+  using Handler = std::function<std::string(Connection& connection, const Command& command)>;
+
+  FakeServer(event_base* base, Handler handler) : base_(base), handler_(std::move(handler)) {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        ::listen(listen_fd_, 16) != 0 ||
+        ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+      std::abort();
+    }
+    port_ = ntohs(address.sin_port);
+    ::fcntl(listen_fd_, F_SETFL, O_NONBLOCK);
+    listen_event_ = event_new(base_, listen_fd_, EV_READ | EV_PERSIST, acceptCb, this);
+    event_add(listen_event_, nullptr);
+  }
+
+  ~FakeServer() {
+    for (auto& connection : connections_) {
+      close(*connection);
+      event_free(connection->event_);
+    }
+    event_free(listen_event_);
+    ::close(listen_fd_);
+  }
+
+  int port() const { return port_; }
+
+  // All connections in the order they are accepted, including the closed ones.
+  const std::vector<std::unique_ptr<Connection>>& connections() const { return connections_; }
+
+  // All commands in the order they are received.
+  const std::vector<Command>& commands() const { return commands_; }
+
+  void write(Connection& connection, absl::string_view data) {
+    while (!connection.closed_ && !data.empty()) {
+      const ssize_t written = ::send(connection.fd_, data.data(), data.size(), MSG_NOSIGNAL);
+      if (written <= 0) {
+        close(connection);
+        return;
+      }
+      data.remove_prefix(written);
+    }
+  }
+
+  // Close the connection from the server side.
+  void close(Connection& connection) {
+    if (connection.closed_) {
+      return;
+    }
+    connection.closed_ = true;
+    // The event is only freed with the server, since it may be closed in its own callback.
+    event_del(connection.event_);
+    ::close(connection.fd_);
+  }
+
+  // Run the event loop until the condition is true or 5 seconds are passed.
+  static bool runUntil(event_base* base, const std::function<bool()>& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    return condition();
+  }
+
+  // Run the event loop for the duration.
+  static void runFor(event_base* base, std::chrono::milliseconds duration) {
+    const auto deadline = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+  }
+
+  static std::string ok() { return "+OK\r\n"; }
+  static std::string nil() { return "$-1\r\n"; }
+  static std::string error(absl::string_view message) { return absl::StrCat("-", message, "\r\n"); }
+  static std::string integer(long long value) { return absl::StrCat(":", value, "\r\n"); }
+  static std::string bulk(absl::string_view value) {
+    return absl::StrCat("$", value.size(), "\r\n", value, "\r\n");
+  }
+  static std::string array(const std::vector<std::string>& elements) {
+    std::string result = absl::StrCat("*", elements.size(), "\r\n");
+    for (const auto& element : elements) {
+      absl::StrAppend(&result, element);
+    }
+    return result;
+  }
+
+private:
+  static void acceptCb(evutil_socket_t fd, short, void* arg) {
+    auto* server = static_cast<FakeServer*>(arg);
+    const int connection_fd = ::accept(fd, nullptr, nullptr);
+    if (connection_fd < 0) {
+      return;
+    }
+    ::fcntl(connection_fd, F_SETFL, O_NONBLOCK);
+    auto connection = std::make_unique<Connection>();
+    connection->server_ = server;
+    connection->fd_ = connection_fd;
+    connection->event_ = event_new(server->base_, connection_fd, EV_READ | EV_PERSIST, readCb,
+                                   connection.get());
+    event_add(connection->event_, nullptr);
+    server->connections_.push_back(std::move(connection));
+  }
+
+  static void readCb(evutil_socket_t, short, void* arg) {
+    auto* connection = static_cast<Connection*>(arg);
+    connection->server_->onRead(*connection);
+  }
+
+  void onRead(Connection& connection) {
+    char data[64 * 1024];
+    const ssize_t length = ::recv(connection.fd_, data, sizeof(data), 0);
+    if (length <= 0) {
+      close(connection);
+      return;
+    }
+    connection.buffer_.append(data, length);
+
+    size_t commands = 0;
+    Command command;
+    while (!connection.closed_ && parseCommand(connection.buffer_, command)) {
+      commands++;
+      commands_.push_back(command);
+      write(connection, handler_(connection, command));
+    }
+    connection.commands_per_read_.push_back(commands);
+  }
+
+  // Parse and consume a command in the form of an array of bulk strings. Return false if the
+  // command is incomplete.
+  static bool parseCommand(std::string& buffer, Command& command) {
+    command.clear();
+    absl::string_view rest(buffer);
+    uint64_t number = 0;
+    if (!parseLength(rest, '*', number)) {
+      return false;
+    }
+    for (uint64_t i = 0; i < number; i++) {
+      uint64_t length = 0;
+      if (!parseLength(rest, '$', length) || rest.size() < length + 2) {
+        return false;
+      }
+      command.emplace_back(rest.substr(0, length));
+      rest.remove_prefix(length + 2);
+    }
+    buffer.erase(0, buffer.size() - rest.size());
+    return true;
+  }
+
+  static bool parseLength(absl::string_view& rest, char type, uint64_t& length) {
+    const size_t end = rest.find("\r\n");
+    if (rest.empty() || rest[0] != type || end == absl::string_view::npos ||
+        !absl::SimpleAtoi(rest.substr(1, end - 1), &length)) {
+      return false;
+    }
+    rest.remove_prefix(end + 2);
+    return true;
+  }
+
+  event_base* base_{nullptr};
+  Handler handler_;
+  int listen_fd_{-1};
+  int port_{0};
+  event* listen_event_{nullptr};
+  std::vector<std::unique_ptr<Connection>> connections_;
+  std::vector<Command> commands_;
+};
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
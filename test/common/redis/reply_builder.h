@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hiredis/hiredis.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+
+/**
+ * Builder of hiredis replies for the parsers. All replies are owned by the builder.
+ */
+class ReplyBuilder {
+public:
+  redisReply* integer(long long value) {
+    redisReply& reply = newReply(REDIS_REPLY_INTEGER);
+    reply.integer = value;
+    return &reply;
+  }
+
+  redisReply* string(std::string value) {
+    strings_.push_back(std::make_unique<std::string>(std::move(value)));
+    redisReply& reply = newReply(REDIS_REPLY_STRING);
+    reply.str = strings_.back()->data();
+    reply.len = strings_.back()->size();
+    return &reply;
+  }
+
+  redisReply* nil() { return &newReply(REDIS_REPLY_NIL); }
+
+  redisReply* array(std::vector<redisReply*> elements) {
+    arrays_.push_back(std::make_unique<std::vector<redisReply*>>(std::move(elements)));
+    redisReply& reply = newReply(REDIS_REPLY_ARRAY);
+    reply.element = arrays_.back()->data();
+    reply.elements = arrays_.back()->size();
+    return &reply;
+  }
+
+private:
+  redisReply& newReply(int type) {
+    replies_.push_back(std::make_unique<redisReply>());
+    redisReply& reply = *replies_.back();
+    memset(&reply, 0, sizeof(redisReply));
+    reply.type = type;
+    return reply;
+  }
+
+  std::vector<std::unique_ptr<redisReply>> replies_;
+  std::vector<std::unique_ptr<std::string>> strings_;
+  std::vector<std::unique_ptr<std::vector<redisReply*>>> arrays_;
+};
+
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
@@ -0,0 +1,138 @@
+#include <chrono>
+#include <cstdlib>
+
+#include "source/common/redis/sentinel_client.h"
+
+#include "test/common/redis/reply_builder.h"
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+TEST(SentinelUtilTest, ParseMasterAddress) {
+  ReplyBuilder r;
+  AsyncClient::Endpoint master;
+  ASSERT_TRUE(
+      SentinelUtil::parseMasterAddress(r.array({r.string("10.0.0.1"), r.string("6379")}), master));
+  EXPECT_EQ("10.0.0.1", master.host_);
+  EXPECT_EQ(6379, master.port_);
+
+  // Unknown master.
+  EXPECT_FALSE(SentinelUtil::parseMasterAddress(r.nil(), master));
+  EXPECT_FALSE(
+      SentinelUtil::parseMasterAddress(r.array({r.string("10.0.0.1"), r.string("x")}), master));
+  EXPECT_FALSE(SentinelUtil::parseMasterAddress(nullptr, master));
+}
+
+TEST(SentinelUtilTest, ParseSwitchMaster) {
+  ReplyBuilder r;
+  AsyncClient::Endpoint master;
+  ASSERT_TRUE(SentinelUtil::parseSwitchMaster(
+      r.array({r.string("message"), r.string("+switch-master"),
+               r.string("mymaster 10.0.0.1 6379 10.0.0.2 6380")}),
+      "mymaster", master));
+  EXPECT_EQ("10.0.0.2", master.host_);
+  EXPECT_EQ(6380, master.port_);
+
+  // Other masters.
+  EXPECT_FALSE(SentinelUtil::parseSwitchMaster(
+      r.array({r.string("message"), r.string("+switch-master"),
+               r.string("other 10.0.0.1 6379 10.0.0.2 6380")}),
+      "mymaster", master));
+  // Confirmation of the subscription.
+  EXPECT_FALSE(SentinelUtil::parseSwitchMaster(
+      r.array({r.string("subscribe"), r.string("+switch-master"), r.integer(1)}), "mymaster",
+      master));
+  EXPECT_FALSE(SentinelUtil::parseSwitchMaster(
+      r.array({r.string("message"), r.string("+switch-master"), r.string("mymaster 10.0.0.1")}),
+      "mymaster", master));
+}
+
+// Run against local redis-server and redis-sentinel processes, for example:
+//
+//   REDIS_SENTINEL_NODES=127.0.0.1:26379,127.0.0.1:26380 REDIS_SENTINEL_MASTER=mymaster
+//
+// A failover is triggered by "SENTINEL FAILOVER" if REDIS_SENTINEL_FAILOVER is set, and the master
+// must have at least one replica. The test is skipped if the variables are not set.
+TEST(SentinelAsyncClientTest, LocalSentinel) {
+  const char* nodes = std::getenv("REDIS_SENTINEL_NODES");
+  const char* master_name = std::getenv("REDIS_SENTINEL_MASTER");
+  if (nodes == nullptr || master_name == nullptr) {
+    GTEST_SKIP() << "REDIS_SENTINEL_NODES or REDIS_SENTINEL_MASTER is not set";
+  }
+
+  std::vector<AsyncClient::Endpoint> sentinels;
+  for (absl::string_view node : absl::StrSplit(nodes, ',', absl::SkipEmpty())) {
+    const auto pos = node.rfind(':');
+    ASSERT_NE(absl::string_view::npos, pos);
+    AsyncClient::Endpoint endpoint{std::string(node.substr(0, pos)), 0};
+    ASSERT_TRUE(absl::SimpleAtoi(node.substr(pos + 1), &endpoint.port_));
+    sentinels.push_back(endpoint);
+  }
+
+  event_base* base = event_base_new();
+  // Run the event loop until the condition is true or the timeout is passed.
+  auto run_until = [base](const std::function<bool()>& condition, std::chrono::seconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    return condition();
+  };
+
+  bool done = false;
+  absl::optional<AsyncCommandClient::Reply> value;
+  {
+    SentinelAsyncClient client(sentinels, master_name, "", "", base, 100);
+    // Set and get a key through the current master.
+    auto set_and_get = [&](const std::string& expected) {
+      client.set("sentinel-client-test", expected, 10000);
+      done = false;
+      client.get("sentinel-client-test",
+                 [&](absl::optional<AsyncCommandClient::Reply> reply,
+                     absl::optional<AsyncCommandClient::Error>) {
+                   value = reply;
+                   done = true;
+                 });
+      return run_until([&done] { return done; }, std::chrono::seconds(5)) && value == expected;
+    };
+
+    ASSERT_TRUE(run_until(
+        [&client] { return client.clientStatus() == AsyncCommandClient::WORKING; },
+        std::chrono::seconds(5)));
+    EXPECT_TRUE(set_and_get("before failover"));
+
+    if (std::getenv("REDIS_SENTINEL_FAILOVER") != nullptr) {
+      const auto old_master = client.masterEndpoint().value();
+      AsyncClient sentinel(sentinels[0], "", base, 100);
+      ASSERT_TRUE(run_until([&sentinel] { return sentinel.clientStatus() == AsyncClient::WORKING; },
+                            std::chrono::seconds(5)));
+      ASSERT_TRUE(sentinel.command({"SENTINEL", "FAILOVER", master_name}, nullptr));
+
+      // The connection is moved to the new master without any config change.
+      ASSERT_TRUE(run_until(
+          [&client, &old_master] {
+            const auto master = client.masterEndpoint();
+            return master.has_value() &&
+                   (master->host_ != old_master.host_ || master->port_ != old_master.port_) &&
+                   client.clientStatus() == AsyncCommandClient::WORKING;
+          },
+          std::chrono::seconds(60)));
+      EXPECT_TRUE(set_and_get("after failover"));
+    }
+  }
+  event_base_free(base);
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
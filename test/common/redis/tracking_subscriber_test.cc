@@ -0,0 +1,231 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "source/common/redis/tracking_subscriber.h"
+
+#include "test/common/redis/fake_server.h"
+#include "test/common/redis/reply_builder.h"
+
+#include "absl/strings/numbers.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Redis {
+namespace {
+
+TEST(TrackingUtilTest, ParseInvalidation) {
+  ReplyBuilder r;
+  std::vector<absl::string_view> keys;
+  bool all = true;
+  ASSERT_TRUE(TrackingUtil::parseInvalidation(
+      r.array({r.string("message"), r.string("__redis__:invalidate"),
+               r.array({r.string("key1"), r.string("key2")})}),
+      keys, all));
+  EXPECT_FALSE(all);
+  EXPECT_EQ((std::vector<absl::string_view>{"key1", "key2"}), keys);
+
+  // The database is flushed.
+  keys.clear();
+  ASSERT_TRUE(TrackingUtil::parseInvalidation(
+      r.array({r.string("message"), r.string("__redis__:invalidate"), r.nil()}), keys, all));
+  EXPECT_TRUE(all);
+  EXPECT_TRUE(keys.empty());
+
+  // Confirmation of the subscription.
+  EXPECT_FALSE(TrackingUtil::parseInvalidation(
+      r.array({r.string("subscribe"), r.string("__redis__:invalidate"), r.integer(1)}), keys,
+      all));
+  EXPECT_FALSE(TrackingUtil::parseInvalidation(
+      r.array({r.string("message"), r.string("__redis__:invalidate"), r.integer(1)}), keys, all));
+  EXPECT_FALSE(TrackingUtil::parseInvalidation(nullptr, keys, all));
+}
+
+// The subscriber and the tracking client talk to a scripted server. Invalidation messages are
+// pushed to the subscriber connection by the test.
+class TrackingSubscriberFakeServerTest : public testing::Test {
+public:
+  TrackingSubscriberFakeServerTest()
+      : base_(event_base_new()),
+        server_(base_, [this](FakeServer::Connection& connection, const FakeServer::Command& cmd) {
+          if (cmd[0] == "CLIENT" && cmd[1] == "ID") {
+            subscriber_connection_ = &connection;
+            return FakeServer::integer(100 + subscriptions_);
+          }
+          if (cmd[0] == "SUBSCRIBE") {
+            subscriptions_++;
+            return FakeServer::array(
+                {FakeServer::bulk("subscribe"), FakeServer::bulk(cmd[1]), FakeServer::integer(1)});
+          }
+          if (cmd[0] == "CLIENT" && cmd[1] == "TRACKING") {
+            reader_connection_ = &connection;
+            tracking_commands_++;
+            return FakeServer::ok();
+          }
+          return FakeServer::bulk("value");
+        }) {
+    const AsyncClient::Endpoint endpoint{"127.0.0.1", server_.port()};
+    tracking_ = std::make_unique<TrackingSubscriber>(
+        endpoint, "", base_, 1000, [this](absl::optional<absl::string_view> key) {
+          if (key.has_value()) {
+            invalidated_.emplace_back(key.value());
+          } else {
+            invalidated_all_++;
+          }
+        });
+    reader_ = std::make_unique<AsyncClient>(endpoint, "", base_, 1000);
+    reader_->setReconnectInterval(10);
+    reader_->setTracking(tracking_.get());
+  }
+
+  ~TrackingSubscriberFakeServerTest() override {
+    reader_.reset();
+    tracking_.reset();
+    event_base_free(base_);
+  }
+
+  void get(const std::string& key) {
+    bool done = false;
+    reader_->get(key, [&done](absl::optional<AsyncClient::Reply>,
+                              absl::optional<AsyncClient::Error>) { done = true; });
+    ASSERT_TRUE(FakeServer::runUntil(base_, [&done] { return done; }));
+  }
+
+  void invalidate(const std::vector<std::string>& keys) {
+    std::vector<std::string> elements;
+    for (const auto& key : keys) {
+      elements.push_back(FakeServer::bulk(key));
+    }
+    server_.write(*subscriber_connection_,
+                  FakeServer::array({FakeServer::bulk("message"),
+                                     FakeServer::bulk("__redis__:invalidate"),
+                                     FakeServer::array(elements)}));
+  }
+
+  event_base* base_;
+  FakeServer server_;
+  std::unique_ptr<TrackingSubscriber> tracking_;
+  std::unique_ptr<AsyncClient> reader_;
+
+  FakeServer::Connection* subscriber_connection_{nullptr};
+  FakeServer::Connection* reader_connection_{nullptr};
+  uint32_t subscriptions_{0};
+  uint32_t tracking_commands_{0};
+
+  std::vector<std::string> invalidated_;
+  uint32_t invalidated_all_{0};
+};
+
+TEST_F(TrackingSubscriberFakeServerTest, LostTracking) {
+  // All keys are invalidated once the redirect connection subscribes, and then the tracking of the
+  // reader is enabled.
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return tracking_commands_ == 1; }));
+  EXPECT_EQ(1, invalidated_all_);
+  EXPECT_EQ(100, tracking_->redirectId());
+
+  get("a");
+  get("b");
+  invalidate({"a"});
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return invalidated_.size() == 1; }));
+  EXPECT_EQ("a", invalidated_[0]);
+
+  // Only the keys that are read by the lost connection and not invalidated yet are dropped.
+  server_.close(*reader_connection_);
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return invalidated_.size() == 2; }));
+  EXPECT_EQ("b", invalidated_[1]);
+  EXPECT_EQ(1, invalidated_all_);
+
+  // The tracking is enabled again after the reader reconnects. Nothing is dropped if the lost
+  // connection read no key.
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return tracking_commands_ == 2; }));
+  server_.close(*reader_connection_);
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return tracking_commands_ == 3; }));
+  EXPECT_EQ(2, invalidated_.size());
+  EXPECT_EQ(1, invalidated_all_);
+
+  // All keys are dropped when the redirect connection is lost, and again when it subscribes.
+  get("c");
+  server_.close(*subscriber_connection_);
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return invalidated_all_ == 2; }));
+  EXPECT_FALSE(tracking_->redirectId().has_value());
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return tracking_commands_ == 4; }));
+  EXPECT_EQ(3, invalidated_all_);
+  EXPECT_EQ(101, tracking_->redirectId());
+  EXPECT_EQ(std::vector<std::string>({"CLIENT", "TRACKING", "ON", "REDIRECT", "101", "NOLOOP"}),
+            server_.commands().back());
+
+  // The key read before is not dropped again with the reader.
+  server_.close(*reader_connection_);
+  ASSERT_TRUE(FakeServer::runUntil(base_, [this] { return tracking_commands_ == 5; }));
+  EXPECT_EQ(2, invalidated_.size());
+}
+
+// Run against a local redis-server of version 6 or later, for example
+// REDIS_SERVER=127.0.0.1:6379. The test is skipped if the variable is not set.
+TEST(TrackingSubscriberTest, LocalServer) {
+  const char* server = std::getenv("REDIS_SERVER");
+  if (server == nullptr) {
+    GTEST_SKIP() << "REDIS_SERVER is not set";
+  }
+  const absl::string_view address(server);
+  const auto pos = address.rfind(':');
+  ASSERT_NE(absl::string_view::npos, pos);
+  AsyncClient::Endpoint endpoint{std::string(address.substr(0, pos)), 0};
+  ASSERT_TRUE(absl::SimpleAtoi(address.substr(pos + 1), &endpoint.port_));
+
+  event_base* base = event_base_new();
+  auto run_until = [base](const std::function<bool()>& condition, std::chrono::seconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!condition() && std::chrono::steady_clock::now() < deadline) {
+      event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+    }
+    return condition();
+  };
+
+  std::vector<std::string> invalidated;
+  uint32_t invalidated_all = 0;
+  {
+    TrackingSubscriber tracking(endpoint, "", base, 100,
+                                [&](absl::optional<absl::string_view> key) {
+                                  if (key.has_value()) {
+                                    invalidated.emplace_back(key.value());
+                                  } else {
+                                    invalidated_all++;
+                                  }
+                                });
+    AsyncClient reader(endpoint, "", base, 100);
+    reader.setTracking(&tracking);
+    AsyncClient writer(endpoint, "", base, 100);
+
+    // All keys are invalidated once the redirect connection subscribes.
+    ASSERT_TRUE(run_until(
+        [&] {
+          return invalidated_all > 0 && reader.clientStatus() == AsyncClient::WORKING &&
+                 writer.clientStatus() == AsyncClient::WORKING;
+        },
+        std::chrono::seconds(5)));
+
+    bool done = false;
+    reader.get("tracking-subscriber-test", [&done](absl::optional<AsyncClient::Reply>,
+                                                   absl::optional<AsyncClient::Error>) {
+      done = true;
+    });
+    ASSERT_TRUE(run_until([&done] { return done; }, std::chrono::seconds(5)));
+
+    writer.set("tracking-subscriber-test", "value", 10000);
+    ASSERT_TRUE(run_until([&invalidated] { return !invalidated.empty(); },
+                          std::chrono::seconds(5)));
+    EXPECT_EQ("tracking-subscriber-test", invalidated.front());
+  }
+  event_base_free(base);
+}
+
+} // namespace
+} // namespace Redis
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
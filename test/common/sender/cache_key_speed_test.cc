@@ -0,0 +1,65 @@
+#include <string>
+
+#include "source/common/sender/cache_request_sender.h"
+
+#include "test/benchmark/main.h"
+#include "test/test_common/utility.h"
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Sender {
+namespace {
+
+// Key maker that selects some parameters and headers as most routes do.
+KeyMakerConfig benchmarkConfig(KeyMakerConfig::Hash hash, bool ignore_case) {
+  KeyMakerConfig config;
+  config.set_hash(hash);
+  config.set_ignore_case(ignore_case);
+  config.add_query_params("id");
+  config.add_query_params("lang");
+  config.add_query_params("page");
+  config.add_headers_keys("x-user");
+  config.add_headers_keys("accept-language");
+  return config;
+}
+
+// Args: hash, ignore case, length of the path.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_HttpCacheKeyBuild(::benchmark::State& state) {
+  const HttpCacheKeyBuilder builder(
+      benchmarkConfig(static_cast<KeyMakerConfig::Hash>(state.range(0)), state.range(1)), "v1");
+  Envoy::Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"},
+      {":authority", "api.example.com"},
+      {":path", absl::StrCat("/v1/items/", std::string(state.range(2), 'a'),
+                             "?id=42&lang=en&page=3&size=20&ts=1690000000")},
+      {"x-user", "Alice"},
+      {"accept-language", "en-US"}};
+
+  for (auto _ : state) { // NOLINT
+    auto key = builder.build(headers);
+    benchmark::DoNotOptimize(key);
+  }
+}
+
+void keyArgs(benchmark::internal::Benchmark* b) {
+  for (int64_t hash : {KeyMakerConfig::MD5, KeyMakerConfig::XXH3_128}) {
+    for (int64_t ignore_case : {0, 1}) {
+      for (int64_t path_size : {16, 1024}) {
+        b->Args({hash, ignore_case, path_size});
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_HttpCacheKeyBuild)->Apply(keyArgs);
+
+} // namespace
+} // namespace Sender
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
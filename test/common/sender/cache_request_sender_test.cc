@@ -0,0 +1,491 @@
+#include <map>
+#include <vector>
+
+#include "source/common/common/proxy_utility.h"
+#include "source/common/sender/cache_request_sender.h"
+
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/server/factory_context.h"
+#include "test/test_common/utility.h"
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Sender {
+namespace {
+
+TEST(HttpCacheKeyBuilderTest, Md5KeysAreCompatible) {
+  KeyMakerConfig config;
+  Envoy::Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":authority", "example.com"}, {":path", "/items/1"}};
+  // MD5 of "v1GETexample.com/items/1".
+  EXPECT_EQ("ff7a4b21c069c0c586c66a51f3818f73", HttpCacheKeyBuilder(config, "v1").build(headers));
+
+  config.set_ignore_case(true);
+  config.add_query_params("id");
+  config.add_query_params("lang");
+  config.add_headers_keys("X-User");
+  Envoy::Http::TestRequestHeaderMapImpl selected{{":method", "GET"},
+                                                 {":authority", "Example.com"},
+                                                 {":path", "/Items?ID=1&id=Abc&id=2"},
+                                                 {"x-user", "Alice"}};
+  // MD5 of "v1getexample.com/itemsidabcx-useralice". The first value of the parameter is used.
+  EXPECT_EQ("80911acd458fcaec92f1e2e471ec9beb", HttpCacheKeyBuilder(config, "v1").build(selected));
+  EXPECT_EQ(HttpCacheKeyBuilder(config, "v1").build(selected),
+            HttpCacheUtil::cacheKey(config, selected, "v1"));
+}
+
+TEST(HttpCacheKeyBuilderTest, Xxh3) {
+  KeyMakerConfig config;
+  config.set_hash(KeyMakerConfig::XXH3_128);
+  config.add_query_params("a");
+  config.add_query_params("ab");
+  const HttpCacheKeyBuilder builder(config, "v1");
+
+  Envoy::Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":authority", "example.com"}, {":path", "/p?a=bc"}};
+  const auto key = builder.build(headers);
+  EXPECT_EQ(32, key.size());
+  EXPECT_EQ(key, builder.build(headers));
+  EXPECT_NE(key, HttpCacheKeyBuilder(KeyMakerConfig(), "v1").build(headers));
+
+  // Parts are separated.
+  headers.setPath("/p?ab=c");
+  EXPECT_NE(key, builder.build(headers));
+
+  // Long keys are hashed in multiple updates.
+  headers.setPath(absl::StrCat("/p?a=", std::string(1000, 'x')));
+  const auto long_key = builder.build(headers);
+  headers.setPath(absl::StrCat("/p?a=", std::string(999, 'x'), "y"));
+  EXPECT_NE(long_key, builder.build(headers));
+}
+
+TEST(HttpCacheKeyBuilderTest, Xxh3KeepsMethodAndIgnoresCase) {
+  KeyMakerConfig config;
+  config.set_hash(KeyMakerConfig::XXH3_128);
+  config.set_exclude_path(true);
+  config.set_ignore_case(true);
+  const HttpCacheKeyBuilder builder(config, "v1");
+
+  Envoy::Http::TestRequestHeaderMapImpl get{
+      {":method", "GET"}, {":authority", "Example.com"}, {":path", "/a"}};
+  Envoy::Http::TestRequestHeaderMapImpl head{
+      {":method", "HEAD"}, {":authority", "example.com"}, {":path", "/b"}};
+  EXPECT_NE(builder.build(get), builder.build(head));
+  head.setMethod("get");
+  EXPECT_EQ(builder.build(get), builder.build(head));
+}
+
+TEST(SpecificCacheConfigTest, CacheTTL) {
+  ProtoTTL ttl;
+  ttl.set_default_(10);
+  auto& customs = *ttl.mutable_customs();
+  customs["200"] = 1;
+  customs["2.*"] = 2;
+  customs["20.*"] = 3;
+  customs["4\\d\\d"] = 4;
+  customs["40[34]"] = 5;
+  SpecificCacheConfig config(KeyMakerConfig(), {{"RedisHttpCache", ttl}, {"MmapCache", ttl}});
+
+  // Exact patterns win over prefixes and longer prefixes win over shorter ones.
+  EXPECT_EQ(1, config.cacheTTL("RedisCache", "200"));
+  EXPECT_EQ(3, config.cacheTTL("RedisCache", "204"));
+  EXPECT_EQ(2, config.cacheTTL("RedisCache", "210"));
+  // Regexes are fully matched and ordered by pattern.
+  EXPECT_EQ(5, config.cacheTTL("MmapCache", "404"));
+  EXPECT_EQ(4, config.cacheTTL("MmapCache", "401"));
+  EXPECT_EQ(10, config.cacheTTL("MmapCache", "4010"));
+  EXPECT_EQ(10, config.cacheTTL("MmapCache", "301"));
+  EXPECT_EQ(0, config.cacheTTL("LocalCache", "200"));
+}
+
+TEST(SpecificCacheConfigTest, InvalidPattern) {
+  ProtoTTL ttl;
+  (*ttl.mutable_customs())["(("] = 1;
+  EXPECT_THROW(SpecificCacheConfig(KeyMakerConfig(), {{"LocalCache", ttl}}), EnvoyException);
+}
+
+class TestCacheEntry : public Cache::CacheEntry {
+public:
+  TestCacheEntry(uint64_t length, uint64_t expire = 0) : length_(length), expire_(expire) {}
+
+  void loadFromString(std::string&&) override {}
+  Cache::CacheEntryPtr createCopy() const override {
+    return std::make_unique<TestCacheEntry>(length_, expire_);
+  }
+  void seal() override {}
+  uint64_t cacheExpire() const override { return expire_; }
+  void cacheExpire(uint64_t expire) override { expire_ = expire; }
+  uint64_t cacheLength() const override { return length_; }
+  absl::optional<std::string> serializeAsString() const override { return absl::nullopt; }
+
+private:
+  const uint64_t length_{0};
+  uint64_t expire_{0};
+};
+
+// Cache with entries of the given lengths and expire times. Asynchronous lookups are completed by
+// complete().
+class TestCache : public Cache::CommonCacheBase {
+public:
+  TestCache(bool inline_lookup) : inline_lookup_(inline_lookup) {}
+
+  Cache::CacheEntryPtr lookupCache(const Cache::CacheKeyType& key) override {
+    auto iter = entries_.find(key);
+    return iter == entries_.end() ? nullptr
+                                  : std::make_unique<TestCacheEntry>(iter->second, expires_[key]);
+  }
+  void lookupCache(const Cache::CacheKeyType& key, AsyncCallback callback) override {
+    pending_.push_back({key, std::move(callback)});
+  }
+  absl::optional<Cache::CacheEntryPtr>
+  lookupCacheInline(const Cache::CacheKeyType& key) override {
+    if (!inline_lookup_) {
+      return absl::nullopt;
+    }
+    return lookupCache(key);
+  }
+  void removeCache(const Cache::CacheKeyType& key) override { entries_.erase(key); }
+  void insertCache(const Cache::CacheKeyType& key, Cache::CacheEntryPtr&& value) override {
+    entries_[key] = value->cacheLength();
+    expires_[key] = value->cacheExpire();
+  }
+
+  // Complete the oldest pending lookup.
+  void complete() {
+    ASSERT_FALSE(pending_.empty());
+    auto pending = std::move(pending_.front());
+    pending_.erase(pending_.begin());
+    pending.second("", lookupCache(pending.first));
+  }
+
+  std::map<std::string, uint64_t> entries_;
+  std::map<std::string, uint64_t> expires_;
+  std::vector<std::pair<std::string, AsyncCallback>> pending_;
+
+private:
+  const bool inline_lookup_{false};
+};
+
+class TestLookupCallback : public CacheLookupCallback {
+public:
+  void onSuccess(Cache::CacheEntryPtr&& entry) override {
+    hit_ = true;
+    hit_length_ = entry->cacheLength();
+    done_ = true;
+  }
+  void onFailure() override { done_ = true; }
+
+  bool done_{false};
+  bool hit_{false};
+  uint64_t hit_length_{0};
+};
+
+class CacheGetterSetterTest : public testing::Test {
+public:
+  void initialize(LookupPolicy::Mode mode) {
+    LookupPolicy policy;
+    policy.set_mode(mode);
+    initialize(policy);
+  }
+
+  void initialize(const LookupPolicy& policy) {
+    local_ = std::make_shared<TestCache>(true);
+    remote_ = std::make_shared<TestCache>(false);
+    origin_ = std::make_shared<TestCache>(false);
+
+    config_ = std::make_unique<CacheGetterSetterConfig>(
+        CacheGetterSetterConfig::CacheList{
+            {"local", local_}, {"remote", remote_}, {"origin", origin_}},
+        context_, policy);
+  }
+
+  CacheLookupStatus lookup() {
+    getter_setter_ = std::make_shared<CacheGetterSetter>(config_.get(), nullptr);
+    getter_setter_->setCacheKey("key");
+    return getter_setter_->lookupCache(&callback_);
+  }
+
+  // Capture the promotion that is posted to the dispatcher.
+  void expectPromotion() {
+    EXPECT_CALL(context_.thread_local_.dispatcher_, post(testing::_))
+        .WillOnce(testing::Invoke([this](Event::PostCb cb) { promotion_ = std::move(cb); }));
+  }
+
+  uint64_t counter(const std::string& name) {
+    return context_.scope().counterFromString("cache_lookup." + name).value();
+  }
+
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context_;
+  std::shared_ptr<TestCache> local_;
+  std::shared_ptr<TestCache> remote_;
+  std::shared_ptr<TestCache> origin_;
+  std::unique_ptr<CacheGetterSetterConfig> config_;
+  CacheGetterSetterSharedPtr getter_setter_;
+  TestLookupCallback callback_;
+  Event::PostCb promotion_;
+};
+
+TEST_F(CacheGetterSetterTest, MaxEntrySize) {
+  initialize(LookupPolicy::SEQUENTIAL);
+  ProtoTTL ttl;
+  ttl.set_default_(10);
+  SpecificCacheConfig route_config(KeyMakerConfig(), {{"local", ttl}}, "v1", 1024);
+  EXPECT_EQ(1024, route_config.maxEntrySize());
+
+  const auto message = [](size_t body_size) {
+    auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+    headers->setStatus(200);
+    auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+    message->body().add(std::string(body_size, 'x'));
+    return message;
+  };
+  const auto sender = [&]() {
+    return std::make_shared<CacheRequestSender>(config_.get(), &route_config);
+  };
+
+  EXPECT_TRUE(sender()->insertResponse("small", message(512)));
+  EXPECT_FALSE(sender()->insertResponse("large", message(1024)));
+  EXPECT_EQ(1, local_->entries_.count("small"));
+  EXPECT_EQ(0, local_->entries_.count("large"));
+
+  EXPECT_NE(nullptr, sender()->insertSharedResponse("shared-small", message(512)));
+  EXPECT_EQ(nullptr, sender()->insertSharedResponse("shared-large", message(1024)));
+  EXPECT_EQ(1, local_->entries_.count("shared-small"));
+  EXPECT_EQ(0, local_->entries_.count("shared-large"));
+}
+
+TEST_F(CacheGetterSetterTest, StaleGraceExtendsExpire) {
+  initialize(LookupPolicy::SEQUENTIAL);
+  ProtoTTL ttl;
+  ttl.set_default_(1000);
+  SpecificCacheConfig route_config(KeyMakerConfig(), {{"local", ttl}}, "v1",
+                                   SpecificCacheConfig::DefaultMaxEntrySize, 60000);
+  EXPECT_EQ(60000, route_config.staleGrace());
+
+  auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+  headers->setStatus(200);
+  auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+  const uint64_t now = Common::TimeUtil::createTimestamp();
+  auto entry = std::make_shared<CacheRequestSender>(config_.get(), &route_config)
+                   ->insertSharedResponse("key", std::move(message));
+  ASSERT_NE(nullptr, entry);
+
+  // Entries are kept for the grace period after the TTL.
+  EXPECT_GE(local_->expires_["key"], now + 61000);
+  EXPECT_LE(local_->expires_["key"], Common::TimeUtil::createTimestamp() + 61000);
+}
+
+TEST_F(CacheGetterSetterTest, TreatAsMissInsertsIntoAllCaches) {
+  initialize(LookupPolicy::SEQUENTIAL);
+  ProtoTTL ttl;
+  ttl.set_default_(1000);
+  SpecificCacheConfig route_config(KeyMakerConfig(),
+                                   {{"local", ttl}, {"remote", ttl}, {"origin", ttl}}, "v1");
+  local_->entries_["key"] = 1;
+
+  getter_setter_ = std::make_shared<CacheGetterSetter>(config_.get(), &route_config);
+  getter_setter_->setCacheKey("key");
+  getter_setter_->lookupCache(&callback_);
+  EXPECT_TRUE(callback_.hit_);
+  EXPECT_EQ("local", getter_setter_->reqeustHitInCache());
+
+  // Responses are only inserted into the caches before the hit one.
+  EXPECT_FALSE(getter_setter_->insertCache(std::make_unique<TestCacheEntry>(2), "200"));
+  EXPECT_EQ(1, local_->entries_["key"]);
+
+  getter_setter_->treatAsMiss();
+  EXPECT_EQ("", getter_setter_->reqeustHitInCache());
+  EXPECT_TRUE(getter_setter_->insertCache(std::make_unique<TestCacheEntry>(3), "200"));
+  EXPECT_EQ(3, local_->entries_["key"]);
+  EXPECT_EQ(3, remote_->entries_["key"]);
+  EXPECT_EQ(3, origin_->entries_["key"]);
+}
+
+TEST_F(CacheGetterSetterTest, Sequential) {
+  initialize(LookupPolicy::SEQUENTIAL);
+  remote_->entries_["key"] = 2;
+  origin_->entries_["key"] = 3;
+
+  EXPECT_EQ(CacheLookupStatus::ONCALL, lookup());
+  // The local miss is completed inline and only the remote cache is pending.
+  EXPECT_EQ(1, remote_->pending_.size());
+  EXPECT_TRUE(origin_->pending_.empty());
+
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(2, callback_.hit_length_);
+  EXPECT_TRUE(origin_->pending_.empty());
+  EXPECT_EQ("remote", getter_setter_->reqeustHitInCache());
+  EXPECT_EQ(1, counter("local.miss"));
+  EXPECT_EQ(1, counter("remote.hit"));
+  EXPECT_EQ(0, counter("origin.lookup"));
+}
+
+TEST_F(CacheGetterSetterTest, ParallelUsesFirstHitInOrder) {
+  initialize(LookupPolicy::PARALLEL);
+  remote_->entries_["key"] = 2;
+  origin_->entries_["key"] = 3;
+
+  lookup();
+  EXPECT_EQ(1, remote_->pending_.size());
+  EXPECT_EQ(1, origin_->pending_.size());
+
+  // The later hit waits for the remote cache.
+  origin_->complete();
+  EXPECT_FALSE(callback_.done_);
+
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(2, callback_.hit_length_);
+  EXPECT_EQ(1, counter("origin.discarded"));
+}
+
+TEST_F(CacheGetterSetterTest, ParallelFallsThroughMisses) {
+  initialize(LookupPolicy::PARALLEL);
+  origin_->entries_["key"] = 3;
+
+  lookup();
+  origin_->complete();
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(3, callback_.hit_length_);
+  EXPECT_EQ("origin", getter_setter_->reqeustHitInCache());
+}
+
+TEST_F(CacheGetterSetterTest, ParallelStopsAtInlineHit) {
+  initialize(LookupPolicy::PARALLEL);
+  local_->entries_["key"] = 1;
+
+  EXPECT_EQ(CacheLookupStatus::ONCALL, lookup());
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(1, callback_.hit_length_);
+  EXPECT_TRUE(remote_->pending_.empty());
+  EXPECT_TRUE(origin_->pending_.empty());
+}
+
+TEST_F(CacheGetterSetterTest, AllMiss) {
+  initialize(LookupPolicy::PARALLEL);
+  lookup();
+  remote_->complete();
+  EXPECT_FALSE(callback_.done_);
+  origin_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_FALSE(callback_.hit_);
+}
+
+TEST_F(CacheGetterSetterTest, Hedged) {
+  auto* timer = new testing::NiceMock<Event::MockTimer>(&context_.thread_local_.dispatcher_);
+  initialize(LookupPolicy::HEDGED);
+  origin_->entries_["key"] = 3;
+
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(5), testing::_));
+  lookup();
+  EXPECT_EQ(1, remote_->pending_.size());
+  EXPECT_TRUE(origin_->pending_.empty());
+
+  // The remote cache is slow and the origin cache is also looked up.
+  timer->invokeCallback();
+  EXPECT_EQ(1, origin_->pending_.size());
+  origin_->complete();
+  EXPECT_FALSE(callback_.done_);
+
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(3, callback_.hit_length_);
+}
+
+TEST_F(CacheGetterSetterTest, CancelDiscardsResults) {
+  initialize(LookupPolicy::PARALLEL);
+  remote_->entries_["key"] = 2;
+
+  lookup();
+  getter_setter_->cancelLookup();
+  remote_->complete();
+  origin_->complete();
+  EXPECT_FALSE(callback_.done_);
+  EXPECT_EQ(1, counter("remote.discarded"));
+}
+
+TEST_F(CacheGetterSetterTest, PromoteRemoteHit) {
+  LookupPolicy policy;
+  policy.mutable_promotion();
+  initialize(policy);
+  const uint64_t expire = Common::TimeUtil::createTimestamp() + 60000;
+  remote_->entries_["key"] = 2;
+  remote_->expires_["key"] = expire;
+
+  expectPromotion();
+  lookup();
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(2, callback_.hit_length_);
+  EXPECT_EQ(1, counter("remote.promoted"));
+
+  // The entry is inserted after the response with the expire time of the remote entry.
+  EXPECT_TRUE(local_->entries_.empty());
+  promotion_();
+  EXPECT_EQ(2, local_->entries_["key"]);
+  EXPECT_EQ(expire, local_->expires_["key"]);
+  EXPECT_TRUE(origin_->entries_.empty());
+
+  // The next lookup is served by the local cache.
+  callback_ = TestLookupCallback();
+  lookup();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ("local", getter_setter_->reqeustHitInCache());
+}
+
+TEST_F(CacheGetterSetterTest, PromotionSkipsShortAndUnknownTTL) {
+  LookupPolicy policy;
+  policy.mutable_promotion();
+  initialize(policy);
+  remote_->entries_["key"] = 2;
+  remote_->expires_["key"] = Common::TimeUtil::createTimestamp() + 100;
+  origin_->entries_["other"] = 3;
+
+  EXPECT_CALL(context_.thread_local_.dispatcher_, post(testing::_)).Times(0);
+  lookup();
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(1, counter("remote.promotion_skipped"));
+
+  getter_setter_ = std::make_shared<CacheGetterSetter>(config_.get(), nullptr);
+  getter_setter_->setCacheKey("other");
+  callback_ = TestLookupCallback();
+  getter_setter_->lookupCache(&callback_);
+  remote_->complete();
+  origin_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(1, counter("origin.promotion_skipped"));
+  EXPECT_TRUE(local_->entries_.empty());
+}
+
+TEST_F(CacheGetterSetterTest, PromotionRateLimit) {
+  LookupPolicy policy;
+  policy.mutable_promotion()->mutable_max_per_second()->set_value(1);
+  initialize(policy);
+  remote_->entries_["key"] = 2;
+  remote_->expires_["key"] = Common::TimeUtil::createTimestamp() + 60000;
+
+  expectPromotion();
+  lookup();
+  remote_->complete();
+
+  // The first promotion has not been run and the second hit is over the rate.
+  callback_ = TestLookupCallback();
+  lookup();
+  remote_->complete();
+  EXPECT_TRUE(callback_.done_);
+  EXPECT_EQ(1, counter("remote.promoted"));
+  EXPECT_EQ(1, counter("remote.promotion_throttled"));
+}
+
+} // namespace
+} // namespace Sender
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
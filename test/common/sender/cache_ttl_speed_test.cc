@@ -0,0 +1,57 @@
+#include <string>
+
+#include "source/common/sender/cache_request_sender.h"
+
+#include "test/benchmark/main.h"
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace Common {
+namespace Sender {
+namespace {
+
+// Equal numbers of exact, prefix and regex patterns.
+ProtoTTL benchmarkTTL(int64_t rules) {
+  ProtoTTL ttl;
+  ttl.set_default_(60);
+  auto& customs = *ttl.mutable_customs();
+  for (int64_t i = 0; i < rules; i++) {
+    switch (i % 3) {
+    case 0:
+      customs[absl::StrCat(200 + i)] = i;
+      break;
+    case 1:
+      customs[absl::StrCat(300 + i, ".*")] = i;
+      break;
+    default:
+      customs[absl::StrCat("4", i % 10, "[0-", i % 10, "]", i / 10, "?")] = i;
+      break;
+    }
+  }
+  return ttl;
+}
+
+// Args: number of TTL rules.
+// NOLINTNEXTLINE(readability-identifier-naming)
+void BM_CacheTTL(::benchmark::State& state) {
+  const SpecificCacheConfig config(KeyMakerConfig(),
+                                   {{"LocalCache", benchmarkTTL(state.range(0))}});
+  // Codes that hit every kind of pattern and the default.
+  const std::string codes[] = {"200", "304", "404", "503"};
+
+  size_t i = 0;
+  for (auto _ : state) { // NOLINT
+    benchmark::DoNotOptimize(config.cacheTTL("LocalCache", codes[i++ % 4]));
+  }
+}
+
+BENCHMARK(BM_CacheTTL)->Arg(3)->Arg(15)->Arg(60)->Arg(120);
+
+} // namespace
+} // namespace Sender
+} // namespace Common
+} // namespace Proxy
+} // namespace Envoy
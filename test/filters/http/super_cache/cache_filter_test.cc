@@ -0,0 +1,873 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/cache/gzip_body_codec.h"
+#include "source/common/cache/http_cache_entry.h"
+#include "source/common/common/proxy_utility.h"
+#include "source/common/http/message_impl.h"
+#include "source/filters/http/super_cache/cache_filter.h"
+
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/http/mocks.h"
+#include "test/mocks/server/factory_context.h"
+#include "test/mocks/upstream/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace HttpFilters {
+namespace SuperCache {
+namespace {
+
+using testing::_;
+using testing::DoDefault;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+using testing::ReturnRef;
+
+using Proxy::Common::Cache::CacheEntryConstSharedPtr;
+using Proxy::Common::Cache::CacheEntryPtr;
+using Proxy::Common::Cache::CacheKeyType;
+
+constexpr char FilterName[] = "proxy.filters.http.super_cache";
+
+// Cache of sealed entries whose lookups are completed inline.
+class TestCache : public Proxy::Common::Cache::CommonCacheBase {
+public:
+  CacheEntryPtr lookupCache(const CacheKeyType& key) override {
+    auto iter = entries_.find(key);
+    return iter == entries_.end() ? nullptr : iter->second->createCopy();
+  }
+  void lookupCache(const CacheKeyType& key, AsyncCallback callback) override {
+    callback("", lookupCache(key));
+  }
+  absl::optional<CacheEntryPtr> lookupCacheInline(const CacheKeyType& key) override {
+    return lookupCache(key);
+  }
+  void removeCache(const CacheKeyType& key) override { entries_.erase(key); }
+  void insertCache(const CacheKeyType& key, CacheEntryPtr&& value) override {
+    value->seal();
+    entries_[key] = std::move(value);
+  }
+
+  std::map<CacheKeyType, CacheEntryConstSharedPtr> entries_;
+};
+
+class HttpCacheFilterTest : public testing::Test {
+public:
+  HttpCacheFilterTest() : cache_(std::make_shared<TestCache>()) {
+    config_ = std::make_unique<CommonCacheConfig>(
+        std::make_shared<Proxy::Common::Sender::CacheGetterSetterConfig>(
+            Proxy::Common::Sender::CacheGetterSetterConfig::CacheList{{"test", cache_}}, context_),
+        context_, "");
+
+    // The response that is encoded by the filter itself.
+    ON_CALL(decoder_callbacks_, encodeHeaders_(_, _))
+        .WillByDefault(Invoke([this](Http::ResponseHeaderMap& headers, bool end_stream) {
+          response_headers_ = Http::createHeaderMap<Http::ResponseHeaderMapImpl>(headers);
+          response_end_ = end_stream;
+        }));
+    ON_CALL(decoder_callbacks_, encodeData(_, _))
+        .WillByDefault(Invoke([this](Buffer::Instance& data, bool end_stream) {
+          response_body_.append(data.toString());
+          data.drain(data.length());
+          response_end_ = end_stream;
+        }));
+    ON_CALL(decoder_callbacks_.dispatcher_, post(_))
+        .WillByDefault(Invoke([this](Event::PostCb cb) { posted_.push_back(std::move(cb)); }));
+  }
+
+  ~HttpCacheFilterTest() override {
+    if (filter_ != nullptr) {
+      filter_->onDestroy();
+    }
+  }
+
+  void setRouteConfig(const std::string& yaml) {
+    RouteProtoConfig proto_config;
+    TestUtility::loadFromYaml(yaml, proto_config);
+    route_config_ = std::make_shared<RouteCacheConfig>(proto_config);
+    ON_CALL(*decoder_callbacks_.route_, mostSpecificPerFilterConfig(FilterName))
+        .WillByDefault(Return(route_config_.get()));
+  }
+
+  // Create a filter for a new request. The previous filter is destroyed.
+  void createFilter() {
+    if (filter_ != nullptr) {
+      filter_->onDestroy();
+    }
+    response_headers_ = nullptr;
+    response_body_.clear();
+    response_end_ = false;
+    filter_ = std::make_unique<HttpCacheFilter>(config_.get(), time_system_, FilterName);
+    filter_->setDecoderFilterCallbacks(decoder_callbacks_);
+    filter_->setEncoderFilterCallbacks(encoder_callbacks_);
+  }
+
+  CacheKeyType cacheKey() { return route_config_->cacheConfig()->cacheKey(request_headers_); }
+
+  // Cache the response of the request with the expire time.
+  void insertEntry(const Http::TestResponseHeaderMapImpl& headers, const std::string& body,
+                   uint64_t expire = 0) {
+    auto message = std::make_unique<Http::ResponseMessageImpl>(
+        Http::createHeaderMap<Http::ResponseHeaderMapImpl>(headers));
+    message->body().add(body);
+    auto entry =
+        std::make_shared<Proxy::Common::Cache::HttpCacheEntry>(std::move(message), expire);
+    entry->seal();
+    cache_->entries_[cacheKey()] = std::move(entry);
+  }
+
+  static std::string gzip(const std::string& body) {
+    Buffer::OwnedImpl input(body);
+    Buffer::OwnedImpl output;
+    EXPECT_TRUE(Proxy::Common::Cache::GzipBodyCodec::compress(input, output));
+    return output.toString();
+  }
+
+  std::string responseHeader(const std::string& name) {
+    if (response_headers_ == nullptr) {
+      ADD_FAILURE() << "No response is encoded by the filter";
+      return "";
+    }
+    const auto header = response_headers_->get(Http::LowerCaseString(name));
+    return header.empty() ? "" : std::string(header[0]->value().getStringView());
+  }
+
+  // Run the callbacks that are posted to the dispatcher of the stream.
+  void runPosted() {
+    auto posted = std::move(posted_);
+    posted_.clear();
+    for (auto& cb : posted) {
+      cb();
+    }
+  }
+
+  uint64_t counter(const std::string& name) {
+    return context_.scope().counterFromString("super_cache." + name).value();
+  }
+
+  NiceMock<Server::Configuration::MockFactoryContext> context_;
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> decoder_callbacks_;
+  NiceMock<Http::MockStreamEncoderFilterCallbacks> encoder_callbacks_;
+  Event::SimulatedTimeSystem time_system_;
+
+  std::shared_ptr<TestCache> cache_;
+  std::unique_ptr<CommonCacheConfig> config_;
+  std::shared_ptr<RouteCacheConfig> route_config_;
+  std::unique_ptr<HttpCacheFilter> filter_;
+
+  Http::TestRequestHeaderMapImpl request_headers_{
+      {":method", "GET"}, {":authority", "example.com"}, {":path", "/items/1"}};
+
+  Http::ResponseHeaderMapPtr response_headers_;
+  std::string response_body_;
+  bool response_end_{false};
+  std::vector<Event::PostCb> posted_;
+};
+
+const std::string DefaultConfig = R"EOF(
+cache_ttls:
+  test:
+    default: 60000
+)EOF";
+
+const std::string CompressionConfig = R"EOF(
+cache_ttls:
+  test:
+    default: 60000
+compression:
+  min_size: 16
+)EOF";
+
+TEST_F(HttpCacheFilterTest, AcceptEncoding) {
+  setRouteConfig(CompressionConfig);
+  const std::string body(1024, 'a');
+  const std::string compressed = gzip(body);
+  insertEntry({{":status", "200"},
+               {"content-encoding", "gzip"},
+               {"content-length", std::to_string(compressed.size())},
+               {"x-super-cache-compressed", "gzip"}},
+              compressed);
+
+  const std::vector<std::pair<std::string, bool>> cases = {
+      {"gzip", true},
+      {"GZIP ; Q=1", true},
+      {"deflate, gzip;q=0.5", true},
+      {"gzip;q=0", false},
+      {"gzip;q=0.000", false},
+      {"gzip;q=invalid", false},
+      {"br", false},
+      {"*", true},
+      {"*;q=0", false},
+      // An explicit gzip coding takes precedence over "*" in any order.
+      {"gzip;q=0, *", false},
+      {"*, gzip;q=0", false},
+      {"*;q=0, gzip", true},
+      {"gzip, *;q=0", true},
+  };
+  for (const auto& [accept_encoding, accepted] : cases) {
+    SCOPED_TRACE(accept_encoding);
+    createFilter();
+    request_headers_.setCopy(Http::LowerCaseString("accept-encoding"), accept_encoding);
+    EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+              filter_->decodeHeaders(request_headers_, true));
+    ASSERT_NE(nullptr, response_headers_);
+    EXPECT_TRUE(response_end_);
+    EXPECT_EQ(accepted ? "gzip" : "", responseHeader("content-encoding"));
+    EXPECT_EQ(accepted ? compressed : body, response_body_);
+  }
+}
+
+TEST_F(HttpCacheFilterTest, DecompressCachedResponse) {
+  setRouteConfig(CompressionConfig);
+  const std::string body(1024, 'a');
+  const std::string compressed = gzip(body);
+  insertEntry({{":status", "200"},
+               {"content-encoding", "gzip"},
+               {"content-length", std::to_string(compressed.size())},
+               {"vary", "accept-encoding"},
+               {"x-super-cache-compressed", "gzip"}},
+              compressed);
+
+  // The encoding is removed and the length is the length of the decompressed body.
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  ASSERT_NE(nullptr, response_headers_);
+  EXPECT_EQ("200", responseHeader(":status"));
+  EXPECT_EQ("", responseHeader("content-encoding"));
+  EXPECT_EQ(std::to_string(body.size()), responseHeader("content-length"));
+  EXPECT_EQ("accept-encoding", responseHeader("vary"));
+  EXPECT_EQ("HIT", responseHeader("x-cache-status"));
+  EXPECT_EQ("", responseHeader("x-super-cache-compressed"));
+  EXPECT_EQ(body, response_body_);
+
+  // The stored bytes are served as they are.
+  createFilter();
+  request_headers_.setCopy(Http::LowerCaseString("accept-encoding"), "gzip");
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("gzip", responseHeader("content-encoding"));
+  EXPECT_EQ(std::to_string(compressed.size()), responseHeader("content-length"));
+  EXPECT_EQ("", responseHeader("x-super-cache-compressed"));
+  EXPECT_EQ(compressed, response_body_);
+  EXPECT_EQ(2, counter("hit"));
+}
+
+TEST_F(HttpCacheFilterTest, CompressedEntryIsDecompressedWithoutRouteCompression) {
+  setRouteConfig(CompressionConfig);
+  const std::string body(1024, 'a');
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers_, true));
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"}};
+  filter_->encodeHeaders(headers, false);
+  Buffer::OwnedImpl data(body);
+  filter_->encodeData(data, true);
+  ASSERT_EQ(1, cache_->entries_.size());
+
+  // Compression is disabled, e.g. by a config change or another route of the shared caches, and
+  // the entry compressed by the filter is still decompressed.
+  setRouteConfig(DefaultConfig);
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("", responseHeader("content-encoding"));
+  EXPECT_EQ("", responseHeader("x-super-cache-compressed"));
+  EXPECT_EQ(body, response_body_);
+
+  createFilter();
+  request_headers_.setCopy(Http::LowerCaseString("accept-encoding"), "gzip");
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("gzip", responseHeader("content-encoding"));
+  EXPECT_EQ("", responseHeader("x-super-cache-compressed"));
+  EXPECT_EQ(gzip(body), response_body_);
+}
+
+TEST_F(HttpCacheFilterTest, EncodedResponseIsKeptWithoutCompression) {
+  setRouteConfig(DefaultConfig);
+  const std::string compressed = gzip(std::string(1024, 'a'));
+  insertEntry({{":status", "200"}, {"content-encoding", "gzip"}}, compressed);
+
+  // Responses that are encoded by upstream are never decoded by the filter.
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("gzip", responseHeader("content-encoding"));
+  EXPECT_EQ(compressed, response_body_);
+
+  // Even if compression is enabled for the route.
+  setRouteConfig(CompressionConfig);
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("gzip", responseHeader("content-encoding"));
+  EXPECT_EQ(compressed, response_body_);
+}
+
+TEST_F(HttpCacheFilterTest, BrokenCompressedResponseIsMiss) {
+  setRouteConfig(CompressionConfig);
+  insertEntry(
+      {{":status", "200"}, {"content-encoding", "gzip"}, {"x-super-cache-compressed", "gzip"}},
+      "not gzip data");
+
+  // The request goes to upstream as a miss.
+  createFilter();
+  EXPECT_CALL(decoder_callbacks_, encodeHeaders_(_, _)).Times(0);
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ(0, counter("hit"));
+}
+
+TEST_F(HttpCacheFilterTest, CachedBodyFollowsDownstreamWatermarks) {
+  setRouteConfig(DefaultConfig);
+  const uint64_t chunk_size = Proxy::Common::Cache::BodyChunkSize;
+  const std::string body(3 * chunk_size, 'a');
+  insertEntry({{":status", "200"}}, body);
+
+  createFilter();
+  EXPECT_CALL(decoder_callbacks_, addDownstreamWatermarkCallbacks(_));
+  // The downstream goes above the high watermark twice while the first chunk is written.
+  EXPECT_CALL(decoder_callbacks_, encodeData(_, _))
+      .WillOnce(Invoke([this](Buffer::Instance& data, bool end_stream) {
+        response_body_.append(data.toString());
+        data.drain(data.length());
+        response_end_ = end_stream;
+        filter_->onAboveWriteBufferHighWatermark();
+        filter_->onAboveWriteBufferHighWatermark();
+      }))
+      .WillRepeatedly(DoDefault());
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ(chunk_size, response_body_.size());
+  EXPECT_FALSE(response_end_);
+
+  // Nothing is resumed until all high watermarks are released.
+  filter_->onBelowWriteBufferLowWatermark();
+  EXPECT_TRUE(posted_.empty());
+  filter_->onBelowWriteBufferLowWatermark();
+  ASSERT_EQ(1, posted_.size());
+  EXPECT_EQ(chunk_size, response_body_.size());
+
+  // The rest of the body is encoded in the next iteration of the event loop.
+  EXPECT_CALL(decoder_callbacks_, removeDownstreamWatermarkCallbacks(_));
+  runPosted();
+  EXPECT_EQ(body, response_body_);
+  EXPECT_TRUE(response_end_);
+}
+
+TEST_F(HttpCacheFilterTest, DestroyFilterWhileResumeIsPosted) {
+  setRouteConfig(DefaultConfig);
+  const uint64_t chunk_size = Proxy::Common::Cache::BodyChunkSize;
+  insertEntry({{":status", "200"}}, std::string(3 * chunk_size, 'a'));
+
+  createFilter();
+  EXPECT_CALL(decoder_callbacks_, encodeData(_, _))
+      .WillOnce(Invoke([this](Buffer::Instance& data, bool) {
+        response_body_.append(data.toString());
+        data.drain(data.length());
+        filter_->onAboveWriteBufferHighWatermark();
+      }));
+  filter_->decodeHeaders(request_headers_, true);
+  filter_->onBelowWriteBufferLowWatermark();
+  ASSERT_EQ(1, posted_.size());
+
+  // The stream is reset before the resumption runs, and the rest of the body is dropped.
+  EXPECT_CALL(decoder_callbacks_, removeDownstreamWatermarkCallbacks(_));
+  filter_->onDestroy();
+  filter_.reset();
+  runPosted();
+  EXPECT_EQ(chunk_size, response_body_.size());
+  EXPECT_FALSE(response_end_);
+}
+
+const std::string CoalescingConfig = R"EOF(
+cache_ttls:
+  test:
+    default: 60000
+max_entry_size: 1024
+coalescing:
+  timeout: 1s
+)EOF";
+
+class HttpCacheFilterCoalescingTest : public HttpCacheFilterTest {
+public:
+  // A request of the same key with its own stream.
+  struct Request {
+    ~Request() {
+      if (filter_ != nullptr) {
+        filter_->onDestroy();
+      }
+    }
+
+    void runPosted() {
+      auto posted = std::move(posted_);
+      posted_.clear();
+      for (auto& cb : posted) {
+        cb();
+      }
+    }
+
+    NiceMock<Http::MockStreamDecoderFilterCallbacks> decoder_callbacks_;
+    NiceMock<Http::MockStreamEncoderFilterCallbacks> encoder_callbacks_;
+    Http::TestRequestHeaderMapImpl request_headers_;
+    // Timer of the wait, which is only created if the request waits.
+    Event::MockTimer* timer_{nullptr};
+    std::unique_ptr<HttpCacheFilter> filter_;
+    std::vector<Event::PostCb> posted_;
+
+    Http::FilterHeadersStatus status_{Http::FilterHeadersStatus::Continue};
+    // Response that is served by the filter itself.
+    std::string cache_status_;
+    std::string body_;
+    bool continued_{false};
+  };
+  using RequestPtr = std::unique_ptr<Request>;
+
+  HttpCacheFilterCoalescingTest() { setRouteConfig(CoalescingConfig); }
+
+  RequestPtr startRequest(bool waits) {
+    auto request = std::make_unique<Request>();
+    Request* r = request.get();
+    r->request_headers_ = request_headers_;
+    ON_CALL(*r->decoder_callbacks_.route_, mostSpecificPerFilterConfig(FilterName))
+        .WillByDefault(Return(route_config_.get()));
+    ON_CALL(r->decoder_callbacks_, encodeHeaders_(_, _))
+        .WillByDefault(Invoke([r](Http::ResponseHeaderMap& headers, bool) {
+          const auto status = headers.get(Http::LowerCaseString("x-cache-status"));
+          r->cache_status_ = status.empty() ? "" : std::string(status[0]->value().getStringView());
+        }));
+    ON_CALL(r->decoder_callbacks_, encodeData(_, _))
+        .WillByDefault(Invoke([r](Buffer::Instance& data, bool) {
+          r->body_.append(data.toString());
+          data.drain(data.length());
+        }));
+    ON_CALL(r->decoder_callbacks_, continueDecoding()).WillByDefault(Invoke([r]() {
+      r->continued_ = true;
+    }));
+    ON_CALL(r->decoder_callbacks_.dispatcher_, post(_))
+        .WillByDefault(Invoke([r](Event::PostCb cb) { r->posted_.push_back(std::move(cb)); }));
+    if (waits) {
+      r->timer_ = new NiceMock<Event::MockTimer>(&r->decoder_callbacks_.dispatcher_);
+    }
+
+    r->filter_ = std::make_unique<HttpCacheFilter>(config_.get(), time_system_, FilterName);
+    r->filter_->setDecoderFilterCallbacks(r->decoder_callbacks_);
+    r->filter_->setEncoderFilterCallbacks(r->encoder_callbacks_);
+    r->status_ = r->filter_->decodeHeaders(r->request_headers_, true);
+    return request;
+  }
+
+  // The request goes to upstream and the response is passed to the filter.
+  void respond(Request& request, Http::TestResponseHeaderMapImpl headers, const std::string& body) {
+    EXPECT_EQ(Http::FilterHeadersStatus::Continue, request.filter_->encodeHeaders(headers, false));
+    Buffer::OwnedImpl data(body);
+    EXPECT_EQ(Http::FilterDataStatus::Continue, request.filter_->encodeData(data, true));
+  }
+
+  static void destroy(Request& request) {
+    request.filter_->onDestroy();
+    request.filter_.reset();
+  }
+};
+
+TEST_F(HttpCacheFilterCoalescingTest, WaiterIsServedByLeader) {
+  auto leader = startRequest(false);
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, leader->status_);
+  EXPECT_EQ(1, config_->coalescer()->flights());
+
+  auto waiter = startRequest(true);
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration, waiter->status_);
+  EXPECT_TRUE(waiter->timer_->enabled_);
+
+  respond(*leader, {{":status", "200"}}, "hello");
+  EXPECT_EQ(1, cache_->entries_.size());
+  EXPECT_EQ(0, config_->coalescer()->flights());
+
+  // The waiter is woken up in its own thread and served the response of the leader.
+  EXPECT_TRUE(waiter->cache_status_.empty());
+  waiter->runPosted();
+  EXPECT_EQ("HIT", waiter->cache_status_);
+  EXPECT_EQ("hello", waiter->body_);
+  EXPECT_FALSE(waiter->continued_);
+  EXPECT_FALSE(waiter->timer_->enabled_);
+  EXPECT_EQ(1, counter("coalesced_hit"));
+  // Only the response of the leader is a miss.
+  EXPECT_EQ(1, counter("miss"));
+}
+
+TEST_F(HttpCacheFilterCoalescingTest, LeaderIsNotCacheable) {
+  auto leader = startRequest(false);
+  auto waiter = startRequest(true);
+
+  respond(*leader, {{":status", "200"}, {"cache-control", "private"}}, "hello");
+  EXPECT_TRUE(cache_->entries_.empty());
+  EXPECT_EQ(0, config_->coalescer()->flights());
+
+  // The waiter goes to upstream by itself.
+  waiter->runPosted();
+  EXPECT_TRUE(waiter->continued_);
+  EXPECT_TRUE(waiter->cache_status_.empty());
+  EXPECT_EQ(1, counter("coalesced_miss"));
+}
+
+TEST_F(HttpCacheFilterCoalescingTest, LeaderFinishesOnEarlyExits) {
+  // The response is known to be too large by its headers.
+  auto leader = startRequest(false);
+  auto waiter = startRequest(true);
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"}, {"content-length", "4096"}};
+  leader->filter_->encodeHeaders(headers, false);
+  EXPECT_EQ(0, config_->coalescer()->flights());
+  waiter->runPosted();
+  EXPECT_TRUE(waiter->continued_);
+
+  // The body grows too large while it is buffered.
+  leader = startRequest(false);
+  waiter = startRequest(true);
+  Http::TestResponseHeaderMapImpl chunked{{":status", "200"}};
+  leader->filter_->encodeHeaders(chunked, false);
+  EXPECT_EQ(1, config_->coalescer()->flights());
+  Buffer::OwnedImpl data(std::string(2048, 'a'));
+  leader->filter_->encodeData(data, false);
+  EXPECT_EQ(0, config_->coalescer()->flights());
+  waiter->runPosted();
+  EXPECT_TRUE(waiter->continued_);
+
+  EXPECT_TRUE(cache_->entries_.empty());
+  EXPECT_EQ(2, counter("coalesced_miss"));
+}
+
+TEST_F(HttpCacheFilterCoalescingTest, WaiterBecomesLeaderAfterLeaderIsDestroyed) {
+  auto leader = startRequest(false);
+  auto waiter1 = startRequest(true);
+  auto waiter2 = startRequest(true);
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(400));
+  destroy(*leader);
+  EXPECT_EQ(0, config_->coalescer()->flights());
+
+  // The first waiter that is woken up becomes the new leader and goes to upstream.
+  waiter1->runPosted();
+  EXPECT_TRUE(waiter1->continued_);
+  EXPECT_EQ(1, config_->coalescer()->flights());
+
+  // The other waiter waits for the new leader until the deadline of its first wait.
+  EXPECT_CALL(*waiter2->timer_, enableTimer(std::chrono::milliseconds(600), _));
+  waiter2->runPosted();
+  EXPECT_FALSE(waiter2->continued_);
+  EXPECT_EQ(2, counter("coalesced_cancelled"));
+
+  respond(*waiter1, {{":status", "200"}}, "hello");
+  waiter2->runPosted();
+  EXPECT_EQ("HIT", waiter2->cache_status_);
+  EXPECT_EQ("hello", waiter2->body_);
+  EXPECT_EQ(1, counter("coalesced_hit"));
+}
+
+TEST_F(HttpCacheFilterCoalescingTest, NoTimeLeftAfterLeaderIsDestroyed) {
+  auto leader = startRequest(false);
+  auto waiter1 = startRequest(true);
+  auto waiter2 = startRequest(true);
+
+  time_system_.advanceTimeWait(std::chrono::milliseconds(1000));
+  destroy(*leader);
+  waiter1->runPosted();
+  EXPECT_TRUE(waiter1->continued_);
+
+  // The deadline has passed and the waiter goes to upstream without waiting again.
+  EXPECT_CALL(*waiter2->timer_, enableTimer(_, _)).Times(0);
+  waiter2->runPosted();
+  EXPECT_TRUE(waiter2->continued_);
+  EXPECT_EQ(1, counter("coalesced_timeout"));
+}
+
+TEST_F(HttpCacheFilterCoalescingTest, WaitTimeout) {
+  auto leader = startRequest(false);
+  auto waiter = startRequest(true);
+
+  waiter->timer_->invokeCallback();
+  EXPECT_TRUE(waiter->continued_);
+  EXPECT_EQ(1, counter("coalesced_timeout"));
+
+  // The waiter is not woken up by the leader any more.
+  respond(*leader, {{":status", "200"}}, "hello");
+  EXPECT_EQ(1, cache_->entries_.size());
+  EXPECT_TRUE(waiter->posted_.empty());
+  EXPECT_EQ(0, counter("coalesced_hit"));
+}
+
+const std::string StaleConfig = R"EOF(
+cache_ttls:
+  test:
+    default: 60000
+stale:
+  stale_while_revalidate: 10s
+  stale_if_error: 60s
+)EOF";
+
+class HttpCacheFilterStaleTest : public HttpCacheFilterTest {
+public:
+  HttpCacheFilterStaleTest() {
+    setRouteConfig(StaleConfig);
+    ON_CALL(context_.cluster_manager_, getThreadLocalCluster(_)).WillByDefault(Return(&cluster_));
+    ON_CALL(cluster_, httpAsyncClient()).WillByDefault(ReturnRef(async_client_));
+    ON_CALL(async_client_, send_(_, _, _))
+        .WillByDefault(Invoke([this](Http::RequestMessagePtr& request,
+                                     Http::AsyncClient::Callbacks& callbacks,
+                                     const Http::AsyncClient::RequestOptions& options) {
+          refresh_request_ = std::move(request);
+          refresh_callbacks_ = &callbacks;
+          refresh_timeout_ = options.timeout;
+          return &async_request_;
+        }));
+  }
+
+  ~HttpCacheFilterStaleTest() override {
+    // The refresher deletes itself once the request is done.
+    if (refresh_callbacks_ != nullptr) {
+      refresh_callbacks_->onFailure(async_request_, Http::AsyncClient::FailureReason::Reset);
+    }
+  }
+
+  // Cache an entry that has been stale for the milliseconds. The entry is fresh if it is negative.
+  void insertStaleEntry(int64_t stale_for, const std::string& body) {
+    const uint64_t expire = Proxy::Common::Common::TimeUtil::createTimestamp() +
+                            route_config_->cacheConfig()->staleGrace() - stale_for;
+    insertEntry({{":status", "200"}, {"content-length", std::to_string(body.size())}}, body,
+                expire);
+  }
+
+  Http::ResponseMessagePtr response(const std::string& status, const std::string& body) {
+    auto message = std::make_unique<Http::ResponseMessageImpl>(
+        Http::createHeaderMap<Http::ResponseHeaderMapImpl>(
+            Http::TestResponseHeaderMapImpl{{":status", status}}));
+    message->body().add(body);
+    return message;
+  }
+
+  void completeRefresh(Http::ResponseMessagePtr&& response) {
+    auto* callbacks = refresh_callbacks_;
+    refresh_callbacks_ = nullptr;
+    callbacks->onSuccess(async_request_, std::move(response));
+  }
+
+  Router::MockRouteEntry& routeEntry() { return decoder_callbacks_.route_->route_entry_; }
+
+  NiceMock<Upstream::MockThreadLocalCluster> cluster_;
+  NiceMock<Http::MockAsyncClient> async_client_;
+  NiceMock<Http::MockAsyncClientRequest> async_request_{&async_client_};
+
+  Http::RequestMessagePtr refresh_request_;
+  Http::AsyncClient::Callbacks* refresh_callbacks_{nullptr};
+  absl::optional<std::chrono::milliseconds> refresh_timeout_;
+};
+
+TEST_F(HttpCacheFilterStaleTest, FreshEntryIsNotRefreshed) {
+  insertStaleEntry(-10000, "fresh");
+  EXPECT_CALL(async_client_, send_(_, _, _)).Times(0);
+
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("HIT", responseHeader("x-cache-status"));
+  EXPECT_EQ("fresh", response_body_);
+  EXPECT_EQ(1, counter("hit"));
+  EXPECT_EQ(0, counter("stale_hit"));
+}
+
+TEST_F(HttpCacheFilterStaleTest, StaleWhileRevalidate) {
+  insertStaleEntry(5000, "stale");
+  request_headers_.setCopy(Http::LowerCaseString("if-none-match"), "\"v1\"");
+  EXPECT_CALL(routeEntry(), finalizeRequestHeaders(_, _, true))
+      .WillOnce(Invoke([](Http::RequestHeaderMap& headers, const StreamInfo::StreamInfo&, bool) {
+        headers.setPath("/v2/items/1");
+      }));
+
+  // The stale entry is served at once and one refresh is sent in the background.
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("STALE", responseHeader("x-cache-status"));
+  EXPECT_EQ("stale", response_body_);
+  EXPECT_EQ(1, counter("stale_hit"));
+  EXPECT_EQ(0, counter("hit"));
+  EXPECT_EQ(1, counter("stale_refresh"));
+
+  // The refresh is routed as the request itself and asks for the full response.
+  ASSERT_NE(nullptr, refresh_request_);
+  EXPECT_EQ("/v2/items/1", refresh_request_->headers().getPathValue());
+  EXPECT_EQ("/items/1", request_headers_.getPathValue());
+  EXPECT_TRUE(refresh_request_->headers().get(Http::LowerCaseString("if-none-match")).empty());
+
+  // Other stale hits of the key do not send another refresh or join the flight.
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("STALE", responseHeader("x-cache-status"));
+  EXPECT_EQ(1, counter("stale_refresh"));
+  EXPECT_EQ(1, config_->coalescer()->flights());
+
+  completeRefresh(response("200", "fresh"));
+  EXPECT_EQ(0, config_->coalescer()->flights());
+
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("HIT", responseHeader("x-cache-status"));
+  EXPECT_EQ("fresh", response_body_);
+}
+
+TEST_F(HttpCacheFilterStaleTest, ErrorsOfRefreshKeepStaleEntry) {
+  insertStaleEntry(5000, "stale");
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  completeRefresh(response("503", "error"));
+  EXPECT_EQ(0, config_->coalescer()->flights());
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  EXPECT_EQ("STALE", responseHeader("x-cache-status"));
+  EXPECT_EQ("stale", response_body_);
+  EXPECT_EQ(2, counter("stale_refresh"));
+}
+
+TEST_F(HttpCacheFilterStaleTest, RefresherDoesNotKeepCachesAlive) {
+  insertStaleEntry(5000, "stale");
+  const auto stale_entry = cache_->entries_.begin()->second;
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  ASSERT_NE(nullptr, refresh_callbacks_);
+
+  // The listener is drained before the refresh is done.
+  std::weak_ptr<Proxy::Common::Sender::CacheGetterSetterConfig> used_caches =
+      config_->usedCaches();
+  filter_->onDestroy();
+  filter_.reset();
+  config_.reset();
+  EXPECT_TRUE(used_caches.expired());
+
+  completeRefresh(response("200", "fresh"));
+  EXPECT_EQ(stale_entry, cache_->entries_.begin()->second);
+}
+
+TEST_F(HttpCacheFilterStaleTest, RefreshTimeout) {
+  insertStaleEntry(5000, "stale");
+
+  // Routes without a timeout use the default, and long timeouts are capped.
+  const std::vector<std::pair<uint64_t, uint64_t>> cases = {
+      {0, 3000}, {5000, 5000}, {120000, 30000}};
+  for (const auto& [route_timeout, timeout] : cases) {
+    SCOPED_TRACE(route_timeout);
+    ON_CALL(routeEntry(), timeout())
+        .WillByDefault(Return(std::chrono::milliseconds(route_timeout)));
+    createFilter();
+    filter_->decodeHeaders(request_headers_, true);
+    EXPECT_EQ(std::chrono::milliseconds(timeout), refresh_timeout_);
+
+    refresh_callbacks_->onFailure(async_request_, Http::AsyncClient::FailureReason::Reset);
+    refresh_callbacks_ = nullptr;
+  }
+}
+
+TEST_F(HttpCacheFilterStaleTest, StaleIfError) {
+  insertStaleEntry(30000, "stale");
+  EXPECT_CALL(async_client_, send_(_, _, _)).Times(0);
+
+  // The stale entry is only served if upstream fails.
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ(nullptr, response_headers_);
+
+  Http::TestResponseHeaderMapImpl headers{{":status", "503"}, {"content-length", "5"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration, filter_->encodeHeaders(headers, false));
+  EXPECT_EQ("200", headers.getStatusValue());
+  EXPECT_EQ("STALE", headers.get_("x-cache-status"));
+  EXPECT_EQ("5", headers.getContentLengthValue());
+
+  // The body of upstream is replaced with the stale body.
+  std::string added;
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke([&added](Buffer::Instance& data, bool) { added = data.toString(); }));
+  Buffer::OwnedImpl data1("err");
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, filter_->encodeData(data1, false));
+  EXPECT_EQ(0, data1.length());
+  Buffer::OwnedImpl data2("or");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(data2, true));
+  EXPECT_EQ(0, data2.length());
+  EXPECT_EQ("stale", added);
+
+  EXPECT_EQ(1, counter("stale_if_error"));
+  EXPECT_EQ(0, counter("stale_hit"));
+  // Nothing of upstream is cached.
+  EXPECT_EQ(1, cache_->entries_.size());
+}
+
+TEST_F(HttpCacheFilterStaleTest, StaleIfErrorWithTrailers) {
+  insertStaleEntry(30000, "stale");
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  Http::TestResponseHeaderMapImpl headers{{":status", "500"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration, filter_->encodeHeaders(headers, false));
+
+  std::string added;
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke([&added](Buffer::Instance& data, bool) { added = data.toString(); }));
+  Buffer::OwnedImpl data("error");
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, filter_->encodeData(data, false));
+  Http::TestResponseTrailerMapImpl trailers{{"grpc-status", "14"}};
+  EXPECT_EQ(Http::FilterTrailersStatus::Continue, filter_->encodeTrailers(trailers));
+  EXPECT_EQ("stale", added);
+}
+
+TEST_F(HttpCacheFilterStaleTest, StaleIfErrorWithoutUpstreamBody) {
+  insertStaleEntry(30000, "stale");
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  std::string added;
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke([&added](Buffer::Instance& data, bool) { added = data.toString(); }));
+  Http::TestResponseHeaderMapImpl headers{{":status", "502"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->encodeHeaders(headers, true));
+  EXPECT_EQ("200", headers.getStatusValue());
+  EXPECT_EQ("stale", added);
+}
+
+TEST_F(HttpCacheFilterStaleTest, UpstreamResponseReplacesStaleEntry) {
+  insertStaleEntry(30000, "stale");
+
+  createFilter();
+  filter_->decodeHeaders(request_headers_, true);
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, _)).Times(0);
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, filter_->encodeHeaders(headers, false));
+  EXPECT_EQ("MISS", headers.get_("x-cache-status"));
+  Buffer::OwnedImpl data("fresh");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(data, true));
+  EXPECT_EQ("fresh", data.toString());
+  EXPECT_EQ(0, counter("stale_if_error"));
+
+  createFilter();
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(request_headers_, true));
+  EXPECT_EQ("HIT", responseHeader("x-cache-status"));
+  EXPECT_EQ("fresh", response_body_);
+}
+
+} // namespace
+} // namespace SuperCache
+} // namespace HttpFilters
+} // namespace Proxy
+} // namespace Envoy
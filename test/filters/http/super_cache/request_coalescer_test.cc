@@ -0,0 +1,183 @@
+#include <vector>
+
+#include "source/common/cache/http_cache_entry.h"
+#include "source/filters/http/super_cache/request_coalescer.h"
+
+#include "test/mocks/event/mocks.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Proxy {
+namespace HttpFilters {
+namespace SuperCache {
+namespace {
+
+using Result = RequestCoalescer::Result;
+
+class RequestCoalescerTest : public testing::Test {
+public:
+  RequestCoalescerTest() {
+    ON_CALL(dispatcher_, post(testing::_)).WillByDefault(testing::Invoke([this](Event::PostCb cb) {
+      posted_.push_back(std::move(cb));
+    }));
+  }
+
+  RequestCoalescer::WaiterHandle wait(const std::string& key) {
+    auto joined = coalescer_.join(key, dispatcher_,
+                                  [this](Result result, const RequestCoalescer::EntrySharedPtr& e) {
+                                    results_.push_back(result);
+                                    entries_.push_back(e);
+                                  });
+    EXPECT_EQ(nullptr, joined.leader_);
+    EXPECT_NE(nullptr, joined.waiter_);
+    return std::move(joined.waiter_);
+  }
+
+  RequestCoalescer::LeaderPtr lead(const std::string& key) {
+    auto joined = coalescer_.join(key, dispatcher_, nullptr);
+    EXPECT_EQ(nullptr, joined.waiter_);
+    return std::move(joined.leader_);
+  }
+
+  void runPosted() {
+    auto posted = std::move(posted_);
+    posted_.clear();
+    for (auto& cb : posted) {
+      cb();
+    }
+  }
+
+  testing::NiceMock<Event::MockDispatcher> dispatcher_;
+  RequestCoalescer coalescer_;
+  std::vector<Event::PostCb> posted_;
+  std::vector<Result> results_;
+  std::vector<RequestCoalescer::EntrySharedPtr> entries_;
+};
+
+RequestCoalescer::EntrySharedPtr createEntry() {
+  auto headers = Envoy::Http::ResponseHeaderMapImpl::create();
+  headers->setStatus(200);
+  auto message = std::make_unique<Envoy::Http::ResponseMessageImpl>(std::move(headers));
+  message->body().add("hello");
+  auto entry = std::make_shared<Proxy::Common::Cache::HttpCacheEntry>(std::move(message), 0);
+  entry->seal();
+  return entry;
+}
+
+TEST_F(RequestCoalescerTest, WaitersAreServedByLeader) {
+  auto leader = lead("key");
+  ASSERT_NE(nullptr, leader);
+  auto waiter1 = wait("key");
+  auto waiter2 = wait("key");
+  // Keys are independent.
+  auto other = lead("other");
+  ASSERT_NE(nullptr, other);
+  EXPECT_EQ(2, coalescer_.flights());
+
+  auto entry = createEntry();
+  leader->finish(entry);
+  EXPECT_EQ(1, coalescer_.flights());
+  // Waiters are woken up in the threads of their dispatchers.
+  EXPECT_TRUE(results_.empty());
+  runPosted();
+  EXPECT_EQ(std::vector<Result>({Result::Inserted, Result::Inserted}), results_);
+  EXPECT_EQ(entry, entries_[0]);
+  EXPECT_EQ(entry, entries_[1]);
+
+  // Finishing again or releasing the leader changes nothing.
+  leader->finish(nullptr);
+  leader.reset();
+  runPosted();
+  EXPECT_EQ(2, results_.size());
+
+  // The next miss of the key becomes the leader.
+  EXPECT_NE(nullptr, lead("key"));
+}
+
+TEST_F(RequestCoalescerTest, NotInserted) {
+  auto leader = lead("key");
+  auto waiter = wait("key");
+  leader->finish(nullptr);
+  runPosted();
+  EXPECT_EQ(std::vector<Result>({Result::NotInserted}), results_);
+  EXPECT_EQ(nullptr, entries_[0]);
+}
+
+TEST_F(RequestCoalescerTest, ReleasedLeaderCancelsWaiters) {
+  auto leader = lead("key");
+  auto waiter = wait("key");
+  leader.reset();
+  EXPECT_EQ(0, coalescer_.flights());
+  runPosted();
+  EXPECT_EQ(std::vector<Result>({Result::Cancelled}), results_);
+}
+
+TEST_F(RequestCoalescerTest, ReleasedWaiterIsNotCalled) {
+  auto leader = lead("key");
+  auto waiter1 = wait("key");
+  auto waiter2 = wait("key");
+
+  // Released before the leader is finished.
+  waiter1.reset();
+  leader->finish(createEntry());
+  EXPECT_EQ(1, posted_.size());
+
+  // Released after the wake-up is posted.
+  waiter2.reset();
+  runPosted();
+  EXPECT_TRUE(results_.empty());
+}
+
+TEST_F(RequestCoalescerTest, HasWaiters) {
+  auto leader = lead("key");
+  EXPECT_FALSE(leader->hasWaiters());
+
+  auto waiter = wait("key");
+  EXPECT_TRUE(leader->hasWaiters());
+
+  // Released waiters are not counted.
+  waiter.reset();
+  EXPECT_FALSE(leader->hasWaiters());
+
+  waiter = wait("key");
+  leader->finish(nullptr);
+  EXPECT_FALSE(leader->hasWaiters());
+}
+
+TEST_F(RequestCoalescerTest, TryLead) {
+  auto leader = coalescer_.tryLead("key");
+  ASSERT_NE(nullptr, leader);
+
+  // Failed attempts add no waiter to the flight.
+  EXPECT_EQ(nullptr, coalescer_.tryLead("key"));
+  EXPECT_EQ(nullptr, coalescer_.tryLead("key"));
+  EXPECT_FALSE(leader->hasWaiters());
+  EXPECT_EQ(1, coalescer_.flights());
+
+  auto waiter = wait("key");
+  leader->finish(createEntry());
+  runPosted();
+  EXPECT_EQ(std::vector<Result>({Result::Inserted}), results_);
+
+  EXPECT_NE(nullptr, coalescer_.tryLead("key"));
+}
+
+TEST(RequestCoalescerLifetimeTest, LeaderOutlivesCoalescer) {
+  auto coalescer = std::make_unique<RequestCoalescer>();
+  auto finished = coalescer->tryLead("finished");
+  auto released = coalescer->tryLead("released");
+  coalescer.reset();
+
+  // Nothing is left to wake up.
+  EXPECT_FALSE(finished->hasWaiters());
+  finished->finish(nullptr);
+  released.reset();
+}
+
+} // namespace
+} // namespace SuperCache
+} // namespace HttpFilters
+} // namespace Proxy
+} // namespace Envoy